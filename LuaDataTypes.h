@@ -120,6 +120,19 @@ enum SetType {
     kSetExcept
 };
 
+enum InsertType {
+    kInsertValues,
+    kInsertSelect
+};
+
+// Why a result is not valid. kErrorLimit results were rejected by one of
+// the limits of sqlparser_limits_configure().
+enum ErrorCode {
+    kErrorNone,
+    kErrorSyntax,
+    kErrorLimit
+};
+
 struct LuaExpr;
 struct LuaAlias;
 struct LuaJoinDefinition;
@@ -132,6 +145,7 @@ struct LuaSetOperation;
 struct LuaSQLStatement;
 struct LuaSelectStatement;
 struct LuaInsertStatement;
+struct LuaUpdateClause;
 struct LuaUpdateStatement;
 struct LuaDeleteStatement;
 struct LuaSQLParserResult;
@@ -242,6 +256,14 @@ typedef struct LuaSQLStatement {
     size_t stringLength;
     size_t hintCount;
     struct LuaExpr** hints;
+
+    // Set for top-level statements only. The fingerprint is a hash of the
+    // statement with all literals and parameters replaced by placeholders
+    // and IN-lists of them collapsed. The literals are listed in the order
+    // they are met walking the tree depth-first.
+    uint64_t fingerprint;
+    size_t literalCount;
+    struct LuaExpr** literals;
 } LuaSQLStatement;
 
 // Representation of a full SQL select statement.
@@ -270,24 +292,410 @@ typedef struct LuaSelectStatement {
     struct LuaLimitDescription* limit;
 } LuaSelectStatement;
 
+// Represents INSERT INTO ... VALUES (...) and INSERT INTO ... SELECT.
 typedef struct LuaInsertStatement {
-    // TODO: define members
+    struct LuaSQLStatement base;
+
+    enum InsertType type;
+    char* schema;
+    char* tableName;
+
+    size_t columnCount;
+    char** columns;
+
+    size_t valueCount;
+    struct LuaExpr** values;
+
+    struct LuaSelectStatement* select;
 } LuaInsertStatement;
 
+// `column = value` in the SET list of an update statement.
+typedef struct LuaUpdateClause {
+    char* column;
+    struct LuaExpr* value;
+} LuaUpdateClause;
+
 typedef struct LuaUpdateStatement {
-    // TODO: define members
+    struct LuaSQLStatement base;
+
+    struct LuaTableRef* table;
+
+    size_t updateCount;
+    struct LuaUpdateClause** updates;
+
+    struct LuaExpr* where;
 } LuaUpdateStatement;
 
 typedef struct LuaDeleteStatement {
-    // TODO: define members
+    struct LuaSQLStatement base;
+
+    char* schema;
+    char* tableName;
+    struct LuaExpr* expr;
 } LuaDeleteStatement;
 
+// What the simplification pass changed in a result, see
+// sqlparser_simplify_enable().
+typedef struct LuaSQLSimplifyReport {
+    size_t folded;       // constant expressions replaced by their value
+    size_t tautologies;  // TRUE and FALSE operands and filters resolved
+    size_t negations;    // double negations removed
+    size_t duplicates;   // repeated operands and IN-list items removed
+    size_t flattened;    // nested AND and OR chains made left-deep
+    size_t normalized;   // BETWEEN and IN turned into equalities
+} LuaSQLSimplifyReport;
+
 typedef struct LuaSQLParserResult {
     bool isValid;
+    enum ErrorCode errorCode;
     char* errorMsg;
     int errorLine;
     int errorColumn;
     
     size_t statementCount;
     struct LuaSQLStatement** statements;
+
+    struct LuaSQLSimplifyReport simplified;
 } LuaSQLParserResult;
+
+
+// Flat representation of a parser result. The whole result is one
+// contiguous, relocatable buffer: nodes refer to each other by 32-bit
+// offsets from the start of the buffer, 0 meaning "not set". A string is a
+// uint32_t length followed by the bytes and a terminating NUL, an array is a
+// uint32_t count followed by the offsets of its items. Enumerations are
+// stored as uint8_t.
+typedef uint32_t LuaFlatRef;
+
+typedef struct LuaFlatExpr {
+    double fval;
+    int64_t ival;
+    int64_t ival2;
+    int64_t columnLength;
+
+    LuaFlatRef expr;
+    LuaFlatRef expr2;
+    LuaFlatRef exprList;
+    LuaFlatRef select;
+
+    LuaFlatRef name;
+    LuaFlatRef table;
+    LuaFlatRef alias;
+
+    uint8_t type;
+    uint8_t datetimeField;
+    uint8_t columnType;
+    uint8_t opType;
+    bool isBoolLiteral;
+    bool distinct;
+} LuaFlatExpr;
+
+typedef struct LuaFlatAlias {
+    LuaFlatRef name;
+    LuaFlatRef columns;
+} LuaFlatAlias;
+
+typedef struct LuaFlatJoinDefinition {
+    LuaFlatRef left;
+    LuaFlatRef right;
+    LuaFlatRef condition;
+
+    uint8_t type;
+} LuaFlatJoinDefinition;
+
+typedef struct LuaFlatTableRef {
+    LuaFlatRef schema;
+    LuaFlatRef name;
+    LuaFlatRef alias;
+    LuaFlatRef select;
+    LuaFlatRef list;
+    LuaFlatRef join;
+
+    uint8_t type;
+} LuaFlatTableRef;
+
+typedef struct LuaFlatGroupByDescription {
+    LuaFlatRef columns;
+    LuaFlatRef having;
+} LuaFlatGroupByDescription;
+
+typedef struct LuaFlatSetOperation {
+    LuaFlatRef nestedSelectStatement;
+    LuaFlatRef resultOrder;
+    LuaFlatRef resultLimit;
+
+    uint8_t setType;
+    bool isAll;
+} LuaFlatSetOperation;
+
+typedef struct LuaFlatOrderDescription {
+    LuaFlatRef expr;
+
+    uint8_t type;
+} LuaFlatOrderDescription;
+
+typedef struct LuaFlatWithDescription {
+    LuaFlatRef alias;
+    LuaFlatRef select;
+} LuaFlatWithDescription;
+
+typedef struct LuaFlatLimitDescription {
+    LuaFlatRef limit;
+    LuaFlatRef offset;
+} LuaFlatLimitDescription;
+
+typedef struct LuaFlatSQLStatement {
+    uint32_t stringLength;
+    LuaFlatRef hints;
+
+    uint8_t type;
+} LuaFlatSQLStatement;
+
+typedef struct LuaFlatSelectStatement {
+    struct LuaFlatSQLStatement base;
+
+    LuaFlatRef fromTable;
+    LuaFlatRef selectList;
+    LuaFlatRef whereClause;
+    LuaFlatRef groupBy;
+    LuaFlatRef setOperations;
+    LuaFlatRef order;
+    LuaFlatRef withDescriptions;
+    LuaFlatRef limit;
+
+    bool selectDistinct;
+} LuaFlatSelectStatement;
+
+typedef struct LuaFlatInsertStatement {
+    struct LuaFlatSQLStatement base;
+
+    LuaFlatRef schema;
+    LuaFlatRef tableName;
+    LuaFlatRef columns;
+    LuaFlatRef values;
+    LuaFlatRef select;
+
+    uint8_t type;
+} LuaFlatInsertStatement;
+
+typedef struct LuaFlatUpdateClause {
+    LuaFlatRef column;
+    LuaFlatRef value;
+} LuaFlatUpdateClause;
+
+typedef struct LuaFlatUpdateStatement {
+    struct LuaFlatSQLStatement base;
+
+    LuaFlatRef table;
+    LuaFlatRef updates;
+    LuaFlatRef where;
+} LuaFlatUpdateStatement;
+
+typedef struct LuaFlatDeleteStatement {
+    struct LuaFlatSQLStatement base;
+
+    LuaFlatRef schema;
+    LuaFlatRef tableName;
+    LuaFlatRef expr;
+} LuaFlatDeleteStatement;
+
+// Always located at offset 0 of the buffer.
+typedef struct LuaFlatResult {
+    uint32_t size;
+
+    bool isValid;
+    enum ErrorCode errorCode;
+    LuaFlatRef errorMsg;
+    int errorLine;
+    int errorColumn;
+
+    LuaFlatRef statements;
+
+    // Parameter expressions ordered by their ids.
+    LuaFlatRef parameters;
+} LuaFlatResult;
+
+typedef struct LuaSQLCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    size_t entries;
+    size_t bytes;
+
+    size_t maxEntries;
+    size_t maxBytes;
+} LuaSQLCacheStats;
+
+// Process-wide interned identifiers live in [buffer, buffer + capacity).
+typedef struct LuaSQLInternStats {
+    const char* buffer;
+    size_t capacity;
+    size_t bytes;
+    size_t entries;
+} LuaSQLInternStats;
+
+// Latency of one phase of parsing. histogram[i] counts the calls that took
+// [2^i, 2^(i + 1)) nanoseconds, the last bucket also counts longer calls.
+typedef struct LuaSQLPhaseStats {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t histogram[32];
+} LuaSQLPhaseStats;
+
+typedef struct LuaSQLStats {
+    bool enabled;
+
+    // parse: hyrise lexer and parser; copy: conversion into the Lua data
+    // types, freeing the hyrise tree included; decode: building Lua tables,
+    // reported by sqlparser.lua; finalize: releasing a result.
+    LuaSQLPhaseStats phases[4];
+
+    // Totals over the parsed queries, cache hits excluded.
+    uint64_t queries;
+    uint64_t queryBytes;
+    uint64_t bytesAllocated;
+    uint64_t nodes;
+
+    uint64_t maxQueryBytes;
+    uint64_t maxBytesAllocated;
+    uint64_t maxNodes;
+    uint64_t maxDepth;
+} LuaSQLStats;
+
+// A table referenced by a query. Tables defined by WITH and subqueries in
+// FROM are not listed, the columns taken from them are.
+typedef struct LuaTableReference {
+    char* schema;
+    char* name;
+    char* alias;
+} LuaTableReference;
+
+// A column referenced by a query. `table` indexes the tables of the
+// references, it is -1 when the column does not come from one listed table:
+// an unqualified column with several tables in scope, or a column of a
+// subquery or WITH table. Star selections are named "*".
+typedef struct LuaColumnReference {
+    int64_t table;
+    char* name;
+} LuaColumnReference;
+
+// The distinct table and column references of a query, see
+// parseSqlReferences().
+typedef struct LuaSQLReferences {
+    bool isValid;
+    enum ErrorCode errorCode;
+    char* errorMsg;
+    int errorLine;
+    int errorColumn;
+
+    size_t tableCount;
+    struct LuaTableReference* tables;
+
+    size_t columnCount;
+    struct LuaColumnReference* columns;
+} LuaSQLReferences;
+
+// A value a shard key column is pinned to: a literal, with the same fields
+// as in LuaExpr, or a parameter with the id in ival.
+typedef struct LuaShardValue {
+    enum ExprType type;
+    int64_t ival;
+    double fval;
+    char* name;
+    bool isBoolLiteral;
+} LuaShardValue;
+
+// The shard keys a statement is restricted to, see parseSqlShardKeys().
+// Unless the statement is scattered, tuple i is values[i * keyLength] up to
+// values[(i + 1) * keyLength], in the order the key columns were
+// registered. No tuples at all mean the statement matches no rows.
+typedef struct LuaSQLShardKeys {
+    bool isValid;
+    enum ErrorCode errorCode;
+    char* errorMsg;
+    int errorLine;
+    int errorColumn;
+
+    char* schema;
+    char* table;
+
+    bool scatter;
+    size_t keyLength;
+    size_t tupleCount;
+    struct LuaShardValue* values;
+} LuaSQLShardKeys;
+
+// SQL text rendered from a parser result. Statement i occupies
+// buffer[offsets[i]] up to buffer[offsets[i + 1]]. On failure only
+// errorMsg is set.
+typedef struct LuaSQLGenResult {
+    char* buffer;
+    size_t statementCount;
+    size_t* offsets;
+
+    char* errorMsg;
+} LuaSQLGenResult;
+
+// A statement rendered with its parameters cut out, see prepareSql(). The
+// value of parameter slotParams[i] goes at text[slotOffsets[i]], the
+// offsets are ascending. Values of parameters 0 to paramCount - 1 are
+// bound. On failure only errorMsg is set.
+typedef struct LuaSQLTemplate {
+    char* text;
+    size_t length;
+    size_t slotCount;
+    size_t* slotOffsets;
+    size_t* slotParams;
+    size_t paramCount;
+
+    char* errorMsg;
+} LuaSQLTemplate;
+
+enum LuaSQLValueType {
+    kValueNull,
+    kValueBool,
+    kValueInt,
+    kValueFloat,
+    kValueString
+};
+
+// A value bound to a parameter of a template. Booleans are kept in ival,
+// strings are `length` bytes at `str`.
+typedef struct LuaSQLValue {
+    enum LuaSQLValueType type;
+    int64_t ival;
+    double fval;
+    const char* str;
+    size_t length;
+} LuaSQLValue;
+
+// Names of the enum values as the Lua AST spells them, indexed by value,
+// see sqlparser_enum_names(). operatorArity holds the number of operands of
+// each operator, -1 for CASE and WHEN.
+typedef struct LuaSQLEnumNames {
+    size_t exprTypeCount;
+    const char* const* exprTypes;
+    size_t datetimeFieldCount;
+    const char* const* datetimeFields;
+    size_t columnTypeCount;
+    const char* const* columnTypes;
+    size_t operatorTypeCount;
+    const char* const* operatorTypes;
+    const int8_t* operatorArity;
+    size_t statementTypeCount;
+    const char* const* statementTypes;
+    size_t joinTypeCount;
+    const char* const* joinTypes;
+    size_t tableRefTypeCount;
+    const char* const* tableRefTypes;
+    size_t orderTypeCount;
+    const char* const* orderTypes;
+    size_t setTypeCount;
+    const char* const* setTypes;
+    size_t insertTypeCount;
+    const char* const* insertTypes;
+    size_t errorCodeCount;
+    const char* const* errorCodes;
+} LuaSQLEnumNames;
@@ -0,0 +1,94 @@
+#include <cstdlib>
+#include "LuaSQLArena.h"
+
+static const size_t kArenaFirstChunkSize = 4096;
+static const size_t kArenaMaxChunkSize = 1024 * 1024;
+
+struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+};
+
+static const size_t kArenaChunkHeaderSize =
+    (sizeof(ArenaChunk) + alignof(std::max_align_t) - 1) &
+        ~(alignof(std::max_align_t) - 1);
+
+void arenaInit(Arena* arena)
+{
+    arena->chunks = 0;
+    arena->pos = 0;
+    arena->end = 0;
+    arena->bytesAllocated = 0;
+}
+
+void* arenaAllocSlow(Arena* arena, size_t size, size_t align)
+{
+    size_t chunkSize = kArenaFirstChunkSize;
+
+    if (arena->chunks != 0) {
+        chunkSize = arena->chunks->size * 2;
+        if (chunkSize > kArenaMaxChunkSize)
+            chunkSize = kArenaMaxChunkSize;
+    }
+
+    // Oversized requests get a chunk of their own.
+    if (chunkSize < kArenaChunkHeaderSize + size + align)
+        chunkSize = kArenaChunkHeaderSize + size + align;
+
+    ArenaChunk* chunk = (ArenaChunk*)std::malloc(chunkSize);
+    if (chunk == 0)
+        return 0;
+
+    chunk->next = arena->chunks;
+    chunk->size = chunkSize;
+
+    arena->chunks = chunk;
+    arena->pos = (char*)chunk + kArenaChunkHeaderSize;
+    arena->end = (char*)chunk + chunkSize;
+
+    return arenaAlloc(arena, size, align);
+}
+
+void arenaRelease(Arena* arena)
+{
+    ArenaChunk* chunk = arena->chunks;
+
+    while (chunk != 0) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arenaInit(arena);
+}
+
+void arenaReset(Arena* arena)
+{
+    // Chunks grow up to kArenaMaxChunkSize, so the newest chunk of at most
+    // that size is the largest normal one. Oversized chunks are released,
+    // one long query must not pin its memory for all the short ones after.
+    ArenaChunk* kept = 0;
+    ArenaChunk* chunk = arena->chunks;
+
+    while (chunk != 0) {
+        ArenaChunk* next = chunk->next;
+
+        if (kept == 0 && chunk->size <= kArenaMaxChunkSize)
+            kept = chunk;
+        else
+            free(chunk);
+
+        chunk = next;
+    }
+
+    arenaInit(arena);
+
+    if (kept == 0)
+        return;
+
+    kept->next = 0;
+
+    arena->chunks = kept;
+    arena->pos = (char*)kept + kArenaChunkHeaderSize;
+    arena->end = (char*)kept + kept->size;
+}
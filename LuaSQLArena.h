@@ -0,0 +1,55 @@
+#ifndef LUA_SQL_ARENA_H
+#define LUA_SQL_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Growable bump allocator. Every node copied for a parser result is carved
+// out of one arena, so the whole tree is released with a single call.
+struct ArenaChunk;
+
+typedef struct Arena {
+    struct ArenaChunk* chunks;
+    char* pos;
+    char* end;
+
+    size_t bytesAllocated;
+} Arena;
+
+void arenaInit(Arena* arena);
+void* arenaAllocSlow(Arena* arena, size_t size, size_t align);
+void arenaRelease(Arena* arena);
+
+// Drops everything allocated so far but keeps the largest chunk of normal
+// size for the next allocations. Chunks made for oversized requests are
+// released.
+void arenaReset(Arena* arena);
+
+inline void* arenaAlloc(Arena* arena, size_t size,
+    size_t align = alignof(std::max_align_t))
+{
+    size_t padding = (size_t)(-(uintptr_t)arena->pos) & (align - 1);
+
+    if (arena->pos == 0 || size + padding > (size_t)(arena->end - arena->pos))
+        return arenaAllocSlow(arena, size, align);
+
+    char* ptr = arena->pos + padding;
+    arena->pos = ptr + size;
+    arena->bytesAllocated += size + padding;
+
+    return ptr;
+}
+
+template<class T>
+T* arenaNew(Arena* arena)
+{
+    return (T*)arenaAlloc(arena, sizeof(T), alignof(T));
+}
+
+template<class T>
+T** arenaNewArr(Arena* arena, size_t n)
+{
+    return (T**)arenaAlloc(arena, n * sizeof(T*), alignof(T*));
+}
+
+#endif
@@ -0,0 +1,159 @@
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "LuaSQLCache.h"
+#include "LuaSQLParse.h"
+#include "LuaSQLParser.h"
+#include "LuaSQLWorkers.h"
+
+
+// A query parsed on the worker pool. It is referenced by the caller and,
+// until the parse is over, by the worker, whichever lets go last frees it.
+// Completion is signalled by making the fd readable.
+struct LuaSQLAsyncParse {
+    std::atomic<int> refCount;
+    std::atomic<bool> done;
+    LuaSQLParserResult* result;
+
+    // With an eventfd both ends are the same descriptor.
+    int readFd;
+    int writeFd;
+
+    // The query is copied, so the caller's buffer may go away before the
+    // parse starts.
+    std::string query;
+};
+
+
+static bool asyncOpenFds(LuaSQLAsyncParse* job)
+{
+#ifdef __linux__
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0)
+        return false;
+
+    job->readFd = fd;
+    job->writeFd = fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+
+    job->readFd = fds[0];
+    job->writeFd = fds[1];
+#endif
+
+    return true;
+}
+
+static void asyncCloseFds(LuaSQLAsyncParse* job)
+{
+    close(job->readFd);
+    if (job->writeFd != job->readFd)
+        close(job->writeFd);
+}
+
+static void asyncComplete(LuaSQLAsyncParse* job, LuaSQLParserResult* result)
+{
+    job->result = result;
+    job->done.store(true, std::memory_order_release);
+
+#ifdef __linux__
+    uint64_t value = 1;
+#else
+    char value = 1;
+#endif
+    ssize_t rc = write(job->writeFd, &value, sizeof(value));
+    (void)rc;
+}
+
+static void asyncUnref(LuaSQLAsyncParse* job)
+{
+    if (job->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    if (job->result != 0)
+        freeSQLParserResult(job->result);
+
+    asyncCloseFds(job);
+
+    delete job;
+}
+
+static void asyncRun(void* arg)
+{
+    LuaSQLAsyncParse* job = (LuaSQLAsyncParse*)arg;
+
+    // parseSqlAsync() has looked the query up in the cache already.
+    LuaSQLParserResult* result =
+        parseUncached(job->query.data(), job->query.size(), 0);
+
+    // Rejections depend on the limits of the moment, do not keep them.
+    if (result->errorCode != kErrorLimit)
+        cacheInsert(job->query.data(), job->query.size(), result);
+
+    asyncComplete(job, result);
+
+    asyncUnref(job);
+}
+
+LuaSQLAsyncParse* parseSqlAsync(const char* data, size_t length)
+{
+    LuaSQLAsyncParse* job = new (std::nothrow) LuaSQLAsyncParse();
+    if (job == 0)
+        return 0;
+
+    if (!asyncOpenFds(job)) {
+        delete job;
+        return 0;
+    }
+
+    job->refCount = 1;
+    job->done = false;
+    job->result = 0;
+
+    // Neither a rejected nor a cached query needs a worker.
+    if (queryTooLong(length)) {
+        asyncComplete(job, newErrorResult(kErrorLimit, "Query is too long"));
+        return job;
+    }
+
+    LuaSQLParserResult* cached = cacheLookup(data, length);
+    if (cached != 0) {
+        asyncComplete(job, cached);
+        return job;
+    }
+
+    job->query.assign(data, length);
+
+    job->refCount++;
+    workersSubmit(asyncRun, job);
+
+    return job;
+}
+
+int parseSqlAsyncFd(LuaSQLAsyncParse* job)
+{
+    return job->readFd;
+}
+
+LuaSQLParserResult* parseSqlAsyncResult(LuaSQLAsyncParse* job)
+{
+    if (!job->done.load(std::memory_order_acquire))
+        return 0;
+
+    LuaSQLParserResult* result = job->result;
+    job->result = 0;
+
+    return result;
+}
+
+void parseSqlAsyncRelease(LuaSQLAsyncParse* job)
+{
+    asyncUnref(job);
+}
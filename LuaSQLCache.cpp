@@ -0,0 +1,155 @@
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "LuaSQLCache.h"
+#include "LuaSQLHash.h"
+
+
+struct CacheEntry {
+    std::string query;
+    LuaSQLParserResult* result;
+    size_t bytes;
+};
+
+struct QueryHasher {
+    size_t operator()(std::string_view query) const
+    {
+        return (size_t)hashBytes(query.data(), query.size());
+    }
+};
+
+typedef std::list<CacheEntry> CacheList;
+
+// LRU cache of parser results keyed by the query text. The index keys point
+// into the query strings owned by the list entries.
+struct Cache {
+    std::mutex mutex;
+
+    // The most recently used entry goes first.
+    CacheList lru;
+    std::unordered_map<std::string_view, CacheList::iterator, QueryHasher>
+        index;
+
+    size_t maxEntries;
+    size_t maxBytes;
+    size_t bytes;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+static Cache cache;
+static std::atomic<bool> cacheEnabled(false);
+
+
+// Must be called with the cache mutex held.
+static void cacheEvict(size_t maxEntries, size_t maxBytes)
+{
+    while (!cache.lru.empty() &&
+        (cache.lru.size() > maxEntries || cache.bytes > maxBytes))
+    {
+        CacheEntry& entry = cache.lru.back();
+
+        cache.index.erase(std::string_view(entry.query));
+        cache.bytes -= entry.bytes;
+        cache.evictions++;
+
+        freeSQLParserResult(entry.result);
+
+        cache.lru.pop_back();
+    }
+}
+
+LuaSQLParserResult* cacheLookup(const char* query, size_t length)
+{
+    if (!cacheEnabled.load(std::memory_order_relaxed))
+        return 0;
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    auto it = cache.index.find(std::string_view(query, length));
+    if (it == cache.index.end()) {
+        cache.misses++;
+        return 0;
+    }
+
+    cache.hits++;
+
+    cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+
+    LuaSQLParserResult* result = it->second->result;
+    retainSQLParserResult(result);
+
+    return result;
+}
+
+void cacheInsert(const char* query, size_t length, LuaSQLParserResult* result)
+{
+    if (!cacheEnabled.load(std::memory_order_relaxed) || result == 0)
+        return;
+
+    size_t bytes = sizeof(CacheEntry) + length +
+        getSQLParserResultSize(result);
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    if (bytes > cache.maxBytes)
+        return;
+
+    // Another thread may have parsed the same query meanwhile.
+    if (cache.index.find(std::string_view(query, length)) != cache.index.end())
+        return;
+
+    cache.lru.push_front(CacheEntry { std::string(query, length), result,
+        bytes });
+    cache.index.emplace(std::string_view(cache.lru.front().query),
+        cache.lru.begin());
+
+    retainSQLParserResult(result);
+    cache.bytes += bytes;
+
+    cacheEvict(cache.maxEntries, cache.maxBytes);
+}
+
+void cacheClear()
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    cacheEvict(0, 0);
+}
+
+void sqlparser_cache_configure(size_t maxEntries, size_t maxBytes)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    if (maxEntries == 0 || maxBytes == 0) {
+        maxEntries = 0;
+        maxBytes = 0;
+    }
+
+    cache.maxEntries = maxEntries;
+    cache.maxBytes = maxBytes;
+
+    cacheEvict(maxEntries, maxBytes);
+
+    cacheEnabled.store(maxEntries != 0, std::memory_order_relaxed);
+}
+
+void sqlparser_cache_stats(LuaSQLCacheStats* stats)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    stats->hits = cache.hits;
+    stats->misses = cache.misses;
+    stats->evictions = cache.evictions;
+
+    stats->entries = cache.lru.size();
+    stats->bytes = cache.bytes;
+
+    stats->maxEntries = cache.maxEntries;
+    stats->maxBytes = cache.maxBytes;
+}
@@ -0,0 +1,21 @@
+#ifndef LUA_SQL_CACHE_H
+#define LUA_SQL_CACHE_H
+
+#include "LuaSQLParser.h"
+
+// Returns a new reference to the cached result of the query, or 0.
+LuaSQLParserResult* cacheLookup(const char* query, size_t length);
+
+// Offers a freshly parsed result to the cache, which takes a reference of
+// its own if the result fits into the budget.
+void cacheInsert(const char* query, size_t length, LuaSQLParserResult* result);
+
+// Drops all entries, for settings that change how results are built.
+void cacheClear();
+
+// Reference counting of parser results, implemented in LuaSQLParser.cpp.
+void retainSQLParserResult(LuaSQLParserResult* result);
+void freeSQLParserResult(LuaSQLParserResult* result);
+size_t getSQLParserResultSize(const LuaSQLParserResult* result);
+
+#endif
@@ -0,0 +1,93 @@
+#include <cstddef>
+#include <cstdint>
+#include "LuaSQLEnums.h"
+#include "LuaSQLParser.h"
+
+
+const char* const kExprTypeStr[] = {
+    "literalFloat", "literalString", "literalInt", "literalNull", "star",
+    "parameter", "columnRef", "functionRef", "operator", "select", "hint",
+    "array", "arrayIndex", "datetimeField"
+};
+
+const char* const kDatetimeFieldStr[] = {
+    "", "second", "minute", "hour", "day", "month", "year"
+};
+
+const char* const kColumnTypeStr[] = {
+    "unknown", "int", "long", "float", "double", "char", "varchar", "text"
+};
+
+const char* const kOperatorTypeStr[] = {
+    "",
+    "between",
+    "case", "when",
+    "+", "-", "*", "/", "%", "^",
+    "=", "<>", "<", "<=", ">", ">=",
+    "like", "not like", "ilike", "and", "or", "in", "||",
+    "not", "-", "is null", "exists"
+};
+
+const int8_t kOperatorArity[] = {
+    0,
+    3,
+    -1, -1,
+    2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2,
+    1, 1, 1, 1
+};
+
+const char* const kStatementTypeStr[] = {
+    "error", "select", "import", "insert", "update", "delete", "create",
+    "drop", "prepare", "execute", "export", "rename", "alter", "show",
+    "transaction"
+};
+
+const char* const kJoinTypeStr[] = {
+    "inner", "full", "left", "right", "cross", "natural"
+};
+
+const char* const kTableRefTypeStr[] = {
+    "table", "select", "join", "crossProduct"
+};
+
+const char* const kOrderTypeStr[] = {
+    "asc", "desc"
+};
+
+const char* const kSetTypeStr[] = {
+    "union", "intersect", "except"
+};
+
+const char* const kInsertTypeStr[] = {
+    "values", "select"
+};
+
+const char* const kErrorCodeStr[] = {
+    "none", "syntax", "limit"
+};
+
+#define ENUM_NAMES(names) sizeof(names) / sizeof(names[0]), names
+
+static const LuaSQLEnumNames enumNames = {
+    ENUM_NAMES(kExprTypeStr),
+    ENUM_NAMES(kDatetimeFieldStr),
+    ENUM_NAMES(kColumnTypeStr),
+    ENUM_NAMES(kOperatorTypeStr),
+    kOperatorArity,
+    ENUM_NAMES(kStatementTypeStr),
+    ENUM_NAMES(kJoinTypeStr),
+    ENUM_NAMES(kTableRefTypeStr),
+    ENUM_NAMES(kOrderTypeStr),
+    ENUM_NAMES(kSetTypeStr),
+    ENUM_NAMES(kInsertTypeStr),
+    ENUM_NAMES(kErrorCodeStr)
+};
+
+#undef ENUM_NAMES
+
+const LuaSQLEnumNames* sqlparser_enum_names()
+{
+    return &enumNames;
+}
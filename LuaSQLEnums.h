@@ -0,0 +1,35 @@
+#ifndef LUA_SQL_ENUMS_H
+#define LUA_SQL_ENUMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "LuaSQLParser.h"
+
+// Names of the enum values as the Lua AST spells them, indexed by value.
+// sqlparser_enum_names() hands them out to the Lua decoder.
+extern const char* const kExprTypeStr[kExprDatetimeField + 1];
+extern const char* const kDatetimeFieldStr[kDatetimeYear + 1];
+extern const char* const kColumnTypeStr[TEXT + 1];
+extern const char* const kOperatorTypeStr[kOpExists + 1];
+extern const char* const kStatementTypeStr[kStmtTransaction + 1];
+extern const char* const kJoinTypeStr[kJoinNatural + 1];
+extern const char* const kTableRefTypeStr[kTableCrossProduct + 1];
+extern const char* const kOrderTypeStr[kOrderDesc + 1];
+extern const char* const kSetTypeStr[kSetExcept + 1];
+extern const char* const kInsertTypeStr[kInsertSelect + 1];
+extern const char* const kErrorCodeStr[kErrorLimit + 1];
+
+// Number of operands of each operator, -1 for CASE and WHEN.
+extern const int8_t kOperatorArity[kOpExists + 1];
+
+// Returns the name of an enum value, 0 if it is out of range.
+template<size_t N>
+inline const char* enumStr(const char* const (&names)[N], int value)
+{
+    if (value < 0 || (size_t)value >= N)
+        return 0;
+
+    return names[value];
+}
+
+#endif
@@ -0,0 +1,816 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "hyrise/src/SQLParser.h"
+#include "LuaSQLParse.h"
+#include "LuaSQLParser.h"
+
+
+// A pending expression of flatExpr(), which walks expressions with an
+// explicit stack so that long operator chains can not exhaust the native
+// stack. The reference to the written node is stored at offset `dst`.
+struct FlatExprTask {
+    const hsql::Expr* expr;
+    LuaFlatRef dst;
+    size_t depth;
+};
+
+// Growable buffer a flat result is serialized into. The buffer may move
+// while it grows, so nodes are referenced by offsets only and a pointer into
+// it is never held across a call that appends to it.
+struct FlatWriter {
+    char* buf;
+    uint32_t size;
+    uint32_t capacity;
+    bool failed;
+
+    std::vector<std::pair<int64_t, LuaFlatRef>> parameters;
+    std::vector<FlatExprTask> exprTasks;
+
+    // Checked the same way the copy into a LuaSQLParserResult checks them.
+    // Once one is exceeded, `failed` is set and `limitError` tells why.
+    Limits limits;
+    size_t nodeCount;
+    size_t depth;
+    size_t stringBytes;
+    const char* limitError;
+};
+
+static const uint32_t kFlatInitialCapacity = 1024;
+
+
+LuaFlatRef flatExpr(const hsql::Expr* expr, FlatWriter* w);
+
+LuaFlatRef flatTableRef(const hsql::TableRef* tableRef, FlatWriter* w);
+
+LuaFlatRef flatOrderDescription(const hsql::OrderDescription* orderDesc,
+    FlatWriter* w);
+
+LuaFlatRef flatLimitDescription(const hsql::LimitDescription* limitDesc,
+    FlatWriter* w);
+
+LuaFlatRef flatSelectStatement(const hsql::SelectStatement* statement,
+    FlatWriter* w);
+
+
+template<class T>
+inline T* flatNode(FlatWriter* w, LuaFlatRef ref)
+{
+    return (T*)(w->buf + ref);
+}
+
+// Reserves zero-filled space for `size` bytes. Returns 0 if the buffer
+// would outgrow the 32-bit offsets or memory is exhausted.
+LuaFlatRef flatAlloc(FlatWriter* w, size_t size, size_t align)
+{
+    if (w->failed)
+        return 0;
+
+    size_t start = (w->size + align - 1) & ~(align - 1);
+    size_t end = start + size;
+
+    if (end > UINT32_MAX) {
+        w->failed = true;
+        return 0;
+    }
+
+    if (end > w->capacity) {
+        size_t capacity = (size_t)w->capacity * 2;
+        while (capacity < end)
+            capacity *= 2;
+        if (capacity > UINT32_MAX)
+            capacity = UINT32_MAX;
+
+        char* buf = (char*)std::realloc(w->buf, capacity);
+        if (buf == 0) {
+            w->failed = true;
+            return 0;
+        }
+
+        w->buf = buf;
+        w->capacity = (uint32_t)capacity;
+    }
+
+    std::memset(w->buf + w->size, 0, end - w->size);
+    w->size = (uint32_t)end;
+
+    return (LuaFlatRef)start;
+}
+
+template<class T>
+inline LuaFlatRef flatNew(FlatWriter* w)
+{
+    return flatAlloc(w, sizeof(T), alignof(T));
+}
+
+inline void flatLimitError(FlatWriter* w, const char* error)
+{
+    w->limitError = error;
+    w->failed = true;
+}
+
+inline bool flatEnter(FlatWriter* w)
+{
+    if (w->failed)
+        return false;
+
+    if (w->nodeCount >= w->limits.maxNodes) {
+        flatLimitError(w, "Query has too many nodes");
+        return false;
+    }
+
+    if (w->depth >= w->limits.maxDepth) {
+        flatLimitError(w, "Query is nested too deeply");
+        return false;
+    }
+
+    w->nodeCount++;
+    w->depth++;
+
+    return true;
+}
+
+inline void flatLeave(FlatWriter* w)
+{
+    w->depth--;
+}
+
+LuaFlatRef flatStr(const char* str, FlatWriter* w)
+{
+    if (str == 0)
+        return 0;
+
+    if (w->failed)
+        return 0;
+
+    size_t n = strlen(str);
+
+    if (n + 1 > w->limits.maxStringBytes - w->stringBytes) {
+        flatLimitError(w, "Query has too many string bytes");
+        return 0;
+    }
+    w->stringBytes += n + 1;
+
+    LuaFlatRef ref = flatAlloc(w, sizeof(uint32_t) + n + 1, sizeof(uint32_t));
+    if (ref == 0)
+        return 0;
+
+    *flatNode<uint32_t>(w, ref) = (uint32_t)n;
+    std::memcpy(w->buf + ref + sizeof(uint32_t), str, n + 1);
+
+    return ref;
+}
+
+template<class ItemSrc>
+LuaFlatRef flatArr(const std::vector<ItemSrc*>* v,
+    LuaFlatRef (*flatArrItem)(const ItemSrc*, FlatWriter*), FlatWriter* w)
+{
+    if (v == 0)
+        return 0;
+
+    size_t n = v->size();
+
+    LuaFlatRef ref = flatAlloc(w, (n + 1) * sizeof(uint32_t),
+        sizeof(uint32_t));
+    if (ref == 0)
+        return 0;
+
+    *flatNode<uint32_t>(w, ref) = (uint32_t)n;
+
+    for (size_t i = 0; i < n; i++) {
+        LuaFlatRef item = flatArrItem((*v)[i], w);
+        flatNode<uint32_t>(w, ref)[i + 1] = item;
+    }
+
+    return ref;
+}
+
+// Writes a single expression, its children are left to the tasks pushed
+// onto w->exprTasks. The node goes first and the children patch their
+// references into it once written.
+LuaFlatRef flatExprNode(const hsql::Expr* expr, FlatWriter* w)
+{
+    if (!flatEnter(w))
+        return 0;
+
+    LuaFlatRef nameRef = flatStr(expr->name, w);
+    LuaFlatRef tableRef = flatStr(expr->table, w);
+    LuaFlatRef aliasRef = flatStr(expr->alias, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatExpr>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatExpr* flat = flatNode<LuaFlatExpr>(w, ref);
+
+    flat->fval = expr->fval;
+    flat->ival = expr->ival;
+    flat->ival2 = expr->ival2;
+    flat->columnLength = expr->columnType.length;
+
+    flat->name = nameRef;
+    flat->table = tableRef;
+    flat->alias = aliasRef;
+
+    flat->type = (uint8_t)expr->type;
+    flat->datetimeField = (uint8_t)expr->datetimeField;
+    flat->columnType = (uint8_t)expr->columnType.data_type;
+    flat->opType = (uint8_t)expr->opType;
+    flat->isBoolLiteral = expr->isBoolLiteral;
+    flat->distinct = expr->distinct;
+
+    if (expr->type == hsql::kExprParameter)
+        w->parameters.push_back(std::make_pair(expr->ival, ref));
+
+    if (expr->select != 0) {
+        LuaFlatRef selectRef = flatSelectStatement(expr->select, w);
+        flatNode<LuaFlatExpr>(w, ref)->select = selectRef;
+    }
+
+    std::vector<FlatExprTask>& tasks = w->exprTasks;
+    size_t depth = w->depth;
+
+    if (expr->exprList != 0) {
+        size_t n = expr->exprList->size();
+
+        LuaFlatRef listRef = flatAlloc(w, (n + 1) * sizeof(uint32_t),
+            sizeof(uint32_t));
+        if (listRef == 0)
+            return 0;
+
+        *flatNode<uint32_t>(w, listRef) = (uint32_t)n;
+        flatNode<LuaFlatExpr>(w, ref)->exprList = listRef;
+
+        for (size_t i = n; i-- > 0;)
+            tasks.push_back(FlatExprTask { (*expr->exprList)[i],
+                (LuaFlatRef)(listRef + (i + 1) * sizeof(uint32_t)), depth });
+    }
+
+    if (expr->expr2 != 0)
+        tasks.push_back(FlatExprTask { expr->expr2,
+            (LuaFlatRef)(ref + offsetof(LuaFlatExpr, expr2)), depth });
+    if (expr->expr != 0)
+        tasks.push_back(FlatExprTask { expr->expr,
+            (LuaFlatRef)(ref + offsetof(LuaFlatExpr, expr)), depth });
+
+    return ref;
+}
+
+LuaFlatRef flatExpr(const hsql::Expr* expr, FlatWriter* w)
+{
+    if (expr == 0)
+        return 0;
+
+    std::vector<FlatExprTask>& tasks = w->exprTasks;
+
+    // Subqueries call back into flatExpr(), their tasks go on top of ours.
+    size_t base = tasks.size();
+    size_t depth = w->depth;
+
+    LuaFlatRef ref = flatExprNode(expr, w);
+
+    while (tasks.size() > base && !w->failed) {
+        FlatExprTask task = tasks.back();
+        tasks.pop_back();
+
+        w->depth = task.depth;
+
+        LuaFlatRef child = flatExprNode(task.expr, w);
+        if (child != 0)
+            *flatNode<LuaFlatRef>(w, task.dst) = child;
+    }
+
+    // Left over once the writer has failed.
+    tasks.resize(base);
+
+    w->depth = depth;
+
+    return ref;
+}
+
+LuaFlatRef flatJoinDefinition(const hsql::JoinDefinition* joinDef,
+    FlatWriter* w)
+{
+    if (joinDef == 0)
+        return 0;
+
+    LuaFlatRef leftRef = flatTableRef(joinDef->left, w);
+    LuaFlatRef rightRef = flatTableRef(joinDef->right, w);
+    LuaFlatRef conditionRef = flatExpr(joinDef->condition, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatJoinDefinition>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatJoinDefinition* flat = flatNode<LuaFlatJoinDefinition>(w, ref);
+
+    flat->left = leftRef;
+    flat->right = rightRef;
+    flat->condition = conditionRef;
+
+    flat->type = (uint8_t)joinDef->type;
+
+    return ref;
+}
+
+LuaFlatRef flatAlias(const hsql::Alias* alias, FlatWriter* w)
+{
+    if (alias == 0)
+        return 0;
+
+    LuaFlatRef nameRef = flatStr(alias->name, w);
+    LuaFlatRef columnsRef = flatArr<char>(alias->columns, flatStr, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatAlias>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatAlias* flat = flatNode<LuaFlatAlias>(w, ref);
+
+    flat->name = nameRef;
+    flat->columns = columnsRef;
+
+    return ref;
+}
+
+LuaFlatRef flatTableRef(const hsql::TableRef* tableRef, FlatWriter* w)
+{
+    if (tableRef == 0)
+        return 0;
+
+    if (!flatEnter(w))
+        return 0;
+
+    LuaFlatRef schemaRef = flatStr(tableRef->schema, w);
+    LuaFlatRef nameRef = flatStr(tableRef->name, w);
+    LuaFlatRef aliasRef = flatAlias(tableRef->alias, w);
+    LuaFlatRef selectRef = flatSelectStatement(tableRef->select, w);
+    LuaFlatRef listRef = flatArr<hsql::TableRef>(tableRef->list,
+        flatTableRef, w);
+    LuaFlatRef joinRef = flatJoinDefinition(tableRef->join, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatTableRef>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatTableRef* flat = flatNode<LuaFlatTableRef>(w, ref);
+
+    flat->schema = schemaRef;
+    flat->name = nameRef;
+    flat->alias = aliasRef;
+    flat->select = selectRef;
+    flat->list = listRef;
+    flat->join = joinRef;
+
+    flat->type = (uint8_t)tableRef->type;
+
+    flatLeave(w);
+
+    return ref;
+}
+
+LuaFlatRef flatGroupByDescription(const hsql::GroupByDescription* groupBy,
+    FlatWriter* w)
+{
+    if (groupBy == 0)
+        return 0;
+
+    LuaFlatRef columnsRef = flatArr<hsql::Expr>(groupBy->columns, flatExpr, w);
+    LuaFlatRef havingRef = flatExpr(groupBy->having, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatGroupByDescription>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatGroupByDescription* flat =
+        flatNode<LuaFlatGroupByDescription>(w, ref);
+
+    flat->columns = columnsRef;
+    flat->having = havingRef;
+
+    return ref;
+}
+
+LuaFlatRef flatSetOperation(const hsql::SetOperation* setOp, FlatWriter* w)
+{
+    if (setOp == 0)
+        return 0;
+
+    LuaFlatRef nestedRef = flatSelectStatement(setOp->nestedSelectStatement,
+        w);
+    LuaFlatRef resultOrderRef = flatArr<hsql::OrderDescription>(
+        setOp->resultOrder, flatOrderDescription, w);
+    LuaFlatRef resultLimitRef = flatLimitDescription(setOp->resultLimit, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatSetOperation>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatSetOperation* flat = flatNode<LuaFlatSetOperation>(w, ref);
+
+    flat->nestedSelectStatement = nestedRef;
+    flat->resultOrder = resultOrderRef;
+    flat->resultLimit = resultLimitRef;
+
+    flat->setType = (uint8_t)setOp->setType;
+    flat->isAll = setOp->isAll;
+
+    return ref;
+}
+
+LuaFlatRef flatOrderDescription(const hsql::OrderDescription* orderDesc,
+    FlatWriter* w)
+{
+    if (orderDesc == 0)
+        return 0;
+
+    LuaFlatRef exprRef = flatExpr(orderDesc->expr, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatOrderDescription>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatOrderDescription* flat = flatNode<LuaFlatOrderDescription>(w, ref);
+
+    flat->expr = exprRef;
+    flat->type = (uint8_t)orderDesc->type;
+
+    return ref;
+}
+
+LuaFlatRef flatWithDescription(const hsql::WithDescription* withDesc,
+    FlatWriter* w)
+{
+    if (withDesc == 0)
+        return 0;
+
+    LuaFlatRef aliasRef = flatStr(withDesc->alias, w);
+    LuaFlatRef selectRef = flatSelectStatement(withDesc->select, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatWithDescription>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatWithDescription* flat = flatNode<LuaFlatWithDescription>(w, ref);
+
+    flat->alias = aliasRef;
+    flat->select = selectRef;
+
+    return ref;
+}
+
+LuaFlatRef flatLimitDescription(const hsql::LimitDescription* limitDesc,
+    FlatWriter* w)
+{
+    if (limitDesc == 0)
+        return 0;
+
+    LuaFlatRef limitRef = flatExpr(limitDesc->limit, w);
+    LuaFlatRef offsetRef = flatExpr(limitDesc->offset, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatLimitDescription>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatLimitDescription* flat = flatNode<LuaFlatLimitDescription>(w, ref);
+
+    flat->limit = limitRef;
+    flat->offset = offsetRef;
+
+    return ref;
+}
+
+void fillFlatSQLStatement(const hsql::SQLStatement* statement,
+    LuaFlatSQLStatement* flat, LuaFlatRef hintsRef)
+{
+    flat->stringLength = (uint32_t)statement->stringLength;
+    flat->hints = hintsRef;
+
+    flat->type = (uint8_t)statement->type();
+}
+
+LuaFlatRef flatSelectStatement(const hsql::SelectStatement* statement,
+    FlatWriter* w)
+{
+    if (statement == 0)
+        return 0;
+
+    if (!flatEnter(w))
+        return 0;
+
+    LuaFlatRef hintsRef = flatArr<hsql::Expr>(statement->hints, flatExpr, w);
+    LuaFlatRef fromTableRef = flatTableRef(statement->fromTable, w);
+    LuaFlatRef selectListRef = flatArr<hsql::Expr>(statement->selectList,
+        flatExpr, w);
+    LuaFlatRef whereClauseRef = flatExpr(statement->whereClause, w);
+    LuaFlatRef groupByRef = flatGroupByDescription(statement->groupBy, w);
+    LuaFlatRef setOperationsRef = flatArr<hsql::SetOperation>(
+        statement->setOperations, flatSetOperation, w);
+    LuaFlatRef orderRef = flatArr<hsql::OrderDescription>(statement->order,
+        flatOrderDescription, w);
+    LuaFlatRef withDescriptionsRef = flatArr<hsql::WithDescription>(
+        statement->withDescriptions, flatWithDescription, w);
+    LuaFlatRef limitRef = flatLimitDescription(statement->limit, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatSelectStatement>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatSelectStatement* flat = flatNode<LuaFlatSelectStatement>(w, ref);
+
+    fillFlatSQLStatement(statement, &flat->base, hintsRef);
+
+    flat->fromTable = fromTableRef;
+    flat->selectList = selectListRef;
+    flat->whereClause = whereClauseRef;
+    flat->groupBy = groupByRef;
+    flat->setOperations = setOperationsRef;
+    flat->order = orderRef;
+    flat->withDescriptions = withDescriptionsRef;
+    flat->limit = limitRef;
+
+    flat->selectDistinct = statement->selectDistinct;
+
+    flatLeave(w);
+
+    return ref;
+}
+
+LuaFlatRef flatInsertStatement(const hsql::InsertStatement* statement,
+    FlatWriter* w)
+{
+    if (!flatEnter(w))
+        return 0;
+
+    LuaFlatRef hintsRef = flatArr<hsql::Expr>(statement->hints, flatExpr, w);
+    LuaFlatRef schemaRef = flatStr(statement->schema, w);
+    LuaFlatRef tableNameRef = flatStr(statement->tableName, w);
+    LuaFlatRef columnsRef = flatArr<char>(statement->columns, flatStr, w);
+    LuaFlatRef valuesRef = flatArr<hsql::Expr>(statement->values, flatExpr, w);
+    LuaFlatRef selectRef = flatSelectStatement(statement->select, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatInsertStatement>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatInsertStatement* flat = flatNode<LuaFlatInsertStatement>(w, ref);
+
+    fillFlatSQLStatement(statement, &flat->base, hintsRef);
+
+    flat->schema = schemaRef;
+    flat->tableName = tableNameRef;
+    flat->columns = columnsRef;
+    flat->values = valuesRef;
+    flat->select = selectRef;
+
+    flat->type = (uint8_t)statement->type;
+
+    flatLeave(w);
+
+    return ref;
+}
+
+LuaFlatRef flatUpdateClause(const hsql::UpdateClause* update, FlatWriter* w)
+{
+    if (update == 0)
+        return 0;
+
+    LuaFlatRef columnRef = flatStr(update->column, w);
+    LuaFlatRef valueRef = flatExpr(update->value, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatUpdateClause>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatUpdateClause* flat = flatNode<LuaFlatUpdateClause>(w, ref);
+
+    flat->column = columnRef;
+    flat->value = valueRef;
+
+    return ref;
+}
+
+LuaFlatRef flatUpdateStatement(const hsql::UpdateStatement* statement,
+    FlatWriter* w)
+{
+    if (!flatEnter(w))
+        return 0;
+
+    LuaFlatRef hintsRef = flatArr<hsql::Expr>(statement->hints, flatExpr, w);
+    LuaFlatRef tableRef = flatTableRef(statement->table, w);
+    LuaFlatRef updatesRef = flatArr<hsql::UpdateClause>(statement->updates,
+        flatUpdateClause, w);
+    LuaFlatRef whereRef = flatExpr(statement->where, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatUpdateStatement>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatUpdateStatement* flat = flatNode<LuaFlatUpdateStatement>(w, ref);
+
+    fillFlatSQLStatement(statement, &flat->base, hintsRef);
+
+    flat->table = tableRef;
+    flat->updates = updatesRef;
+    flat->where = whereRef;
+
+    flatLeave(w);
+
+    return ref;
+}
+
+LuaFlatRef flatDeleteStatement(const hsql::DeleteStatement* statement,
+    FlatWriter* w)
+{
+    if (!flatEnter(w))
+        return 0;
+
+    LuaFlatRef hintsRef = flatArr<hsql::Expr>(statement->hints, flatExpr, w);
+    LuaFlatRef schemaRef = flatStr(statement->schema, w);
+    LuaFlatRef tableNameRef = flatStr(statement->tableName, w);
+    LuaFlatRef exprRef = flatExpr(statement->expr, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatDeleteStatement>(w);
+    if (ref == 0)
+        return 0;
+
+    LuaFlatDeleteStatement* flat = flatNode<LuaFlatDeleteStatement>(w, ref);
+
+    fillFlatSQLStatement(statement, &flat->base, hintsRef);
+
+    flat->schema = schemaRef;
+    flat->tableName = tableNameRef;
+    flat->expr = exprRef;
+
+    flatLeave(w);
+
+    return ref;
+}
+
+LuaFlatRef flatSQLStatement(const hsql::SQLStatement* statement,
+    FlatWriter* w)
+{
+    if (statement == 0)
+        return 0;
+
+    switch (statement->type()) {
+        case hsql::kStmtSelect:
+            return flatSelectStatement(
+                (const hsql::SelectStatement*)statement, w);
+        case hsql::kStmtInsert:
+            return flatInsertStatement(
+                (const hsql::InsertStatement*)statement, w);
+        case hsql::kStmtUpdate:
+            return flatUpdateStatement(
+                (const hsql::UpdateStatement*)statement, w);
+        case hsql::kStmtDelete:
+            return flatDeleteStatement(
+                (const hsql::DeleteStatement*)statement, w);
+        default:
+            break;
+    }
+
+    if (!flatEnter(w))
+        return 0;
+
+    LuaFlatRef hintsRef = flatArr<hsql::Expr>(statement->hints, flatExpr, w);
+
+    LuaFlatRef ref = flatNew<LuaFlatSQLStatement>(w);
+    if (ref == 0)
+        return 0;
+
+    fillFlatSQLStatement(statement, flatNode<LuaFlatSQLStatement>(w, ref),
+        hintsRef);
+
+    flatLeave(w);
+
+    return ref;
+}
+
+LuaFlatRef flatParameters(FlatWriter* w)
+{
+    std::sort(w->parameters.begin(), w->parameters.end());
+
+    size_t n = w->parameters.size();
+
+    LuaFlatRef ref = flatAlloc(w, (n + 1) * sizeof(uint32_t),
+        sizeof(uint32_t));
+    if (ref == 0)
+        return 0;
+
+    uint32_t* arr = flatNode<uint32_t>(w, ref);
+
+    arr[0] = (uint32_t)n;
+    for (size_t i = 0; i < n; i++)
+        arr[i + 1] = w->parameters[i].second;
+
+    return ref;
+}
+
+void flatInit(FlatWriter* w)
+{
+    w->buf = (char*)std::malloc(kFlatInitialCapacity);
+    w->size = 0;
+    w->capacity = kFlatInitialCapacity;
+    w->failed = (w->buf == 0);
+
+    w->limits = getLimits();
+    w->nodeCount = 0;
+    w->depth = 0;
+    w->stringBytes = 0;
+    w->limitError = 0;
+
+    // The header takes offset 0, so no node can ever be referenced by 0.
+    flatNew<LuaFlatResult>(w);
+}
+
+// An invalid flat result carrying only an error.
+LuaFlatResult* flatErrorResult(ErrorCode errorCode, const char* errorMsg,
+    int errorLine, int errorColumn)
+{
+    FlatWriter w;
+    flatInit(&w);
+
+    // The message is not part of the query, so no limit applies to it.
+    w.limits.maxStringBytes = SIZE_MAX;
+
+    LuaFlatRef errorMsgRef = flatStr(errorMsg, &w);
+
+    if (w.failed) {
+        free(w.buf);
+        return 0;
+    }
+
+    LuaFlatResult* flat = flatNode<LuaFlatResult>(&w, 0);
+
+    flat->size = w.size;
+    flat->isValid = false;
+    flat->errorCode = errorCode;
+    flat->errorMsg = errorMsgRef;
+    flat->errorLine = errorLine;
+    flat->errorColumn = errorColumn;
+
+    return flat;
+}
+
+LuaFlatResult* flatSQLParserResult(hsql::SQLParserResult* result)
+{
+    if (result == 0)
+        return 0;
+
+    if (!result->isValid())
+        return flatErrorResult(kErrorSyntax, result->errorMsg(),
+            result->errorLine(), result->errorColumn());
+
+    FlatWriter w;
+    flatInit(&w);
+
+    LuaFlatRef statementsRef = flatArr<hsql::SQLStatement>(
+        &result->getStatements(), flatSQLStatement, &w);
+    LuaFlatRef parametersRef = flatParameters(&w);
+
+    if (w.failed) {
+        free(w.buf);
+
+        if (w.limitError != 0)
+            return flatErrorResult(kErrorLimit, w.limitError, 0, 0);
+
+        return 0;
+    }
+
+    LuaFlatResult* flat = flatNode<LuaFlatResult>(&w, 0);
+
+    flat->size = w.size;
+    flat->isValid = true;
+    flat->errorCode = kErrorNone;
+    flat->statements = statementsRef;
+    flat->parameters = parametersRef;
+
+    return flat;
+}
+
+LuaFlatResult* parseSqlFlat(const char* query)
+{
+    size_t length = strlen(query);
+
+    if (queryTooLong(length))
+        return flatErrorResult(kErrorLimit, "Query is too long", 0, 0);
+
+    hsql::SQLParserResult result;
+    parseBytes(query, length, &result);
+
+    LuaFlatResult* flat = flatSQLParserResult(&result);
+
+    freeHyriseResult(&result, length);
+
+    return flat;
+}
+
+void finalizeFlat(LuaFlatResult* result)
+{
+    free(result);
+}
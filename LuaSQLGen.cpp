@@ -0,0 +1,1128 @@
+#include <cinttypes>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "LuaSQLEnums.h"
+#include "LuaSQLParser.h"
+
+
+// Growable buffer the SQL text is rendered into. Rendering stops at the
+// first error, which is kept as a message for the caller.
+struct SqlWriter {
+    char* buf;
+    size_t size;
+    size_t capacity;
+
+    bool failed;
+    char* errorMsg;
+
+    std::vector<size_t> offsets;
+
+    // Parameters are cut out of the text for templates, leaving their
+    // offsets and ids.
+    bool cutParameters;
+    std::vector<size_t> slotOffsets;
+    std::vector<size_t> slotParams;
+
+    // Nesting of the expressions, table references and SELECTs being
+    // rendered, and the left-deep operator chains being rendered by
+    // sqlBinaryOperator().
+    size_t depth;
+    std::vector<const LuaExpr*> chain;
+};
+
+static const size_t kSqlInitialCapacity = 256;
+
+// Rendering recurses through nested expressions, table references and
+// SELECTs, deeper trees are rejected rather than risking a fiber stack.
+// Left-deep chains of binary operators, such as long AND and OR lists, are
+// rendered in a loop and do not count.
+static const size_t kSqlMaxDepth = 1000;
+
+void sqlSelectStatement(const LuaSelectStatement* statement, SqlWriter* w);
+
+void sqlTableRef(const LuaTableRef* tableRef, SqlWriter* w);
+
+void sqlError(SqlWriter* w, const char* fmt, ...);
+
+inline bool sqlEnter(SqlWriter* w)
+{
+    if (w->failed)
+        return false;
+
+    if (w->depth >= kSqlMaxDepth) {
+        sqlError(w, "the query is nested too deeply to render");
+        return false;
+    }
+
+    w->depth++;
+    return true;
+}
+
+
+void sqlError(SqlWriter* w, const char* fmt, ...)
+{
+    if (w->failed)
+        return;
+
+    w->failed = true;
+
+    char msg[256];
+
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    w->errorMsg = strdup(msg);
+}
+
+// Makes room for `n` more bytes. Returns false once the writer has failed.
+bool sqlReserve(SqlWriter* w, size_t n)
+{
+    if (w->failed)
+        return false;
+
+    if (w->size + n > w->capacity) {
+        size_t capacity = w->capacity * 2;
+        while (capacity < w->size + n)
+            capacity *= 2;
+
+        char* buf = (char*)std::realloc(w->buf, capacity);
+        if (buf == 0) {
+            sqlError(w, "out of memory");
+            return false;
+        }
+
+        w->buf = buf;
+        w->capacity = capacity;
+    }
+
+    return true;
+}
+
+void sqlAppend(SqlWriter* w, const char* str, size_t n)
+{
+    if (!sqlReserve(w, n))
+        return;
+
+    std::memcpy(w->buf + w->size, str, n);
+    w->size += n;
+}
+
+inline void sqlAppend(SqlWriter* w, const char* str)
+{
+    sqlAppend(w, str, strlen(str));
+}
+
+// Formats straight into the buffer, which grows to fit and is formatted
+// into again when the text is longer than the space left. "%f" of a large
+// float literal alone takes more than 300 bytes.
+void sqlPrintf(SqlWriter* w, const char* fmt, ...)
+{
+    if (w->failed)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(w->buf + w->size, w->capacity - w->size, fmt, ap);
+    va_end(ap);
+
+    if (n < 0) {
+        sqlError(w, "can not format a literal");
+        return;
+    }
+
+    if ((size_t)n >= w->capacity - w->size) {
+        // vsnprintf() writes a NUL after the text.
+        if (!sqlReserve(w, (size_t)n + 1))
+            return;
+
+        va_start(ap, fmt);
+        vsnprintf(w->buf + w->size, w->capacity - w->size, fmt, ap);
+        va_end(ap);
+    }
+
+    w->size += n;
+}
+
+// Identifiers are always quoted, as sqlgen.lua does.
+void sqlIdentifier(const char* name, SqlWriter* w)
+{
+    sqlAppend(w, "\"", 1);
+    sqlAppend(w, name);
+    sqlAppend(w, "\"", 1);
+}
+
+void sqlStringLiteral(const char* str, SqlWriter* w)
+{
+    sqlAppend(w, "'", 1);
+
+    const char* quote;
+    while ((quote = strchr(str, '\'')) != 0) {
+        sqlAppend(w, str, quote - str + 1);
+        sqlAppend(w, "'", 1);
+        str = quote + 1;
+    }
+
+    sqlAppend(w, str);
+    sqlAppend(w, "'", 1);
+}
+
+void sqlExpr(const LuaExpr* expr, SqlWriter* w, bool nested = false,
+    bool allowAlias = false);
+
+void sqlExprArr(LuaExpr* const* arr, size_t n, SqlWriter* w,
+    bool allowAlias = false)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (i != 0)
+            sqlAppend(w, ", ", 2);
+
+        sqlExpr(arr[i], w, false, allowAlias);
+    }
+}
+
+void sqlFunction(const LuaExpr* expr, SqlWriter* w)
+{
+    const char* name = expr->name != 0 ? expr->name : "";
+
+    if (expr->datetimeField != kDatetimeNone) {
+        const char* field = enumStr(kDatetimeFieldStr, expr->datetimeField);
+
+        if (strcasecmp(name, "extract") != 0 || field == 0) {
+            sqlError(w, "unknown date-time function: %s", name);
+            return;
+        }
+
+        sqlAppend(w, "extract(");
+        sqlAppend(w, field);
+        sqlAppend(w, " from ");
+        sqlExpr(expr->expr, w);
+        sqlAppend(w, ")", 1);
+    }
+    else if (expr->columnType != UNKNOWN) {
+        const char* columnType = enumStr(kColumnTypeStr, expr->columnType);
+
+        if (strcasecmp(name, "cast") != 0 || columnType == 0) {
+            sqlError(w, "unknown type casting function: %s", name);
+            return;
+        }
+
+        sqlAppend(w, "cast(");
+        sqlExpr(expr->expr, w);
+        sqlAppend(w, " as ");
+        sqlAppend(w, columnType);
+
+        if (expr->columnLength > 0)
+            sqlPrintf(w, "(%" PRId64 ")", expr->columnLength);
+
+        sqlAppend(w, ")", 1);
+    }
+    else {
+        if (!expr->distinct && strchr(name, '.') != 0)
+            sqlIdentifier(name, w);
+        else
+            sqlAppend(w, name);
+
+        sqlAppend(w, "(", 1);
+
+        if (expr->distinct)
+            sqlAppend(w, "distinct ");
+
+        sqlExprArr(expr->exprList, expr->exprListSize, w);
+
+        sqlAppend(w, ")", 1);
+    }
+}
+
+int getOperatorArity(OperatorType opType)
+{
+    if (opType == kOpNone)
+        return 0;
+
+    if (opType == kOpBetween)
+        return 3;
+
+    if (opType == kOpCase || opType == kOpCaseListElement)
+        return -1;
+
+    if (opType >= kOpPlus && opType <= kOpConcat)
+        return 2;
+
+    return 1;
+}
+
+inline bool needsBrackets(const LuaExpr* expr, bool nested)
+{
+    return nested && (
+        expr->opType == kOpPlus ||
+        expr->opType == kOpMinus ||
+        expr->opType == kOpOr ||
+        expr->opType == kOpConcat);
+}
+
+// Whether the left operand of a binary operator continues its chain.
+inline bool isChainLink(const LuaExpr* expr)
+{
+    return expr != 0 && expr->type == kExprOperator && expr->table == 0 &&
+        getOperatorArity(expr->opType) == 2 &&
+        enumStr(kOperatorTypeStr, expr->opType) != 0;
+}
+
+// Renders a binary operator together with the binary operators down its
+// left operands in one loop: the opening brackets and the innermost left
+// operand first, then the rest of every operator from the inside out.
+void sqlBinaryOperator(const LuaExpr* expr, SqlWriter* w, bool nested)
+{
+    size_t base = w->chain.size();
+
+    const LuaExpr* link = expr;
+    for (;;) {
+        if (link->opType != kOpIn && link->expr2 == 0) {
+            sqlError(w, "the second operand of a binary operator "
+                "is not set: %s", enumStr(kOperatorTypeStr, link->opType));
+            w->chain.resize(base);
+            return;
+        }
+
+        if (needsBrackets(link, link == expr ? nested : true))
+            sqlAppend(w, "(", 1);
+
+        w->chain.push_back(link);
+
+        if (!isChainLink(link->expr))
+            break;
+
+        link = link->expr;
+    }
+
+    sqlExpr(link->expr, w, true);
+
+    while (w->chain.size() > base && !w->failed) {
+        link = w->chain.back();
+        w->chain.pop_back();
+
+        sqlAppend(w, " ", 1);
+        sqlAppend(w, enumStr(kOperatorTypeStr, link->opType));
+        sqlAppend(w, " ", 1);
+
+        if (link->opType == kOpIn) {
+            sqlAppend(w, "(", 1);
+            if (link->exprList != 0)
+                sqlExprArr(link->exprList, link->exprListSize, w);
+            else
+                sqlSelectStatement(link->select, w);
+            sqlAppend(w, ")", 1);
+        }
+        else {
+            sqlExpr(link->expr2, w, true);
+        }
+
+        if (needsBrackets(link, link == expr ? nested : true))
+            sqlAppend(w, ")", 1);
+    }
+
+    w->chain.resize(base);
+}
+
+void sqlOperator(const LuaExpr* expr, SqlWriter* w, bool nested)
+{
+    const char* op = enumStr(kOperatorTypeStr, expr->opType);
+    if (op == 0) {
+        sqlError(w, "unknown operator type: %d", (int)expr->opType);
+        return;
+    }
+
+    switch (getOperatorArity(expr->opType)) {
+        case 1:
+            if (expr->opType == kOpNot) {
+                sqlAppend(w, "not ");
+                sqlExpr(expr->expr, w);
+            }
+            else if (expr->opType == kOpUnaryMinus) {
+                sqlAppend(w, "-", 1);
+                sqlExpr(expr->expr, w);
+            }
+            else if (expr->opType == kOpIsNull) {
+                sqlExpr(expr->expr, w);
+                sqlAppend(w, " is null");
+            }
+            else if (expr->opType == kOpExists) {
+                sqlAppend(w, "exists(");
+                sqlSelectStatement(expr->select, w);
+                sqlAppend(w, ")", 1);
+            }
+            else {
+                sqlError(w, "unknown unary operator type: %s", op);
+            }
+            break;
+
+        case 2:
+            sqlBinaryOperator(expr, w, nested);
+            break;
+
+        case 3:
+            if (expr->exprListSize < 2) {
+                sqlError(w, "unknown ternary operator type: %s", op);
+                return;
+            }
+
+            sqlExpr(expr->expr, w);
+            sqlAppend(w, " between ");
+            sqlExpr(expr->exprList[0], w);
+            sqlAppend(w, " and ");
+            sqlExpr(expr->exprList[1], w);
+            break;
+
+        case -1:
+            if (expr->opType == kOpCase) {
+                sqlAppend(w, "case");
+
+                for (size_t i = 0; i < expr->exprListSize; i++)
+                    sqlExpr(expr->exprList[i], w);
+
+                if (expr->expr2 != 0) {
+                    sqlAppend(w, " else ");
+                    sqlExpr(expr->expr2, w);
+                }
+
+                sqlAppend(w, " end");
+            }
+            else {
+                sqlAppend(w, " when ");
+                sqlExpr(expr->expr, w);
+                sqlAppend(w, " then ");
+                sqlExpr(expr->expr2, w);
+            }
+            break;
+
+        default:
+            sqlError(w, "unhandled operator type: %s", op);
+            break;
+    }
+}
+
+void sqlExpr(const LuaExpr* expr, SqlWriter* w, bool nested, bool allowAlias)
+{
+    if (w->failed)
+        return;
+
+    if (expr == 0) {
+        sqlError(w, "expression is not specified");
+        return;
+    }
+
+    if (!sqlEnter(w))
+        return;
+
+    if (expr->table != 0) {
+        sqlIdentifier(expr->table, w);
+        sqlAppend(w, ".", 1);
+    }
+
+    switch (expr->type) {
+        case kExprLiteralFloat:
+            sqlPrintf(w, "%f", expr->fval);
+            break;
+
+        case kExprLiteralString:
+            sqlStringLiteral(expr->name, w);
+            break;
+
+        case kExprLiteralInt:
+            if (!expr->isBoolLiteral)
+                sqlPrintf(w, "%" PRId64, expr->ival);
+            else
+                sqlAppend(w, expr->ival != 0 ? "true" : "false");
+            break;
+
+        case kExprLiteralNull:
+            sqlAppend(w, "null");
+            break;
+
+        case kExprStar:
+            sqlAppend(w, "*", 1);
+            break;
+
+        case kExprParameter:
+            if (!w->cutParameters) {
+                sqlAppend(w, "?", 1);
+            }
+            else if (expr->ival < 0) {
+                sqlError(w, "invalid parameter id: %" PRId64, expr->ival);
+            }
+            else {
+                w->slotOffsets.push_back(w->size);
+                w->slotParams.push_back((size_t)expr->ival);
+            }
+            break;
+
+        case kExprColumnRef:
+            sqlIdentifier(expr->name, w);
+            break;
+
+        case kExprFunctionRef:
+            sqlFunction(expr, w);
+            break;
+
+        case kExprOperator:
+            sqlOperator(expr, w, nested);
+            break;
+
+        case kExprSelect:
+            sqlAppend(w, "(", 1);
+            sqlSelectStatement(expr->select, w);
+            sqlAppend(w, ")", 1);
+            break;
+
+        case kExprArray:
+            sqlAppend(w, "array [");
+            sqlExprArr(expr->exprList, expr->exprListSize, w);
+            sqlAppend(w, "]", 1);
+            break;
+
+        case kExprArrayIndex:
+            sqlExpr(expr->expr, w);
+            sqlPrintf(w, "[%" PRId64 "]", expr->ival);
+            break;
+
+        case kExprDatetimeField: {
+            const char* field =
+                enumStr(kDatetimeFieldStr, expr->datetimeField);
+            if (field == 0) {
+                sqlError(w, "unknown date-time field: %d",
+                    (int)expr->datetimeField);
+                return;
+            }
+
+            sqlAppend(w, field);
+            break;
+        }
+
+        case kExprHint:
+            sqlError(w, "unhandled expression type: hint");
+            return;
+
+        default:
+            sqlError(w, "unknown expression type: %d", (int)expr->type);
+            return;
+    }
+
+    if (allowAlias && expr->alias != 0) {
+        sqlAppend(w, " as ");
+        sqlIdentifier(expr->alias, w);
+    }
+
+    w->depth--;
+}
+
+void sqlJoinDefinition(const LuaJoinDefinition* joinDef, SqlWriter* w)
+{
+    const char* type = enumStr(kJoinTypeStr, joinDef->type);
+    if (type == 0) {
+        sqlError(w, "unknown join type: %d", (int)joinDef->type);
+        return;
+    }
+
+    sqlTableRef(joinDef->left, w);
+    sqlAppend(w, " ", 1);
+    sqlAppend(w, type);
+    sqlAppend(w, " join ");
+    sqlTableRef(joinDef->right, w);
+
+    if (joinDef->condition != 0) {
+        sqlAppend(w, " on ");
+        sqlExpr(joinDef->condition, w);
+    }
+}
+
+void sqlTableRef(const LuaTableRef* tableRef, SqlWriter* w)
+{
+    if (w->failed)
+        return;
+
+    if (tableRef == 0) {
+        sqlError(w, "table reference is not specified");
+        return;
+    }
+
+    if (!sqlEnter(w))
+        return;
+
+    switch (tableRef->type) {
+        case kTableName:
+            if (tableRef->schema != 0) {
+                sqlIdentifier(tableRef->schema, w);
+                sqlAppend(w, ".", 1);
+            }
+            sqlIdentifier(tableRef->name, w);
+            break;
+
+        case kTableSelect:
+            sqlAppend(w, "(", 1);
+            sqlSelectStatement(tableRef->select, w);
+            sqlAppend(w, ")", 1);
+            break;
+
+        case kTableJoin:
+            sqlJoinDefinition(tableRef->join, w);
+            break;
+
+        case kTableCrossProduct:
+            for (size_t i = 0; i < tableRef->listSize; i++) {
+                if (i != 0)
+                    sqlAppend(w, ", ", 2);
+
+                sqlTableRef(tableRef->list[i], w);
+            }
+            break;
+
+        default:
+            sqlError(w, "unknown table reference type: %d",
+                (int)tableRef->type);
+            return;
+    }
+
+    if (tableRef->alias != 0) {
+        sqlAppend(w, " as ");
+        sqlIdentifier(tableRef->alias->name, w);
+    }
+
+    w->depth--;
+}
+
+void sqlOrderDescriptions(LuaOrderDescription* const* order, size_t n,
+    SqlWriter* w)
+{
+    for (size_t i = 0; i < n; i++) {
+        sqlAppend(w, i == 0 ? " order by " : ", ");
+        sqlExpr(order[i]->expr, w);
+
+        if (order[i]->type == kOrderDesc)
+            sqlAppend(w, " desc");
+    }
+}
+
+void sqlLimitDescription(const LuaLimitDescription* limitDesc, SqlWriter* w)
+{
+    if (limitDesc->limit != 0) {
+        sqlAppend(w, " limit ");
+        sqlExpr(limitDesc->limit, w);
+    }
+
+    if (limitDesc->offset != 0) {
+        sqlAppend(w, " offset ");
+        sqlExpr(limitDesc->offset, w);
+    }
+}
+
+void sqlSetOperation(const LuaSetOperation* setOp, SqlWriter* w)
+{
+    const char* type = enumStr(kSetTypeStr, setOp->setType);
+    if (type == 0) {
+        sqlError(w, "unknown set operation: %d", (int)setOp->setType);
+        return;
+    }
+
+    sqlAppend(w, " ", 1);
+    sqlAppend(w, type);
+    sqlAppend(w, " ", 1);
+
+    if (setOp->isAll)
+        sqlAppend(w, "all ");
+
+    sqlAppend(w, "(", 1);
+    sqlSelectStatement(setOp->nestedSelectStatement, w);
+    sqlAppend(w, ")", 1);
+
+    if (setOp->resultOrder != 0)
+        sqlOrderDescriptions(setOp->resultOrder, setOp->resultOrderCount, w);
+
+    if (setOp->resultLimit != 0)
+        sqlLimitDescription(setOp->resultLimit, w);
+}
+
+void sqlSelectStatement(const LuaSelectStatement* statement, SqlWriter* w)
+{
+    if (w->failed)
+        return;
+
+    if (statement == 0) {
+        sqlError(w, "select statement is not specified");
+        return;
+    }
+
+    if (!sqlEnter(w))
+        return;
+
+    // Every set operation but the last one wraps everything before it into
+    // brackets: ((a) union (b)) union (c).
+    size_t setOpCount = statement->setOperations != 0 ?
+        statement->setOperationCount : 0;
+
+    for (size_t i = 0; i < setOpCount; i++)
+        sqlAppend(w, "(", 1);
+
+    if (statement->withDescriptions != 0) {
+        for (size_t i = 0; i < statement->withDescriptionCount; i++) {
+            const LuaWithDescription* withDesc =
+                statement->withDescriptions[i];
+
+            sqlAppend(w, i == 0 ? "with " : ", ");
+            sqlIdentifier(withDesc->alias, w);
+            sqlAppend(w, " as (");
+            sqlSelectStatement(withDesc->select, w);
+            sqlAppend(w, ")", 1);
+        }
+
+        if (statement->withDescriptionCount != 0)
+            sqlAppend(w, " ", 1);
+    }
+
+    sqlAppend(w, statement->selectDistinct ? "select distinct " : "select ");
+
+    sqlExprArr(statement->selectList, statement->selectListSize, w, true);
+
+    if (statement->fromTable != 0) {
+        sqlAppend(w, " from ");
+        sqlTableRef(statement->fromTable, w);
+    }
+
+    if (statement->whereClause != 0) {
+        sqlAppend(w, " where ");
+        sqlExpr(statement->whereClause, w);
+    }
+
+    if (statement->groupBy != 0) {
+        sqlAppend(w, " group by ");
+        sqlExprArr(statement->groupBy->columns,
+            statement->groupBy->columnCount, w);
+
+        if (statement->groupBy->having != 0) {
+            sqlAppend(w, " having ");
+            sqlExpr(statement->groupBy->having, w);
+        }
+    }
+
+    if (statement->order != 0)
+        sqlOrderDescriptions(statement->order, statement->orderCount, w);
+
+    if (statement->limit != 0)
+        sqlLimitDescription(statement->limit, w);
+
+    for (size_t i = 0; i < setOpCount; i++) {
+        sqlAppend(w, ")", 1);
+        sqlSetOperation(statement->setOperations[i], w);
+    }
+
+    w->depth--;
+}
+
+void sqlTableName(const char* schema, const char* tableName, SqlWriter* w)
+{
+    if (schema != 0) {
+        sqlIdentifier(schema, w);
+        sqlAppend(w, ".", 1);
+    }
+
+    sqlIdentifier(tableName, w);
+}
+
+void sqlInsertStatement(const LuaInsertStatement* statement, SqlWriter* w)
+{
+    sqlAppend(w, "insert into ");
+    sqlTableName(statement->schema, statement->tableName, w);
+
+    if (statement->columns != 0) {
+        sqlAppend(w, " (", 2);
+
+        for (size_t i = 0; i < statement->columnCount; i++) {
+            if (i != 0)
+                sqlAppend(w, ", ", 2);
+
+            sqlIdentifier(statement->columns[i], w);
+        }
+
+        sqlAppend(w, ")", 1);
+    }
+
+    if (statement->type == kInsertValues) {
+        sqlAppend(w, " values (");
+        sqlExprArr(statement->values, statement->valueCount, w);
+        sqlAppend(w, ")", 1);
+    }
+    else if (statement->type == kInsertSelect) {
+        sqlAppend(w, " ", 1);
+        sqlSelectStatement(statement->select, w);
+    }
+    else {
+        sqlError(w, "unknown insert type: %d", (int)statement->type);
+    }
+}
+
+void sqlUpdateStatement(const LuaUpdateStatement* statement, SqlWriter* w)
+{
+    sqlAppend(w, "update ");
+    sqlTableRef(statement->table, w);
+    sqlAppend(w, " set ");
+
+    for (size_t i = 0; i < statement->updateCount; i++) {
+        if (i != 0)
+            sqlAppend(w, ", ", 2);
+
+        sqlIdentifier(statement->updates[i]->column, w);
+        sqlAppend(w, " = ");
+        sqlExpr(statement->updates[i]->value, w);
+    }
+
+    if (statement->where != 0) {
+        sqlAppend(w, " where ");
+        sqlExpr(statement->where, w);
+    }
+}
+
+void sqlDeleteStatement(const LuaDeleteStatement* statement, SqlWriter* w)
+{
+    sqlAppend(w, "delete from ");
+    sqlTableName(statement->schema, statement->tableName, w);
+
+    if (statement->expr != 0) {
+        sqlAppend(w, " where ");
+        sqlExpr(statement->expr, w);
+    }
+}
+
+void sqlSQLStatement(const LuaSQLStatement* statement, SqlWriter* w)
+{
+    if (statement == 0) {
+        sqlError(w, "SQL statement is not specified");
+        return;
+    }
+
+    switch (statement->type) {
+        case kStmtSelect:
+            sqlSelectStatement((const LuaSelectStatement*)statement, w);
+            break;
+
+        case kStmtInsert:
+            sqlInsertStatement((const LuaInsertStatement*)statement, w);
+            break;
+
+        case kStmtUpdate:
+            sqlUpdateStatement((const LuaUpdateStatement*)statement, w);
+            break;
+
+        case kStmtDelete:
+            sqlDeleteStatement((const LuaDeleteStatement*)statement, w);
+            break;
+
+        default: {
+            const char* type = enumStr(kStatementTypeStr, statement->type);
+
+            sqlError(w, "Generating of an SQL query string for statement "
+                "type '%s' is not implemented", type != 0 ? type : "");
+            return;
+        }
+    }
+
+    sqlAppend(w, ";", 1);
+}
+
+LuaSQLGenResult* generateSql(const LuaSQLParserResult* result)
+{
+    SqlWriter w;
+    w.buf = (char*)std::malloc(kSqlInitialCapacity);
+    w.size = 0;
+    w.capacity = kSqlInitialCapacity;
+    w.failed = w.buf == 0;
+    w.errorMsg = 0;
+    w.cutParameters = false;
+    w.depth = 0;
+
+    LuaSQLGenResult* gen =
+        (LuaSQLGenResult*)std::calloc(1, sizeof(LuaSQLGenResult));
+    if (gen == 0 || w.failed) {
+        std::free(gen);
+        std::free(w.buf);
+        return 0;
+    }
+
+    if (!result->isValid)
+        sqlError(&w, "AST is not valid");
+
+    w.offsets.push_back(0);
+
+    for (size_t i = 0; i < result->statementCount && !w.failed; i++) {
+        sqlSQLStatement(result->statements[i], &w);
+        w.offsets.push_back(w.size);
+    }
+
+    if (w.failed) {
+        std::free(w.buf);
+        gen->errorMsg = w.errorMsg != 0 ? w.errorMsg : strdup("out of memory");
+        return gen;
+    }
+
+    gen->offsets = (size_t*)std::malloc(w.offsets.size() * sizeof(size_t));
+    if (gen->offsets == 0) {
+        std::free(w.buf);
+        std::free(gen);
+        return 0;
+    }
+
+    std::memcpy(gen->offsets, w.offsets.data(),
+        w.offsets.size() * sizeof(size_t));
+
+    gen->buffer = w.buf;
+    gen->statementCount = result->statementCount;
+
+    return gen;
+}
+
+void finalizeGenerated(LuaSQLGenResult* gen)
+{
+    if (gen == 0)
+        return;
+
+    std::free(gen->buffer);
+    std::free(gen->offsets);
+    std::free(gen->errorMsg);
+    std::free(gen);
+}
+
+LuaSQLTemplate* prepareSql(const char* data, size_t length)
+{
+    LuaSQLTemplate* tmpl =
+        (LuaSQLTemplate*)std::calloc(1, sizeof(LuaSQLTemplate));
+    if (tmpl == 0)
+        return 0;
+
+    LuaSQLParserResult* result = parseSqlN(data, length);
+
+    SqlWriter w;
+    w.buf = (char*)std::malloc(kSqlInitialCapacity);
+    w.size = 0;
+    w.capacity = kSqlInitialCapacity;
+    w.failed = w.buf == 0;
+    w.errorMsg = 0;
+    w.cutParameters = true;
+    w.depth = 0;
+
+    if (!result->isValid) {
+        sqlError(&w, "%s", result->errorMsg != 0 ?
+            result->errorMsg : "AST is not valid");
+    }
+    else if (result->statementCount != 1) {
+        sqlError(&w, "a template holds a single statement");
+    }
+    else {
+        sqlSQLStatement(result->statements[0], &w);
+    }
+
+    finalize(result);
+
+    size_t slotCount = w.slotOffsets.size();
+
+    if (!w.failed) {
+        tmpl->slotOffsets = (size_t*)std::malloc(
+            (slotCount + 1) * sizeof(size_t));
+        tmpl->slotParams = (size_t*)std::malloc(
+            (slotCount + 1) * sizeof(size_t));
+
+        if (tmpl->slotOffsets == 0 || tmpl->slotParams == 0)
+            sqlError(&w, "out of memory");
+    }
+
+    if (w.failed) {
+        std::free(w.buf);
+        std::free(tmpl->slotOffsets);
+        std::free(tmpl->slotParams);
+        std::memset(tmpl, 0, sizeof(LuaSQLTemplate));
+
+        tmpl->errorMsg = w.errorMsg != 0 ? w.errorMsg : strdup("out of memory");
+        return tmpl;
+    }
+
+    for (size_t i = 0; i < slotCount; i++) {
+        tmpl->slotOffsets[i] = w.slotOffsets[i];
+        tmpl->slotParams[i] = w.slotParams[i];
+
+        if (w.slotParams[i] >= tmpl->paramCount)
+            tmpl->paramCount = w.slotParams[i] + 1;
+    }
+
+    tmpl->text = w.buf;
+    tmpl->length = w.size;
+    tmpl->slotCount = slotCount;
+
+    return tmpl;
+}
+
+// Output of a template. Bytes past the capacity are counted, not written.
+struct TemplateOutput {
+    char* buf;
+    size_t capacity;
+    size_t size;
+};
+
+inline void templatePut(TemplateOutput* out, const char* str, size_t n)
+{
+    if (out->size + n <= out->capacity)
+        std::memcpy(out->buf + out->size, str, n);
+
+    out->size += n;
+}
+
+// Floats are written in the shortest form that reads back to the same
+// value, without an exponent, which the lexer does not take, and with a
+// decimal point, so that they stay floats.
+static bool templatePutFloat(TemplateOutput* out, double value)
+{
+    if (!std::isfinite(value))
+        return false;
+
+    char str[400];
+    int n = 0;
+    int precision;
+
+    for (precision = 15; precision < 17; precision++) {
+        n = snprintf(str, sizeof(str), "%.*g", precision, value);
+        if (strtod(str, 0) == value)
+            break;
+    }
+
+    if (precision == 17)
+        n = snprintf(str, sizeof(str), "%.17g", value);
+
+    if (strchr(str, 'e') != 0) {
+        // As many decimals as the significant digits reach.
+        int exponent = (int)std::floor(std::log10(std::fabs(value)));
+        int decimals = precision - 1 - exponent;
+        if (decimals < 0)
+            decimals = 0;
+        n = snprintf(str, sizeof(str), "%.*f", decimals, value);
+
+        // The trailing zeros of the fixed notation.
+        if (decimals > 0) {
+            while (n > 1 && str[n - 1] == '0' && str[n - 2] != '.')
+                n--;
+        }
+    }
+
+    if (n <= 0 || (size_t)n >= sizeof(str))
+        return false;
+
+    templatePut(out, str, n);
+
+    if (memchr(str, '.', n) == 0)
+        templatePut(out, ".0", 2);
+
+    return true;
+}
+
+static bool templatePutValue(TemplateOutput* out, const LuaSQLValue* value)
+{
+    switch (value->type) {
+        case kValueNull:
+            templatePut(out, "null", 4);
+            return true;
+
+        case kValueBool:
+            if (value->ival != 0)
+                templatePut(out, "true", 4);
+            else
+                templatePut(out, "false", 5);
+            return true;
+
+        case kValueInt: {
+            // Digits are written from the end, the magnitude is unsigned so
+            // that INT64_MIN has one.
+            char str[24];
+            char* p = str + sizeof(str);
+            uint64_t magnitude = value->ival < 0 ?
+                0 - (uint64_t)value->ival : (uint64_t)value->ival;
+
+            do {
+                *--p = (char)('0' + magnitude % 10);
+                magnitude /= 10;
+            } while (magnitude != 0);
+
+            if (value->ival < 0)
+                *--p = '-';
+
+            templatePut(out, p, str + sizeof(str) - p);
+            return true;
+        }
+
+        case kValueFloat:
+            return templatePutFloat(out, value->fval);
+
+        case kValueString: {
+            const char* str = value->str;
+            const char* end = str + value->length;
+
+            if (memchr(str, 0, value->length) != 0)
+                return false;
+
+            templatePut(out, "'", 1);
+
+            const char* quote;
+            while ((quote = (const char*)memchr(str, '\'', end - str)) != 0) {
+                templatePut(out, str, quote - str + 1);
+                templatePut(out, "'", 1);
+                str = quote + 1;
+            }
+
+            templatePut(out, str, end - str);
+            templatePut(out, "'", 1);
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+int64_t renderTemplate(const LuaSQLTemplate* tmpl, const LuaSQLValue* values,
+    size_t count, char* buffer, size_t capacity)
+{
+    if (tmpl->errorMsg != 0 || count < tmpl->paramCount)
+        return -1;
+
+    TemplateOutput out;
+    out.buf = buffer;
+    out.capacity = buffer != 0 ? capacity : 0;
+    out.size = 0;
+
+    size_t offset = 0;
+
+    for (size_t i = 0; i < tmpl->slotCount; i++) {
+        size_t slotOffset = tmpl->slotOffsets[i];
+
+        templatePut(&out, tmpl->text + offset, slotOffset - offset);
+        offset = slotOffset;
+
+        if (!templatePutValue(&out, &values[tmpl->slotParams[i]]))
+            return -1;
+    }
+
+    templatePut(&out, tmpl->text + offset, tmpl->length - offset);
+
+    return (int64_t)out.size;
+}
+
+void finalizeTemplate(LuaSQLTemplate* tmpl)
+{
+    if (tmpl == 0)
+        return;
+
+    std::free(tmpl->text);
+    std::free(tmpl->slotOffsets);
+    std::free(tmpl->slotParams);
+    std::free(tmpl->errorMsg);
+    std::free(tmpl);
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_set>
+#include "LuaSQLHash.h"
+#include "LuaSQLIntern.h"
+
+
+void internSetInit(InternSet* set)
+{
+    set->slots.assign(64, InternSlot { 0, 0 });
+    set->count = 0;
+}
+
+void internSetClear(InternSet* set)
+{
+    // The slots a large query made room for are not worth clearing on
+    // every later query.
+    if (set->slots.size() > 1024) {
+        internSetInit(set);
+        return;
+    }
+
+    std::fill(set->slots.begin(), set->slots.end(), InternSlot { 0, 0 });
+    set->count = 0;
+}
+
+char* internSetFind(const InternSet* set, const char* str, uint64_t hash)
+{
+    size_t mask = set->slots.size() - 1;
+
+    for (size_t i = hash & mask; set->slots[i].str != 0; i = (i + 1) & mask) {
+        const InternSlot& slot = set->slots[i];
+
+        if (slot.hash == hash && strcmp(slot.str, str) == 0)
+            return slot.str;
+    }
+
+    return 0;
+}
+
+static void internSetPut(std::vector<InternSlot>& slots, InternSlot slot)
+{
+    size_t mask = slots.size() - 1;
+
+    size_t i = slot.hash & mask;
+    while (slots[i].str != 0)
+        i = (i + 1) & mask;
+
+    slots[i] = slot;
+}
+
+void internSetAdd(InternSet* set, char* str, uint64_t hash)
+{
+    // Kept at most half full.
+    if ((set->count + 1) * 2 > set->slots.size()) {
+        std::vector<InternSlot> slots(set->slots.size() * 2,
+            InternSlot { 0, 0 });
+
+        for (const InternSlot& slot : set->slots)
+            if (slot.str != 0)
+                internSetPut(slots, slot);
+
+        set->slots.swap(slots);
+    }
+
+    internSetPut(set->slots, InternSlot { hash, str });
+    set->count++;
+}
+
+
+struct StrHasher {
+    size_t operator()(std::string_view str) const
+    {
+        return (size_t)hashBytes(str.data(), str.size());
+    }
+};
+
+// Process-wide identifiers, stored back to back in one buffer allocated by
+// sqlparser_intern_configure(). Buffers are never freed: results may point
+// into them for as long as they live.
+struct SharedStrings {
+    std::shared_mutex mutex;
+
+    char* buffer;
+    size_t capacity;
+    size_t bytes;
+
+    std::unordered_set<std::string_view, StrHasher> index;
+};
+
+static SharedStrings shared;
+static std::atomic<bool> sharedEnabled(false);
+
+
+const char* internShared(const char* str, size_t length)
+{
+    if (!sharedEnabled.load(std::memory_order_relaxed))
+        return 0;
+
+    std::string_view key(str, length);
+
+    {
+        std::shared_lock<std::shared_mutex> lock(shared.mutex);
+
+        auto it = shared.index.find(key);
+        if (it != shared.index.end())
+            return it->data();
+
+        if (shared.capacity - shared.bytes < length + 1)
+            return 0;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shared.mutex);
+
+    // Another thread may have added it meanwhile.
+    auto it = shared.index.find(key);
+    if (it != shared.index.end())
+        return it->data();
+
+    if (shared.buffer == 0 || shared.capacity - shared.bytes < length + 1)
+        return 0;
+
+    char* copy = shared.buffer + shared.bytes;
+    std::memcpy(copy, str, length);
+    copy[length] = '\0';
+    shared.bytes += length + 1;
+
+    shared.index.emplace(copy, length);
+
+    return copy;
+}
+
+void sqlparser_intern_configure(size_t maxBytes)
+{
+    std::unique_lock<std::shared_mutex> lock(shared.mutex);
+
+    // Identifiers interned so far stay where they are, only new ones go to
+    // the new buffer.
+    shared.index.clear();
+    shared.buffer = maxBytes != 0 ? (char*)malloc(maxBytes) : 0;
+    shared.capacity = shared.buffer != 0 ? maxBytes : 0;
+    shared.bytes = 0;
+
+    sharedEnabled.store(shared.buffer != 0, std::memory_order_relaxed);
+}
+
+void sqlparser_intern_stats(LuaSQLInternStats* stats)
+{
+    std::shared_lock<std::shared_mutex> lock(shared.mutex);
+
+    stats->buffer = shared.buffer;
+    stats->capacity = shared.capacity;
+    stats->bytes = shared.bytes;
+    stats->entries = shared.index.size();
+}
@@ -0,0 +1,36 @@
+#ifndef LUA_SQL_INTERN_H
+#define LUA_SQL_INTERN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "LuaSQLParser.h"
+
+struct InternSlot {
+    uint64_t hash;
+    char* str;
+};
+
+// Identifiers copied into one result, an open-addressing set keyed by the
+// string contents. Repeated identifiers of a query share one copy.
+struct InternSet {
+    std::vector<InternSlot> slots;
+    size_t count;
+};
+
+void internSetInit(InternSet* set);
+
+// Empties the set, keeping its slots.
+void internSetClear(InternSet* set);
+
+// Returns the copy of `str` already in the set, or 0.
+char* internSetFind(const InternSet* set, const char* str, uint64_t hash);
+
+void internSetAdd(InternSet* set, char* str, uint64_t hash);
+
+// Returns the process-wide copy of `str`, adding it if there is room left,
+// or 0 if process-wide interning is disabled or full. The copies live as
+// long as the process and must not be modified.
+const char* internShared(const char* str, size_t length);
+
+#endif
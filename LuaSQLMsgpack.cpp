@@ -0,0 +1,1879 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "LuaSQLArena.h"
+#include "LuaSQLEnums.h"
+#include "LuaSQLParser.h"
+
+
+// MessagePack encoding of parser results. The maps have the keys of the
+// tables sqlparser.lua decodes results into, and a key is left out exactly
+// when the Lua field would be nil, so that msgpack.decode() of an encoding
+// and msgpack.encode() of a decoded AST are interchangeable.
+
+static const size_t kMsgpackInitialCapacity = 256;
+
+// Nesting of table references and SELECTs, subqueries included, that is
+// encoded and decoded. Both sides recurse through them, so deeper results
+// are rejected rather than risking a fiber stack on untrusted data.
+// Expressions are walked with explicit stacks and nest without a limit.
+static const size_t kMsgpackMaxDepth = 256;
+
+// A pending step of encoding an expression: a key, then an expression or
+// the header of an exprList whose items follow as tasks of their own.
+struct MpExprTask {
+    const char* key;
+    const LuaExpr* expr;
+    bool isList;
+    size_t listSize;
+};
+
+struct MpWriter {
+    char* buf;
+    size_t size;
+    size_t capacity;
+
+    // The caller's buffer, for as long as the encoding fits into it.
+    char* external;
+    bool failed;
+
+    // Parameters met so far, encoded once the statements are.
+    std::vector<const LuaExpr*> params;
+
+    std::vector<MpExprTask> stack;
+
+    // Nesting of table references and SELECTs being encoded.
+    size_t depth;
+};
+
+static char* mpReserve(MpWriter* w, size_t n)
+{
+    if (w->failed)
+        return 0;
+
+    if (w->capacity - w->size >= n)
+        return w->buf + w->size;
+
+    size_t capacity = std::max(w->capacity * 2, kMsgpackInitialCapacity);
+    while (capacity - w->size < n)
+        capacity *= 2;
+
+    char* buf;
+    if (w->buf == w->external) {
+        buf = (char*)std::malloc(capacity);
+        if (buf != 0 && w->size != 0)
+            std::memcpy(buf, w->buf, w->size);
+    }
+    else {
+        buf = (char*)std::realloc(w->buf, capacity);
+    }
+
+    if (buf == 0) {
+        w->failed = true;
+        return 0;
+    }
+
+    w->buf = buf;
+    w->capacity = capacity;
+
+    return w->buf + w->size;
+}
+
+// Writes a type byte followed by `n` big-endian bytes of `value`.
+static void mpPut(MpWriter* w, uint8_t type, uint64_t value, size_t n)
+{
+    char* p = mpReserve(w, 1 + n);
+    if (p == 0)
+        return;
+
+    p[0] = (char)type;
+    for (size_t i = 0; i < n; i++)
+        p[1 + i] = (char)(value >> (8 * (n - 1 - i)));
+
+    w->size += 1 + n;
+}
+
+static void mpNil(MpWriter* w)
+{
+    mpPut(w, 0xc0, 0, 0);
+}
+
+static void mpBool(MpWriter* w, bool value)
+{
+    mpPut(w, value ? 0xc3 : 0xc2, 0, 0);
+}
+
+static void mpUint(MpWriter* w, uint64_t value)
+{
+    if (value <= 0x7f)
+        mpPut(w, (uint8_t)value, 0, 0);
+    else if (value <= UINT8_MAX)
+        mpPut(w, 0xcc, value, 1);
+    else if (value <= UINT16_MAX)
+        mpPut(w, 0xcd, value, 2);
+    else if (value <= UINT32_MAX)
+        mpPut(w, 0xce, value, 4);
+    else
+        mpPut(w, 0xcf, value, 8);
+}
+
+static void mpInt(MpWriter* w, int64_t value)
+{
+    if (value >= 0)
+        mpUint(w, (uint64_t)value);
+    else if (value >= -32)
+        mpPut(w, (uint8_t)value, 0, 0);
+    else if (value >= INT8_MIN)
+        mpPut(w, 0xd0, (uint64_t)value, 1);
+    else if (value >= INT16_MIN)
+        mpPut(w, 0xd1, (uint64_t)value, 2);
+    else if (value >= INT32_MIN)
+        mpPut(w, 0xd2, (uint64_t)value, 4);
+    else
+        mpPut(w, 0xd3, (uint64_t)value, 8);
+}
+
+// Integral numbers are written as integers, as msgpack.encode() does with
+// Lua numbers.
+static void mpNumber(MpWriter* w, double value)
+{
+    if (std::isfinite(value) && value >= -9.2e18 && value <= 9.2e18 &&
+        std::trunc(value) == value) {
+        mpInt(w, (int64_t)value);
+        return;
+    }
+
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    mpPut(w, 0xcb, bits, 8);
+}
+
+static void mpStr(MpWriter* w, const char* str, size_t n)
+{
+    if (n <= 31)
+        mpPut(w, 0xa0 | (uint8_t)n, 0, 0);
+    else if (n <= UINT8_MAX)
+        mpPut(w, 0xd9, n, 1);
+    else if (n <= UINT16_MAX)
+        mpPut(w, 0xda, n, 2);
+    else
+        mpPut(w, 0xdb, n, 4);
+
+    char* p = mpReserve(w, n);
+    if (p == 0)
+        return;
+
+    std::memcpy(p, str, n);
+    w->size += n;
+}
+
+static void mpStr(MpWriter* w, const char* str)
+{
+    mpStr(w, str, strlen(str));
+}
+
+static void mpArray(MpWriter* w, size_t n)
+{
+    if (n <= 15)
+        mpPut(w, 0x90 | (uint8_t)n, 0, 0);
+    else if (n <= UINT16_MAX)
+        mpPut(w, 0xdc, n, 2);
+    else
+        mpPut(w, 0xdd, n, 4);
+}
+
+static void mpMap(MpWriter* w, size_t n)
+{
+    if (n <= 15)
+        mpPut(w, 0x80 | (uint8_t)n, 0, 0);
+    else if (n <= UINT16_MAX)
+        mpPut(w, 0xde, n, 2);
+    else
+        mpPut(w, 0xdf, n, 4);
+}
+
+// Writes `key: str` if the string is set.
+static void mpStrField(MpWriter* w, const char* key, const char* str)
+{
+    if (str == 0)
+        return;
+
+    mpStr(w, key);
+    mpStr(w, str);
+}
+
+inline size_t isSet(const void* ptr)
+{
+    return ptr != 0 ? 1 : 0;
+}
+
+static void encodeSelect(MpWriter* w, const LuaSelectStatement* select,
+    size_t extraKeys);
+static void encodeTableRef(MpWriter* w, const LuaTableRef* tableRef);
+
+static bool mpWriterEnter(MpWriter* w)
+{
+    if (++w->depth > kMsgpackMaxDepth)
+        w->failed = true;
+
+    return !w->failed;
+}
+
+// Writes the map header and the fields of an expression that are not
+// expressions themselves.
+static void encodeExprFields(MpWriter* w, const LuaExpr* expr)
+{
+    const char* name = expr->name;
+    if (expr->type == kExprOperator) {
+        name = enumStr(kOperatorTypeStr, expr->opType);
+        if (name == 0)
+            name = "";
+    }
+
+    size_t count = 1 + isSet(expr->select) + isSet(name) +
+        isSet(expr->table) + isSet(expr->alias) + isSet(expr->exprList) +
+        isSet(expr->expr2) + isSet(expr->expr);
+
+    switch (expr->type) {
+        case kExprLiteralFloat:
+        case kExprLiteralNull:
+        case kExprParameter:
+        case kExprOperator:
+        case kExprArrayIndex:
+            count += 1;
+            break;
+        case kExprLiteralString:
+            count += isSet(expr->name);
+            break;
+        case kExprLiteralInt:
+            count += 2;
+            break;
+        case kExprFunctionRef:
+            count += 1 + (expr->datetimeField > 0) + (expr->columnType > 0) +
+                (expr->columnLength > 0);
+            break;
+        default:
+            break;
+    }
+
+    mpMap(w, count);
+
+    const char* type = enumStr(kExprTypeStr, expr->type);
+    mpStr(w, "type");
+    mpStr(w, type != 0 ? type : "");
+
+    if (expr->select != 0) {
+        mpStr(w, "select");
+        encodeSelect(w, expr->select, 0);
+    }
+
+    mpStrField(w, "name", name);
+    mpStrField(w, "table", expr->table);
+    mpStrField(w, "alias", expr->alias);
+
+    switch (expr->type) {
+        case kExprLiteralFloat:
+            mpStr(w, "value");
+            mpNumber(w, expr->fval);
+            break;
+
+        case kExprLiteralString:
+            mpStrField(w, "value", expr->name);
+            break;
+
+        case kExprLiteralInt:
+            mpStr(w, "value");
+            mpInt(w, expr->ival);
+            mpStr(w, "isBoolLiteral");
+            mpBool(w, expr->isBoolLiteral);
+            break;
+
+        case kExprLiteralNull:
+            mpStr(w, "value");
+            mpNil(w);
+            break;
+
+        case kExprParameter:
+            mpStr(w, "paramId");
+            mpInt(w, expr->ival);
+            w->params.push_back(expr);
+            break;
+
+        case kExprFunctionRef:
+            mpStr(w, "distinct");
+            mpBool(w, expr->distinct);
+
+            if (expr->datetimeField > 0) {
+                const char* field =
+                    enumStr(kDatetimeFieldStr, expr->datetimeField);
+                mpStr(w, "datetimeField");
+                mpStr(w, field != 0 ? field : "");
+            }
+
+            if (expr->columnType > 0) {
+                const char* columnType =
+                    enumStr(kColumnTypeStr, expr->columnType);
+                mpStr(w, "columnType");
+                mpStr(w, columnType != 0 ? columnType : "");
+            }
+
+            if (expr->columnLength > 0) {
+                mpStr(w, "columnLength");
+                mpInt(w, expr->columnLength);
+            }
+            break;
+
+        case kExprOperator: {
+            int opType = expr->opType;
+            mpStr(w, "arity");
+            mpInt(w, opType >= 0 && opType <= kOpExists ?
+                kOperatorArity[opType] : 0);
+            break;
+        }
+
+        case kExprArrayIndex:
+            mpStr(w, "index");
+            mpInt(w, expr->ival);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Expressions are encoded with an explicit stack, so that long operator
+// chains can not exhaust the native stack.
+static void encodeExpr(MpWriter* w, const LuaExpr* root)
+{
+    size_t base = w->stack.size();
+    w->stack.push_back(MpExprTask { 0, root, false, 0 });
+
+    while (w->stack.size() > base && !w->failed) {
+        MpExprTask task = w->stack.back();
+        w->stack.pop_back();
+
+        if (task.key != 0)
+            mpStr(w, task.key);
+
+        if (task.isList) {
+            mpArray(w, task.listSize);
+            continue;
+        }
+
+        const LuaExpr* expr = task.expr;
+        if (expr == 0) {
+            mpNil(w);
+            continue;
+        }
+
+        encodeExprFields(w, expr);
+
+        if (expr->expr2 != 0)
+            w->stack.push_back(MpExprTask { "expr2", expr->expr2, false, 0 });
+
+        if (expr->expr != 0)
+            w->stack.push_back(MpExprTask { "expr", expr->expr, false, 0 });
+
+        if (expr->exprList != 0) {
+            for (size_t i = expr->exprListSize; i > 0; i--) {
+                w->stack.push_back(
+                    MpExprTask { 0, expr->exprList[i - 1], false, 0 });
+            }
+
+            w->stack.push_back(
+                MpExprTask { "exprList", 0, true, expr->exprListSize });
+        }
+    }
+
+    w->stack.resize(base);
+}
+
+static void encodeExprField(MpWriter* w, const char* key, const LuaExpr* expr)
+{
+    if (expr == 0)
+        return;
+
+    mpStr(w, key);
+    encodeExpr(w, expr);
+}
+
+static void encodeExprArr(MpWriter* w, const char* key,
+    LuaExpr* const* arr, size_t n)
+{
+    if (arr == 0)
+        return;
+
+    mpStr(w, key);
+    mpArray(w, n);
+
+    for (size_t i = 0; i < n; i++)
+        encodeExpr(w, arr[i]);
+}
+
+static void encodeStrArr(MpWriter* w, const char* key, char* const* arr,
+    size_t n)
+{
+    if (arr == 0)
+        return;
+
+    mpStr(w, key);
+    mpArray(w, n);
+
+    for (size_t i = 0; i < n; i++) {
+        if (arr[i] != 0)
+            mpStr(w, arr[i]);
+        else
+            mpNil(w);
+    }
+}
+
+static void encodeEnum(MpWriter* w, const char* key, const char* name)
+{
+    mpStr(w, key);
+    mpStr(w, name != 0 ? name : "");
+}
+
+static void encodeOrderArr(MpWriter* w, const char* key,
+    LuaOrderDescription* const* arr, size_t n)
+{
+    if (arr == 0)
+        return;
+
+    mpStr(w, key);
+    mpArray(w, n);
+
+    for (size_t i = 0; i < n; i++) {
+        const LuaOrderDescription* order = arr[i];
+
+        mpMap(w, 1 + isSet(order->expr));
+        encodeEnum(w, "type", enumStr(kOrderTypeStr, order->type));
+        encodeExprField(w, "expr", order->expr);
+    }
+}
+
+static void encodeLimit(MpWriter* w, const char* key,
+    const LuaLimitDescription* limit)
+{
+    if (limit == 0)
+        return;
+
+    mpStr(w, key);
+    mpMap(w, isSet(limit->limit) + isSet(limit->offset));
+    encodeExprField(w, "limit", limit->limit);
+    encodeExprField(w, "offset", limit->offset);
+}
+
+static void encodeTableRefField(MpWriter* w, const char* key,
+    const LuaTableRef* tableRef)
+{
+    if (tableRef == 0)
+        return;
+
+    mpStr(w, key);
+    encodeTableRef(w, tableRef);
+}
+
+static void encodeTableRef(MpWriter* w, const LuaTableRef* tableRef)
+{
+    if (!mpWriterEnter(w)) {
+        w->depth--;
+        return;
+    }
+
+    mpMap(w, 1 + isSet(tableRef->schema) + isSet(tableRef->name) +
+        isSet(tableRef->alias) + isSet(tableRef->select) +
+        isSet(tableRef->list) + isSet(tableRef->join));
+
+    encodeEnum(w, "type", enumStr(kTableRefTypeStr, tableRef->type));
+    mpStrField(w, "schema", tableRef->schema);
+    mpStrField(w, "name", tableRef->name);
+
+    const LuaAlias* alias = tableRef->alias;
+    if (alias != 0) {
+        mpStr(w, "alias");
+        mpMap(w, isSet(alias->name) + isSet(alias->columns));
+        mpStrField(w, "name", alias->name);
+        encodeStrArr(w, "columns", alias->columns, alias->columnCount);
+    }
+
+    if (tableRef->select != 0) {
+        mpStr(w, "select");
+        encodeSelect(w, tableRef->select, 0);
+    }
+
+    if (tableRef->list != 0) {
+        mpStr(w, "list");
+        mpArray(w, tableRef->listSize);
+
+        for (size_t i = 0; i < tableRef->listSize; i++)
+            encodeTableRef(w, tableRef->list[i]);
+    }
+
+    const LuaJoinDefinition* join = tableRef->join;
+    if (join != 0) {
+        mpStr(w, "join");
+        mpMap(w, 1 + isSet(join->left) + isSet(join->right) +
+            isSet(join->condition));
+        encodeTableRefField(w, "left", join->left);
+        encodeTableRefField(w, "right", join->right);
+        encodeExprField(w, "condition", join->condition);
+        encodeEnum(w, "type", enumStr(kJoinTypeStr, join->type));
+    }
+
+    w->depth--;
+}
+
+// Writes a SELECT, leaving `extraKeys` more entries in its map for the
+// fields of top-level statements.
+static void encodeSelect(MpWriter* w, const LuaSelectStatement* select,
+    size_t extraKeys)
+{
+    if (!mpWriterEnter(w)) {
+        w->depth--;
+        return;
+    }
+
+    mpMap(w, extraKeys + 1 + isSet(select->fromTable) +
+        isSet(select->selectList) + isSet(select->whereClause) +
+        isSet(select->groupBy) + isSet(select->setOperations) +
+        isSet(select->order) + isSet(select->withDescriptions) +
+        isSet(select->limit));
+
+    encodeTableRefField(w, "fromTable", select->fromTable);
+
+    mpStr(w, "selectDistinct");
+    mpBool(w, select->selectDistinct);
+
+    encodeExprArr(w, "selectList", select->selectList,
+        select->selectListSize);
+    encodeExprField(w, "whereClause", select->whereClause);
+
+    const LuaGroupByDescription* groupBy = select->groupBy;
+    if (groupBy != 0) {
+        mpStr(w, "groupBy");
+        mpMap(w, isSet(groupBy->columns) + isSet(groupBy->having));
+        encodeExprArr(w, "columns", groupBy->columns, groupBy->columnCount);
+        encodeExprField(w, "having", groupBy->having);
+    }
+
+    if (select->setOperations != 0) {
+        mpStr(w, "setOperations");
+        mpArray(w, select->setOperationCount);
+
+        for (size_t i = 0; i < select->setOperationCount; i++) {
+            const LuaSetOperation* setOp = select->setOperations[i];
+
+            mpMap(w, 2 + isSet(setOp->nestedSelectStatement) +
+                isSet(setOp->resultOrder) + isSet(setOp->resultLimit));
+            encodeEnum(w, "setType", enumStr(kSetTypeStr, setOp->setType));
+            mpStr(w, "isAll");
+            mpBool(w, setOp->isAll);
+
+            if (setOp->nestedSelectStatement != 0) {
+                mpStr(w, "nestedSelectStatement");
+                encodeSelect(w, setOp->nestedSelectStatement, 0);
+            }
+
+            encodeOrderArr(w, "resultOrder", setOp->resultOrder,
+                setOp->resultOrderCount);
+            encodeLimit(w, "resultLimit", setOp->resultLimit);
+        }
+    }
+
+    encodeOrderArr(w, "order", select->order, select->orderCount);
+
+    if (select->withDescriptions != 0) {
+        mpStr(w, "withDescriptions");
+        mpArray(w, select->withDescriptionCount);
+
+        for (size_t i = 0; i < select->withDescriptionCount; i++) {
+            const LuaWithDescription* with = select->withDescriptions[i];
+
+            mpMap(w, isSet(with->alias) + isSet(with->select));
+            mpStrField(w, "alias", with->alias);
+
+            if (with->select != 0) {
+                mpStr(w, "select");
+                encodeSelect(w, with->select, 0);
+            }
+        }
+    }
+
+    encodeLimit(w, "limit", select->limit);
+
+    w->depth--;
+}
+
+// Literals are plain values, as in statement.literals of the Lua AST.
+static void encodeLiteral(MpWriter* w, const LuaExpr* literal)
+{
+    if (literal->type == kExprLiteralFloat)
+        mpNumber(w, literal->fval);
+    else if (literal->type == kExprLiteralString && literal->name != 0)
+        mpStr(w, literal->name);
+    else if (literal->type == kExprLiteralString)
+        mpNil(w);
+    else if (literal->isBoolLiteral)
+        mpBool(w, literal->ival != 0);
+    else
+        mpInt(w, literal->ival);
+}
+
+static void encodeStatement(MpWriter* w, const LuaSQLStatement* statement)
+{
+    // type, fingerprint, literals and possibly hints.
+    size_t extraKeys = 3 + isSet(statement->hints);
+
+    switch (statement->type) {
+        case kStmtSelect:
+            encodeSelect(w, (const LuaSelectStatement*)statement, extraKeys);
+            break;
+
+        case kStmtInsert: {
+            const LuaInsertStatement* insert =
+                (const LuaInsertStatement*)statement;
+
+            mpMap(w, extraKeys + 1 + isSet(insert->schema) +
+                isSet(insert->tableName) + isSet(insert->columns) +
+                isSet(insert->values) + isSet(insert->select));
+
+            encodeEnum(w, "insertType", enumStr(kInsertTypeStr, insert->type));
+            mpStrField(w, "schema", insert->schema);
+            mpStrField(w, "tableName", insert->tableName);
+            encodeStrArr(w, "columns", insert->columns, insert->columnCount);
+            encodeExprArr(w, "values", insert->values, insert->valueCount);
+
+            if (insert->select != 0) {
+                mpStr(w, "select");
+                encodeSelect(w, insert->select, 0);
+            }
+            break;
+        }
+
+        case kStmtUpdate: {
+            const LuaUpdateStatement* update =
+                (const LuaUpdateStatement*)statement;
+
+            mpMap(w, extraKeys + isSet(update->table) +
+                isSet(update->updates) + isSet(update->where));
+
+            encodeTableRefField(w, "table", update->table);
+
+            if (update->updates != 0) {
+                mpStr(w, "updates");
+                mpArray(w, update->updateCount);
+
+                for (size_t i = 0; i < update->updateCount; i++) {
+                    const LuaUpdateClause* clause = update->updates[i];
+
+                    mpMap(w, isSet(clause->column) + isSet(clause->value));
+                    mpStrField(w, "column", clause->column);
+                    encodeExprField(w, "value", clause->value);
+                }
+            }
+
+            encodeExprField(w, "where", update->where);
+            break;
+        }
+
+        case kStmtDelete: {
+            const LuaDeleteStatement* del =
+                (const LuaDeleteStatement*)statement;
+
+            mpMap(w, extraKeys + isSet(del->schema) +
+                isSet(del->tableName) + isSet(del->expr));
+
+            mpStrField(w, "schema", del->schema);
+            mpStrField(w, "tableName", del->tableName);
+            encodeExprField(w, "expr", del->expr);
+            break;
+        }
+
+        default:
+            mpMap(w, extraKeys);
+            break;
+    }
+
+    encodeEnum(w, "type", enumStr(kStatementTypeStr, statement->type));
+
+    encodeExprArr(w, "hints", statement->hints, statement->hintCount);
+
+    char fingerprint[17];
+    snprintf(fingerprint, sizeof(fingerprint), "%016llx",
+        (unsigned long long)statement->fingerprint);
+    mpStr(w, "fingerprint");
+    mpStr(w, fingerprint, 16);
+
+    mpStr(w, "literals");
+    mpArray(w, statement->literalCount);
+
+    for (size_t i = 0; i < statement->literalCount; i++)
+        encodeLiteral(w, statement->literals[i]);
+}
+
+static void encodeResult(MpWriter* w, const LuaSQLParserResult* result)
+{
+    const LuaSQLSimplifyReport& simplified = result->simplified;
+    bool isSimplified = simplified.folded + simplified.tautologies +
+        simplified.negations + simplified.duplicates +
+        simplified.flattened + simplified.normalized != 0;
+
+    mpMap(w, 5 + isSet(result->statements) + isSet(result->errorMsg) +
+        isSimplified);
+
+    mpStr(w, "isValid");
+    mpBool(w, result->isValid);
+    encodeEnum(w, "errorCode", enumStr(kErrorCodeStr, result->errorCode));
+
+    if (result->statements != 0) {
+        mpStr(w, "statements");
+        mpArray(w, result->statementCount);
+
+        for (size_t i = 0; i < result->statementCount; i++)
+            encodeStatement(w, result->statements[i]);
+    }
+
+    // The parameters are the expressions met in the statements, ordered by
+    // their ids.
+    std::stable_sort(w->params.begin(), w->params.end(),
+        [](const LuaExpr* a, const LuaExpr* b) {
+            return a->ival < b->ival;
+        });
+
+    std::vector<const LuaExpr*> params;
+    params.swap(w->params);
+
+    mpStr(w, "parameters");
+    mpArray(w, params.size());
+
+    for (const LuaExpr* param : params)
+        encodeExpr(w, param);
+
+    mpStrField(w, "errorMsg", result->errorMsg);
+    mpStr(w, "errorLine");
+    mpInt(w, result->errorLine);
+    mpStr(w, "errorColumn");
+    mpInt(w, result->errorColumn);
+
+    if (isSimplified) {
+        mpStr(w, "simplified");
+        mpMap(w, 6);
+        mpStr(w, "folded");
+        mpUint(w, simplified.folded);
+        mpStr(w, "tautologies");
+        mpUint(w, simplified.tautologies);
+        mpStr(w, "negations");
+        mpUint(w, simplified.negations);
+        mpStr(w, "duplicates");
+        mpUint(w, simplified.duplicates);
+        mpStr(w, "flattened");
+        mpUint(w, simplified.flattened);
+        mpStr(w, "normalized");
+        mpUint(w, simplified.normalized);
+    }
+}
+
+static size_t encodeMsgpack(const LuaSQLParserResult* result, char* buffer,
+    size_t capacity, char** data)
+{
+    MpWriter w;
+    w.buf = buffer;
+    w.size = 0;
+    w.capacity = buffer != 0 ? capacity : 0;
+    w.external = buffer;
+    w.failed = false;
+    w.depth = 0;
+
+    encodeResult(&w, result);
+
+    if (w.failed) {
+        if (w.buf != w.external)
+            std::free(w.buf);
+        *data = 0;
+        return 0;
+    }
+
+    *data = w.buf;
+    return w.size;
+}
+
+size_t parseSqlToMsgpack(const char* query, size_t length, char* buffer,
+    size_t capacity, char** data)
+{
+    LuaSQLParserResult* result = parseSqlN(query, length);
+
+    size_t size = encodeMsgpack(result, buffer, capacity, data);
+
+    finalize(result);
+
+    return size;
+}
+
+void freeMsgpack(char* data)
+{
+    std::free(data);
+}
+
+
+enum MpKind {
+    kMpNil,
+    kMpBool,
+    kMpInt,
+    kMpDouble,
+    kMpStr,
+    kMpArray,
+    kMpMap,
+    kMpOther
+};
+
+// A scalar value read without knowing the key it belongs to yet.
+struct MpValue {
+    MpKind kind;
+    bool b;
+    int64_t i;
+    double d;
+    const char* str;
+    size_t len;
+};
+
+// The map of an expression being read by decodeExpr(): the entries and the
+// exprList items left, and the fields that take effect once the type,
+// which may come last, is known.
+struct MpExprFrame {
+    LuaExpr* expr;
+    uint64_t remaining;
+    uint64_t listRemaining;
+
+    int type;
+    MpValue name;
+    MpValue value;
+    int64_t arity;
+};
+
+// Reads MessagePack back into the data types of parser results, allocated
+// in one arena. Keys the generator does not need are skipped.
+struct MpReader {
+    const char* pos;
+    const char* end;
+    Arena* arena;
+    size_t depth;
+
+    // Expressions being read, shared by the nested calls for subqueries.
+    std::vector<MpExprFrame> exprFrames;
+
+    const char* error;
+};
+
+static bool mpFail(MpReader* r, const char* error)
+{
+    if (r->error == 0)
+        r->error = error;
+
+    r->pos = r->end;
+    return false;
+}
+
+static bool mpTake(MpReader* r, size_t n, uint64_t* value)
+{
+    if ((size_t)(r->end - r->pos) < n)
+        return mpFail(r, "unexpected end of data");
+
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++)
+        v = (v << 8) | (uint8_t)r->pos[i];
+
+    r->pos += n;
+    *value = v;
+    return true;
+}
+
+// Reads the header of the next value. Strings and other blobs are left for
+// the caller to consume `*n` bytes of, arrays and maps have `*n` items.
+static bool mpHeader(MpReader* r, MpValue* v, uint64_t* n)
+{
+    uint64_t x;
+    if (!mpTake(r, 1, &x))
+        return false;
+
+    uint8_t type = (uint8_t)x;
+    *n = 0;
+
+    if (type <= 0x7f || type >= 0xe0) {
+        v->kind = kMpInt;
+        v->i = (int8_t)type;
+        if (type <= 0x7f)
+            v->i = type;
+        return true;
+    }
+
+    if ((type & 0xe0) == 0xa0) {
+        v->kind = kMpStr;
+        *n = type & 0x1f;
+        return true;
+    }
+
+    if ((type & 0xf0) == 0x90) {
+        v->kind = kMpArray;
+        *n = type & 0x0f;
+        return true;
+    }
+
+    if ((type & 0xf0) == 0x80) {
+        v->kind = kMpMap;
+        *n = type & 0x0f;
+        return true;
+    }
+
+    switch (type) {
+        case 0xc0:
+            v->kind = kMpNil;
+            return true;
+        case 0xc2:
+        case 0xc3:
+            v->kind = kMpBool;
+            v->b = type == 0xc3;
+            return true;
+        case 0xcc:
+        case 0xcd:
+        case 0xce:
+        case 0xcf:
+            if (!mpTake(r, (size_t)1 << (type - 0xcc), &x))
+                return false;
+            if (x > INT64_MAX)
+                return mpFail(r, "integer out of range");
+            v->kind = kMpInt;
+            v->i = (int64_t)x;
+            return true;
+        case 0xd0:
+            if (!mpTake(r, 1, &x))
+                return false;
+            v->kind = kMpInt;
+            v->i = (int8_t)x;
+            return true;
+        case 0xd1:
+            if (!mpTake(r, 2, &x))
+                return false;
+            v->kind = kMpInt;
+            v->i = (int16_t)x;
+            return true;
+        case 0xd2:
+            if (!mpTake(r, 4, &x))
+                return false;
+            v->kind = kMpInt;
+            v->i = (int32_t)x;
+            return true;
+        case 0xd3:
+            if (!mpTake(r, 8, &x))
+                return false;
+            v->kind = kMpInt;
+            v->i = (int64_t)x;
+            return true;
+        case 0xca: {
+            if (!mpTake(r, 4, &x))
+                return false;
+            uint32_t bits = (uint32_t)x;
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            v->kind = kMpDouble;
+            v->d = f;
+            return true;
+        }
+        case 0xcb:
+            if (!mpTake(r, 8, &x))
+                return false;
+            v->kind = kMpDouble;
+            std::memcpy(&v->d, &x, sizeof(v->d));
+            return true;
+        case 0xd9:
+        case 0xda:
+        case 0xdb:
+            v->kind = kMpStr;
+            return mpTake(r, (size_t)1 << (type - 0xd9), n);
+        case 0xc4:
+        case 0xc5:
+        case 0xc6:
+            v->kind = kMpOther;
+            return mpTake(r, (size_t)1 << (type - 0xc4), n);
+        case 0xdc:
+        case 0xdd:
+            v->kind = kMpArray;
+            return mpTake(r, (size_t)2 << (type - 0xdc), n);
+        case 0xde:
+        case 0xdf:
+            v->kind = kMpMap;
+            return mpTake(r, (size_t)2 << (type - 0xde), n);
+        case 0xd4:
+        case 0xd5:
+        case 0xd6:
+        case 0xd7:
+        case 0xd8:
+            // fixext: a type byte and 1 to 16 bytes of data.
+            v->kind = kMpOther;
+            *n = 1 + ((size_t)1 << (type - 0xd4));
+            return true;
+        case 0xc7:
+        case 0xc8:
+        case 0xc9:
+            if (!mpTake(r, (size_t)1 << (type - 0xc7), n))
+                return false;
+            v->kind = kMpOther;
+            *n += 1;
+            return true;
+        default:
+            return mpFail(r, "unknown type");
+    }
+}
+
+static bool mpSkipBytes(MpReader* r, uint64_t n)
+{
+    if ((uint64_t)(r->end - r->pos) < n)
+        return mpFail(r, "unexpected end of data");
+
+    r->pos += n;
+    return true;
+}
+
+// Skips a whole value, iteratively.
+static bool mpSkip(MpReader* r)
+{
+    uint64_t pending = 1;
+
+    while (pending > 0) {
+        MpValue v;
+        uint64_t n;
+        if (!mpHeader(r, &v, &n))
+            return false;
+        pending--;
+
+        if (v.kind == kMpArray || v.kind == kMpMap) {
+            pending += v.kind == kMpMap ? 2 * n : n;
+
+            // Every item takes a byte at least.
+            if (pending > (uint64_t)(r->end - r->pos))
+                return mpFail(r, "unexpected end of data");
+        }
+        else if (v.kind == kMpStr || v.kind == kMpOther) {
+            if (!mpSkipBytes(r, n))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Reads a scalar value. Strings point into the data.
+static bool mpScalar(MpReader* r, MpValue* v)
+{
+    uint64_t n;
+    if (!mpHeader(r, v, &n))
+        return false;
+
+    if (v->kind == kMpStr) {
+        v->str = r->pos;
+        v->len = (size_t)n;
+        return mpSkipBytes(r, n);
+    }
+
+    if (v->kind == kMpArray || v->kind == kMpMap || v->kind == kMpOther)
+        return mpFail(r, "unexpected value type");
+
+    return true;
+}
+
+static bool mpMapHeader(MpReader* r, uint64_t* n)
+{
+    MpValue v;
+    if (!mpHeader(r, &v, n))
+        return false;
+
+    if (v.kind != kMpMap)
+        return mpFail(r, "a map is expected");
+
+    return true;
+}
+
+// Reads an array header, nil reads as an absent array.
+static bool mpArrayHeader(MpReader* r, uint64_t* n, bool* isNil)
+{
+    MpValue v;
+    if (!mpHeader(r, &v, n))
+        return false;
+
+    *isNil = v.kind == kMpNil;
+    if (!*isNil && v.kind != kMpArray)
+        return mpFail(r, "an array is expected");
+
+    if (*n > (uint64_t)(r->end - r->pos))
+        return mpFail(r, "unexpected end of data");
+
+    return true;
+}
+
+// Whether the next value is nil, which is then consumed.
+static bool mpNextNil(MpReader* r)
+{
+    if (r->pos < r->end && (uint8_t)*r->pos == 0xc0) {
+        r->pos++;
+        return true;
+    }
+
+    return false;
+}
+
+static bool mpKey(MpReader* r, const char** key, size_t* len)
+{
+    MpValue v;
+    if (!mpScalar(r, &v))
+        return false;
+
+    if (v.kind != kMpStr)
+        return mpFail(r, "a string key is expected");
+
+    *key = v.str;
+    *len = v.len;
+    return true;
+}
+
+inline bool keyIs(const char* key, size_t len, const char* name)
+{
+    return strlen(name) == len && std::memcmp(key, name, len) == 0;
+}
+
+static char* mpCopyStr(MpReader* r, const MpValue& v)
+{
+    if (v.kind != kMpStr)
+        return 0;
+
+    char* str = (char*)arenaAlloc(r->arena, v.len + 1, 1);
+    std::memcpy(str, v.str, v.len);
+    str[v.len] = 0;
+
+    return str;
+}
+
+static char* mpReadStr(MpReader* r)
+{
+    MpValue v;
+    if (!mpScalar(r, &v))
+        return 0;
+
+    if (v.kind != kMpStr && v.kind != kMpNil) {
+        mpFail(r, "a string is expected");
+        return 0;
+    }
+
+    return mpCopyStr(r, v);
+}
+
+static bool mpReadBool(MpReader* r)
+{
+    MpValue v;
+    if (!mpScalar(r, &v))
+        return false;
+
+    if (v.kind != kMpBool) {
+        mpFail(r, "a boolean is expected");
+        return false;
+    }
+
+    return v.b;
+}
+
+static int64_t mpReadInt(MpReader* r)
+{
+    MpValue v;
+    if (!mpScalar(r, &v))
+        return 0;
+
+    if (v.kind == kMpDouble)
+        return (int64_t)v.d;
+
+    if (v.kind != kMpInt) {
+        mpFail(r, "an integer is expected");
+        return 0;
+    }
+
+    return v.i;
+}
+
+// Returns the value of an enum by its name, or -1.
+template<size_t N>
+static int mpReadEnum(MpReader* r, const char* const (&names)[N])
+{
+    MpValue v;
+    if (!mpScalar(r, &v))
+        return -1;
+
+    if (v.kind == kMpStr) {
+        for (size_t i = 0; i < N; i++) {
+            if (keyIs(v.str, v.len, names[i]))
+                return (int)i;
+        }
+    }
+
+    mpFail(r, "unknown enum value");
+    return -1;
+}
+
+template<class T>
+static T* mpNew(MpReader* r)
+{
+    T* node = arenaNew<T>(r->arena);
+    std::memset(node, 0, sizeof(T));
+    return node;
+}
+
+static bool mpEnter(MpReader* r)
+{
+    if (++r->depth > kMsgpackMaxDepth)
+        return mpFail(r, "nested too deeply");
+
+    return true;
+}
+
+static LuaExpr* decodeExpr(MpReader* r);
+static LuaSelectStatement* decodeSelect(MpReader* r,
+    LuaSelectStatement* select);
+static LuaTableRef* decodeTableRef(MpReader* r);
+
+// Reads an array of `T` decoded by `decode` into *arr and *count.
+template<class T>
+static void decodeArr(MpReader* r, T*** arr, size_t* count,
+    T* (*decode)(MpReader*))
+{
+    uint64_t n;
+    bool isNil;
+    if (!mpArrayHeader(r, &n, &isNil) || isNil)
+        return;
+
+    *arr = arenaNewArr<T>(r->arena, (size_t)n);
+    *count = (size_t)n;
+
+    for (size_t i = 0; i < n; i++)
+        (*arr)[i] = decode(r);
+}
+
+static char* decodeStrItem(MpReader* r)
+{
+    return mpReadStr(r);
+}
+
+// Operators are named by their symbol, the arity tells the unary minus from
+// the binary one.
+static OperatorType operatorType(const MpValue& name, int64_t arity)
+{
+    for (int i = 0; i <= kOpExists; i++) {
+        if (keyIs(name.str, name.len, kOperatorTypeStr[i]) &&
+            (arity < -1 || kOperatorArity[i] == arity))
+            return (OperatorType)i;
+    }
+
+    return kOpNone;
+}
+
+// Starts reading the expression at the current position into *dst. A map
+// gets a frame of its own, to be read by decodeExpr().
+static void beginExpr(MpReader* r, LuaExpr** dst)
+{
+    *dst = 0;
+
+    if (mpNextNil(r))
+        return;
+
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return;
+
+    MpExprFrame frame = MpExprFrame();
+    frame.expr = mpNew<LuaExpr>(r);
+    frame.remaining = n;
+    frame.type = -1;
+    frame.arity = -2;
+
+    *dst = frame.expr;
+    r->exprFrames.push_back(frame);
+}
+
+// Applies the fields of an expression that depend on its type.
+static void endExpr(MpReader* r, const MpExprFrame& frame)
+{
+    LuaExpr* expr = frame.expr;
+    int type = frame.type;
+
+    if (type < 0) {
+        mpFail(r, "an expression has no type");
+        return;
+    }
+
+    expr->type = (ExprType)type;
+
+    const MpValue& name = frame.name;
+    if (type == kExprOperator && name.kind == kMpStr)
+        expr->opType = operatorType(name, frame.arity);
+    else
+        expr->name = mpCopyStr(r, name);
+
+    const MpValue& value = frame.value;
+    if (type == kExprLiteralFloat)
+        expr->fval = value.kind == kMpDouble ? value.d : (double)value.i;
+    else if (type == kExprLiteralInt && value.kind == kMpBool)
+        expr->ival = value.b;
+    else if (type == kExprLiteralInt)
+        expr->ival = value.kind == kMpDouble ? (int64_t)value.d : value.i;
+}
+
+// Expressions are read with an explicit stack, the way encodeExpr() writes
+// them, so that long operator chains can not exhaust the native stack.
+static LuaExpr* decodeExpr(MpReader* r)
+{
+    size_t base = r->exprFrames.size();
+
+    LuaExpr* root;
+    beginExpr(r, &root);
+
+    while (r->exprFrames.size() > base && r->error == 0) {
+        // Reading a child pushes a frame, `frame` is not used after that.
+        MpExprFrame& frame = r->exprFrames.back();
+        LuaExpr* expr = frame.expr;
+
+        if (frame.listRemaining > 0) {
+            size_t i = expr->exprListSize - frame.listRemaining--;
+            beginExpr(r, &expr->exprList[i]);
+            continue;
+        }
+
+        if (frame.remaining == 0) {
+            endExpr(r, frame);
+            r->exprFrames.pop_back();
+            continue;
+        }
+
+        frame.remaining--;
+
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "type"))
+            frame.type = mpReadEnum(r, kExprTypeStr);
+        else if (keyIs(key, len, "name"))
+            mpScalar(r, &frame.name);
+        else if (keyIs(key, len, "value"))
+            mpScalar(r, &frame.value);
+        else if (keyIs(key, len, "arity"))
+            frame.arity = mpReadInt(r);
+        else if (keyIs(key, len, "table"))
+            expr->table = mpReadStr(r);
+        else if (keyIs(key, len, "alias"))
+            expr->alias = mpReadStr(r);
+        else if (keyIs(key, len, "select"))
+            expr->select = decodeSelect(r, 0);
+        else if (keyIs(key, len, "isBoolLiteral"))
+            expr->isBoolLiteral = mpReadBool(r);
+        else if (keyIs(key, len, "paramId") || keyIs(key, len, "index"))
+            expr->ival = mpReadInt(r);
+        else if (keyIs(key, len, "distinct"))
+            expr->distinct = mpReadBool(r);
+        else if (keyIs(key, len, "datetimeField"))
+            expr->datetimeField =
+                (DatetimeField)mpReadEnum(r, kDatetimeFieldStr);
+        else if (keyIs(key, len, "columnType"))
+            expr->columnType = (ColumnType)mpReadEnum(r, kColumnTypeStr);
+        else if (keyIs(key, len, "columnLength"))
+            expr->columnLength = mpReadInt(r);
+        else if (keyIs(key, len, "exprList")) {
+            uint64_t n;
+            bool isNil;
+            if (mpArrayHeader(r, &n, &isNil) && !isNil) {
+                expr->exprList = arenaNewArr<LuaExpr>(r->arena, (size_t)n);
+                expr->exprListSize = (size_t)n;
+                frame.listRemaining = n;
+            }
+        }
+        else if (keyIs(key, len, "expr"))
+            beginExpr(r, &expr->expr);
+        else if (keyIs(key, len, "expr2"))
+            beginExpr(r, &expr->expr2);
+        else
+            mpSkip(r);
+    }
+
+    r->exprFrames.resize(base);
+
+    return r->error == 0 ? root : 0;
+}
+
+static LuaOrderDescription* decodeOrder(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaOrderDescription* order = mpNew<LuaOrderDescription>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "type"))
+            order->type = (OrderType)mpReadEnum(r, kOrderTypeStr);
+        else if (keyIs(key, len, "expr"))
+            order->expr = decodeExpr(r);
+        else
+            mpSkip(r);
+    }
+
+    return order;
+}
+
+static LuaLimitDescription* decodeLimit(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaLimitDescription* limit = mpNew<LuaLimitDescription>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "limit"))
+            limit->limit = decodeExpr(r);
+        else if (keyIs(key, len, "offset"))
+            limit->offset = decodeExpr(r);
+        else
+            mpSkip(r);
+    }
+
+    return limit;
+}
+
+static LuaAlias* decodeAlias(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaAlias* alias = mpNew<LuaAlias>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "name"))
+            alias->name = mpReadStr(r);
+        else if (keyIs(key, len, "columns"))
+            decodeArr(r, &alias->columns, &alias->columnCount, decodeStrItem);
+        else
+            mpSkip(r);
+    }
+
+    return alias;
+}
+
+static LuaJoinDefinition* decodeJoin(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaJoinDefinition* join = mpNew<LuaJoinDefinition>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "left"))
+            join->left = decodeTableRef(r);
+        else if (keyIs(key, len, "right"))
+            join->right = decodeTableRef(r);
+        else if (keyIs(key, len, "condition"))
+            join->condition = decodeExpr(r);
+        else if (keyIs(key, len, "type"))
+            join->type = (JoinType)mpReadEnum(r, kJoinTypeStr);
+        else
+            mpSkip(r);
+    }
+
+    return join;
+}
+
+static LuaTableRef* decodeTableRef(MpReader* r)
+{
+    uint64_t n;
+    if (!mpEnter(r) || !mpMapHeader(r, &n))
+        return 0;
+
+    LuaTableRef* tableRef = mpNew<LuaTableRef>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "type"))
+            tableRef->type = (TableRefType)mpReadEnum(r, kTableRefTypeStr);
+        else if (keyIs(key, len, "schema"))
+            tableRef->schema = mpReadStr(r);
+        else if (keyIs(key, len, "name"))
+            tableRef->name = mpReadStr(r);
+        else if (keyIs(key, len, "alias"))
+            tableRef->alias = decodeAlias(r);
+        else if (keyIs(key, len, "select"))
+            tableRef->select = decodeSelect(r, 0);
+        else if (keyIs(key, len, "list"))
+            decodeArr(r, &tableRef->list, &tableRef->listSize,
+                decodeTableRef);
+        else if (keyIs(key, len, "join"))
+            tableRef->join = decodeJoin(r);
+        else
+            mpSkip(r);
+    }
+
+    r->depth--;
+
+    return tableRef;
+}
+
+static LuaGroupByDescription* decodeGroupBy(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaGroupByDescription* groupBy = mpNew<LuaGroupByDescription>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "columns"))
+            decodeArr(r, &groupBy->columns, &groupBy->columnCount,
+                decodeExpr);
+        else if (keyIs(key, len, "having"))
+            groupBy->having = decodeExpr(r);
+        else
+            mpSkip(r);
+    }
+
+    return groupBy;
+}
+
+static LuaSelectStatement* decodeNestedSelect(MpReader* r)
+{
+    return decodeSelect(r, 0);
+}
+
+static LuaSetOperation* decodeSetOperation(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaSetOperation* setOp = mpNew<LuaSetOperation>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "setType"))
+            setOp->setType = (SetType)mpReadEnum(r, kSetTypeStr);
+        else if (keyIs(key, len, "isAll"))
+            setOp->isAll = mpReadBool(r);
+        else if (keyIs(key, len, "nestedSelectStatement"))
+            setOp->nestedSelectStatement = decodeNestedSelect(r);
+        else if (keyIs(key, len, "resultOrder"))
+            decodeArr(r, &setOp->resultOrder, &setOp->resultOrderCount,
+                decodeOrder);
+        else if (keyIs(key, len, "resultLimit"))
+            setOp->resultLimit = decodeLimit(r);
+        else
+            mpSkip(r);
+    }
+
+    return setOp;
+}
+
+static LuaWithDescription* decodeWith(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaWithDescription* with = mpNew<LuaWithDescription>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "alias"))
+            with->alias = mpReadStr(r);
+        else if (keyIs(key, len, "select"))
+            with->select = decodeNestedSelect(r);
+        else
+            mpSkip(r);
+    }
+
+    return with;
+}
+
+// Reads the fields of a SELECT map that begins at the current position,
+// into `select` if given. Keys of other statements are skipped.
+static LuaSelectStatement* decodeSelect(MpReader* r,
+    LuaSelectStatement* select)
+{
+    if (mpNextNil(r))
+        return 0;
+
+    uint64_t n;
+    if (!mpEnter(r) || !mpMapHeader(r, &n))
+        return 0;
+
+    if (select == 0)
+        select = mpNew<LuaSelectStatement>(r);
+    select->base.type = kStmtSelect;
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "fromTable"))
+            select->fromTable = decodeTableRef(r);
+        else if (keyIs(key, len, "selectDistinct"))
+            select->selectDistinct = mpReadBool(r);
+        else if (keyIs(key, len, "selectList"))
+            decodeArr(r, &select->selectList, &select->selectListSize,
+                decodeExpr);
+        else if (keyIs(key, len, "whereClause"))
+            select->whereClause = decodeExpr(r);
+        else if (keyIs(key, len, "groupBy"))
+            select->groupBy = decodeGroupBy(r);
+        else if (keyIs(key, len, "setOperations"))
+            decodeArr(r, &select->setOperations, &select->setOperationCount,
+                decodeSetOperation);
+        else if (keyIs(key, len, "order"))
+            decodeArr(r, &select->order, &select->orderCount, decodeOrder);
+        else if (keyIs(key, len, "withDescriptions"))
+            decodeArr(r, &select->withDescriptions,
+                &select->withDescriptionCount, decodeWith);
+        else if (keyIs(key, len, "limit"))
+            select->limit = decodeLimit(r);
+        else
+            mpSkip(r);
+    }
+
+    r->depth--;
+
+    return select;
+}
+
+static LuaUpdateClause* decodeUpdateClause(MpReader* r)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    LuaUpdateClause* clause = mpNew<LuaUpdateClause>(r);
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "column"))
+            clause->column = mpReadStr(r);
+        else if (keyIs(key, len, "value"))
+            clause->value = decodeExpr(r);
+        else
+            mpSkip(r);
+    }
+
+    return clause;
+}
+
+// Returns the type of the statement map at the current position, which is
+// not consumed, or -1.
+static int peekStatementType(MpReader* r)
+{
+    MpReader scan = *r;
+    int type = -1;
+
+    uint64_t n;
+    if (!mpMapHeader(&scan, &n))
+        return mpFail(r, scan.error), -1;
+
+    for (uint64_t i = 0; i < n && scan.error == 0 && type < 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(&scan, &key, &len))
+            break;
+
+        if (keyIs(key, len, "type"))
+            type = mpReadEnum(&scan, kStatementTypeStr);
+        else
+            mpSkip(&scan);
+    }
+
+    if (scan.error != 0)
+        mpFail(r, scan.error);
+    else if (type < 0)
+        mpFail(r, "a statement has no type");
+
+    return type;
+}
+
+static LuaSQLStatement* decodeStatement(MpReader* r)
+{
+    int type = peekStatementType(r);
+    if (type < 0)
+        return 0;
+
+    if (type == kStmtSelect)
+        return &decodeSelect(r, mpNew<LuaSelectStatement>(r))->base;
+
+    LuaSQLStatement* statement = 0;
+    LuaInsertStatement* insert = 0;
+    LuaUpdateStatement* update = 0;
+    LuaDeleteStatement* del = 0;
+
+    if (type == kStmtInsert)
+        statement = &(insert = mpNew<LuaInsertStatement>(r))->base;
+    else if (type == kStmtUpdate)
+        statement = &(update = mpNew<LuaUpdateStatement>(r))->base;
+    else if (type == kStmtDelete)
+        statement = &(del = mpNew<LuaDeleteStatement>(r))->base;
+    else
+        statement = mpNew<LuaSQLStatement>(r);
+
+    statement->type = (StatementType)type;
+
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return 0;
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (insert != 0 && keyIs(key, len, "insertType"))
+            insert->type = (InsertType)mpReadEnum(r, kInsertTypeStr);
+        else if (insert != 0 && keyIs(key, len, "schema"))
+            insert->schema = mpReadStr(r);
+        else if (insert != 0 && keyIs(key, len, "tableName"))
+            insert->tableName = mpReadStr(r);
+        else if (insert != 0 && keyIs(key, len, "columns"))
+            decodeArr(r, &insert->columns, &insert->columnCount,
+                decodeStrItem);
+        else if (insert != 0 && keyIs(key, len, "values"))
+            decodeArr(r, &insert->values, &insert->valueCount, decodeExpr);
+        else if (insert != 0 && keyIs(key, len, "select"))
+            insert->select = decodeNestedSelect(r);
+        else if (update != 0 && keyIs(key, len, "table"))
+            update->table = decodeTableRef(r);
+        else if (update != 0 && keyIs(key, len, "updates"))
+            decodeArr(r, &update->updates, &update->updateCount,
+                decodeUpdateClause);
+        else if (update != 0 && keyIs(key, len, "where"))
+            update->where = decodeExpr(r);
+        else if (del != 0 && keyIs(key, len, "schema"))
+            del->schema = mpReadStr(r);
+        else if (del != 0 && keyIs(key, len, "tableName"))
+            del->tableName = mpReadStr(r);
+        else if (del != 0 && keyIs(key, len, "expr"))
+            del->expr = decodeExpr(r);
+        else
+            mpSkip(r);
+    }
+
+    return statement;
+}
+
+// Reads the result map into `result`, whose nodes go to the reader's arena.
+static void decodeResult(MpReader* r, LuaSQLParserResult* result)
+{
+    uint64_t n;
+    if (!mpMapHeader(r, &n))
+        return;
+
+    for (uint64_t i = 0; i < n && r->error == 0; i++) {
+        const char* key;
+        size_t len;
+        if (!mpKey(r, &key, &len))
+            break;
+
+        if (keyIs(key, len, "isValid"))
+            result->isValid = mpReadBool(r);
+        else if (keyIs(key, len, "statements"))
+            decodeArr(r, &result->statements, &result->statementCount,
+                decodeStatement);
+        else
+            mpSkip(r);
+    }
+
+    if (r->error == 0 && r->pos != r->end)
+        mpFail(r, "trailing data");
+}
+
+LuaSQLGenResult* generateSqlFromMsgpack(const char* data, size_t size)
+{
+    Arena arena;
+    arenaInit(&arena);
+
+    MpReader r;
+    r.pos = data;
+    r.end = data + size;
+    r.arena = &arena;
+    r.depth = 0;
+    r.error = 0;
+
+    LuaSQLParserResult result;
+    std::memset(&result, 0, sizeof(result));
+
+    decodeResult(&r, &result);
+
+    LuaSQLGenResult* gen;
+
+    if (r.error != 0) {
+        gen = (LuaSQLGenResult*)std::calloc(1, sizeof(LuaSQLGenResult));
+        if (gen != 0) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "malformed MessagePack: %s",
+                r.error);
+            gen->errorMsg = strdup(msg);
+        }
+    }
+    else {
+        gen = generateSql(&result);
+    }
+
+    arenaRelease(&arena);
+
+    return gen;
+}
@@ -0,0 +1,46 @@
+#ifndef LUA_SQL_PARSE_H
+#define LUA_SQL_PARSE_H
+
+#include <cstddef>
+#include "hyrise/src/SQLParser.h"
+#include "LuaSQLParser.h"
+
+// The parsing steps shared by the entry points, implemented in
+// LuaSQLParser.cpp.
+
+// Same as hsql::SQLParser::parse(), but hands the caller's buffer, which
+// does not have to be NUL-terminated, to the scanner without an intermediate
+// std::string. The scanner still takes its own copy.
+void parseBytes(const char* data, size_t length,
+    hsql::SQLParserResult* result);
+
+// Same as parseBytes(), but reuses a scanner made by hsql_lex_init().
+void parseBytesWith(void* scanner, const char* data, size_t length,
+    hsql::SQLParserResult* result);
+
+// Parses and copies a query the way parseSqlN() does, bypassing the cache.
+// A null scanner makes a fresh one for the query.
+LuaSQLParserResult* parseUncached(const char* data, size_t length,
+    void* scanner);
+
+// An invalid result carrying only an error.
+LuaSQLParserResult* newErrorResult(ErrorCode errorCode, const char* errorMsg);
+
+// Frees the tree of a hyrise result parsed from `length` bytes. Trees of
+// long queries are freed without recursing through their expressions.
+void freeHyriseResult(hsql::SQLParserResult* result, size_t length);
+
+// Limits of sqlparser_limits_configure(), SIZE_MAX when disabled.
+struct Limits {
+    size_t maxQueryBytes;
+    size_t maxNodes;
+    size_t maxDepth;
+    size_t maxStringBytes;
+};
+
+Limits getLimits();
+
+// Whether the query is over the limit of sqlparser_limits_configure().
+bool queryTooLong(size_t length);
+
+#endif
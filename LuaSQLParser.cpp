@@ -1,130 +1,393 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
 #include "hyrise/src/SQLParser.h"
+#include "hyrise/src/parser/bison_parser.h"
+#include "hyrise/src/parser/flex_lexer.h"
+#include "LuaSQLArena.h"
+#include "LuaSQLCache.h"
+#include "LuaSQLHash.h"
+#include "LuaSQLIntern.h"
+#include "LuaSQLParse.h"
 #include "LuaSQLParser.h"
-
-
-LuaExpr* copyExpr(const hsql::Expr* expr);
-void freeExpr(LuaExpr* luaExpr);
-
-LuaExpr** copyExprArr(const std::vector<hsql::Expr*>* v);
-void freeExprArr(LuaExpr** arr, size_t count);
-
-LuaJoinDefinition* copyJoinDefinition(const hsql::JoinDefinition* joinDef);
-void freeJoinDefinition(LuaJoinDefinition* luaJoinDef);
-
-LuaAlias* copyAlias(const hsql::Alias* alias);
-void freeAlias(LuaAlias* luaAlias);
-
-LuaTableRef* copyTableRef(const hsql::TableRef* tableRef);
-void freeTableRef(LuaTableRef* luaTableRef);
+#include "LuaSQLSimplify.h"
+#include "LuaSQLStats.h"
+#include "LuaSQLWorkers.h"
+
+
+static std::atomic<size_t> limitQueryBytes(SIZE_MAX);
+static std::atomic<size_t> limitNodes(SIZE_MAX);
+static std::atomic<size_t> limitDepth(SIZE_MAX);
+static std::atomic<size_t> limitStringBytes(SIZE_MAX);
+
+// A pending step of copyExpr(), which walks expressions with an explicit
+// stack so that long operator chains can not exhaust the native stack.
+enum ExprTaskType {
+    // Copy `expr` into `*dst`.
+    kExprTaskCopy,
+    // Copy the exprList of `expr` into `luaExpr`.
+    kExprTaskList,
+    // Unmute the fingerprint at the end of a collapsed IN-list.
+    kExprTaskUnmute,
+    // Copy the subquery of `expr` into `luaExpr`.
+    kExprTaskSelect
+};
+
+struct ExprTask {
+    ExprTaskType type;
+    const hsql::Expr* expr;
+    LuaExpr** dst;
+    LuaExpr* luaExpr;
+
+    // Nesting of the expression owning the step.
+    size_t depth;
+};
+
+// State threaded through a single copy pass.
+struct CopyContext {
+    Arena* arena;
+
+    // Fingerprint of the top-level statement being copied and the literals
+    // found in it so far. Mixing is muted inside collapsed IN-lists.
+    uint64_t fingerprint;
+    int fingerprintMuted;
+
+    LuaExpr** literals;
+    size_t literalCount;
+    size_t literalCapacity;
+
+    // Expressions, table references and statements copied so far, and the
+    // current and deepest nesting of them.
+    size_t nodeCount;
+    size_t depth;
+    size_t maxDepth;
+
+    // Limits taken when the copy started, the string bytes copied so far and
+    // the message of the first limit exceeded. Once it is set the copy
+    // unwinds without copying anything else.
+    Limits limits;
+    size_t stringBytes;
+    const char* limitError;
+
+    // Steps of copyExpr(), shared by the nested calls for subqueries.
+    std::vector<ExprTask> exprTasks;
+
+    // Identifiers copied so far.
+    InternSet idents;
+};
+
+// Tags mixed into a fingerprint ahead of every node, so that trees of
+// different shapes do not collide.
+enum FingerprintTag {
+    kFingerprintStatement = 1,
+    kFingerprintSelect,
+    kFingerprintExpr,
+    kFingerprintPlaceholder,
+    kFingerprintInList,
+    kFingerprintJoin,
+    kFingerprintAlias,
+    kFingerprintTableRef,
+    kFingerprintGroupBy,
+    kFingerprintSetOperation,
+    kFingerprintOrder,
+    kFingerprintWith,
+    kFingerprintLimit,
+    kFingerprintInsert,
+    kFingerprintUpdateClause,
+    kFingerprintUpdate,
+    kFingerprintDelete
+};
+
+static const uint64_t kFingerprintSeed = 0x9e3779b97f4a7c15ULL;
+
+// A parser result together with the arena that owns it. The holder is the
+// first allocation of the arena, so the Lua side sees an ordinary
+// LuaSQLParserResult and the whole tree goes away in one release call.
+// A result shared through the parse cache is released by its last owner.
+struct LuaSQLParserResultHolder {
+    Arena arena;
+    std::atomic<uint32_t> refCount;
+
+    LuaSQLParserResult result;
+};
+
+
+LuaExpr* copyExpr(const hsql::Expr* expr, CopyContext* ctx);
+
+LuaExpr** copyExprArr(const std::vector<hsql::Expr*>* v, CopyContext* ctx);
+
+LuaJoinDefinition* copyJoinDefinition(const hsql::JoinDefinition* joinDef,
+    CopyContext* ctx);
+
+LuaAlias* copyAlias(const hsql::Alias* alias, CopyContext* ctx);
+
+LuaTableRef* copyTableRef(const hsql::TableRef* tableRef, CopyContext* ctx);
 
 LuaGroupByDescription* copyGroupByDescription(
-    const hsql::GroupByDescription* groupBy);
-void freeGroupByDescription(LuaGroupByDescription* luaGroupBy);
+    const hsql::GroupByDescription* groupBy, CopyContext* ctx);
 
-LuaSetOperation* copySetOperation(const hsql::SetOperation* setOp);
-void freeSetOperation(LuaSetOperation* luaSetOp);
+LuaSetOperation* copySetOperation(const hsql::SetOperation* setOp,
+    CopyContext* ctx);
 
 LuaOrderDescription* copyOrderDescription(
-    const hsql::OrderDescription* orderDesc);
-void freeOrderDescription(LuaOrderDescription* luaOrderDesc);
+    const hsql::OrderDescription* orderDesc, CopyContext* ctx);
 
 LuaWithDescription* copyWithDescription(
-    const hsql::WithDescription* withDesc);
-void freeWithDescription(LuaWithDescription* luaWithDesc);
+    const hsql::WithDescription* withDesc, CopyContext* ctx);
 
 LuaLimitDescription* copyLimitDescription(
-    const hsql::LimitDescription* limitDesc);
-void freeLimitDescription(LuaLimitDescription* luaLimitDesc);
+    const hsql::LimitDescription* limitDesc, CopyContext* ctx);
 
 LuaSelectStatement* copySelectStatement(
-    const hsql::SelectStatement* statement);
-void freeSelectStatement(LuaSelectStatement* luaStatement);
+    const hsql::SelectStatement* statement, CopyContext* ctx);
+
+LuaInsertStatement* copyInsertStatement(
+    const hsql::InsertStatement* statement, CopyContext* ctx);
+
+LuaUpdateStatement* copyUpdateStatement(
+    const hsql::UpdateStatement* statement, CopyContext* ctx);
 
-LuaSQLStatement* copySQLStatement(const hsql::SQLStatement* statement);
-void freeSQLStatement(LuaSQLStatement* luaStatement);
+LuaDeleteStatement* copyDeleteStatement(
+    const hsql::DeleteStatement* statement, CopyContext* ctx);
+
+LuaSQLStatement* copySQLStatement(const hsql::SQLStatement* statement,
+    CopyContext* ctx);
 
 LuaSQLParserResult* copySQLParserResult(hsql::SQLParserResult* result);
-void freeSQLParserResult(LuaSQLParserResult* result);
 
 
+inline void fingerprintMix(CopyContext* ctx, uint64_t value)
+{
+    if (ctx->fingerprintMuted == 0)
+        ctx->fingerprint = hashMix(ctx->fingerprint, value);
+}
+
+inline void fingerprintStr(CopyContext* ctx, const char* str)
+{
+    if (ctx->fingerprintMuted == 0 && str != 0)
+        ctx->fingerprint = hashBytes(str, strlen(str), ctx->fingerprint);
+}
+
+inline bool enterNode(CopyContext* ctx)
+{
+    if (ctx->limitError != 0)
+        return false;
+
+    if (ctx->nodeCount >= ctx->limits.maxNodes) {
+        ctx->limitError = "Query has too many nodes";
+        return false;
+    }
+
+    if (ctx->depth >= ctx->limits.maxDepth) {
+        ctx->limitError = "Query is nested too deeply";
+        return false;
+    }
+
+    ctx->nodeCount++;
+    if (++ctx->depth > ctx->maxDepth)
+        ctx->maxDepth = ctx->depth;
+
+    return true;
+}
+
+inline void leaveNode(CopyContext* ctx)
+{
+    ctx->depth--;
+}
+
 template<class ItemSrc, class ItemDst>
 ItemDst** copyArr(const std::vector<ItemSrc*>* v,
-    ItemDst* (*copyArrItem)(const ItemSrc*))
+    ItemDst* (*copyArrItem)(const ItemSrc*, CopyContext*), CopyContext* ctx)
 {
-    if (v == 0)
+    if (v == 0 || ctx->limitError != 0)
         return 0;
 
     size_t n = v->size();
 
-    ItemDst** arr = (ItemDst**)std::malloc(
-        n * sizeof(ItemDst*));
+    fingerprintMix(ctx, n);
 
-    for (size_t i = 0; i < n; i++)
-        arr[i] = copyArrItem((*v)[i]);
+    ItemDst** arr = arenaNewArr<ItemDst>(ctx->arena, n);
+
+    for (size_t i = 0; i < n && ctx->limitError == 0; i++)
+        arr[i] = copyArrItem((*v)[i], ctx);
 
     return arr;
 }
 
-template<class Item>
-void freeArr(Item** arr, size_t count, void (*freeArrItem)(Item*))
+char* copyStr(const char* str, CopyContext* ctx)
 {
-    if (arr == 0)
-        return;
+    if (str == 0)
+        return 0;
 
-    for (size_t i = 0; i < count; i++)
-        freeArrItem(arr[i]);
+    if (ctx->limitError != 0)
+        return 0;
 
-    free(arr);
-}
+    size_t n = strlen(str) + 1;
 
-char* copyStr(const char* str)
-{
-    if (str == 0)
+    if (n > ctx->limits.maxStringBytes - ctx->stringBytes) {
+        ctx->limitError = "Query has too many string bytes";
         return 0;
+    }
+    ctx->stringBytes += n;
 
-    size_t n = strlen(str) + 1;
-    char* strCopy = (char*)std::malloc(n);
+    char* strCopy = (char*)arenaAlloc(ctx->arena, n, 1);
     std::memcpy(strCopy, str, n);
 
     return strCopy;
 }
 
-inline void freeStr(char* str)
+// Copies an identifier, or returns the copy already made for an equal one,
+// either in this result or process-wide.
+char* copyIdent(const char* str, CopyContext* ctx)
 {
-    if (str != 0)
-        free(str);
+    if (str == 0 || ctx->limitError != 0)
+        return 0;
+
+    size_t length = strlen(str);
+    uint64_t hash = hashBytes(str, length);
+
+    char* copy = internSetFind(&ctx->idents, str, hash);
+    if (copy != 0)
+        return copy;
+
+    copy = (char*)internShared(str, length);
+    if (copy == 0)
+        copy = copyStr(str, ctx);
+
+    if (copy != 0)
+        internSetAdd(&ctx->idents, copy, hash);
+
+    return copy;
+}
+
+inline bool isPlaceholder(const hsql::Expr* expr)
+{
+    switch (expr->type) {
+        case hsql::kExprLiteralFloat:
+        case hsql::kExprLiteralString:
+        case hsql::kExprLiteralInt:
+        case hsql::kExprParameter:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// An IN-list made of literals and parameters only is fingerprinted as a
+// whole, whatever the number of its items.
+bool isCollapsibleInList(const hsql::Expr* expr)
+{
+    if (expr->opType != hsql::kOpIn || expr->exprList == 0)
+        return false;
+
+    for (const hsql::Expr* item : *expr->exprList)
+        if (item == 0 || !isPlaceholder(item) || item->alias != 0)
+            return false;
+
+    return true;
+}
+
+// Mixes everything but the children of the expression into the
+// fingerprint. Literals and parameters become the same placeholder.
+void fingerprintExpr(const hsql::Expr* expr, CopyContext* ctx)
+{
+    if (ctx->fingerprintMuted != 0)
+        return;
+
+    // Literals differ in where they keep their value, string ones in
+    // `name`, so nothing but the placeholder itself is mixed for them.
+    if (isPlaceholder(expr)) {
+        fingerprintMix(ctx, kFingerprintPlaceholder);
+        return;
+    }
+
+    fingerprintMix(ctx, kFingerprintExpr);
+    fingerprintMix(ctx, expr->type);
+    fingerprintMix(ctx, expr->opType);
+    fingerprintMix(ctx, expr->distinct);
+    fingerprintMix(ctx, expr->datetimeField);
+    fingerprintMix(ctx, (uint64_t)expr->columnType.data_type);
+    fingerprintMix(ctx, expr->columnType.length);
+
+    if (expr->type == hsql::kExprArrayIndex)
+        fingerprintMix(ctx, expr->ival);
+
+    fingerprintStr(ctx, expr->name);
+
+    fingerprintMix(ctx,
+        (expr->expr != 0) |
+        (expr->expr2 != 0) << 1 |
+        (expr->exprList != 0) << 2 |
+        (expr->select != 0) << 3 |
+        (expr->name != 0) << 4 |
+        (expr->table != 0) << 5 |
+        (expr->alias != 0) << 6);
+
+    fingerprintStr(ctx, expr->table);
+    fingerprintStr(ctx, expr->alias);
 }
 
-void freeStrArr(char** arr, size_t count)
+void addLiteral(LuaExpr* luaExpr, CopyContext* ctx)
 {
-    freeArr<char>(arr, count, freeStr);
+    if (ctx->literalCount == ctx->literalCapacity) {
+        size_t capacity = ctx->literalCapacity * 2;
+        if (capacity == 0)
+            capacity = 16;
+
+        LuaExpr** literals = arenaNewArr<LuaExpr>(ctx->arena, capacity);
+        if (ctx->literalCount != 0)
+            std::memcpy(literals, ctx->literals,
+                ctx->literalCount * sizeof(LuaExpr*));
+
+        ctx->literals = literals;
+        ctx->literalCapacity = capacity;
+    }
+
+    ctx->literals[ctx->literalCount++] = luaExpr;
 }
 
-LuaExpr* copyExpr(const hsql::Expr* expr)
+// Copies a single expression, its children are left to the steps pushed
+// onto ctx->exprTasks in the order the recursive copy would visit them.
+LuaExpr* copyExprNode(const hsql::Expr* expr, CopyContext* ctx)
 {
     if (expr == 0)
         return 0;
 
-    LuaExpr* luaExpr = (LuaExpr*)std::malloc(sizeof(LuaExpr));
+    if (!enterNode(ctx))
+        return 0;
+
+    fingerprintExpr(expr, ctx);
+
+    LuaExpr* luaExpr = arenaNew<LuaExpr>(ctx->arena);
 
     luaExpr->type = (ExprType)expr->type;
 
-    luaExpr->expr = copyExpr(expr->expr);
-    luaExpr->expr2 = copyExpr(expr->expr2);
+    luaExpr->expr = 0;
+    luaExpr->expr2 = 0;
 
     if (expr->exprList != 0)
         luaExpr->exprListSize = expr->exprList->size();
     else
         luaExpr->exprListSize = 0;
 
-    luaExpr->exprList = copyExprArr(expr->exprList);
+    luaExpr->exprList = 0;
+    luaExpr->select = 0;
 
-    luaExpr->select = copySelectStatement(expr->select);
+    // The name of a string literal is its value.
+    if (expr->type == hsql::kExprLiteralString)
+        luaExpr->name = copyStr(expr->name, ctx);
+    else
+        luaExpr->name = copyIdent(expr->name, ctx);
 
-    luaExpr->name = copyStr(expr->name);
-    luaExpr->table = copyStr(expr->table);
-    luaExpr->alias = copyStr(expr->alias);
+    luaExpr->table = copyIdent(expr->table, ctx);
+    luaExpr->alias = copyIdent(expr->alias, ctx);
     luaExpr->fval = expr->fval;
     luaExpr->ival = expr->ival;
     luaExpr->ival2 = expr->ival2;
@@ -136,113 +399,177 @@ LuaExpr* copyExpr(const hsql::Expr* expr)
     luaExpr->opType = (OperatorType)expr->opType;
     luaExpr->distinct = expr->distinct;
 
+    // Literals have no children, so they are listed depth-first anyway.
+    if (isPlaceholder(expr) && expr->type != hsql::kExprParameter)
+        addLiteral(luaExpr, ctx);
+
+    std::vector<ExprTask>& tasks = ctx->exprTasks;
+    size_t depth = ctx->depth;
+
+    if (expr->select != 0)
+        tasks.push_back(ExprTask { kExprTaskSelect, expr, 0, luaExpr, depth });
+    if (expr->exprList != 0)
+        tasks.push_back(ExprTask { kExprTaskList, expr, 0, luaExpr, depth });
+    if (expr->expr2 != 0)
+        tasks.push_back(
+            ExprTask { kExprTaskCopy, expr->expr2, &luaExpr->expr2, 0, depth });
+    if (expr->expr != 0)
+        tasks.push_back(
+            ExprTask { kExprTaskCopy, expr->expr, &luaExpr->expr, 0, depth });
+
     return luaExpr;
 }
 
-void freeExpr(LuaExpr* luaExpr)
+void copyExprList(const hsql::Expr* expr, LuaExpr* luaExpr, size_t depth,
+    CopyContext* ctx)
 {
-    if (luaExpr == 0)
-        return;
+    std::vector<ExprTask>& tasks = ctx->exprTasks;
 
-    freeExpr(luaExpr->expr);
-    freeExpr(luaExpr->expr2);
+    if (isCollapsibleInList(expr)) {
+        fingerprintMix(ctx, kFingerprintInList);
+        ctx->fingerprintMuted++;
 
-    freeArr<LuaExpr>(luaExpr->exprList, luaExpr->exprListSize, freeExpr);
+        tasks.push_back(ExprTask { kExprTaskUnmute, 0, 0, 0, depth });
+    }
+
+    size_t n = expr->exprList->size();
 
-    freeSelectStatement(luaExpr->select);
+    fingerprintMix(ctx, n);
 
-    freeStr(luaExpr->name);
-    freeStr(luaExpr->table);
-    freeStr(luaExpr->alias);
+    luaExpr->exprList = arenaNewArr<LuaExpr>(ctx->arena, n);
 
-    free(luaExpr);
+    for (size_t i = n; i-- > 0;)
+        tasks.push_back(ExprTask { kExprTaskCopy, (*expr->exprList)[i],
+            &luaExpr->exprList[i], 0, depth });
 }
 
-LuaExpr** copyExprArr(const std::vector<hsql::Expr*>* v)
+LuaExpr* copyExpr(const hsql::Expr* expr, CopyContext* ctx)
 {
-    return copyArr<hsql::Expr, LuaExpr>(v, copyExpr);
+    if (expr == 0)
+        return 0;
+
+    std::vector<ExprTask>& tasks = ctx->exprTasks;
+
+    // Subqueries call back into copyExpr(), their steps go on top of ours.
+    size_t base = tasks.size();
+    size_t depth = ctx->depth;
+
+    LuaExpr* luaExpr = 0;
+    tasks.push_back(ExprTask { kExprTaskCopy, expr, &luaExpr, 0, depth });
+
+    while (tasks.size() > base && ctx->limitError == 0) {
+        ExprTask task = tasks.back();
+        tasks.pop_back();
+
+        ctx->depth = task.depth;
+
+        switch (task.type) {
+            case kExprTaskCopy:
+                *task.dst = copyExprNode(task.expr, ctx);
+                break;
+            case kExprTaskList:
+                copyExprList(task.expr, task.luaExpr, task.depth, ctx);
+                break;
+            case kExprTaskUnmute:
+                ctx->fingerprintMuted--;
+                break;
+            case kExprTaskSelect:
+                task.luaExpr->select =
+                    copySelectStatement(task.expr->select, ctx);
+                break;
+        }
+    }
+
+    // Left over once a limit is exceeded.
+    tasks.resize(base);
+
+    ctx->depth = depth;
+
+    return luaExpr;
 }
 
-void freeExprArr(LuaExpr** arr, size_t count)
+LuaExpr** copyExprArr(const std::vector<hsql::Expr*>* v, CopyContext* ctx)
 {
-    freeArr<LuaExpr>(arr, count, freeExpr);
+    return copyArr<hsql::Expr, LuaExpr>(v, copyExpr, ctx);
 }
 
-LuaJoinDefinition* copyJoinDefinition(const hsql::JoinDefinition* joinDef)
+LuaJoinDefinition* copyJoinDefinition(const hsql::JoinDefinition* joinDef,
+    CopyContext* ctx)
 {
     if (joinDef == 0)
         return 0;
 
-    LuaJoinDefinition* luaJoinDef = (LuaJoinDefinition*)std::malloc(
-        sizeof(LuaJoinDefinition));
+    fingerprintMix(ctx, kFingerprintJoin);
+    fingerprintMix(ctx, joinDef->type);
+    fingerprintMix(ctx, joinDef->condition != 0);
 
-    luaJoinDef->left = copyTableRef(joinDef->left);
-    luaJoinDef->right = copyTableRef(joinDef->right);
-    luaJoinDef->condition = copyExpr(joinDef->condition);
+    LuaJoinDefinition* luaJoinDef = arenaNew<LuaJoinDefinition>(ctx->arena);
+
+    luaJoinDef->left = copyTableRef(joinDef->left, ctx);
+    luaJoinDef->right = copyTableRef(joinDef->right, ctx);
+    luaJoinDef->condition = copyExpr(joinDef->condition, ctx);
 
     luaJoinDef->type = (JoinType)joinDef->type;
 
     return luaJoinDef;
 }
 
-void freeJoinDefinition(LuaJoinDefinition* luaJoinDef)
-{
-    if (luaJoinDef == 0)
-        return;
-
-    freeTableRef(luaJoinDef->left);
-    freeTableRef(luaJoinDef->right);
-    freeExpr(luaJoinDef->condition);
-
-    free(luaJoinDef);
-}
-
-LuaAlias* copyAlias(const hsql::Alias* alias)
+LuaAlias* copyAlias(const hsql::Alias* alias, CopyContext* ctx)
 {
     if (alias == 0)
         return 0;
 
-    LuaAlias* luaAlias = (LuaAlias*)std::malloc(
-        sizeof(LuaAlias));
+    fingerprintMix(ctx, kFingerprintAlias);
+    fingerprintStr(ctx, alias->name);
+    fingerprintMix(ctx, alias->columns != 0);
+
+    LuaAlias* luaAlias = arenaNew<LuaAlias>(ctx->arena);
 
-    luaAlias->name = copyStr(alias->name);
+    luaAlias->name = copyIdent(alias->name, ctx);
 
     if (alias->columns != 0)
         luaAlias->columnCount = alias->columns->size();
     else
         luaAlias->columnCount = 0;
 
-    luaAlias->columns = copyArr<char, char>(alias->columns, copyStr);
+    luaAlias->columns = copyArr<char, char>(alias->columns, copyIdent, ctx);
 
-    return luaAlias;
-}
-
-void freeAlias(LuaAlias* luaAlias)
-{
-    if (luaAlias == 0)
-        return;
-
-    freeStr(luaAlias->name);
-    freeStrArr(luaAlias->columns, luaAlias->columnCount);
+    if (alias->columns != 0)
+        for (const char* column : *alias->columns)
+            fingerprintStr(ctx, column);
 
-    free(luaAlias);
+    return luaAlias;
 }
 
-LuaTableRef* copyTableRef(const hsql::TableRef* tableRef)
+LuaTableRef* copyTableRef(const hsql::TableRef* tableRef, CopyContext* ctx)
 {
     if (tableRef == 0)
         return 0;
 
-    LuaTableRef* luaTableRef = (LuaTableRef*)std::malloc(
-        sizeof(LuaTableRef));
+    if (!enterNode(ctx))
+        return 0;
+
+    fingerprintMix(ctx, kFingerprintTableRef);
+    fingerprintMix(ctx, tableRef->type);
+    fingerprintMix(ctx,
+        (tableRef->schema != 0) |
+        (tableRef->name != 0) << 1 |
+        (tableRef->alias != 0) << 2 |
+        (tableRef->select != 0) << 3 |
+        (tableRef->list != 0) << 4 |
+        (tableRef->join != 0) << 5);
+    fingerprintStr(ctx, tableRef->schema);
+    fingerprintStr(ctx, tableRef->name);
+
+    LuaTableRef* luaTableRef = arenaNew<LuaTableRef>(ctx->arena);
 
     luaTableRef->type = (TableRefType)tableRef->type;
 
-    luaTableRef->schema = copyStr(tableRef->schema);
-    luaTableRef->name = copyStr(tableRef->name);
-    luaTableRef->alias = copyAlias(tableRef->alias);
+    luaTableRef->schema = copyIdent(tableRef->schema, ctx);
+    luaTableRef->name = copyIdent(tableRef->name, ctx);
+    luaTableRef->alias = copyAlias(tableRef->alias, ctx);
 
-    luaTableRef->select = copySelectStatement(tableRef->select);
+    luaTableRef->select = copySelectStatement(tableRef->select, ctx);
 
     if (tableRef->list != 0)
         luaTableRef->listSize = tableRef->list->size();
@@ -250,78 +577,62 @@ LuaTableRef* copyTableRef(const hsql::TableRef* tableRef)
         luaTableRef->listSize = 0;
 
     luaTableRef->list = copyArr<hsql::TableRef, LuaTableRef>(
-        tableRef->list, copyTableRef);
-
-    luaTableRef->join = copyJoinDefinition(tableRef->join);
-
-    return luaTableRef;
-}
-
-void freeTableRef(LuaTableRef* luaTableRef)
-{
-    if (luaTableRef == 0)
-        return;
+        tableRef->list, copyTableRef, ctx);
 
-    freeStr(luaTableRef->schema);
-    freeStr(luaTableRef->name);
-    freeAlias(luaTableRef->alias);
+    luaTableRef->join = copyJoinDefinition(tableRef->join, ctx);
 
-    freeSelectStatement(luaTableRef->select);
+    leaveNode(ctx);
 
-    freeArr<LuaTableRef>(luaTableRef->list, luaTableRef->listSize,
-        freeTableRef);
-
-    freeJoinDefinition(luaTableRef->join);
-
-    free(luaTableRef);
+    return luaTableRef;
 }
 
 LuaGroupByDescription* copyGroupByDescription(
-    const hsql::GroupByDescription* groupBy)
+    const hsql::GroupByDescription* groupBy, CopyContext* ctx)
 {
     if (groupBy == 0)
         return 0;
 
+    fingerprintMix(ctx, kFingerprintGroupBy);
+    fingerprintMix(ctx,
+        (groupBy->columns != 0) |
+        (groupBy->having != 0) << 1);
+
     LuaGroupByDescription* luaGroupBy =
-        (LuaGroupByDescription*)std::malloc(
-            sizeof(LuaGroupByDescription));
+        arenaNew<LuaGroupByDescription>(ctx->arena);
 
     if (groupBy->columns != 0)
         luaGroupBy->columnCount = groupBy->columns->size();
     else
         luaGroupBy->columnCount = 0;
 
-    luaGroupBy->columns = copyExprArr(groupBy->columns);
+    luaGroupBy->columns = copyExprArr(groupBy->columns, ctx);
 
-    luaGroupBy->having = copyExpr(groupBy->having);
+    luaGroupBy->having = copyExpr(groupBy->having, ctx);
 
     return luaGroupBy;
 }
 
-void freeGroupByDescription(LuaGroupByDescription* luaGroupBy)
-{
-    if (luaGroupBy == 0)
-        return;
-
-    freeExprArr(luaGroupBy->columns, luaGroupBy->columnCount);
-    freeExpr(luaGroupBy->having);
-
-    free(luaGroupBy);
-}
-
-LuaSetOperation* copySetOperation(const hsql::SetOperation* setOp)
+LuaSetOperation* copySetOperation(const hsql::SetOperation* setOp,
+    CopyContext* ctx)
 {
     if (setOp == 0)
         return 0;
 
-    LuaSetOperation* luaSetOp = (LuaSetOperation*)std::malloc(
-        sizeof(LuaSetOperation));
+    fingerprintMix(ctx, kFingerprintSetOperation);
+    fingerprintMix(ctx, setOp->setType);
+    fingerprintMix(ctx,
+        setOp->isAll |
+        (setOp->nestedSelectStatement != 0) << 1 |
+        (setOp->resultOrder != 0) << 2 |
+        (setOp->resultLimit != 0) << 3);
+
+    LuaSetOperation* luaSetOp = arenaNew<LuaSetOperation>(ctx->arena);
 
     luaSetOp->setType = (SetType)setOp->setType;
     luaSetOp->isAll = setOp->isAll;
 
     luaSetOp->nestedSelectStatement = copySelectStatement(
-        setOp->nestedSelectStatement);
+        setOp->nestedSelectStatement, ctx);
 
     if (setOp->resultOrder != 0)
         luaSetOp->resultOrderCount = setOp->resultOrder->size();
@@ -330,107 +641,78 @@ LuaSetOperation* copySetOperation(const hsql::SetOperation* setOp)
 
     luaSetOp->resultOrder =
         copyArr<hsql::OrderDescription, LuaOrderDescription>(
-            setOp->resultOrder, copyOrderDescription);
+            setOp->resultOrder, copyOrderDescription, ctx);
 
-    luaSetOp->resultLimit = copyLimitDescription(setOp->resultLimit);
+    luaSetOp->resultLimit = copyLimitDescription(setOp->resultLimit, ctx);
 
     return luaSetOp;
 }
 
-void freeSetOperation(LuaSetOperation* luaSetOp)
-{
-    if (luaSetOp == 0)
-        return;
-
-    freeSelectStatement(luaSetOp->nestedSelectStatement);
-
-    freeArr<LuaOrderDescription>(luaSetOp->resultOrder,
-        luaSetOp->resultOrderCount, freeOrderDescription);
-
-    freeLimitDescription(luaSetOp->resultLimit);
-
-    free(luaSetOp);
-}
-
 LuaOrderDescription* copyOrderDescription(
-    const hsql::OrderDescription* orderDesc)
+    const hsql::OrderDescription* orderDesc, CopyContext* ctx)
 {
     if (orderDesc == 0)
         return 0;
 
-    LuaOrderDescription* luaOrderDesc = (LuaOrderDescription*)std::malloc(
-        sizeof(LuaOrderDescription));
+    fingerprintMix(ctx, kFingerprintOrder);
+    fingerprintMix(ctx, orderDesc->type);
+    fingerprintMix(ctx, orderDesc->expr != 0);
+
+    LuaOrderDescription* luaOrderDesc =
+        arenaNew<LuaOrderDescription>(ctx->arena);
 
     luaOrderDesc->type = (OrderType)orderDesc->type;
-    luaOrderDesc->expr = copyExpr(orderDesc->expr);
+    luaOrderDesc->expr = copyExpr(orderDesc->expr, ctx);
 
     return luaOrderDesc;
 }
 
-void freeOrderDescription(LuaOrderDescription* luaOrderDesc)
-{
-    if (luaOrderDesc == 0)
-        return;
-
-    freeExpr(luaOrderDesc->expr);
-
-    free(luaOrderDesc);
-}
-
-LuaWithDescription* copyWithDescription(const hsql::WithDescription* withDesc)
+LuaWithDescription* copyWithDescription(const hsql::WithDescription* withDesc,
+    CopyContext* ctx)
 {
     if (withDesc == 0)
         return 0;
 
-    LuaWithDescription* luaWithDesc = (LuaWithDescription*)std::malloc(
-        sizeof(LuaWithDescription));
-
-    luaWithDesc->alias = copyStr(withDesc->alias);
-    luaWithDesc->select = copySelectStatement(withDesc->select);
+    fingerprintMix(ctx, kFingerprintWith);
+    fingerprintStr(ctx, withDesc->alias);
+    fingerprintMix(ctx, withDesc->select != 0);
 
-    return luaWithDesc;
-}
-
-void freeWithDescription(LuaWithDescription* luaWithDesc)
-{
-    if (luaWithDesc == 0)
-        return;
+    LuaWithDescription* luaWithDesc =
+        arenaNew<LuaWithDescription>(ctx->arena);
 
-    freeStr(luaWithDesc->alias);
-    freeSelectStatement(luaWithDesc->select);
+    luaWithDesc->alias = copyIdent(withDesc->alias, ctx);
+    luaWithDesc->select = copySelectStatement(withDesc->select, ctx);
 
-    free(luaWithDesc);
+    return luaWithDesc;
 }
 
 LuaLimitDescription* copyLimitDescription(
-    const hsql::LimitDescription* limitDesc)
+    const hsql::LimitDescription* limitDesc, CopyContext* ctx)
 {
     if (limitDesc == 0)
         return 0;
 
-    LuaLimitDescription* luaLimitDesc = (LuaLimitDescription*)std::malloc(
-        sizeof(LuaLimitDescription));
-
-    luaLimitDesc->limit = copyExpr(limitDesc->limit);
-    luaLimitDesc->offset = copyExpr(limitDesc->offset);
-
-    return luaLimitDesc;
-}
+    fingerprintMix(ctx, kFingerprintLimit);
+    fingerprintMix(ctx,
+        (limitDesc->limit != 0) |
+        (limitDesc->offset != 0) << 1);
 
-void freeLimitDescription(LuaLimitDescription* luaLimitDesc)
-{
-    if (luaLimitDesc == 0)
-        return;
+    LuaLimitDescription* luaLimitDesc =
+        arenaNew<LuaLimitDescription>(ctx->arena);
 
-    freeExpr(luaLimitDesc->limit);
-    freeExpr(luaLimitDesc->offset);
+    luaLimitDesc->limit = copyExpr(limitDesc->limit, ctx);
+    luaLimitDesc->offset = copyExpr(limitDesc->offset, ctx);
 
-    free(luaLimitDesc);
+    return luaLimitDesc;
 }
 
 void fillSQLStatement(const hsql::SQLStatement* statement,
-    LuaSQLStatement* luaStatement)
+    LuaSQLStatement* luaStatement, CopyContext* ctx)
 {
+    fingerprintMix(ctx, kFingerprintStatement);
+    fingerprintMix(ctx, statement->type());
+    fingerprintMix(ctx, statement->hints != 0);
+
     luaStatement->type = (StatementType)statement->type();
 
     luaStatement->stringLength = statement->stringLength;
@@ -440,20 +722,41 @@ void fillSQLStatement(const hsql::SQLStatement* statement,
     else
         luaStatement->hintCount = 0;
 
-    luaStatement->hints = copyExprArr(statement->hints);
+    luaStatement->hints = copyExprArr(statement->hints, ctx);
+
+    // Filled in by copySQLStatement() for top-level statements.
+    luaStatement->fingerprint = 0;
+    luaStatement->literalCount = 0;
+    luaStatement->literals = 0;
 }
 
-LuaSelectStatement* copySelectStatement(const hsql::SelectStatement* statement)
+LuaSelectStatement* copySelectStatement(const hsql::SelectStatement* statement,
+    CopyContext* ctx)
 {
     if (statement == 0)
         return 0;
 
-    LuaSelectStatement* luaStatement = (LuaSelectStatement*)std::malloc(
-        sizeof(LuaSelectStatement));
+    if (!enterNode(ctx))
+        return 0;
+
+    LuaSelectStatement* luaStatement =
+        arenaNew<LuaSelectStatement>(ctx->arena);
+
+    fillSQLStatement(statement, &luaStatement->base, ctx);
 
-    fillSQLStatement(statement, &luaStatement->base);
+    fingerprintMix(ctx, kFingerprintSelect);
+    fingerprintMix(ctx,
+        statement->selectDistinct |
+        (statement->fromTable != 0) << 1 |
+        (statement->selectList != 0) << 2 |
+        (statement->whereClause != 0) << 3 |
+        (statement->groupBy != 0) << 4 |
+        (statement->setOperations != 0) << 5 |
+        (statement->order != 0) << 6 |
+        (statement->withDescriptions != 0) << 7 |
+        (statement->limit != 0) << 8);
 
-    luaStatement->fromTable = copyTableRef(statement->fromTable);
+    luaStatement->fromTable = copyTableRef(statement->fromTable, ctx);
 
     luaStatement->selectDistinct = statement->selectDistinct;
 
@@ -462,11 +765,11 @@ LuaSelectStatement* copySelectStatement(const hsql::SelectStatement* statement)
     else
         luaStatement->selectListSize = 0;
 
-    luaStatement->selectList = copyExprArr(statement->selectList);
-    
-    luaStatement->whereClause = copyExpr(statement->whereClause);
+    luaStatement->selectList = copyExprArr(statement->selectList, ctx);
 
-    luaStatement->groupBy = copyGroupByDescription(statement->groupBy);
+    luaStatement->whereClause = copyExpr(statement->whereClause, ctx);
+
+    luaStatement->groupBy = copyGroupByDescription(statement->groupBy, ctx);
 
     if (statement->setOperations != 0)
         luaStatement->setOperationCount = statement->setOperations->size();
@@ -475,7 +778,7 @@ LuaSelectStatement* copySelectStatement(const hsql::SelectStatement* statement)
 
     luaStatement->setOperations =
         copyArr<hsql::SetOperation, LuaSetOperation>(
-            statement->setOperations, copySetOperation);
+            statement->setOperations, copySetOperation, ctx);
 
     if (statement->order != 0)
         luaStatement->orderCount = statement->order->size();
@@ -484,7 +787,7 @@ LuaSelectStatement* copySelectStatement(const hsql::SelectStatement* statement)
 
     luaStatement->order =
         copyArr<hsql::OrderDescription, LuaOrderDescription>(
-            statement->order, copyOrderDescription);
+            statement->order, copyOrderDescription, ctx);
 
     if (statement->withDescriptions != 0)
         luaStatement->withDescriptionCount =
@@ -494,155 +797,931 @@ LuaSelectStatement* copySelectStatement(const hsql::SelectStatement* statement)
 
     luaStatement->withDescriptions =
         copyArr<hsql::WithDescription, LuaWithDescription>(
-            statement->withDescriptions, copyWithDescription);
+            statement->withDescriptions, copyWithDescription, ctx);
+
+    luaStatement->limit = copyLimitDescription(statement->limit, ctx);
 
-    luaStatement->limit = copyLimitDescription(statement->limit);
+    leaveNode(ctx);
 
     return luaStatement;
 }
 
-void freeSelectStatement(LuaSelectStatement* luaStatement)
+LuaInsertStatement* copyInsertStatement(
+    const hsql::InsertStatement* statement, CopyContext* ctx)
 {
-    if (luaStatement == 0)
-        return;
+    if (statement == 0)
+        return 0;
+
+    if (!enterNode(ctx))
+        return 0;
+
+    LuaInsertStatement* luaStatement =
+        arenaNew<LuaInsertStatement>(ctx->arena);
+
+    fillSQLStatement(statement, &luaStatement->base, ctx);
+
+    fingerprintMix(ctx, kFingerprintInsert);
+    fingerprintMix(ctx, statement->type);
+    fingerprintMix(ctx,
+        (statement->schema != 0) |
+        (statement->columns != 0) << 1 |
+        (statement->values != 0) << 2 |
+        (statement->select != 0) << 3);
+    fingerprintStr(ctx, statement->schema);
+    fingerprintStr(ctx, statement->tableName);
+
+    luaStatement->type = (InsertType)statement->type;
+
+    luaStatement->schema = copyIdent(statement->schema, ctx);
+    luaStatement->tableName = copyIdent(statement->tableName, ctx);
+
+    if (statement->columns != 0)
+        luaStatement->columnCount = statement->columns->size();
+    else
+        luaStatement->columnCount = 0;
+
+    luaStatement->columns =
+        copyArr<char, char>(statement->columns, copyIdent, ctx);
+
+    if (statement->columns != 0)
+        for (const char* column : *statement->columns)
+            fingerprintStr(ctx, column);
+
+    if (statement->values != 0)
+        luaStatement->valueCount = statement->values->size();
+    else
+        luaStatement->valueCount = 0;
+
+    luaStatement->values = copyExprArr(statement->values, ctx);
+
+    luaStatement->select = copySelectStatement(statement->select, ctx);
+
+    leaveNode(ctx);
+
+    return luaStatement;
+}
+
+LuaUpdateClause* copyUpdateClause(const hsql::UpdateClause* update,
+    CopyContext* ctx)
+{
+    if (update == 0)
+        return 0;
+
+    fingerprintMix(ctx, kFingerprintUpdateClause);
+    fingerprintStr(ctx, update->column);
+
+    LuaUpdateClause* luaUpdate = arenaNew<LuaUpdateClause>(ctx->arena);
+
+    luaUpdate->column = copyIdent(update->column, ctx);
+    luaUpdate->value = copyExpr(update->value, ctx);
+
+    return luaUpdate;
+}
 
-    freeTableRef(luaStatement->fromTable);
-    freeExprArr(luaStatement->selectList, luaStatement->selectListSize);
-    freeExpr(luaStatement->whereClause);
-    freeGroupByDescription(luaStatement->groupBy);
+LuaUpdateStatement* copyUpdateStatement(
+    const hsql::UpdateStatement* statement, CopyContext* ctx)
+{
+    if (statement == 0)
+        return 0;
+
+    if (!enterNode(ctx))
+        return 0;
+
+    LuaUpdateStatement* luaStatement =
+        arenaNew<LuaUpdateStatement>(ctx->arena);
+
+    fillSQLStatement(statement, &luaStatement->base, ctx);
+
+    fingerprintMix(ctx, kFingerprintUpdate);
+    fingerprintMix(ctx,
+        (statement->table != 0) |
+        (statement->updates != 0) << 1 |
+        (statement->where != 0) << 2);
+
+    luaStatement->table = copyTableRef(statement->table, ctx);
+
+    if (statement->updates != 0)
+        luaStatement->updateCount = statement->updates->size();
+    else
+        luaStatement->updateCount = 0;
+
+    luaStatement->updates =
+        copyArr<hsql::UpdateClause, LuaUpdateClause>(
+            statement->updates, copyUpdateClause, ctx);
+
+    luaStatement->where = copyExpr(statement->where, ctx);
+
+    leaveNode(ctx);
+
+    return luaStatement;
+}
+
+LuaDeleteStatement* copyDeleteStatement(
+    const hsql::DeleteStatement* statement, CopyContext* ctx)
+{
+    if (statement == 0)
+        return 0;
+
+    if (!enterNode(ctx))
+        return 0;
+
+    LuaDeleteStatement* luaStatement =
+        arenaNew<LuaDeleteStatement>(ctx->arena);
 
-    freeArr<LuaSetOperation>(luaStatement->setOperations,
-        luaStatement->setOperationCount, freeSetOperation);
+    fillSQLStatement(statement, &luaStatement->base, ctx);
 
-    freeArr<LuaOrderDescription>(luaStatement->order,
-        luaStatement->orderCount, freeOrderDescription);
+    fingerprintMix(ctx, kFingerprintDelete);
+    fingerprintMix(ctx,
+        (statement->schema != 0) |
+        (statement->expr != 0) << 1);
+    fingerprintStr(ctx, statement->schema);
+    fingerprintStr(ctx, statement->tableName);
 
-    freeArr<LuaWithDescription>(luaStatement->withDescriptions,
-        luaStatement->withDescriptionCount, freeWithDescription);
+    luaStatement->schema = copyIdent(statement->schema, ctx);
+    luaStatement->tableName = copyIdent(statement->tableName, ctx);
+    luaStatement->expr = copyExpr(statement->expr, ctx);
 
-    freeLimitDescription(luaStatement->limit);
+    leaveNode(ctx);
 
-    free(luaStatement);
+    return luaStatement;
 }
 
-LuaSQLStatement* copySQLStatement(const hsql::SQLStatement* statement)
+LuaSQLStatement* copySQLStatement(const hsql::SQLStatement* statement,
+    CopyContext* ctx)
 {
     if (statement == 0)
         return 0;
 
     LuaSQLStatement* luaStatement;
 
+    ctx->fingerprint = kFingerprintSeed;
+    ctx->fingerprintMuted = 0;
+    ctx->literals = 0;
+    ctx->literalCount = 0;
+    ctx->literalCapacity = 0;
+
     hsql::StatementType statementType = statement->type();
 
     switch (statementType) {
         case StatementType::kStmtSelect:
             luaStatement = (LuaSQLStatement*)copySelectStatement(
-                (hsql::SelectStatement*)statement);
+                (hsql::SelectStatement*)statement, ctx);
+            break;
+        case StatementType::kStmtInsert:
+            luaStatement = (LuaSQLStatement*)copyInsertStatement(
+                (hsql::InsertStatement*)statement, ctx);
+            break;
+        case StatementType::kStmtUpdate:
+            luaStatement = (LuaSQLStatement*)copyUpdateStatement(
+                (hsql::UpdateStatement*)statement, ctx);
+            break;
+        case StatementType::kStmtDelete:
+            luaStatement = (LuaSQLStatement*)copyDeleteStatement(
+                (hsql::DeleteStatement*)statement, ctx);
             break;
-        // case StatementType::kStmtInsert:
-        //     // TODO: copy insert statement
-        //     break;
-        // case StatementType::kStmtUpdate:
-        //     // TODO: copy update statement
-        //     break;
-        // case StatementType::kStmtDelete:
-        //     // TODO: copy delete statement
-        //     break;
         default:
-            luaStatement = (LuaSQLStatement*)std::malloc(
-                sizeof(LuaSQLStatement));
-            fillSQLStatement(statement, luaStatement);
+            luaStatement = arenaNew<LuaSQLStatement>(ctx->arena);
+            fillSQLStatement(statement, luaStatement, ctx);
             break;
     }
 
+    if (luaStatement == 0)
+        return 0;
+
+    luaStatement->fingerprint = ctx->fingerprint;
+    luaStatement->literalCount = ctx->literalCount;
+    luaStatement->literals = ctx->literals;
+
     return luaStatement;
 }
 
-void freeSQLStatement(LuaSQLStatement* luaStatement)
+// Starts a result in its own arena, the holder is handed the final state of
+// the arena by the caller.
+LuaSQLParserResultHolder* newResultHolder(Arena* arena)
 {
-    if (luaStatement == 0)
+    LuaSQLParserResultHolder* holder = new (
+        arenaNew<LuaSQLParserResultHolder>(arena)) LuaSQLParserResultHolder;
+    holder->refCount.store(1, std::memory_order_relaxed);
+
+    LuaSQLParserResult* luaResult = &holder->result;
+    luaResult->isValid = false;
+    luaResult->errorCode = kErrorNone;
+    luaResult->errorMsg = 0;
+    luaResult->errorLine = 0;
+    luaResult->errorColumn = 0;
+    luaResult->statementCount = 0;
+    luaResult->statements = 0;
+
+    std::memset(&luaResult->simplified, 0, sizeof(luaResult->simplified));
+
+    return holder;
+}
+
+// Makes an invalid result carrying only an error in `arena`.
+static LuaSQLParserResult* newErrorResultIn(Arena* arena, ErrorCode errorCode,
+    const char* errorMsg)
+{
+    LuaSQLParserResultHolder* holder = newResultHolder(arena);
+
+    holder->result.errorCode = errorCode;
+
+    if (errorMsg != 0) {
+        size_t n = strlen(errorMsg) + 1;
+        holder->result.errorMsg = (char*)arenaAlloc(arena, n, 1);
+        std::memcpy(holder->result.errorMsg, errorMsg, n);
+    }
+
+    holder->arena = *arena;
+
+    return &holder->result;
+}
+
+LuaSQLParserResult* newErrorResult(ErrorCode errorCode, const char* errorMsg)
+{
+    Arena arena;
+    arenaInit(&arena);
+
+    return newErrorResultIn(&arena, errorCode, errorMsg);
+}
+
+Limits getLimits()
+{
+    return Limits {
+        limitQueryBytes.load(std::memory_order_relaxed),
+        limitNodes.load(std::memory_order_relaxed),
+        limitDepth.load(std::memory_order_relaxed),
+        limitStringBytes.load(std::memory_order_relaxed)
+    };
+}
+
+// Copies an invalid hyrise result into `arena`.
+static LuaSQLParserResult* copyErrorResult(hsql::SQLParserResult* result,
+    Arena* arena)
+{
+    LuaSQLParserResult* luaResult =
+        newErrorResultIn(arena, kErrorSyntax, result->errorMsg());
+    luaResult->errorLine = result->errorLine();
+    luaResult->errorColumn = result->errorColumn();
+
+    return luaResult;
+}
+
+// Copies a valid hyrise result into `arena`. The interned identifiers and
+// the expression steps of `ctx` are to be empty, the rest of it is set up
+// here.
+static LuaSQLParserResult* copyValidResult(hsql::SQLParserResult* result,
+    Arena* arena, CopyContext* ctx)
+{
+    ctx->arena = arena;
+    ctx->fingerprint = kFingerprintSeed;
+    ctx->fingerprintMuted = 0;
+    ctx->literals = 0;
+    ctx->literalCount = 0;
+    ctx->literalCapacity = 0;
+    ctx->nodeCount = 0;
+    ctx->depth = 0;
+    ctx->maxDepth = 0;
+    ctx->limits = getLimits();
+    ctx->stringBytes = 0;
+    ctx->limitError = 0;
+
+    LuaSQLParserResultHolder* holder = newResultHolder(arena);
+
+    LuaSQLParserResult* luaResult = &holder->result;
+    luaResult->isValid = true;
+
+    const std::vector<hsql::SQLStatement*>& statements =
+        result->getStatements();
+
+    luaResult->statementCount = result->size();
+    luaResult->statements =
+        copyArr<hsql::SQLStatement, LuaSQLStatement>(
+            &statements, copySQLStatement, ctx);
+
+    if (ctx->limitError != 0) {
+        // Drop whatever was copied before the limit was hit.
+        arenaReset(arena);
+
+        return newErrorResultIn(arena, kErrorLimit, ctx->limitError);
+    }
+
+    // The arena has kept growing while copying, hand its final state over
+    // to the holder only now.
+    holder->arena = *arena;
+
+    if (statsOn()) {
+        statsRecordResult(arena->bytesAllocated, ctx->nodeCount,
+            ctx->maxDepth);
+    }
+
+    return luaResult;
+}
+
+LuaSQLParserResult* copySQLParserResult(hsql::SQLParserResult* result)
+{
+    if (result == 0)
+        return 0;
+
+    Arena arena;
+    arenaInit(&arena);
+
+    if (!result->isValid())
+        return copyErrorResult(result, &arena);
+
+    CopyContext ctx;
+    internSetInit(&ctx.idents);
+
+    return copyValidResult(result, &arena, &ctx);
+}
+
+inline LuaSQLParserResultHolder* getResultHolder(
+    const LuaSQLParserResult* luaResult)
+{
+    return (LuaSQLParserResultHolder*)(
+        (char*)luaResult - offsetof(LuaSQLParserResultHolder, result));
+}
+
+void retainSQLParserResult(LuaSQLParserResult* luaResult)
+{
+    getResultHolder(luaResult)->refCount.fetch_add(1,
+        std::memory_order_relaxed);
+}
+
+void freeSQLParserResult(LuaSQLParserResult* luaResult)
+{
+    if (luaResult == 0)
         return;
 
-    freeExprArr(luaStatement->hints, luaStatement->hintCount);
+    LuaSQLParserResultHolder* holder = getResultHolder(luaResult);
 
-    StatementType statementType = luaStatement->type;
+    if (holder->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
 
-    switch (statementType) {
+    // The holder lives inside the arena it describes.
+    Arena arena = holder->arena;
+    arenaRelease(&arena);
+}
+
+size_t getSQLParserResultSize(const LuaSQLParserResult* luaResult)
+{
+    return getResultHolder(luaResult)->arena.bytesAllocated;
+}
+
+// hsql::Expr deletes its children recursively, so freeing a long operator
+// chain takes one native frame per term. Before a hyrise result of a long
+// query is freed, its expressions are unlinked from each other and deleted
+// one by one instead.
+struct ExprRelease {
+    std::vector<hsql::Expr*> stack;
+    std::vector<hsql::Expr*> unlinked;
+};
+
+void unlinkSelectStatement(hsql::SelectStatement* statement,
+    ExprRelease* release);
+
+inline void unlinkChild(hsql::Expr* child, ExprRelease* release)
+{
+    if (child == 0)
+        return;
+
+    release->stack.push_back(child);
+    release->unlinked.push_back(child);
+}
+
+// Unlinks the descendants of `root`, the root itself stays with its owner.
+void unlinkExpr(hsql::Expr* root, ExprRelease* release)
+{
+    if (root == 0)
+        return;
+
+    // Subqueries call back into unlinkExpr(), their entries go on top.
+    size_t base = release->stack.size();
+    release->stack.push_back(root);
+
+    while (release->stack.size() > base) {
+        hsql::Expr* expr = release->stack.back();
+        release->stack.pop_back();
+
+        unlinkSelectStatement(expr->select, release);
+
+        unlinkChild(expr->expr, release);
+        unlinkChild(expr->expr2, release);
+        expr->expr = 0;
+        expr->expr2 = 0;
+
+        if (expr->exprList != 0) {
+            for (hsql::Expr* item : *expr->exprList)
+                unlinkChild(item, release);
+            expr->exprList->clear();
+        }
+    }
+}
+
+void unlinkExprArr(std::vector<hsql::Expr*>* v, ExprRelease* release)
+{
+    if (v == 0)
+        return;
+
+    for (hsql::Expr* expr : *v)
+        unlinkExpr(expr, release);
+}
+
+void unlinkLimitDescription(hsql::LimitDescription* limitDesc,
+    ExprRelease* release)
+{
+    if (limitDesc == 0)
+        return;
+
+    unlinkExpr(limitDesc->limit, release);
+    unlinkExpr(limitDesc->offset, release);
+}
+
+void unlinkOrderDescriptions(std::vector<hsql::OrderDescription*>* v,
+    ExprRelease* release)
+{
+    if (v == 0)
+        return;
+
+    for (hsql::OrderDescription* orderDesc : *v)
+        if (orderDesc != 0)
+            unlinkExpr(orderDesc->expr, release);
+}
+
+void unlinkTableRef(hsql::TableRef* tableRef, ExprRelease* release)
+{
+    if (tableRef == 0)
+        return;
+
+    unlinkSelectStatement(tableRef->select, release);
+
+    if (tableRef->list != 0)
+        for (hsql::TableRef* item : *tableRef->list)
+            unlinkTableRef(item, release);
+
+    if (tableRef->join != 0) {
+        unlinkTableRef(tableRef->join->left, release);
+        unlinkTableRef(tableRef->join->right, release);
+        unlinkExpr(tableRef->join->condition, release);
+    }
+}
+
+void unlinkSelectStatement(hsql::SelectStatement* statement,
+    ExprRelease* release)
+{
+    if (statement == 0)
+        return;
+
+    unlinkTableRef(statement->fromTable, release);
+    unlinkExprArr(statement->selectList, release);
+    unlinkExpr(statement->whereClause, release);
+
+    if (statement->groupBy != 0) {
+        unlinkExprArr(statement->groupBy->columns, release);
+        unlinkExpr(statement->groupBy->having, release);
+    }
+
+    if (statement->setOperations != 0) {
+        for (hsql::SetOperation* setOp : *statement->setOperations) {
+            if (setOp == 0)
+                continue;
+
+            unlinkSelectStatement(setOp->nestedSelectStatement, release);
+            unlinkOrderDescriptions(setOp->resultOrder, release);
+            unlinkLimitDescription(setOp->resultLimit, release);
+        }
+    }
+
+    unlinkOrderDescriptions(statement->order, release);
+
+    if (statement->withDescriptions != 0)
+        for (hsql::WithDescription* withDesc : *statement->withDescriptions)
+            if (withDesc != 0)
+                unlinkSelectStatement(withDesc->select, release);
+
+    unlinkLimitDescription(statement->limit, release);
+}
+
+void unlinkSQLStatement(hsql::SQLStatement* statement, ExprRelease* release)
+{
+    switch (statement->type()) {
         case StatementType::kStmtSelect:
-            freeSelectStatement((LuaSelectStatement*)luaStatement);
+            unlinkSelectStatement((hsql::SelectStatement*)statement, release);
+            break;
+        case StatementType::kStmtInsert: {
+            hsql::InsertStatement* insert = (hsql::InsertStatement*)statement;
+            unlinkExprArr(insert->values, release);
+            unlinkSelectStatement(insert->select, release);
+            break;
+        }
+        case StatementType::kStmtUpdate: {
+            hsql::UpdateStatement* update = (hsql::UpdateStatement*)statement;
+            unlinkTableRef(update->table, release);
+            if (update->updates != 0)
+                for (hsql::UpdateClause* clause : *update->updates)
+                    if (clause != 0)
+                        unlinkExpr(clause->value, release);
+            unlinkExpr(update->where, release);
+            break;
+        }
+        case StatementType::kStmtDelete:
+            unlinkExpr(((hsql::DeleteStatement*)statement)->expr, release);
             break;
-        // case StatementType::kStmtInsert:
-        //     // TODO: free insert statement
-        //     break;
-        // case StatementType::kStmtUpdate:
-        //     // TODO: free update statement
-        //     break;
-        // case StatementType::kStmtDelete:
-        //     // TODO: free delete statement
-        //     break;
         default:
-            free(luaStatement);
             break;
     }
 }
 
-LuaSQLParserResult* copySQLParserResult(hsql::SQLParserResult* result)
+void freeHyriseResult(hsql::SQLParserResult* result, size_t length)
 {
-    if (result == 0)
-        return 0;
+    // Queries shorter than this can not nest deep enough to matter.
+    if (length < 4096) {
+        result->reset();
+        return;
+    }
 
-    LuaSQLParserResult* luaResult = (LuaSQLParserResult*)std::malloc(
-        sizeof(LuaSQLParserResult));
-    luaResult->errorMsg = 0;
-    luaResult->errorLine = 0;
-    luaResult->errorColumn = 0;
-    luaResult->statementCount = 0;
-    luaResult->statements = 0;
+    ExprRelease release;
+
+    for (hsql::SQLStatement* statement : result->getStatements())
+        if (statement != 0)
+            unlinkSQLStatement(statement, &release);
+
+    for (hsql::Expr* expr : release.unlinked)
+        delete expr;
+
+    result->reset();
+}
+
+void parseBytesWith(void* scanner, const char* data, size_t length,
+    hsql::SQLParserResult* result)
+{
+    if (length > INT_MAX) {
+        result->setIsValid(false);
+        result->setErrorDetails(strdup("Query is too long"), 0, 0);
+        return;
+    }
+
+    YY_BUFFER_STATE state = hsql__scan_bytes(data, (int)length, scanner);
+
+    result->setIsValid(hsql_parse(result, scanner) == 0);
+
+    hsql__delete_buffer(state, scanner);
+}
+
+void parseBytes(const char* data, size_t length,
+    hsql::SQLParserResult* result)
+{
+    yyscan_t scanner;
+    if (hsql_lex_init(&scanner) != 0) {
+        result->setIsValid(false);
+        result->setErrorDetails(
+            strdup("Error when initializing lexer"), 0, 0);
+        return;
+    }
 
-    bool isValid = result->isValid();
-    luaResult->isValid = isValid;
+    parseBytesWith(scanner, data, length, result);
 
-    if (isValid) {
-        const std::vector<hsql::SQLStatement*>& statements =
-            result->getStatements();
+    hsql_lex_destroy(scanner);
+}
+
+bool queryTooLong(size_t length)
+{
+    return length > limitQueryBytes.load(std::memory_order_relaxed);
+}
+
+static void parseWith(void* scanner, const char* data, size_t length,
+    hsql::SQLParserResult* result)
+{
+    if (scanner != 0)
+        parseBytesWith(scanner, data, length, result);
+    else
+        parseBytes(data, length, result);
+}
 
-        luaResult->statementCount = result->size();
-        luaResult->statements =
-            copyArr<hsql::SQLStatement, LuaSQLStatement>(
-                &statements, copySQLStatement);
+LuaSQLParserResult* parseUncached(const char* data, size_t length,
+    void* scanner)
+{
+    LuaSQLParserResult* luaResult;
+
+    if (!statsOn()) {
+        hsql::SQLParserResult result;
+        parseWith(scanner, data, length, &result);
+
+        luaResult = copySQLParserResult(&result);
+        freeHyriseResult(&result, length);
+
+        if (simplifyOn() && luaResult->isValid)
+            simplifySQLParserResult(luaResult);
     }
     else {
-        luaResult->errorMsg = copyStr(result->errorMsg());
-        luaResult->errorLine = result->errorLine();
-        luaResult->errorColumn = result->errorColumn();
+        statsRecordQuery(length);
+
+        uint64_t start = statsNow();
+
+        hsql::SQLParserResult result;
+        parseWith(scanner, data, length, &result);
+
+        uint64_t parsed = statsNow();
+        statsRecordPhase(kPhaseParse, parsed - start);
+
+        // Freeing the hyrise tree is accounted to the copy.
+        luaResult = copySQLParserResult(&result);
+        freeHyriseResult(&result, length);
+
+        if (simplifyOn() && luaResult->isValid)
+            simplifySQLParserResult(luaResult);
+
+        statsRecordPhase(kPhaseCopy, statsNow() - parsed);
     }
 
     return luaResult;
 }
 
-void freeSQLParserResult(LuaSQLParserResult* luaResult)
+LuaSQLParserResult* parseSqlN(const char* data, size_t length)
 {
-    if (luaResult == 0)
-        return;
+    if (queryTooLong(length))
+        return newErrorResult(kErrorLimit, "Query is too long");
+
+    LuaSQLParserResult* luaResult = cacheLookup(data, length);
+    if (luaResult != 0)
+        return luaResult;
 
-    freeArr<LuaSQLStatement>(luaResult->statements,
-        luaResult->statementCount, freeSQLStatement);
+    luaResult = parseUncached(data, length, 0);
 
-    freeStr(luaResult->errorMsg);
+    // Rejections depend on the limits of the moment, do not keep them.
+    if (luaResult->errorCode != kErrorLimit)
+        cacheInsert(data, length, luaResult);
 
-    free(luaResult);
+    return luaResult;
 }
 
 LuaSQLParserResult* parseSql(const char* query)
 {
+    return parseSqlN(query, strlen(query));
+}
+
+void finalize(LuaSQLParserResult* result)
+{
+    if (!statsOn()) {
+        freeSQLParserResult(result);
+        return;
+    }
+
+    uint64_t start = statsNow();
+    freeSQLParserResult(result);
+    statsRecordPhase(kPhaseFinalize, statsNow() - start);
+}
+
+// A parser kept between parses: the hyrise result and the scratch space of
+// the copy keep their memory, and every result is copied into an arena that
+// is reset rather than released.
+struct LuaSQLParserContext {
+    yyscan_t scanner;
     hsql::SQLParserResult result;
-    hsql::SQLParser::parse(std::string(query), &result);
+    CopyContext copy;
+    Arena arena;
+};
+
+LuaSQLParserContext* sqlparser_context_new()
+{
+    LuaSQLParserContext* context = new (std::nothrow) LuaSQLParserContext();
+    if (context == 0)
+        return 0;
+
+    if (hsql_lex_init(&context->scanner) != 0) {
+        delete context;
+        return 0;
+    }
+
+    internSetInit(&context->copy.idents);
+    arenaInit(&context->arena);
+
+    return context;
+}
+
+void sqlparser_context_free(LuaSQLParserContext* context)
+{
+    if (context == 0)
+        return;
+
+    if (context->scanner != 0)
+        hsql_lex_destroy(context->scanner);
+    arenaRelease(&context->arena);
+
+    delete context;
+}
+
+static LuaSQLParserResult* copyContextResult(LuaSQLParserContext* context)
+{
+    if (!context->result.isValid())
+        return copyErrorResult(&context->result, &context->arena);
+
+    internSetClear(&context->copy.idents);
+    context->copy.exprTasks.clear();
+
+    return copyValidResult(&context->result, &context->arena,
+        &context->copy);
+}
+
+// Flex keeps the start condition of a scanner from one input to the next
+// and has no call to reset it, so a query ending inside a comment or a
+// string literal would make the next one start there. The scanner is made
+// afresh instead; it is left 0 if that fails, making parseWith() use a
+// scanner of its own.
+static void resetContextScanner(LuaSQLParserContext* context)
+{
+    if (context->scanner != 0)
+        hsql_lex_destroy(context->scanner);
+
+    if (hsql_lex_init(&context->scanner) != 0)
+        context->scanner = 0;
+}
+
+static void resetContextResult(LuaSQLParserContext* context, size_t length)
+{
+    freeHyriseResult(&context->result, length);
+
+    // reset() leaves the placeholders of the query in the result. They are
+    // not read again, but would pile up from query to query.
+    if (context->result.parameters().size() > 1024) {
+        context->result.~SQLParserResult();
+        new (&context->result) hsql::SQLParserResult();
+    }
+}
+
+LuaSQLParserResult* parseSqlContext(LuaSQLParserContext* context,
+    const char* data, size_t length)
+{
+    // The previous result goes away, its memory is kept for this one.
+    arenaReset(&context->arena);
+
+    if (queryTooLong(length)) {
+        return newErrorResultIn(&context->arena, kErrorLimit,
+            "Query is too long");
+    }
+
+    resetContextScanner(context);
+
+    LuaSQLParserResult* luaResult;
+
+    if (!statsOn()) {
+        parseWith(context->scanner, data, length, &context->result);
+
+        luaResult = copyContextResult(context);
+        resetContextResult(context, length);
+
+        if (simplifyOn() && luaResult->isValid)
+            simplifySQLParserResult(luaResult);
+    }
+    else {
+        statsRecordQuery(length);
+
+        uint64_t start = statsNow();
+
+        parseWith(context->scanner, data, length, &context->result);
+
+        uint64_t parsed = statsNow();
+        statsRecordPhase(kPhaseParse, parsed - start);
+
+        luaResult = copyContextResult(context);
+        resetContextResult(context, length);
+
+        if (simplifyOn() && luaResult->isValid)
+            simplifySQLParserResult(luaResult);
+
+        statsRecordPhase(kPhaseCopy, statsNow() - parsed);
+    }
 
-    LuaSQLParserResult* luaResult = copySQLParserResult(&result);
     return luaResult;
 }
 
-void finalize(LuaSQLParserResult* result)
+// A batch is parsed by the calling thread together with helpers from the
+// worker pool, each taking the next unparsed query until none are left.
+// The pool is shared with other jobs, so a helper may only start once the
+// batch is over: the caller waits for the parsed queries rather than for
+// the helpers, and whichever of them lets go of the batch last frees it.
+struct BatchJob {
+    std::atomic<int> refCount;
+
+    const char* const* queries;
+    const size_t* lengths;
+    size_t count;
+    LuaSQLParserResult** results;
+
+    std::atomic<size_t> next;
+    std::atomic<size_t> completed;
+
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+void unrefBatch(BatchJob* batch)
 {
-    freeSQLParserResult(result);
+    if (batch->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete batch;
+}
+
+void runBatch(BatchJob* batch)
+{
+    size_t i;
+
+    // The queries belong to the caller, they are only touched for indexes
+    // it still waits for.
+    while ((i = batch->next.fetch_add(1)) < batch->count) {
+        const char* query = batch->queries[i];
+
+        size_t length;
+        if (batch->lengths != 0)
+            length = batch->lengths[i];
+        else
+            length = strlen(query);
+
+        batch->results[i] = parseSqlN(query, length);
+
+        if (batch->completed.fetch_add(1) + 1 == batch->count) {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->done.notify_one();
+        }
+    }
+}
+
+void runBatchHelper(void* arg)
+{
+    BatchJob* batch = (BatchJob*)arg;
+
+    runBatch(batch);
+    unrefBatch(batch);
+}
+
+LuaSQLParserResult** parseSqlBatch(const char* const* queries,
+    const size_t* lengths, size_t count)
+{
+    LuaSQLParserResult** results =
+        (LuaSQLParserResult**)calloc(count != 0 ? count : 1,
+            sizeof(LuaSQLParserResult*));
+    if (results == 0)
+        return 0;
+
+    BatchJob* batch = new (std::nothrow) BatchJob();
+    if (batch == 0) {
+        free(results);
+        return 0;
+    }
+
+    batch->queries = queries;
+    batch->lengths = lengths;
+    batch->count = count;
+    batch->results = results;
+    batch->next = 0;
+    batch->completed = 0;
+
+    size_t helpers = count > 1 ? std::min(workersCount(), count - 1) : 0;
+
+    batch->refCount = (int)helpers + 1;
+    for (size_t i = 0; i < helpers; i++)
+        workersSubmit(runBatchHelper, batch);
+
+    runBatch(batch);
+
+    {
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->done.wait(lock,
+            [batch] { return batch->completed.load() == batch->count; });
+    }
+
+    unrefBatch(batch);
+
+    return results;
+}
+
+void finalizeBatch(LuaSQLParserResult** results, size_t count)
+{
+    if (results == 0)
+        return;
+
+    for (size_t i = 0; i < count; i++)
+        if (results[i] != 0)
+            freeSQLParserResult(results[i]);
+
+    free(results);
+}
+
+void sqlparser_limits_configure(size_t maxQueryBytes, size_t maxNodes,
+    size_t maxDepth, size_t maxStringBytes)
+{
+    limitQueryBytes.store(maxQueryBytes != 0 ? maxQueryBytes : SIZE_MAX,
+        std::memory_order_relaxed);
+    limitNodes.store(maxNodes != 0 ? maxNodes : SIZE_MAX,
+        std::memory_order_relaxed);
+    limitDepth.store(maxDepth != 0 ? maxDepth : SIZE_MAX,
+        std::memory_order_relaxed);
+    limitStringBytes.store(maxStringBytes != 0 ? maxStringBytes : SIZE_MAX,
+        std::memory_order_relaxed);
+
+    // Cached results were only checked against the limits of their parse.
+    cacheClear();
+}
+
+void sqlparser_workers_configure(size_t count)
+{
+    workersConfigure(count);
 }
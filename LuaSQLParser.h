@@ -1,6 +1,227 @@
+#ifndef LUA_SQL_PARSER_H
+#define LUA_SQL_PARSER_H
+
 #include <cstddef>
 #include <cstdint>
 #include "LuaDataTypes.h"
 
 extern "C" LuaSQLParserResult* parseSql(const char* query);
+// Parses `length` bytes of `data`. The query does not have to be
+// NUL-terminated: the scanner takes its own copy of exactly those bytes.
+extern "C" LuaSQLParserResult* parseSqlN(const char* data, size_t length);
 extern "C" void finalize(LuaSQLParserResult* result);
+
+// A parser context keeps its scratch space and result memory from one parse
+// to the next, so that parsing short queries again and again allocates next
+// to nothing but the scanner and the hyrise tree. Each parse starts with a
+// fresh scanner, whatever state the previous query left. parseSqlContext()
+// works like parseSqlN(), bypassing the parse cache; the result belongs to
+// the context and stays valid until its next parse or its release, it must
+// not be finalized. A context is for one thread at a time, typically one
+// per thread. sqlparser_context_new() returns 0 if out of memory.
+typedef struct LuaSQLParserContext LuaSQLParserContext;
+
+extern "C" LuaSQLParserContext* sqlparser_context_new();
+extern "C" void sqlparser_context_free(LuaSQLParserContext* context);
+extern "C" LuaSQLParserResult* parseSqlContext(LuaSQLParserContext* context,
+    const char* data, size_t length);
+
+// Parses `count` queries on the worker pool and returns their results in
+// input order. `lengths` may be 0 for NUL-terminated queries. The array and
+// every result left in it are released by finalizeBatch(); a caller may take
+// over a result by replacing its entry with 0.
+extern "C" LuaSQLParserResult** parseSqlBatch(const char* const* queries,
+    const size_t* lengths, size_t count);
+extern "C" void finalizeBatch(LuaSQLParserResult** results, size_t count);
+
+// Sets the number of threads of the worker pool, zero means one per
+// hardware thread. The threads are started on first use.
+//
+// All parse functions may be called from any thread concurrently. The
+// hyrise lexer and parser are generated as reentrant (flex `reentrant`,
+// bison `api.pure`), so each call owns its scanner and parser state; the
+// results live in per-result arenas, and the parse cache and the worker
+// pool are guarded by their own locks.
+extern "C" void sqlparser_workers_configure(size_t count);
+
+// Asynchronous parsing on the worker pool. The query is copied. Once the
+// parse is over, the fd returned by parseSqlAsyncFd() becomes readable and
+// parseSqlAsyncResult() hands out the result, it returns 0 before that and
+// on any later call. The job is released with parseSqlAsyncRelease(), at
+// any time: a running parse is then dropped when it completes.
+// parseSqlAsync() returns 0 if no fd can be created.
+typedef struct LuaSQLAsyncParse LuaSQLAsyncParse;
+
+extern "C" LuaSQLAsyncParse* parseSqlAsync(const char* data, size_t length);
+extern "C" int parseSqlAsyncFd(LuaSQLAsyncParse* job);
+extern "C" LuaSQLParserResult* parseSqlAsyncResult(LuaSQLAsyncParse* job);
+extern "C" void parseSqlAsyncRelease(LuaSQLAsyncParse* job);
+
+// Parses a script of `;`-separated statements a batch at a time. Each call
+// of parseSqlStreamNext() parses up to `maxStatements` further statements
+// into a result of their own, to be finalized by the caller, and returns 0
+// once the script is over. Only the script is kept between calls, so the
+// memory in use is bounded by the largest batch. The script is not copied
+// and must outlive the stream; the parse cache is bypassed, the length
+// limit applies to each batch. parseSqlStreamOpen() returns 0 if out of
+// memory.
+typedef struct LuaSQLStream LuaSQLStream;
+
+extern "C" LuaSQLStream* parseSqlStreamOpen(const char* data, size_t length);
+extern "C" LuaSQLParserResult* parseSqlStreamNext(LuaSQLStream* stream,
+    size_t maxStatements);
+extern "C" void parseSqlStreamClose(LuaSQLStream* stream);
+
+// Renders a parser result back to SQL text, the same way sqlgen.lua does.
+// Returns 0 if out of memory.
+extern "C" LuaSQLGenResult* generateSql(const LuaSQLParserResult* result);
+extern "C" void finalizeGenerated(LuaSQLGenResult* gen);
+
+// Parses a single statement and renders it into a template, with the text
+// between its parameters precomputed. renderTemplate() then binds a value
+// to every parameter, `values[i]` to the one of id i, in one pass over the
+// template: numbers and booleans are written as literals, strings quoted
+// with their quotes doubled and null values as NULL. It writes up to
+// `capacity` bytes into `buffer`, no terminating NUL, and returns the
+// length of the whole query, which is to be rendered again into a larger
+// buffer if it does not fit. Returns -1 if there are fewer values than
+// parameters, a float is not finite, a string has a NUL byte or the
+// template failed. prepareSql() returns 0 if out of memory.
+extern "C" LuaSQLTemplate* prepareSql(const char* data, size_t length);
+extern "C" int64_t renderTemplate(const LuaSQLTemplate* tmpl,
+    const LuaSQLValue* values, size_t count, char* buffer, size_t capacity);
+extern "C" void finalizeTemplate(LuaSQLTemplate* tmpl);
+
+// Parses a query like parseSqlN() and encodes the result as MessagePack,
+// with the keys and values of the table sqlparser.lua decodes it into. The
+// encoding goes into `buffer` if it fits in `capacity` bytes, otherwise
+// into memory to be released by freeMsgpack(); *data is set to wherever it
+// went. Returns the size of the encoding, or 0 if out of memory or if
+// SELECTs and table references nest more than 256 levels deep, the most
+// generateSqlFromMsgpack() reads back.
+extern "C" size_t parseSqlToMsgpack(const char* query, size_t length,
+    char* buffer, size_t capacity, char** data);
+extern "C" void freeMsgpack(char* data);
+
+// Renders a MessagePack encoded result back to SQL text, as generateSql()
+// does. Malformed input is reported through errorMsg. Returns 0 if out of
+// memory.
+extern "C" LuaSQLGenResult* generateSqlFromMsgpack(const char* data,
+    size_t size);
+
+// Rewrites queries natively and renders them back to SQL, no AST is built.
+// A rewriter renames logical tables to physical ones, along with the
+// column qualifiers naming them, unless a WITH table or an alias hides
+// the name. It ANDs a predicate into every query block, UPDATE and DELETE
+// once per logical table. Unqualified columns of the predicate are
+// qualified by the table's alias or physical name. For a table on the
+// nullable side of an outer join the predicate goes into the join
+// condition instead. Placeholders of the predicate come out as `?` where
+// it is injected. A non-zero limit caps the integer LIMIT of top-level
+// SELECTs, adding one where there is none; a LIMIT given by a parameter is
+// left as it is.
+//
+// A rewriter must not be changed while it is in use, rewriteSql() may be
+// called from any number of threads. Rewritten queries are parsed past the
+// parse cache. sqlparser_rewriter_new() returns 0 if out of memory, a null
+// physical name removes a rule and sqlparser_rewriter_predicate() returns
+// false if the predicate is not a single WHERE clause.
+typedef struct LuaSQLRewriter LuaSQLRewriter;
+
+extern "C" LuaSQLRewriter* sqlparser_rewriter_new();
+extern "C" void sqlparser_rewriter_free(LuaSQLRewriter* rewriter);
+extern "C" void sqlparser_rewriter_table(LuaSQLRewriter* rewriter,
+    const char* logical, const char* physical);
+extern "C" bool sqlparser_rewriter_predicate(LuaSQLRewriter* rewriter,
+    const char* predicate);
+extern "C" void sqlparser_rewriter_limit(LuaSQLRewriter* rewriter,
+    int64_t maxLimit);
+extern "C" LuaSQLGenResult* rewriteSql(const LuaSQLRewriter* rewriter,
+    const char* data, size_t length);
+
+// Parses a query for its table and column references only. The hyrise tree
+// is walked once, nothing else of the statements is copied. Columns are
+// attributed to tables by qualifier, searching enclosing queries for
+// correlated ones, or to the only table in scope when unqualified. The
+// limits of sqlparser_limits_configure() apply as they do to parseSql().
+extern "C" LuaSQLReferences* parseSqlReferences(const char* data,
+    size_t length);
+extern "C" void finalizeReferences(LuaSQLReferences* refs);
+
+// Parses a single statement and finds the shard keys its WHERE clause pins
+// to literals or parameters, through AND, OR, IN and equalities. SELECT,
+// UPDATE and DELETE of one table and INSERT with named columns are
+// analysed; anything else, or a key left unpinned, scatters the statement.
+extern "C" LuaSQLShardKeys* parseSqlShardKeys(const char* data,
+    size_t length);
+extern "C" void finalizeShardKeys(LuaSQLShardKeys* keys);
+
+// Registers the shard key columns of a table, replacing earlier ones. Zero
+// columns unregister the table.
+extern "C" void sqlparser_shard_key_set(const char* table,
+    const char* const* columns, size_t count);
+extern "C" void sqlparser_shard_key_clear();
+
+// Lexes a query without parsing it. The token numbers of the first
+// `capacity` tokens are stored into `tokens` and, unless `offsets` is 0,
+// their byte offsets into `offsets`. Lexing stops once the buffer is full.
+// Returns the number of tokens stored, or -1 if the query can not be lexed
+// or is over the length limit. Single-character tokens are numbered by
+// their character, sqlparser_token() numbers the others.
+extern "C" int64_t tokenizeSql(const char* data, size_t length,
+    int16_t* tokens, uint32_t* offsets, size_t capacity);
+
+// Returns the number of a keyword token by its upper case name, or of the
+// IDENTIFIER, STRING, FLOATVAL and INTVAL tokens; -1 for unknown names.
+extern "C" int sqlparser_token(const char* name);
+
+// Parses a query into a single buffer of LuaFlat* nodes. The limits of
+// sqlparser_limits_configure() apply as they do to parseSql(). Returns 0 if
+// the buffer would outgrow 4GB or memory is exhausted.
+extern "C" LuaFlatResult* parseSqlFlat(const char* query);
+extern "C" void finalizeFlat(LuaFlatResult* result);
+
+// The names of all enum values of the results, for decoders.
+extern "C" const LuaSQLEnumNames* sqlparser_enum_names();
+
+// Parse cache. Results handed out by parseSql() while the cache is enabled
+// may be shared between callers and must be treated as immutable; every
+// caller still releases its own reference with finalize(). A zero budget
+// disables the cache.
+extern "C" void sqlparser_cache_configure(size_t maxEntries, size_t maxBytes);
+extern "C" void sqlparser_cache_stats(LuaSQLCacheStats* stats);
+
+// Simplifies the results parsed from now on: constant arithmetic and
+// comparisons are folded, AND and OR chains lose TRUE and FALSE operands and
+// repeated ones, double negations are removed and single-valued BETWEEN and
+// IN become equalities. Fingerprints and literals still describe the query
+// as written. Switching clears the parse cache.
+extern "C" void sqlparser_simplify_enable(bool enable);
+
+// Limits on the queries parsed from now on, zero disables a limit. Longer
+// queries are rejected before parsing; trees with more nodes (expressions,
+// table references and statements), deeper nesting or more bytes of
+// strings are rejected as soon as the copy reaches the limit. Rejected
+// queries get an invalid result with the kErrorLimit error code.
+// Configuring clears the parse cache, so that cached results are held to
+// the new limits as well.
+extern "C" void sqlparser_limits_configure(size_t maxQueryBytes,
+    size_t maxNodes, size_t maxDepth, size_t maxStringBytes);
+
+// Identifiers (table, column and alias names) are interned: the repeated
+// ones of a result share one copy. With a non-zero budget they are also
+// interned process-wide into a buffer of `maxBytes`, shared by all results
+// and never freed; once it is full, new identifiers are only interned per
+// result. Reconfiguring starts a new buffer, the old one stays alive.
+extern "C" void sqlparser_intern_configure(size_t maxBytes);
+extern "C" void sqlparser_intern_stats(LuaSQLInternStats* stats);
+
+// Per-phase timing and tree size statistics, off by default. While disabled
+// the parse path does not read the clock. The decode phase runs in Lua and
+// is reported by sqlparser_stats_decode().
+extern "C" void sqlparser_stats_enable(bool enable);
+extern "C" void sqlparser_stats_reset();
+extern "C" void sqlparser_stats_decode(uint64_t ns);
+extern "C" void sqlparser_stats(LuaSQLStats* stats);
+
+#endif
@@ -0,0 +1,617 @@
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "hyrise/src/SQLParser.h"
+#include "LuaSQLArena.h"
+#include "LuaSQLParse.h"
+#include "LuaSQLParser.h"
+
+
+// A name columns can be qualified with: an alias or a table name of a FROM
+// clause. `table` indexes RefsContext::tables, it is -1 for subqueries and
+// WITH tables.
+struct ScopeEntry {
+    const char* name;
+    int64_t table;
+};
+
+struct TableKey {
+    const char* schema;
+    const char* name;
+    const char* alias;
+};
+
+struct ColumnKey {
+    int64_t table;
+    const char* name;
+};
+
+// A pending expression of walkExpr() and the nesting it is found at.
+struct RefsExpr {
+    const hsql::Expr* expr;
+    size_t depth;
+};
+
+// State of one walk over a hyrise tree. Names point into the tree until
+// they are copied into the result.
+struct RefsContext {
+    std::vector<TableKey> tables;
+    std::vector<ColumnKey> columns;
+
+    // Serialized keys of the tables and columns found so far.
+    std::unordered_map<std::string, int64_t> tableIndex;
+    std::unordered_set<std::string> columnIndex;
+
+    // FROM entries of the queries being walked, the innermost last. Those of
+    // query i start at scope[scopeStarts[i]].
+    std::vector<ScopeEntry> scope;
+    std::vector<size_t> scopeStarts;
+
+    // Names of the WITH tables in scope.
+    std::vector<const char*> withNames;
+
+    // Pending expressions of walkExpr(), shared by the nested calls for
+    // subqueries.
+    std::vector<RefsExpr> exprs;
+
+    // The limits of sqlparser_limits_configure(), checked the way the copy
+    // into a LuaSQLParserResult checks them: expressions, table references
+    // and statements walked so far, their current nesting and the bytes of
+    // string literals. The walk stops once one is exceeded.
+    Limits limits;
+    size_t nodeCount;
+    size_t depth;
+    size_t stringBytes;
+    const char* limitError;
+};
+
+struct LuaSQLReferencesHolder {
+    Arena arena;
+    LuaSQLReferences refs;
+};
+
+
+static void walkSelect(const hsql::SelectStatement* statement,
+    RefsContext* ctx);
+
+static void appendKey(std::string& key, const char* str)
+{
+    if (str == 0) {
+        key += '\1';
+        return;
+    }
+
+    key += '\2';
+    key += str;
+    key += '\0';
+}
+
+static int64_t addTable(const char* schema, const char* name,
+    const char* alias, RefsContext* ctx)
+{
+    std::string key;
+    appendKey(key, schema);
+    appendKey(key, name);
+    appendKey(key, alias);
+
+    auto it = ctx->tableIndex.find(key);
+    if (it != ctx->tableIndex.end())
+        return it->second;
+
+    int64_t table = ctx->tables.size();
+
+    ctx->tables.push_back(TableKey { schema, name, alias });
+    ctx->tableIndex.emplace(std::move(key), table);
+
+    return table;
+}
+
+static void addColumn(int64_t table, const char* name, RefsContext* ctx)
+{
+    std::string key((const char*)&table, sizeof(table));
+    appendKey(key, name);
+
+    if (ctx->columnIndex.insert(std::move(key)).second)
+        ctx->columns.push_back(ColumnKey { table, name });
+}
+
+static void pushScope(RefsContext* ctx)
+{
+    ctx->scopeStarts.push_back(ctx->scope.size());
+}
+
+static void popScope(RefsContext* ctx)
+{
+    ctx->scope.resize(ctx->scopeStarts.back());
+    ctx->scopeStarts.pop_back();
+}
+
+// Looks the qualifier up from the innermost query outwards, so correlated
+// columns are attributed to the table of the enclosing query.
+static int64_t resolveQualified(const char* qualifier, RefsContext* ctx)
+{
+    for (size_t i = ctx->scope.size(); i-- > 0;)
+        if (strcmp(ctx->scope[i].name, qualifier) == 0)
+            return ctx->scope[i].table;
+
+    return -1;
+}
+
+static int64_t resolveUnqualified(RefsContext* ctx)
+{
+    if (ctx->scopeStarts.empty() ||
+        ctx->scope.size() - ctx->scopeStarts.back() != 1)
+        return -1;
+
+    return ctx->scope.back().table;
+}
+
+static int64_t resolveColumn(const char* qualifier, RefsContext* ctx)
+{
+    if (qualifier != 0)
+        return resolveQualified(qualifier, ctx);
+
+    return resolveUnqualified(ctx);
+}
+
+static bool isWithName(const char* name, RefsContext* ctx)
+{
+    for (const char* withName : ctx->withNames)
+        if (strcmp(withName, name) == 0)
+            return true;
+
+    return false;
+}
+
+static bool enterNode(RefsContext* ctx)
+{
+    if (ctx->limitError != 0)
+        return false;
+
+    if (ctx->nodeCount >= ctx->limits.maxNodes) {
+        ctx->limitError = "Query has too many nodes";
+        return false;
+    }
+
+    if (ctx->depth >= ctx->limits.maxDepth) {
+        ctx->limitError = "Query is nested too deeply";
+        return false;
+    }
+
+    ctx->nodeCount++;
+    ctx->depth++;
+
+    return true;
+}
+
+static void leaveNode(RefsContext* ctx)
+{
+    ctx->depth--;
+}
+
+static bool countString(const char* str, RefsContext* ctx)
+{
+    size_t n = strlen(str) + 1;
+
+    if (n > ctx->limits.maxStringBytes - ctx->stringBytes) {
+        ctx->limitError = "Query has too many string bytes";
+        return false;
+    }
+    ctx->stringBytes += n;
+
+    return true;
+}
+
+static void walkExpr(const hsql::Expr* expr, RefsContext* ctx)
+{
+    if (expr == 0 || ctx->limitError != 0)
+        return;
+
+    std::vector<RefsExpr>& exprs = ctx->exprs;
+
+    // Subqueries call back into walkExpr(), their expressions go on top of
+    // ours.
+    size_t base = exprs.size();
+    size_t depth = ctx->depth;
+
+    exprs.push_back(RefsExpr { expr, depth });
+
+    while (exprs.size() > base && ctx->limitError == 0) {
+        expr = exprs.back().expr;
+        ctx->depth = exprs.back().depth;
+        exprs.pop_back();
+
+        if (!enterNode(ctx))
+            break;
+
+        if (expr->type == hsql::kExprLiteralString && expr->name != 0 &&
+            !countString(expr->name, ctx))
+            break;
+
+        if (expr->type == hsql::kExprColumnRef && expr->name != 0)
+            addColumn(resolveColumn(expr->table, ctx), expr->name, ctx);
+        else if (expr->type == hsql::kExprStar)
+            addColumn(resolveColumn(expr->table, ctx), "*", ctx);
+
+        walkSelect(expr->select, ctx);
+
+        size_t childDepth = ctx->depth;
+
+        if (expr->exprList != 0)
+            for (size_t i = expr->exprList->size(); i-- > 0;)
+                if ((*expr->exprList)[i] != 0)
+                    exprs.push_back(
+                        RefsExpr { (*expr->exprList)[i], childDepth });
+
+        if (expr->expr2 != 0)
+            exprs.push_back(RefsExpr { expr->expr2, childDepth });
+        if (expr->expr != 0)
+            exprs.push_back(RefsExpr { expr->expr, childDepth });
+    }
+
+    // Left over once a limit is exceeded.
+    exprs.resize(base);
+
+    ctx->depth = depth;
+}
+
+static void walkExprArr(const std::vector<hsql::Expr*>* v,
+    RefsContext* ctx)
+{
+    if (v == 0)
+        return;
+
+    for (const hsql::Expr* expr : *v)
+        walkExpr(expr, ctx);
+}
+
+static void walkOrder(const std::vector<hsql::OrderDescription*>* v,
+    RefsContext* ctx)
+{
+    if (v == 0)
+        return;
+
+    for (const hsql::OrderDescription* orderDesc : *v)
+        if (orderDesc != 0)
+            walkExpr(orderDesc->expr, ctx);
+}
+
+static void walkLimit(const hsql::LimitDescription* limitDesc,
+    RefsContext* ctx)
+{
+    if (limitDesc == 0)
+        return;
+
+    walkExpr(limitDesc->limit, ctx);
+    walkExpr(limitDesc->offset, ctx);
+}
+
+// Adds the FROM entries of `tableRef` to the innermost scope. The join
+// conditions are only collected: they may refer to any table of the FROM
+// clause, so they are walked once all of them are in scope.
+static void walkTableRef(const hsql::TableRef* tableRef,
+    std::vector<const hsql::Expr*>* conditions, RefsContext* ctx)
+{
+    if (tableRef == 0 || !enterNode(ctx))
+        return;
+
+    const char* alias = tableRef->alias != 0 ? tableRef->alias->name : 0;
+
+    switch (tableRef->type) {
+        case hsql::kTableName:
+            if (tableRef->name == 0)
+                break;
+
+            if (tableRef->schema == 0 && isWithName(tableRef->name, ctx)) {
+                ctx->scope.push_back(ScopeEntry {
+                    alias != 0 ? alias : tableRef->name, -1 });
+                break;
+            }
+
+            ctx->scope.push_back(ScopeEntry {
+                alias != 0 ? alias : tableRef->name,
+                addTable(tableRef->schema, tableRef->name, alias, ctx) });
+            break;
+        case hsql::kTableSelect:
+            walkSelect(tableRef->select, ctx);
+
+            if (alias != 0)
+                ctx->scope.push_back(ScopeEntry { alias, -1 });
+            break;
+        case hsql::kTableJoin:
+            if (tableRef->join == 0)
+                break;
+
+            walkTableRef(tableRef->join->left, conditions, ctx);
+            walkTableRef(tableRef->join->right, conditions, ctx);
+
+            if (tableRef->join->condition != 0)
+                conditions->push_back(tableRef->join->condition);
+            break;
+        case hsql::kTableCrossProduct:
+            if (tableRef->list != 0)
+                for (const hsql::TableRef* item : *tableRef->list)
+                    walkTableRef(item, conditions, ctx);
+            break;
+    }
+
+    leaveNode(ctx);
+}
+
+static void walkSelect(const hsql::SelectStatement* statement,
+    RefsContext* ctx)
+{
+    if (statement == 0 || !enterNode(ctx))
+        return;
+
+    size_t withCount = ctx->withNames.size();
+
+    // A WITH table sees the ones defined before it.
+    if (statement->withDescriptions != 0) {
+        for (const hsql::WithDescription* withDesc :
+            *statement->withDescriptions)
+        {
+            if (withDesc == 0)
+                continue;
+
+            walkSelect(withDesc->select, ctx);
+
+            if (withDesc->alias != 0)
+                ctx->withNames.push_back(withDesc->alias);
+        }
+    }
+
+    pushScope(ctx);
+
+    std::vector<const hsql::Expr*> conditions;
+    walkTableRef(statement->fromTable, &conditions, ctx);
+
+    for (const hsql::Expr* condition : conditions)
+        walkExpr(condition, ctx);
+
+    walkExprArr(statement->selectList, ctx);
+    walkExpr(statement->whereClause, ctx);
+
+    if (statement->groupBy != 0) {
+        walkExprArr(statement->groupBy->columns, ctx);
+        walkExpr(statement->groupBy->having, ctx);
+    }
+
+    walkOrder(statement->order, ctx);
+    walkLimit(statement->limit, ctx);
+
+    if (statement->setOperations != 0) {
+        for (const hsql::SetOperation* setOp : *statement->setOperations) {
+            if (setOp == 0)
+                continue;
+
+            walkOrder(setOp->resultOrder, ctx);
+            walkLimit(setOp->resultLimit, ctx);
+        }
+    }
+
+    popScope(ctx);
+
+    // The operands of a set operation do not see the FROM clause of the
+    // first one.
+    if (statement->setOperations != 0)
+        for (const hsql::SetOperation* setOp : *statement->setOperations)
+            if (setOp != 0)
+                walkSelect(setOp->nestedSelectStatement, ctx);
+
+    ctx->withNames.resize(withCount);
+
+    leaveNode(ctx);
+}
+
+// INSERT, UPDATE and DELETE put their target table in scope.
+static void pushTargetScope(const char* schema, const char* name,
+    RefsContext* ctx)
+{
+    pushScope(ctx);
+
+    if (name != 0)
+        ctx->scope.push_back(ScopeEntry { name,
+            addTable(schema, name, 0, ctx) });
+}
+
+static void walkSQLStatement(const hsql::SQLStatement* statement,
+    RefsContext* ctx)
+{
+    if (statement->type() == hsql::kStmtSelect) {
+        walkSelect((const hsql::SelectStatement*)statement, ctx);
+        return;
+    }
+
+    if (!enterNode(ctx))
+        return;
+
+    switch (statement->type()) {
+        case hsql::kStmtInsert: {
+            const hsql::InsertStatement* insert =
+                (const hsql::InsertStatement*)statement;
+
+            pushTargetScope(insert->schema, insert->tableName, ctx);
+
+            if (insert->columns != 0)
+                for (const char* column : *insert->columns)
+                    if (column != 0)
+                        addColumn(resolveUnqualified(ctx), column, ctx);
+
+            walkExprArr(insert->values, ctx);
+
+            popScope(ctx);
+
+            walkSelect(insert->select, ctx);
+            break;
+        }
+        case hsql::kStmtUpdate: {
+            const hsql::UpdateStatement* update =
+                (const hsql::UpdateStatement*)statement;
+
+            pushScope(ctx);
+
+            std::vector<const hsql::Expr*> conditions;
+            walkTableRef(update->table, &conditions, ctx);
+
+            if (update->updates != 0) {
+                for (const hsql::UpdateClause* clause : *update->updates) {
+                    if (clause == 0)
+                        continue;
+
+                    if (clause->column != 0)
+                        addColumn(resolveUnqualified(ctx), clause->column,
+                            ctx);
+
+                    walkExpr(clause->value, ctx);
+                }
+            }
+
+            walkExpr(update->where, ctx);
+
+            popScope(ctx);
+            break;
+        }
+        case hsql::kStmtDelete: {
+            const hsql::DeleteStatement* del =
+                (const hsql::DeleteStatement*)statement;
+
+            pushTargetScope(del->schema, del->tableName, ctx);
+            walkExpr(del->expr, ctx);
+            popScope(ctx);
+            break;
+        }
+        default:
+            break;
+    }
+
+    leaveNode(ctx);
+}
+
+static char* copyRefStr(const char* str, Arena* arena)
+{
+    if (str == 0)
+        return 0;
+
+    size_t n = strlen(str) + 1;
+    char* copy = (char*)arenaAlloc(arena, n, 1);
+    std::memcpy(copy, str, n);
+
+    return copy;
+}
+
+static LuaSQLReferencesHolder* newReferencesHolder(Arena* arena)
+{
+    LuaSQLReferencesHolder* holder =
+        new (arenaNew<LuaSQLReferencesHolder>(arena)) LuaSQLReferencesHolder;
+
+    LuaSQLReferences* refs = &holder->refs;
+    refs->isValid = false;
+    refs->errorCode = kErrorNone;
+    refs->errorMsg = 0;
+    refs->errorLine = 0;
+    refs->errorColumn = 0;
+    refs->tableCount = 0;
+    refs->tables = 0;
+    refs->columnCount = 0;
+    refs->columns = 0;
+
+    return holder;
+}
+
+LuaSQLReferences* parseSqlReferences(const char* data, size_t length)
+{
+    Arena arena;
+    arenaInit(&arena);
+
+    LuaSQLReferencesHolder* holder = newReferencesHolder(&arena);
+    LuaSQLReferences* refs = &holder->refs;
+
+    if (queryTooLong(length)) {
+        refs->errorCode = kErrorLimit;
+        refs->errorMsg = copyRefStr("Query is too long", &arena);
+
+        holder->arena = arena;
+        return refs;
+    }
+
+    hsql::SQLParserResult result;
+    parseBytes(data, length, &result);
+
+    if (!result.isValid()) {
+        refs->errorCode = kErrorSyntax;
+        refs->errorMsg = copyRefStr(result.errorMsg(), &arena);
+        refs->errorLine = result.errorLine();
+        refs->errorColumn = result.errorColumn();
+    }
+    else {
+        RefsContext ctx;
+        ctx.limits = getLimits();
+        ctx.nodeCount = 0;
+        ctx.depth = 0;
+        ctx.stringBytes = 0;
+        ctx.limitError = 0;
+
+        for (const hsql::SQLStatement* statement : result.getStatements())
+            if (statement != 0)
+                walkSQLStatement(statement, &ctx);
+
+        if (ctx.limitError != 0) {
+            refs->errorCode = kErrorLimit;
+            refs->errorMsg = copyRefStr(ctx.limitError, &arena);
+
+            freeHyriseResult(&result, length);
+
+            holder->arena = arena;
+            return refs;
+        }
+
+        refs->isValid = true;
+
+        refs->tableCount = ctx.tables.size();
+        refs->tables = (LuaTableReference*)arenaAlloc(&arena,
+            ctx.tables.size() * sizeof(LuaTableReference),
+            alignof(LuaTableReference));
+
+        for (size_t i = 0; i < ctx.tables.size(); i++) {
+            refs->tables[i].schema = copyRefStr(ctx.tables[i].schema, &arena);
+            refs->tables[i].name = copyRefStr(ctx.tables[i].name, &arena);
+            refs->tables[i].alias = copyRefStr(ctx.tables[i].alias, &arena);
+        }
+
+        refs->columnCount = ctx.columns.size();
+        refs->columns = (LuaColumnReference*)arenaAlloc(&arena,
+            ctx.columns.size() * sizeof(LuaColumnReference),
+            alignof(LuaColumnReference));
+
+        for (size_t i = 0; i < ctx.columns.size(); i++) {
+            refs->columns[i].table = ctx.columns[i].table;
+            refs->columns[i].name = copyRefStr(ctx.columns[i].name, &arena);
+        }
+    }
+
+    freeHyriseResult(&result, length);
+
+    // The arena has kept growing, hand its final state over to the holder
+    // only now.
+    holder->arena = arena;
+
+    return refs;
+}
+
+void finalizeReferences(LuaSQLReferences* refs)
+{
+    if (refs == 0)
+        return;
+
+    LuaSQLReferencesHolder* holder = (LuaSQLReferencesHolder*)(
+        (char*)refs - offsetof(LuaSQLReferencesHolder, refs));
+
+    // The holder lives inside the arena it describes.
+    Arena arena = holder->arena;
+    arenaRelease(&arena);
+}
@@ -0,0 +1,585 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "LuaSQLArena.h"
+#include "LuaSQLParse.h"
+#include "LuaSQLParser.h"
+
+
+// Rules of a rewrite, see sqlparser_rewriter_new(). They are not changed
+// while queries are rewritten, so one rewriter serves any number of
+// threads.
+struct LuaSQLRewriter {
+    // Physical names of the logical tables.
+    std::unordered_map<std::string, std::string> tables;
+
+    // The predicate, the WHERE clause of a query of its own.
+    LuaSQLParserResult* predicateResult;
+    const LuaExpr* predicate;
+
+    int64_t maxLimit;
+};
+
+// A name a query block binds in its FROM clause or WITH list. Column
+// qualifiers are resolved against the innermost binding of their name.
+struct RewriteBinding {
+    const char* name;
+    bool isTable;
+};
+
+// A table the predicate is injected for, and the filter it goes into: the
+// WHERE clause, or the condition of the outer join the table is on the
+// nullable side of.
+struct RewriteTarget {
+    const char* qualifier;
+    LuaExpr** filter;
+};
+
+struct RewriteContext {
+    const LuaSQLRewriter* rewriter;
+    Arena* arena;
+
+    std::vector<RewriteBinding> scope;
+    std::vector<LuaExpr*> pending;
+};
+
+static void rewriteSelect(LuaSelectStatement* statement, RewriteContext* ctx);
+
+
+// Returns the physical name of a logical table, or 0.
+static const char* physicalName(const char* name, RewriteContext* ctx)
+{
+    if (name == 0 || ctx->rewriter->tables.empty())
+        return 0;
+
+    auto it = ctx->rewriter->tables.find(name);
+    if (it == ctx->rewriter->tables.end())
+        return 0;
+
+    return it->second.c_str();
+}
+
+// Returns the binding a name refers to, or 0 if none is in scope.
+static const RewriteBinding* findBinding(const char* name,
+    RewriteContext* ctx)
+{
+    for (size_t i = ctx->scope.size(); i-- > 0;) {
+        if (strcmp(ctx->scope[i].name, name) == 0)
+            return &ctx->scope[i];
+    }
+
+    return 0;
+}
+
+// Returns the physical name of a table reference by a logical name that is
+// not hidden by a WITH table of the same name, or 0.
+static const char* renamedTable(const char* name, RewriteContext* ctx)
+{
+    const char* physical = physicalName(name, ctx);
+    if (physical == 0)
+        return 0;
+
+    const RewriteBinding* binding = findBinding(name, ctx);
+    if (binding != 0 && !binding->isTable)
+        return 0;
+
+    return physical;
+}
+
+// Renames the qualifiers of column references to logical tables and
+// rewrites the subqueries of an expression, without recursion.
+static void rewriteExpr(LuaExpr* root, RewriteContext* ctx)
+{
+    if (root == 0)
+        return;
+
+    size_t base = ctx->pending.size();
+    ctx->pending.push_back(root);
+
+    while (ctx->pending.size() > base) {
+        LuaExpr* expr = ctx->pending.back();
+        ctx->pending.pop_back();
+
+        if (expr->type == kExprColumnRef && expr->table != 0) {
+            const char* physical = renamedTable(expr->table, ctx);
+            if (physical != 0)
+                expr->table = (char*)physical;
+        }
+
+        // The subquery pushes its own bindings and pending expressions,
+        // both are back where they were once it is done.
+        if (expr->select != 0)
+            rewriteSelect(expr->select, ctx);
+
+        for (size_t i = expr->exprListSize; i-- > 0;)
+            if (expr->exprList[i] != 0)
+                ctx->pending.push_back(expr->exprList[i]);
+
+        if (expr->expr2 != 0)
+            ctx->pending.push_back(expr->expr2);
+        if (expr->expr != 0)
+            ctx->pending.push_back(expr->expr);
+    }
+}
+
+static void rewriteExprArr(LuaExpr** exprs, size_t count,
+    RewriteContext* ctx)
+{
+    for (size_t i = 0; i < count; i++)
+        rewriteExpr(exprs[i], ctx);
+}
+
+// Copies the predicate for a table, qualifying its column references with
+// the name the table goes by in the query. Subqueries are shared.
+static LuaExpr* copyPredicate(const LuaExpr* expr, const char* qualifier,
+    Arena* arena)
+{
+    if (expr == 0)
+        return 0;
+
+    LuaExpr* copy = arenaNew<LuaExpr>(arena);
+    *copy = *expr;
+
+    if (copy->type == kExprColumnRef && copy->table == 0)
+        copy->table = (char*)qualifier;
+
+    copy->expr = copyPredicate(expr->expr, qualifier, arena);
+    copy->expr2 = copyPredicate(expr->expr2, qualifier, arena);
+
+    if (expr->exprList != 0) {
+        copy->exprList = arenaNewArr<LuaExpr>(arena, expr->exprListSize);
+        for (size_t i = 0; i < expr->exprListSize; i++)
+            copy->exprList[i] = copyPredicate(expr->exprList[i], qualifier,
+                arena);
+    }
+
+    return copy;
+}
+
+// ANDs the predicate, qualified for a table, into a filter.
+static void injectPredicate(const RewriteTarget& target, RewriteContext* ctx)
+{
+    LuaExpr* predicate = copyPredicate(ctx->rewriter->predicate,
+        target.qualifier, ctx->arena);
+
+    if (*target.filter == 0) {
+        *target.filter = predicate;
+        return;
+    }
+
+    LuaExpr* conjunction = arenaNew<LuaExpr>(ctx->arena);
+    std::memset(conjunction, 0, sizeof(LuaExpr));
+    conjunction->type = kExprOperator;
+    conjunction->opType = kOpAnd;
+    conjunction->expr = *target.filter;
+    conjunction->expr2 = predicate;
+
+    *target.filter = conjunction;
+}
+
+// Renames the tables of a FROM clause and binds the names it introduces.
+// Logical tables are added to `targets` together with the filter their
+// predicate goes into. Derived tables are rewritten as query blocks of
+// their own.
+static void rewriteTableRef(LuaTableRef* tableRef, LuaExpr** filter,
+    std::vector<RewriteTarget>* targets, RewriteContext* ctx)
+{
+    if (tableRef == 0)
+        return;
+
+    const char* alias = tableRef->alias != 0 ? tableRef->alias->name : 0;
+
+    switch (tableRef->type) {
+        case kTableName: {
+            const char* physical = renamedTable(tableRef->name, ctx);
+
+            // Bound by the logical name, so that qualifiers by it are
+            // renamed along. A WITH table is bound as it is.
+            if (alias != 0) {
+                ctx->scope.push_back(RewriteBinding { alias, false });
+            }
+            else if (tableRef->name != 0) {
+                ctx->scope.push_back(
+                    RewriteBinding { tableRef->name, physical != 0 });
+            }
+
+            if (physical != 0) {
+                tableRef->name = (char*)physical;
+                targets->push_back(RewriteTarget {
+                    alias != 0 ? alias : physical, filter });
+            }
+            return;
+        }
+
+        case kTableSelect:
+            rewriteSelect(tableRef->select, ctx);
+
+            if (alias != 0)
+                ctx->scope.push_back(RewriteBinding { alias, false });
+            return;
+
+        case kTableJoin: {
+            LuaJoinDefinition* join = tableRef->join;
+            if (join == 0)
+                return;
+
+            // A predicate on the nullable side of an outer join goes into
+            // its condition, the WHERE clause would drop the unmatched
+            // rows of the other side.
+            bool leftNullable = join->type == kJoinRight ||
+                join->type == kJoinFull;
+            bool rightNullable = join->type == kJoinLeft ||
+                join->type == kJoinFull;
+
+            rewriteTableRef(join->left,
+                leftNullable ? &join->condition : filter, targets, ctx);
+            rewriteTableRef(join->right,
+                rightNullable ? &join->condition : filter, targets, ctx);
+            return;
+        }
+
+        case kTableCrossProduct:
+            for (size_t i = 0; i < tableRef->listSize; i++)
+                rewriteTableRef(tableRef->list[i], filter, targets, ctx);
+            return;
+
+        default:
+            return;
+    }
+}
+
+// Rewrites the join conditions of a FROM clause once all of its names are
+// bound.
+static void rewriteJoinConditions(LuaTableRef* tableRef, RewriteContext* ctx)
+{
+    if (tableRef == 0)
+        return;
+
+    for (size_t i = 0; i < tableRef->listSize; i++)
+        rewriteJoinConditions(tableRef->list[i], ctx);
+
+    if (tableRef->join != 0) {
+        rewriteJoinConditions(tableRef->join->left, ctx);
+        rewriteJoinConditions(tableRef->join->right, ctx);
+        rewriteExpr(tableRef->join->condition, ctx);
+    }
+}
+
+static void rewriteOrder(LuaOrderDescription** order, size_t count,
+    RewriteContext* ctx)
+{
+    for (size_t i = 0; i < count; i++)
+        if (order[i] != 0)
+            rewriteExpr(order[i]->expr, ctx);
+}
+
+static void rewriteLimit(LuaLimitDescription* limit, RewriteContext* ctx)
+{
+    if (limit == 0)
+        return;
+
+    rewriteExpr(limit->limit, ctx);
+    rewriteExpr(limit->offset, ctx);
+}
+
+static void rewriteSelect(LuaSelectStatement* statement, RewriteContext* ctx)
+{
+    if (statement == 0)
+        return;
+
+    size_t scopeSize = ctx->scope.size();
+
+    // A WITH table sees the ones before it and hides logical tables of the
+    // same name.
+    for (size_t i = 0; i < statement->withDescriptionCount; i++) {
+        LuaWithDescription* with = statement->withDescriptions[i];
+        if (with == 0)
+            continue;
+
+        rewriteSelect(with->select, ctx);
+
+        if (with->alias != 0)
+            ctx->scope.push_back(RewriteBinding { with->alias, false });
+    }
+
+    size_t withSize = ctx->scope.size();
+
+    std::vector<RewriteTarget> targets;
+    rewriteTableRef(statement->fromTable, &statement->whereClause, &targets,
+        ctx);
+    rewriteJoinConditions(statement->fromTable, ctx);
+
+    rewriteExprArr(statement->selectList, statement->selectListSize, ctx);
+    rewriteExpr(statement->whereClause, ctx);
+
+    if (statement->groupBy != 0) {
+        rewriteExprArr(statement->groupBy->columns,
+            statement->groupBy->columnCount, ctx);
+        rewriteExpr(statement->groupBy->having, ctx);
+    }
+
+    rewriteOrder(statement->order, statement->orderCount, ctx);
+    rewriteLimit(statement->limit, ctx);
+
+    if (ctx->rewriter->predicate != 0) {
+        for (const RewriteTarget& target : targets)
+            injectPredicate(target, ctx);
+    }
+
+    // The blocks of set operations see the WITH tables, but not the FROM
+    // clause of the first block.
+    ctx->scope.resize(withSize);
+
+    for (size_t i = 0; i < statement->setOperationCount; i++) {
+        LuaSetOperation* setOp = statement->setOperations[i];
+        if (setOp == 0)
+            continue;
+
+        rewriteSelect(setOp->nestedSelectStatement, ctx);
+        rewriteOrder(setOp->resultOrder, setOp->resultOrderCount, ctx);
+        rewriteLimit(setOp->resultLimit, ctx);
+    }
+
+    ctx->scope.resize(scopeSize);
+}
+
+static LuaExpr* newLimitLiteral(int64_t value, Arena* arena)
+{
+    LuaExpr* literal = arenaNew<LuaExpr>(arena);
+    std::memset(literal, 0, sizeof(LuaExpr));
+    literal->type = kExprLiteralInt;
+    literal->ival = value;
+
+    return literal;
+}
+
+// Caps the number of rows a top-level SELECT returns. The limit of a set
+// operation is the one of its last part. Limits other than integer
+// literals, such as parameters, are left to the caller.
+static void capLimit(LuaSelectStatement* statement, RewriteContext* ctx)
+{
+    int64_t maxLimit = ctx->rewriter->maxLimit;
+
+    LuaLimitDescription** limit = &statement->limit;
+    if (statement->setOperationCount != 0 &&
+        statement->setOperations[statement->setOperationCount - 1] != 0) {
+        limit = &statement->setOperations[
+            statement->setOperationCount - 1]->resultLimit;
+    }
+
+    if (*limit == 0) {
+        *limit = arenaNew<LuaLimitDescription>(ctx->arena);
+        (*limit)->limit = 0;
+        (*limit)->offset = 0;
+    }
+
+    LuaExpr* value = (*limit)->limit;
+
+    if (value == 0) {
+        (*limit)->limit = newLimitLiteral(maxLimit, ctx->arena);
+    }
+    else if (value->type == kExprLiteralInt && !value->isBoolLiteral &&
+        value->ival > maxLimit) {
+        // A new node, the statement's literals keep the one as written.
+        (*limit)->limit = newLimitLiteral(maxLimit, ctx->arena);
+    }
+}
+
+// Renames the table of an INSERT, UPDATE or DELETE and returns the name it
+// goes by, or 0 if it is not a logical table.
+static const char* rewriteTarget(char** tableName, RewriteContext* ctx)
+{
+    const char* physical = renamedTable(*tableName, ctx);
+    if (physical == 0)
+        return 0;
+
+    *tableName = (char*)physical;
+    return physical;
+}
+
+static void rewriteSQLStatement(LuaSQLStatement* statement,
+    RewriteContext* ctx)
+{
+    const LuaExpr* predicate = ctx->rewriter->predicate;
+
+    switch (statement->type) {
+        case kStmtSelect: {
+            LuaSelectStatement* select = (LuaSelectStatement*)statement;
+
+            rewriteSelect(select, ctx);
+
+            if (ctx->rewriter->maxLimit > 0)
+                capLimit(select, ctx);
+            break;
+        }
+
+        case kStmtInsert: {
+            LuaInsertStatement* insert = (LuaInsertStatement*)statement;
+
+            rewriteTarget(&insert->tableName, ctx);
+            rewriteExprArr(insert->values, insert->valueCount, ctx);
+            rewriteSelect(insert->select, ctx);
+            break;
+        }
+
+        case kStmtUpdate: {
+            LuaUpdateStatement* update = (LuaUpdateStatement*)statement;
+
+            std::vector<RewriteTarget> targets;
+            rewriteTableRef(update->table, &update->where, &targets, ctx);
+
+            for (size_t i = 0; i < update->updateCount; i++)
+                if (update->updates[i] != 0)
+                    rewriteExpr(update->updates[i]->value, ctx);
+
+            rewriteExpr(update->where, ctx);
+
+            if (predicate != 0) {
+                for (const RewriteTarget& target : targets)
+                    injectPredicate(target, ctx);
+            }
+
+            ctx->scope.clear();
+            break;
+        }
+
+        case kStmtDelete: {
+            LuaDeleteStatement* del = (LuaDeleteStatement*)statement;
+
+            const char* logical = del->tableName;
+            const char* physical = rewriteTarget(&del->tableName, ctx);
+
+            if (logical != 0)
+                ctx->scope.push_back(RewriteBinding { logical, true });
+
+            rewriteExpr(del->expr, ctx);
+
+            if (physical != 0 && predicate != 0)
+                injectPredicate(RewriteTarget { physical, &del->expr }, ctx);
+
+            ctx->scope.clear();
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+LuaSQLRewriter* sqlparser_rewriter_new()
+{
+    LuaSQLRewriter* rewriter = new (std::nothrow) LuaSQLRewriter();
+    if (rewriter == 0)
+        return 0;
+
+    rewriter->predicateResult = 0;
+    rewriter->predicate = 0;
+    rewriter->maxLimit = 0;
+
+    return rewriter;
+}
+
+void sqlparser_rewriter_free(LuaSQLRewriter* rewriter)
+{
+    if (rewriter == 0)
+        return;
+
+    if (rewriter->predicateResult != 0)
+        finalize(rewriter->predicateResult);
+
+    delete rewriter;
+}
+
+void sqlparser_rewriter_table(LuaSQLRewriter* rewriter, const char* logical,
+    const char* physical)
+{
+    if (physical == 0)
+        rewriter->tables.erase(logical);
+    else
+        rewriter->tables[logical] = physical;
+}
+
+bool sqlparser_rewriter_predicate(LuaSQLRewriter* rewriter,
+    const char* predicate)
+{
+    LuaSQLParserResult* result = 0;
+
+    if (predicate != 0) {
+        // Parsed as the WHERE clause of a query, which must have nothing
+        // else past it.
+        std::string query = "select * from \"_\" where ";
+        query += predicate;
+
+        result = parseUncached(query.data(), query.size(), 0);
+
+        const LuaSelectStatement* select = result->isValid &&
+            result->statementCount == 1 &&
+            result->statements[0]->type == kStmtSelect ?
+            (const LuaSelectStatement*)result->statements[0] : 0;
+
+        if (select == 0 || select->whereClause == 0 ||
+            select->groupBy != 0 || select->setOperations != 0 ||
+            select->order != 0 || select->limit != 0) {
+            finalize(result);
+            return false;
+        }
+    }
+
+    if (rewriter->predicateResult != 0)
+        finalize(rewriter->predicateResult);
+
+    rewriter->predicateResult = result;
+    rewriter->predicate = result != 0 ?
+        ((const LuaSelectStatement*)result->statements[0])->whereClause : 0;
+
+    return true;
+}
+
+void sqlparser_rewriter_limit(LuaSQLRewriter* rewriter, int64_t maxLimit)
+{
+    rewriter->maxLimit = maxLimit > 0 ? maxLimit : 0;
+}
+
+LuaSQLGenResult* rewriteSql(const LuaSQLRewriter* rewriter, const char* data,
+    size_t length)
+{
+    // The tree is rewritten in place, so it must not be shared through the
+    // parse cache.
+    LuaSQLParserResult* result = queryTooLong(length) ?
+        newErrorResult(kErrorLimit, "Query is too long") :
+        parseUncached(data, length, 0);
+
+    LuaSQLGenResult* gen;
+
+    if (!result->isValid) {
+        gen = (LuaSQLGenResult*)std::calloc(1, sizeof(LuaSQLGenResult));
+        if (gen != 0) {
+            gen->errorMsg = strdup(result->errorMsg != 0 ?
+                result->errorMsg : "AST is not valid");
+        }
+    }
+    else {
+        // The nodes the rewrite adds live as long as the rendering.
+        Arena arena;
+        arenaInit(&arena);
+
+        RewriteContext ctx;
+        ctx.rewriter = rewriter;
+        ctx.arena = &arena;
+
+        for (size_t i = 0; i < result->statementCount; i++)
+            if (result->statements[i] != 0)
+                rewriteSQLStatement(result->statements[i], &ctx);
+
+        gen = generateSql(result);
+
+        arenaRelease(&arena);
+    }
+
+    finalize(result);
+
+    return gen;
+}
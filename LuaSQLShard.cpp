@@ -0,0 +1,634 @@
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "hyrise/src/SQLParser.h"
+#include "LuaSQLArena.h"
+#include "LuaSQLParse.h"
+#include "LuaSQLParser.h"
+
+
+// Disjunctions growing past this many key tuples, and AND/OR nesting deeper
+// than this, are not analysed further. They count as not restricting the
+// key at all, which can only turn a routable query into a scattered one.
+static const size_t kMaxShardTuples = 1024;
+static const size_t kMaxShardDepth = 64;
+
+// Shard keys registered with sqlparser_shard_key_set(), by table name.
+struct ShardKeys {
+    std::shared_mutex mutex;
+
+    std::unordered_map<std::string, std::vector<std::string>> tables;
+};
+
+static ShardKeys shardKeys;
+
+// A value a key column is pinned to: a literal or a parameter. Unpinned
+// columns have the type kExprStar. Strings point into the hyrise tree.
+struct KeyValue {
+    hsql::ExprType type;
+    int64_t ival;
+    double fval;
+    const char* name;
+    bool isBoolLiteral;
+};
+
+// A conjunction of equalities, one value per key column.
+typedef std::vector<KeyValue> KeyTuple;
+
+// An expression in disjunctive normal form, as far as the key columns are
+// concerned: the rows it matches have the key of one of the tuples. An empty
+// list matches nothing, a tuple with unpinned columns matches any value of
+// those.
+typedef std::vector<KeyTuple> KeyTuples;
+
+struct ShardContext {
+    const std::vector<std::string>* columns;
+
+    // The names the routed table can be referenced by.
+    const char* tableName;
+    const char* alias;
+};
+
+struct LuaSQLShardKeysHolder {
+    Arena arena;
+    LuaSQLShardKeys keys;
+};
+
+
+static KeyTuples anyKey(const ShardContext* ctx)
+{
+    KeyValue unpinned = { hsql::kExprStar, 0, 0, 0, false };
+
+    return KeyTuples(1, KeyTuple(ctx->columns->size(), unpinned));
+}
+
+static int keyColumnIndex(const char* name, const ShardContext* ctx)
+{
+    for (size_t i = 0; i < ctx->columns->size(); i++)
+        if ((*ctx->columns)[i] == name)
+            return (int)i;
+
+    return -1;
+}
+
+// Returns the key column the expression refers to, -1 if it is not one.
+static int keyColumn(const hsql::Expr* expr, const ShardContext* ctx)
+{
+    if (expr == 0 || expr->type != hsql::kExprColumnRef || expr->name == 0)
+        return -1;
+
+    if (expr->table != 0) {
+        const char* name = ctx->alias != 0 ? ctx->alias : ctx->tableName;
+        if (strcmp(expr->table, name) != 0)
+            return -1;
+    }
+
+    return keyColumnIndex(expr->name, ctx);
+}
+
+static bool keyValue(const hsql::Expr* expr, KeyValue* value)
+{
+    if (expr == 0)
+        return false;
+
+    bool negate = false;
+
+    if (expr->type == hsql::kExprOperator &&
+        expr->opType == hsql::kOpUnaryMinus)
+    {
+        negate = true;
+        expr = expr->expr;
+
+        if (expr == 0 || (expr->type != hsql::kExprLiteralInt &&
+            expr->type != hsql::kExprLiteralFloat))
+            return false;
+    }
+
+    switch (expr->type) {
+        case hsql::kExprLiteralInt:
+        case hsql::kExprLiteralFloat:
+        case hsql::kExprLiteralString:
+        case hsql::kExprParameter:
+            break;
+        default:
+            return false;
+    }
+
+    value->type = expr->type;
+    value->ival = negate ? (int64_t)(0 - (uint64_t)expr->ival) : expr->ival;
+    value->fval = negate ? -expr->fval : expr->fval;
+    value->name = expr->name;
+    value->isBoolLiteral = expr->isBoolLiteral;
+
+    return true;
+}
+
+// Returns whether two literals are known to differ. Parameters and values of
+// different types are not.
+static bool valuesDiffer(const KeyValue* a, const KeyValue* b)
+{
+    if (a->type != b->type)
+        return false;
+
+    switch (a->type) {
+        case hsql::kExprLiteralInt:
+            return a->ival != b->ival;
+        case hsql::kExprLiteralFloat:
+            return a->fval != b->fval;
+        case hsql::kExprLiteralString:
+            return a->name == 0 || b->name == 0 ||
+                strcmp(a->name, b->name) != 0;
+        default:
+            return false;
+    }
+}
+
+// Intersects two tuples into `a`, returns false if they contradict.
+static bool mergeTuple(KeyTuple* a, const KeyTuple* b)
+{
+    for (size_t i = 0; i < a->size(); i++) {
+        KeyValue* value = &(*a)[i];
+        const KeyValue* other = &(*b)[i];
+
+        if (other->type == hsql::kExprStar)
+            continue;
+
+        // A row matching both pins the column to either value, keep ours.
+        if (value->type == hsql::kExprStar)
+            *value = *other;
+        else if (valuesDiffer(value, other))
+            return false;
+    }
+
+    return true;
+}
+
+static KeyTuples analyzeExpr(const hsql::Expr* expr, const ShardContext* ctx,
+    size_t depth);
+
+static KeyTuples analyzeEquality(const hsql::Expr* expr,
+    const ShardContext* ctx)
+{
+    const hsql::Expr* column = expr->expr;
+    const hsql::Expr* operand = expr->expr2;
+
+    int index = keyColumn(column, ctx);
+    if (index < 0) {
+        column = expr->expr2;
+        operand = expr->expr;
+        index = keyColumn(column, ctx);
+    }
+
+    KeyTuples tuples = anyKey(ctx);
+
+    if (index >= 0 && !keyValue(operand, &tuples[0][index]))
+        tuples[0][index].type = hsql::kExprStar;
+
+    return tuples;
+}
+
+static KeyTuples analyzeIn(const hsql::Expr* expr, const ShardContext* ctx)
+{
+    int index = keyColumn(expr->expr, ctx);
+    if (index < 0 || expr->exprList == 0 ||
+        expr->exprList->size() > kMaxShardTuples)
+        return anyKey(ctx);
+
+    KeyTuples tuples;
+    tuples.reserve(expr->exprList->size());
+
+    for (const hsql::Expr* item : *expr->exprList) {
+        KeyTuple tuple = anyKey(ctx)[0];
+
+        if (!keyValue(item, &tuple[index]))
+            return anyKey(ctx);
+
+        tuples.push_back(tuple);
+    }
+
+    return tuples;
+}
+
+// Combines the operands of an AND or OR chain. The chain is flattened
+// without recursion, so long chains only cost one level of nesting.
+static KeyTuples analyzeChain(const hsql::Expr* expr, const ShardContext* ctx,
+    size_t depth)
+{
+    hsql::OperatorType opType = expr->opType;
+
+    std::vector<const hsql::Expr*> pending(1, expr);
+    std::vector<const hsql::Expr*> operands;
+
+    while (!pending.empty()) {
+        const hsql::Expr* node = pending.back();
+        pending.pop_back();
+
+        if (node != 0 && node->type == hsql::kExprOperator &&
+            node->opType == opType)
+        {
+            pending.push_back(node->expr2);
+            pending.push_back(node->expr);
+        }
+        else {
+            operands.push_back(node);
+        }
+    }
+
+    if (opType == hsql::kOpOr) {
+        KeyTuples tuples;
+
+        for (const hsql::Expr* operand : operands) {
+            KeyTuples alternatives = analyzeExpr(operand, ctx, depth + 1);
+
+            tuples.insert(tuples.end(), alternatives.begin(),
+                alternatives.end());
+
+            if (tuples.size() > kMaxShardTuples)
+                return anyKey(ctx);
+        }
+
+        return tuples;
+    }
+
+    KeyTuples tuples = anyKey(ctx);
+
+    for (const hsql::Expr* operand : operands) {
+        KeyTuples factors = analyzeExpr(operand, ctx, depth + 1);
+
+        if (tuples.size() * factors.size() > kMaxShardTuples) {
+            // Dropping an operand only widens the set of matched rows.
+            continue;
+        }
+
+        KeyTuples product;
+
+        for (const KeyTuple& tuple : tuples) {
+            for (const KeyTuple& factor : factors) {
+                KeyTuple merged = tuple;
+
+                if (mergeTuple(&merged, &factor))
+                    product.push_back(merged);
+            }
+        }
+
+        tuples.swap(product);
+    }
+
+    return tuples;
+}
+
+static KeyTuples analyzeExpr(const hsql::Expr* expr, const ShardContext* ctx,
+    size_t depth)
+{
+    if (expr == 0 || expr->type != hsql::kExprOperator ||
+        depth > kMaxShardDepth)
+        return anyKey(ctx);
+
+    switch (expr->opType) {
+        case hsql::kOpAnd:
+        case hsql::kOpOr:
+            return analyzeChain(expr, ctx, depth);
+        case hsql::kOpEquals:
+            return analyzeEquality(expr, ctx);
+        case hsql::kOpIn:
+            return analyzeIn(expr, ctx);
+        default:
+            return anyKey(ctx);
+    }
+}
+
+// Subqueries read tables of their own, queries with them are never routed
+// to a single shard.
+static bool hasSubquery(const hsql::Expr* expr)
+{
+    std::vector<const hsql::Expr*> pending(1, expr);
+
+    while (!pending.empty()) {
+        const hsql::Expr* node = pending.back();
+        pending.pop_back();
+
+        if (node == 0)
+            continue;
+
+        if (node->type == hsql::kExprSelect || node->select != 0)
+            return true;
+
+        pending.push_back(node->expr);
+        pending.push_back(node->expr2);
+
+        if (node->exprList != 0)
+            pending.insert(pending.end(), node->exprList->begin(),
+                node->exprList->end());
+    }
+
+    return false;
+}
+
+static bool hasSubquery(const std::vector<hsql::Expr*>* exprs)
+{
+    if (exprs != 0)
+        for (const hsql::Expr* expr : *exprs)
+            if (hasSubquery(expr))
+                return true;
+
+    return false;
+}
+
+// The routed table of a statement and the expression restricting its rows.
+// Returns false for statements that can not be routed by their WHERE
+// clause.
+static bool routedTable(const hsql::SQLStatement* statement,
+    const hsql::TableRef** table, const hsql::Expr** where)
+{
+    switch (statement->type()) {
+        case hsql::kStmtSelect: {
+            const hsql::SelectStatement* select =
+                (const hsql::SelectStatement*)statement;
+
+            if (select->setOperations != 0 ||
+                select->withDescriptions != 0 ||
+                hasSubquery(select->selectList))
+                return false;
+
+            if (select->groupBy != 0 &&
+                (hasSubquery(select->groupBy->columns) ||
+                hasSubquery(select->groupBy->having)))
+                return false;
+
+            if (select->order != 0)
+                for (const hsql::OrderDescription* order : *select->order)
+                    if (order != 0 && hasSubquery(order->expr))
+                        return false;
+
+            *table = select->fromTable;
+            *where = select->whereClause;
+
+            return true;
+        }
+        case hsql::kStmtUpdate: {
+            const hsql::UpdateStatement* update =
+                (const hsql::UpdateStatement*)statement;
+
+            if (update->updates != 0)
+                for (const hsql::UpdateClause* clause : *update->updates)
+                    if (clause != 0 && hasSubquery(clause->value))
+                        return false;
+
+            *table = update->table;
+            *where = update->where;
+
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static char* copyShardStr(const char* str, Arena* arena)
+{
+    if (str == 0)
+        return 0;
+
+    size_t length = strlen(str);
+
+    char* copy = (char*)arenaAlloc(arena, length + 1, 1);
+    std::memcpy(copy, str, length + 1);
+
+    return copy;
+}
+
+// Serializes a tuple, so that duplicates can be found.
+static void appendTupleKey(const KeyTuple* tuple, std::string* key)
+{
+    for (const KeyValue& value : *tuple) {
+        key->push_back((char)value.type);
+
+        switch (value.type) {
+            case hsql::kExprLiteralFloat:
+                key->append((const char*)&value.fval, sizeof(value.fval));
+                break;
+            case hsql::kExprLiteralString:
+                key->append(value.name != 0 ? value.name : "");
+                key->push_back('\0');
+                break;
+            default:
+                key->append((const char*)&value.ival, sizeof(value.ival));
+                break;
+        }
+    }
+}
+
+static void analyzeStatement(const hsql::SQLStatement* statement,
+    LuaSQLShardKeys* keys, Arena* arena)
+{
+    const char* schema = 0;
+    const char* tableName = 0;
+    const char* alias = 0;
+    const hsql::Expr* where = 0;
+
+    // INSERT pins the key of its row directly, if the columns are named.
+    const hsql::InsertStatement* insert = 0;
+
+    if (statement->type() == hsql::kStmtInsert) {
+        insert = (const hsql::InsertStatement*)statement;
+
+        if (insert->select != 0 || insert->columns == 0 ||
+            insert->values == 0 || hasSubquery(insert->values))
+            return;
+
+        schema = insert->schema;
+        tableName = insert->tableName;
+    }
+    else if (statement->type() == hsql::kStmtDelete) {
+        const hsql::DeleteStatement* deleteStatement =
+            (const hsql::DeleteStatement*)statement;
+
+        schema = deleteStatement->schema;
+        tableName = deleteStatement->tableName;
+        where = deleteStatement->expr;
+    }
+    else {
+        const hsql::TableRef* table = 0;
+
+        if (!routedTable(statement, &table, &where) || table == 0 ||
+            table->type != hsql::kTableName)
+            return;
+
+        schema = table->schema;
+        tableName = table->name;
+        alias = table->alias != 0 ? table->alias->name : 0;
+    }
+
+    if (tableName == 0 || hasSubquery(where))
+        return;
+
+    keys->schema = copyShardStr(schema, arena);
+    keys->table = copyShardStr(tableName, arena);
+
+    std::shared_lock<std::shared_mutex> lock(shardKeys.mutex);
+
+    auto it = shardKeys.tables.find(tableName);
+    if (it == shardKeys.tables.end())
+        return;
+
+    ShardContext ctx = { &it->second, tableName, alias };
+
+    KeyTuples tuples;
+
+    if (insert != 0) {
+        tuples = anyKey(&ctx);
+
+        for (size_t i = 0; i < insert->columns->size() &&
+            i < insert->values->size(); i++)
+        {
+            const char* column = (*insert->columns)[i];
+            int index = column != 0 ? keyColumnIndex(column, &ctx) : -1;
+
+            if (index >= 0 &&
+                !keyValue((*insert->values)[i], &tuples[0][index]))
+                tuples[0][index].type = hsql::kExprStar;
+        }
+    }
+    else {
+        tuples = analyzeExpr(where, &ctx, 0);
+    }
+
+    size_t keyLength = ctx.columns->size();
+
+    for (const KeyTuple& tuple : tuples)
+        for (const KeyValue& value : tuple)
+            if (value.type == hsql::kExprStar)
+                return;
+
+    keys->scatter = false;
+    keys->keyLength = keyLength;
+    keys->values = (LuaShardValue*)arenaAlloc(arena,
+        tuples.size() * keyLength * sizeof(LuaShardValue),
+        alignof(LuaShardValue));
+
+    std::unordered_set<std::string> seen;
+
+    for (const KeyTuple& tuple : tuples) {
+        std::string key;
+        appendTupleKey(&tuple, &key);
+
+        if (!seen.insert(key).second)
+            continue;
+
+        LuaShardValue* values = keys->values + keys->tupleCount * keyLength;
+
+        for (size_t i = 0; i < keyLength; i++) {
+            values[i].type = (ExprType)tuple[i].type;
+            values[i].ival = tuple[i].ival;
+            values[i].fval = tuple[i].fval;
+            values[i].name = copyShardStr(tuple[i].name, arena);
+            values[i].isBoolLiteral = tuple[i].isBoolLiteral;
+        }
+
+        keys->tupleCount++;
+    }
+}
+
+static LuaSQLShardKeysHolder* newShardKeysHolder(Arena* arena)
+{
+    LuaSQLShardKeysHolder* holder = new(arenaAlloc(arena,
+        sizeof(LuaSQLShardKeysHolder), alignof(LuaSQLShardKeysHolder)))
+        LuaSQLShardKeysHolder;
+
+    LuaSQLShardKeys* keys = &holder->keys;
+
+    keys->isValid = false;
+    keys->errorCode = kErrorNone;
+    keys->errorMsg = 0;
+    keys->errorLine = 0;
+    keys->errorColumn = 0;
+    keys->schema = 0;
+    keys->table = 0;
+    keys->scatter = true;
+    keys->keyLength = 0;
+    keys->tupleCount = 0;
+    keys->values = 0;
+
+    return holder;
+}
+
+void sqlparser_shard_key_set(const char* table, const char* const* columns,
+    size_t count)
+{
+    std::unique_lock<std::shared_mutex> lock(shardKeys.mutex);
+
+    if (count == 0) {
+        shardKeys.tables.erase(table);
+        return;
+    }
+
+    shardKeys.tables[table].assign(columns, columns + count);
+}
+
+void sqlparser_shard_key_clear()
+{
+    std::unique_lock<std::shared_mutex> lock(shardKeys.mutex);
+
+    shardKeys.tables.clear();
+}
+
+LuaSQLShardKeys* parseSqlShardKeys(const char* data, size_t length)
+{
+    Arena arena;
+    arenaInit(&arena);
+
+    LuaSQLShardKeysHolder* holder = newShardKeysHolder(&arena);
+    LuaSQLShardKeys* keys = &holder->keys;
+
+    if (queryTooLong(length)) {
+        keys->errorCode = kErrorLimit;
+        keys->errorMsg = copyShardStr("Query is too long", &arena);
+
+        holder->arena = arena;
+        return keys;
+    }
+
+    hsql::SQLParserResult result;
+    parseBytes(data, length, &result);
+
+    if (!result.isValid()) {
+        keys->errorCode = kErrorSyntax;
+        keys->errorMsg = copyShardStr(result.errorMsg(), &arena);
+        keys->errorLine = result.errorLine();
+        keys->errorColumn = result.errorColumn();
+    }
+    else {
+        keys->isValid = true;
+
+        // Several statements are routed one by one, by the caller.
+        if (result.size() == 1 && result.getStatement(0) != 0)
+            analyzeStatement(result.getStatement(0), keys, &arena);
+    }
+
+    freeHyriseResult(&result, length);
+
+    // The arena has kept growing, hand its final state over to the holder
+    // only now.
+    holder->arena = arena;
+
+    return keys;
+}
+
+void finalizeShardKeys(LuaSQLShardKeys* keys)
+{
+    if (keys == 0)
+        return;
+
+    LuaSQLShardKeysHolder* holder = (LuaSQLShardKeysHolder*)(
+        (char*)keys - offsetof(LuaSQLShardKeysHolder, keys));
+
+    // The holder lives inside the arena it describes.
+    Arena arena = holder->arena;
+    arenaRelease(&arena);
+}
@@ -0,0 +1,746 @@
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "LuaSQLCache.h"
+#include "LuaSQLHash.h"
+#include "LuaSQLSimplify.h"
+
+
+std::atomic<bool> simplifyEnabled(false);
+
+// State of one simplification pass. The vectors are scratch space reused by
+// the walks over all expressions of the result.
+struct SimplifyContext {
+    LuaSQLSimplifyReport* report;
+
+    std::vector<LuaExpr*> pending;
+    std::vector<const LuaExpr*> pendingPairs;
+};
+
+struct ExprFrame {
+    LuaExpr* expr;
+    bool visited;
+    bool chainInterior;
+};
+
+static void simplifySelect(LuaSelectStatement* statement,
+    SimplifyContext* ctx);
+
+
+static bool isNumber(const LuaExpr* expr)
+{
+    return (expr->type == kExprLiteralInt && !expr->isBoolLiteral) ||
+        expr->type == kExprLiteralFloat;
+}
+
+static bool isBool(const LuaExpr* expr, bool value)
+{
+    return expr->type == kExprLiteralInt && expr->isBoolLiteral &&
+        (expr->ival != 0) == value;
+}
+
+static bool isChain(const LuaExpr* expr)
+{
+    return expr != 0 && expr->type == kExprOperator &&
+        (expr->opType == kOpAnd || expr->opType == kOpOr);
+}
+
+static double numberValue(const LuaExpr* expr)
+{
+    return expr->type == kExprLiteralInt ? (double)expr->ival : expr->fval;
+}
+
+// Turns the node into a literal. Fields an operator node shares with a
+// literal one, such as an alias, are kept.
+static void setLiteral(LuaExpr* expr, ExprType type, int64_t ival,
+    double fval, bool isBoolLiteral)
+{
+    expr->type = type;
+
+    expr->expr = 0;
+    expr->expr2 = 0;
+    expr->exprListSize = 0;
+    expr->exprList = 0;
+    expr->select = 0;
+    expr->name = 0;
+    expr->table = 0;
+
+    expr->ival = ival;
+    expr->fval = fval;
+    expr->isBoolLiteral = isBoolLiteral;
+    expr->opType = kOpNone;
+    expr->distinct = false;
+}
+
+static void setBool(LuaExpr* expr, bool value)
+{
+    setLiteral(expr, kExprLiteralInt, value ? 1 : 0, 0, true);
+}
+
+// Replaces the node with another one of the same tree, keeping its alias.
+static void replaceExpr(LuaExpr* expr, const LuaExpr* with)
+{
+    char* alias = expr->alias;
+
+    *expr = *with;
+
+    if (alias != 0)
+        expr->alias = alias;
+}
+
+// Hashes the subtree for finding duplicates. Returns false if it may
+// evaluate differently each time: functions and subqueries are never
+// considered duplicates.
+static bool hashExpr(const LuaExpr* root, uint64_t* hash,
+    SimplifyContext* ctx)
+{
+    std::vector<LuaExpr*>& pending = ctx->pending;
+    size_t base = pending.size();
+
+    pending.push_back((LuaExpr*)root);
+
+    uint64_t h = 0;
+    bool deterministic = true;
+
+    while (pending.size() > base) {
+        const LuaExpr* expr = pending.back();
+        pending.pop_back();
+
+        if (expr == 0) {
+            h = hashBytes(&h, sizeof(h), 1);
+            continue;
+        }
+
+        if (expr->type == kExprFunctionRef || expr->type == kExprSelect ||
+            expr->select != 0)
+        {
+            deterministic = false;
+            break;
+        }
+
+        uint64_t fields[] = {
+            (uint64_t)expr->type,
+            (uint64_t)expr->opType,
+            (uint64_t)expr->ival,
+            (uint64_t)expr->ival2,
+            (uint64_t)expr->isBoolLiteral,
+            (uint64_t)expr->distinct,
+            (uint64_t)expr->datetimeField,
+            (uint64_t)expr->columnType,
+            (uint64_t)expr->columnLength,
+            (uint64_t)expr->exprListSize
+        };
+        h = hashBytes(fields, sizeof(fields), h);
+        h = hashBytes(&expr->fval, sizeof(expr->fval), h);
+
+        if (expr->name != 0)
+            h = hashBytes(expr->name, strlen(expr->name), h);
+        if (expr->table != 0)
+            h = hashBytes(expr->table, strlen(expr->table), h);
+
+        pending.push_back(expr->expr);
+        pending.push_back(expr->expr2);
+
+        for (size_t i = 0; i < expr->exprListSize; i++)
+            pending.push_back(expr->exprList[i]);
+    }
+
+    pending.resize(base);
+
+    *hash = h;
+
+    return deterministic;
+}
+
+static bool sameStr(const char* a, const char* b)
+{
+    return a == b || (a != 0 && b != 0 && strcmp(a, b) == 0);
+}
+
+// Compares two subtrees hashExpr() accepted.
+static bool equalExprs(const LuaExpr* a, const LuaExpr* b,
+    SimplifyContext* ctx)
+{
+    std::vector<const LuaExpr*>& pending = ctx->pendingPairs;
+    pending.clear();
+
+    pending.push_back(a);
+    pending.push_back(b);
+
+    while (!pending.empty()) {
+        const LuaExpr* y = pending.back();
+        pending.pop_back();
+        const LuaExpr* x = pending.back();
+        pending.pop_back();
+
+        if (x == 0 || y == 0) {
+            if (x != y)
+                return false;
+            continue;
+        }
+
+        if (x->type != y->type || x->opType != y->opType ||
+            x->ival != y->ival || x->ival2 != y->ival2 ||
+            x->fval != y->fval || x->isBoolLiteral != y->isBoolLiteral ||
+            x->distinct != y->distinct ||
+            x->datetimeField != y->datetimeField ||
+            x->columnType != y->columnType ||
+            x->columnLength != y->columnLength ||
+            x->exprListSize != y->exprListSize ||
+            !sameStr(x->name, y->name) || !sameStr(x->table, y->table))
+            return false;
+
+        pending.push_back(x->expr);
+        pending.push_back(y->expr);
+        pending.push_back(x->expr2);
+        pending.push_back(y->expr2);
+
+        for (size_t i = 0; i < x->exprListSize; i++) {
+            pending.push_back(x->exprList[i]);
+            pending.push_back(y->exprList[i]);
+        }
+    }
+
+    return true;
+}
+
+// Drops the items of `exprs` that repeat an earlier one, returns the new
+// count.
+static size_t removeDuplicates(LuaExpr** exprs, size_t count,
+    SimplifyContext* ctx)
+{
+    std::unordered_multimap<uint64_t, LuaExpr*> seen;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        LuaExpr* expr = exprs[i];
+        uint64_t hash;
+
+        if (expr != 0 && hashExpr(expr, &hash, ctx)) {
+            bool duplicate = false;
+
+            auto range = seen.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (equalExprs(it->second, expr, ctx)) {
+                    duplicate = true;
+                    break;
+                }
+            }
+
+            if (duplicate) {
+                ctx->report->duplicates++;
+                continue;
+            }
+
+            seen.emplace(hash, expr);
+        }
+
+        exprs[kept++] = expr;
+    }
+
+    return kept;
+}
+
+static bool foldArithmetic(LuaExpr* expr)
+{
+    const LuaExpr* a = expr->expr;
+    const LuaExpr* b = expr->expr2;
+
+    if (a->type == kExprLiteralInt && b->type == kExprLiteralInt) {
+        int64_t x = a->ival;
+        int64_t y = b->ival;
+        int64_t value;
+
+        switch (expr->opType) {
+            case kOpPlus:
+                if (__builtin_add_overflow(x, y, &value))
+                    return false;
+                break;
+            case kOpMinus:
+                if (__builtin_sub_overflow(x, y, &value))
+                    return false;
+                break;
+            case kOpAsterisk:
+                if (__builtin_mul_overflow(x, y, &value))
+                    return false;
+                break;
+            case kOpSlash:
+            case kOpPercentage:
+                if (y == 0 || (x == INT64_MIN && y == -1))
+                    return false;
+                value = expr->opType == kOpSlash ? x / y : x % y;
+                break;
+            default:
+                return false;
+        }
+
+        setLiteral(expr, kExprLiteralInt, value, 0, false);
+        return true;
+    }
+
+    double x = numberValue(a);
+    double y = numberValue(b);
+    double value;
+
+    switch (expr->opType) {
+        case kOpPlus:
+            value = x + y;
+            break;
+        case kOpMinus:
+            value = x - y;
+            break;
+        case kOpAsterisk:
+            value = x * y;
+            break;
+        case kOpSlash:
+            if (y == 0)
+                return false;
+            value = x / y;
+            break;
+        default:
+            return false;
+    }
+
+    setLiteral(expr, kExprLiteralFloat, 0, value, false);
+    return true;
+}
+
+static bool foldComparison(LuaExpr* expr)
+{
+    const LuaExpr* a = expr->expr;
+    const LuaExpr* b = expr->expr2;
+
+    // Integers are compared exactly, anything else as doubles.
+    int order;
+    if (a->type == kExprLiteralInt && b->type == kExprLiteralInt) {
+        order = a->ival < b->ival ? -1 : a->ival > b->ival;
+    }
+    else {
+        double x = numberValue(a);
+        double y = numberValue(b);
+
+        if (x != x || y != y)
+            return false;
+
+        order = x < y ? -1 : x > y;
+    }
+
+    bool value;
+
+    switch (expr->opType) {
+        case kOpEquals:
+            value = order == 0;
+            break;
+        case kOpNotEquals:
+            value = order != 0;
+            break;
+        case kOpLess:
+            value = order < 0;
+            break;
+        case kOpLessEq:
+            value = order <= 0;
+            break;
+        case kOpGreater:
+            value = order > 0;
+            break;
+        case kOpGreaterEq:
+            value = order >= 0;
+            break;
+        default:
+            return false;
+    }
+
+    setBool(expr, value);
+    return true;
+}
+
+// Simplifies a whole AND or OR chain at its topmost node: the operands are
+// collected, TRUE and FALSE ones resolved, repeated ones dropped and the
+// rest linked back into a left-deep chain, the shape the parser builds.
+static void simplifyChain(LuaExpr* root, SimplifyContext* ctx)
+{
+    OperatorType opType = root->opType;
+
+    // AND drops TRUE operands and is FALSE with a FALSE one, OR the other
+    // way around.
+    bool identity = opType == kOpAnd;
+
+    std::vector<LuaExpr*> nodes;
+    std::vector<LuaExpr*> operands;
+    bool leftDeep = true;
+
+    std::vector<LuaExpr*>& pending = ctx->pending;
+    size_t base = pending.size();
+
+    pending.push_back(root);
+
+    while (pending.size() > base) {
+        LuaExpr* expr = pending.back();
+        pending.pop_back();
+
+        if (expr != 0 && expr->type == kExprOperator &&
+            expr->opType == opType)
+        {
+            if (expr->expr2 != 0 && expr->expr2->type == kExprOperator &&
+                expr->expr2->opType == opType)
+                leftDeep = false;
+
+            nodes.push_back(expr);
+            pending.push_back(expr->expr2);
+            pending.push_back(expr->expr);
+        }
+        else {
+            operands.push_back(expr);
+        }
+    }
+
+    size_t count = 0;
+
+    for (LuaExpr* operand : operands) {
+        if (operand == 0)
+            return;
+    }
+
+    for (LuaExpr* operand : operands) {
+        if (isBool(operand, identity)) {
+            ctx->report->tautologies++;
+            continue;
+        }
+
+        if (isBool(operand, !identity)) {
+            ctx->report->tautologies++;
+            setBool(root, !identity);
+            return;
+        }
+
+        operands[count++] = operand;
+    }
+
+    count = removeDuplicates(operands.data(), count, ctx);
+
+    if (count == operands.size() && leftDeep)
+        return;
+
+    if (!leftDeep)
+        ctx->report->flattened++;
+
+    if (count == 0) {
+        setBool(root, identity);
+        return;
+    }
+
+    if (count == 1) {
+        replaceExpr(root, operands[0]);
+        return;
+    }
+
+    // nodes[0] is the root, nodes[i] becomes the left operand of
+    // nodes[i - 1].
+    for (size_t i = 0; i + 1 < count; i++) {
+        LuaExpr* node = nodes[i];
+
+        node->expr = i + 2 < count ? nodes[i + 1] : operands[0];
+        node->expr2 = operands[count - 1 - i];
+    }
+}
+
+static void simplifyNode(LuaExpr* expr, SimplifyContext* ctx)
+{
+    if (expr->type != kExprOperator)
+        return;
+
+    LuaExpr* a = expr->expr;
+    LuaExpr* b = expr->expr2;
+
+    switch (expr->opType) {
+        case kOpAnd:
+        case kOpOr:
+            simplifyChain(expr, ctx);
+            break;
+
+        case kOpNot:
+            if (a == 0)
+                break;
+
+            if (a->type == kExprLiteralInt && a->isBoolLiteral) {
+                ctx->report->folded++;
+                setBool(expr, a->ival == 0);
+            }
+            else if (a->type == kExprOperator && a->opType == kOpNot &&
+                a->expr != 0)
+            {
+                ctx->report->negations++;
+                replaceExpr(expr, a->expr);
+            }
+            break;
+
+        case kOpUnaryMinus:
+            if (a == 0 || !isNumber(a))
+                break;
+
+            if (a->type == kExprLiteralFloat) {
+                setLiteral(expr, kExprLiteralFloat, 0, -a->fval, false);
+            }
+            else {
+                if (a->ival == INT64_MIN)
+                    break;
+                setLiteral(expr, kExprLiteralInt, -a->ival, 0, false);
+            }
+
+            ctx->report->folded++;
+            break;
+
+        case kOpPlus:
+        case kOpMinus:
+        case kOpAsterisk:
+        case kOpSlash:
+        case kOpPercentage:
+            if (a != 0 && b != 0 && isNumber(a) && isNumber(b) &&
+                foldArithmetic(expr))
+                ctx->report->folded++;
+            break;
+
+        case kOpEquals:
+        case kOpNotEquals:
+        case kOpLess:
+        case kOpLessEq:
+        case kOpGreater:
+        case kOpGreaterEq:
+            if (a != 0 && b != 0 && isNumber(a) && isNumber(b) &&
+                foldComparison(expr))
+                ctx->report->folded++;
+            break;
+
+        case kOpBetween: {
+            if (a == 0 || expr->exprListSize != 2)
+                break;
+
+            LuaExpr* low = expr->exprList[0];
+            LuaExpr* high = expr->exprList[1];
+            if (low == 0 || high == 0)
+                break;
+
+            uint64_t lowHash;
+            uint64_t highHash;
+
+            // `x BETWEEN y AND y` is `x = y`.
+            if (hashExpr(low, &lowHash, ctx) &&
+                hashExpr(high, &highHash, ctx) && lowHash == highHash &&
+                equalExprs(low, high, ctx))
+            {
+                ctx->report->normalized++;
+                expr->opType = kOpEquals;
+                expr->expr2 = low;
+                expr->exprListSize = 0;
+                expr->exprList = 0;
+            }
+            break;
+        }
+
+        case kOpIn:
+            if (a == 0 || expr->exprList == 0)
+                break;
+
+            expr->exprListSize = removeDuplicates(expr->exprList,
+                expr->exprListSize, ctx);
+
+            // `x IN (y)` is `x = y`.
+            if (expr->exprListSize == 1 && expr->exprList[0] != 0) {
+                ctx->report->normalized++;
+                expr->opType = kOpEquals;
+                expr->expr2 = expr->exprList[0];
+                expr->exprListSize = 0;
+                expr->exprList = 0;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Simplifies the expression bottom-up without recursion. The inner nodes
+// of AND and OR chains are left to the topmost one.
+static void simplifyExpr(LuaExpr* root, SimplifyContext* ctx)
+{
+    if (root == 0)
+        return;
+
+    std::vector<ExprFrame> frames;
+    frames.push_back(ExprFrame { root, false, false });
+
+    while (!frames.empty()) {
+        ExprFrame& frame = frames.back();
+        LuaExpr* expr = frame.expr;
+
+        if (frame.visited) {
+            bool chainInterior = frame.chainInterior;
+            frames.pop_back();
+
+            if (!chainInterior)
+                simplifyNode(expr, ctx);
+            continue;
+        }
+
+        frame.visited = true;
+
+        if (expr->select != 0)
+            simplifySelect(expr->select, ctx);
+
+        // Pushing may reallocate, `frame` is not used past this point.
+        bool chain = isChain(expr);
+        OperatorType opType = expr->opType;
+
+        for (size_t i = expr->exprListSize; i-- > 0;)
+            if (expr->exprList[i] != 0)
+                frames.push_back(ExprFrame { expr->exprList[i], false,
+                    false });
+
+        LuaExpr* children[] = { expr->expr2, expr->expr };
+        for (LuaExpr* child : children) {
+            if (child == 0)
+                continue;
+
+            bool interior = chain && child->type == kExprOperator &&
+                child->opType == opType;
+            frames.push_back(ExprFrame { child, false, interior });
+        }
+    }
+}
+
+static void simplifyExprArr(LuaExpr** exprs, size_t count,
+    SimplifyContext* ctx)
+{
+    for (size_t i = 0; i < count; i++)
+        simplifyExpr(exprs[i], ctx);
+}
+
+// Simplifies a filter. A filter that is always TRUE is dropped.
+static void simplifyFilter(LuaExpr** filter, SimplifyContext* ctx)
+{
+    simplifyExpr(*filter, ctx);
+
+    if (*filter != 0 && isBool(*filter, true)) {
+        ctx->report->tautologies++;
+        *filter = 0;
+    }
+}
+
+static void simplifyLimit(LuaLimitDescription* limit, SimplifyContext* ctx)
+{
+    if (limit == 0)
+        return;
+
+    simplifyExpr(limit->limit, ctx);
+    simplifyExpr(limit->offset, ctx);
+}
+
+static void simplifyOrder(LuaOrderDescription** order, size_t count,
+    SimplifyContext* ctx)
+{
+    for (size_t i = 0; i < count; i++)
+        if (order[i] != 0)
+            simplifyExpr(order[i]->expr, ctx);
+}
+
+static void simplifyTableRef(LuaTableRef* tableRef, SimplifyContext* ctx)
+{
+    if (tableRef == 0)
+        return;
+
+    simplifySelect(tableRef->select, ctx);
+
+    for (size_t i = 0; i < tableRef->listSize; i++)
+        simplifyTableRef(tableRef->list[i], ctx);
+
+    if (tableRef->join != 0) {
+        simplifyTableRef(tableRef->join->left, ctx);
+        simplifyTableRef(tableRef->join->right, ctx);
+        simplifyExpr(tableRef->join->condition, ctx);
+    }
+}
+
+static void simplifySelect(LuaSelectStatement* statement,
+    SimplifyContext* ctx)
+{
+    if (statement == 0)
+        return;
+
+    for (size_t i = 0; i < statement->withDescriptionCount; i++)
+        if (statement->withDescriptions[i] != 0)
+            simplifySelect(statement->withDescriptions[i]->select, ctx);
+
+    simplifyTableRef(statement->fromTable, ctx);
+    simplifyExprArr(statement->selectList, statement->selectListSize, ctx);
+    simplifyFilter(&statement->whereClause, ctx);
+
+    if (statement->groupBy != 0) {
+        simplifyExprArr(statement->groupBy->columns,
+            statement->groupBy->columnCount, ctx);
+        simplifyFilter(&statement->groupBy->having, ctx);
+    }
+
+    for (size_t i = 0; i < statement->setOperationCount; i++) {
+        LuaSetOperation* setOp = statement->setOperations[i];
+        if (setOp == 0)
+            continue;
+
+        simplifySelect(setOp->nestedSelectStatement, ctx);
+        simplifyOrder(setOp->resultOrder, setOp->resultOrderCount, ctx);
+        simplifyLimit(setOp->resultLimit, ctx);
+    }
+
+    simplifyOrder(statement->order, statement->orderCount, ctx);
+    simplifyLimit(statement->limit, ctx);
+}
+
+static void simplifySQLStatement(LuaSQLStatement* statement,
+    SimplifyContext* ctx)
+{
+    switch (statement->type) {
+        case kStmtSelect:
+            simplifySelect((LuaSelectStatement*)statement, ctx);
+            break;
+        case kStmtInsert: {
+            LuaInsertStatement* insert = (LuaInsertStatement*)statement;
+
+            simplifyExprArr(insert->values, insert->valueCount, ctx);
+            simplifySelect(insert->select, ctx);
+            break;
+        }
+        case kStmtUpdate: {
+            LuaUpdateStatement* update = (LuaUpdateStatement*)statement;
+
+            simplifyTableRef(update->table, ctx);
+
+            for (size_t i = 0; i < update->updateCount; i++)
+                if (update->updates[i] != 0)
+                    simplifyExpr(update->updates[i]->value, ctx);
+
+            simplifyFilter(&update->where, ctx);
+            break;
+        }
+        case kStmtDelete:
+            simplifyFilter(&((LuaDeleteStatement*)statement)->expr, ctx);
+            break;
+        default:
+            break;
+    }
+}
+
+void simplifySQLParserResult(LuaSQLParserResult* result)
+{
+    SimplifyContext ctx;
+    ctx.report = &result->simplified;
+
+    for (size_t i = 0; i < result->statementCount; i++)
+        if (result->statements[i] != 0)
+            simplifySQLStatement(result->statements[i], &ctx);
+}
+
+void sqlparser_simplify_enable(bool enable)
+{
+    // Cached results were simplified, or not, when they were parsed.
+    if (simplifyEnabled.exchange(enable) != enable)
+        cacheClear();
+}
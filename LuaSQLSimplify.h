@@ -0,0 +1,19 @@
+#ifndef LUA_SQL_SIMPLIFY_H
+#define LUA_SQL_SIMPLIFY_H
+
+#include <atomic>
+#include "LuaSQLParser.h"
+
+extern std::atomic<bool> simplifyEnabled;
+
+inline bool simplifyOn()
+{
+    return simplifyEnabled.load(std::memory_order_relaxed);
+}
+
+// Simplifies the expressions of a freshly copied result in place and
+// records what was changed in result->simplified. Must run before the
+// result is shared.
+void simplifySQLParserResult(LuaSQLParserResult* result);
+
+#endif
@@ -0,0 +1,134 @@
+#include <cstring>
+#include "LuaSQLStats.h"
+
+
+struct PhaseCounters {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+    std::atomic<uint64_t> histogram[32];
+};
+
+// Updated by relaxed atomics from any thread. A snapshot taken while
+// parses run may be slightly inconsistent between counters.
+struct Stats {
+    PhaseCounters phases[4];
+
+    std::atomic<uint64_t> queries;
+    std::atomic<uint64_t> queryBytes;
+    std::atomic<uint64_t> bytesAllocated;
+    std::atomic<uint64_t> nodes;
+
+    std::atomic<uint64_t> maxQueryBytes;
+    std::atomic<uint64_t> maxBytesAllocated;
+    std::atomic<uint64_t> maxNodes;
+    std::atomic<uint64_t> maxDepth;
+};
+
+std::atomic<bool> statsEnabled(false);
+
+static Stats stats;
+
+
+static inline void statsMax(std::atomic<uint64_t>& max, uint64_t value)
+{
+    uint64_t cur = max.load(std::memory_order_relaxed);
+
+    while (value > cur &&
+        !max.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+        ;
+}
+
+static inline void statsAdd(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+void statsRecordPhase(StatsPhase phase, uint64_t ns)
+{
+    PhaseCounters& counters = stats.phases[phase];
+
+    size_t bucket = 0;
+    while (bucket < 31 && (ns >> (bucket + 1)) != 0)
+        bucket++;
+
+    statsAdd(counters.count, 1);
+    statsAdd(counters.totalNs, ns);
+    statsMax(counters.maxNs, ns);
+    statsAdd(counters.histogram[bucket], 1);
+}
+
+void statsRecordQuery(size_t length)
+{
+    statsAdd(stats.queries, 1);
+    statsAdd(stats.queryBytes, length);
+    statsMax(stats.maxQueryBytes, length);
+}
+
+void statsRecordResult(size_t bytes, size_t nodes, size_t depth)
+{
+    statsAdd(stats.bytesAllocated, bytes);
+    statsAdd(stats.nodes, nodes);
+
+    statsMax(stats.maxBytesAllocated, bytes);
+    statsMax(stats.maxNodes, nodes);
+    statsMax(stats.maxDepth, depth);
+}
+
+void sqlparser_stats_enable(bool enable)
+{
+    statsEnabled.store(enable, std::memory_order_relaxed);
+}
+
+void sqlparser_stats_reset()
+{
+    for (PhaseCounters& counters : stats.phases) {
+        counters.count = 0;
+        counters.totalNs = 0;
+        counters.maxNs = 0;
+        for (std::atomic<uint64_t>& bucket : counters.histogram)
+            bucket = 0;
+    }
+
+    stats.queries = 0;
+    stats.queryBytes = 0;
+    stats.bytesAllocated = 0;
+    stats.nodes = 0;
+
+    stats.maxQueryBytes = 0;
+    stats.maxBytesAllocated = 0;
+    stats.maxNodes = 0;
+    stats.maxDepth = 0;
+}
+
+void sqlparser_stats_decode(uint64_t ns)
+{
+    if (statsOn())
+        statsRecordPhase(kPhaseDecode, ns);
+}
+
+void sqlparser_stats(LuaSQLStats* out)
+{
+    out->enabled = statsOn();
+
+    for (size_t i = 0; i < 4; i++) {
+        PhaseCounters& counters = stats.phases[i];
+        LuaSQLPhaseStats& phase = out->phases[i];
+
+        phase.count = counters.count;
+        phase.totalNs = counters.totalNs;
+        phase.maxNs = counters.maxNs;
+        for (size_t j = 0; j < 32; j++)
+            phase.histogram[j] = counters.histogram[j];
+    }
+
+    out->queries = stats.queries;
+    out->queryBytes = stats.queryBytes;
+    out->bytesAllocated = stats.bytesAllocated;
+    out->nodes = stats.nodes;
+
+    out->maxQueryBytes = stats.maxQueryBytes;
+    out->maxBytesAllocated = stats.maxBytesAllocated;
+    out->maxNodes = stats.maxNodes;
+    out->maxDepth = stats.maxDepth;
+}
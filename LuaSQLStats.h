@@ -0,0 +1,42 @@
+#ifndef LUA_SQL_STATS_H
+#define LUA_SQL_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "LuaSQLParser.h"
+
+// Phases timed by the stats, in the order of LuaSQLStats::phases.
+enum StatsPhase {
+    kPhaseParse,
+    kPhaseCopy,
+    kPhaseDecode,
+    kPhaseFinalize
+};
+
+extern std::atomic<bool> statsEnabled;
+
+// Every instrumented spot checks this first, so that disabled stats cost
+// one relaxed load.
+inline bool statsOn()
+{
+    return statsEnabled.load(std::memory_order_relaxed);
+}
+
+inline uint64_t statsNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void statsRecordPhase(StatsPhase phase, uint64_t ns);
+
+// Accounts one parsed query of `length` bytes.
+void statsRecordQuery(size_t length);
+
+// Accounts one copied result: its arena size, the number of nodes and the
+// depth of the deepest one.
+void statsRecordResult(size_t bytes, size_t nodes, size_t depth);
+
+#endif
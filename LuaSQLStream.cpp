@@ -0,0 +1,159 @@
+#include <cctype>
+#include <cstddef>
+#include <new>
+#include "hyrise/src/parser/bison_parser.h"
+#include "hyrise/src/parser/flex_lexer.h"
+#include "LuaSQLParse.h"
+#include "LuaSQLParser.h"
+
+
+// A script being parsed statement by statement. The script is the caller's
+// buffer, `offset` is where the next batch starts and `line` and `column`
+// its position, counted the way the lexer counts them.
+struct LuaSQLStream {
+    const char* data;
+    size_t length;
+    size_t offset;
+    int line;
+    int column;
+
+    // One scanner lexes every batch of the script.
+    yyscan_t scanner;
+};
+
+// Moves the stream past the next statement and its `;` and returns whether
+// the statement has anything but whitespace and comments. Separators are
+// searched for outside of quotes and `--` comments only, the lexer finds
+// every other error when the statement is parsed.
+static bool scanStatement(LuaSQLStream* stream)
+{
+    const char* data = stream->data;
+    size_t i = stream->offset;
+    char quote = 0;
+    bool comment = false;
+    bool tokens = false;
+
+    while (i < stream->length) {
+        char c = data[i++];
+
+        if (c == '\n') {
+            stream->line++;
+            stream->column = 0;
+        }
+        else {
+            stream->column++;
+        }
+
+        if (comment) {
+            comment = c != '\n';
+            continue;
+        }
+
+        // A doubled quote closes and reopens the string, which keeps the
+        // state right without special casing escapes.
+        if (quote != 0) {
+            if (c == quote)
+                quote = 0;
+            continue;
+        }
+
+        if (c == ';')
+            break;
+
+        if (c == '\'' || c == '"')
+            quote = c;
+        else if (c == '-' && i < stream->length && data[i] == '-')
+            comment = true;
+
+        if (!comment && !isspace((unsigned char)c))
+            tokens = true;
+    }
+
+    stream->offset = i;
+    return tokens;
+}
+
+LuaSQLStream* parseSqlStreamOpen(const char* data, size_t length)
+{
+    LuaSQLStream* stream = new (std::nothrow) LuaSQLStream();
+    if (stream == 0)
+        return 0;
+
+    if (hsql_lex_init(&stream->scanner) != 0) {
+        delete stream;
+        return 0;
+    }
+
+    stream->data = data;
+    stream->length = length;
+    return stream;
+}
+
+LuaSQLParserResult* parseSqlStreamNext(LuaSQLStream* stream,
+    size_t maxStatements)
+{
+    if (maxStatements == 0)
+        maxStatements = 1;
+
+    // Leading empty statements are skipped, an empty one after the first
+    // statement ends the batch so that the parser never sees one.
+    size_t start;
+    int line;
+    int column;
+    size_t end = stream->offset;
+    size_t count = 0;
+
+    do {
+        start = stream->offset;
+        line = stream->line;
+        column = stream->column;
+
+        if (start == stream->length)
+            return 0;
+    } while (!scanStatement(stream));
+
+    do {
+        end = stream->offset;
+        count++;
+
+        if (count == maxStatements || end == stream->length)
+            break;
+
+        size_t offset = stream->offset;
+        int nextLine = stream->line;
+        int nextColumn = stream->column;
+
+        if (!scanStatement(stream)) {
+            stream->offset = offset;
+            stream->line = nextLine;
+            stream->column = nextColumn;
+            break;
+        }
+    } while (true);
+
+    size_t length = end - start;
+
+    if (queryTooLong(length))
+        return newErrorResult(kErrorLimit, "Query is too long");
+
+    LuaSQLParserResult* result = parseUncached(stream->data + start, length,
+        stream->scanner);
+
+    // Errors are reported at their position in the script.
+    if (!result->isValid && result->errorCode == kErrorSyntax) {
+        if (result->errorLine == 0)
+            result->errorColumn += column;
+        result->errorLine += line;
+    }
+
+    return result;
+}
+
+void parseSqlStreamClose(LuaSQLStream* stream)
+{
+    if (stream == 0)
+        return;
+
+    hsql_lex_destroy(stream->scanner);
+    delete stream;
+}
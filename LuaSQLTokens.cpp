@@ -0,0 +1,145 @@
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "hyrise/src/parser/bison_parser.h"
+#include "hyrise/src/parser/flex_lexer.h"
+#include "LuaSQLParse.h"
+#include "LuaSQLParser.h"
+
+
+struct TokenName {
+    const char* name;
+    int token;
+};
+
+// The tokens sqlparser_token() knows, enough to classify statements.
+static const TokenName kTokenNames[] = {
+    { "IDENTIFIER", SQL_IDENTIFIER },
+    { "STRING", SQL_STRING },
+    { "FLOATVAL", SQL_FLOATVAL },
+    { "INTVAL", SQL_INTVAL },
+    { "ALTER", SQL_ALTER },
+    { "AS", SQL_AS },
+    { "BEGIN", SQL_BEGIN },
+    { "COLUMNS", SQL_COLUMNS },
+    { "COMMIT", SQL_COMMIT },
+    { "COPY", SQL_COPY },
+    { "CREATE", SQL_CREATE },
+    { "DEALLOCATE", SQL_DEALLOCATE },
+    { "DELETE", SQL_DELETE },
+    { "DESCRIBE", SQL_DESCRIBE },
+    { "DROP", SQL_DROP },
+    { "EXCEPT", SQL_EXCEPT },
+    { "EXECUTE", SQL_EXECUTE },
+    { "EXISTS", SQL_EXISTS },
+    { "FROM", SQL_FROM },
+    { "GROUP", SQL_GROUP },
+    { "HAVING", SQL_HAVING },
+    { "IF", SQL_IF },
+    { "IMPORT", SQL_IMPORT },
+    { "INDEX", SQL_INDEX },
+    { "INSERT", SQL_INSERT },
+    { "INTERSECT", SQL_INTERSECT },
+    { "INTO", SQL_INTO },
+    { "JOIN", SQL_JOIN },
+    { "LIMIT", SQL_LIMIT },
+    { "NOT", SQL_NOT },
+    { "ON", SQL_ON },
+    { "ORDER", SQL_ORDER },
+    { "PREPARE", SQL_PREPARE },
+    { "ROLLBACK", SQL_ROLLBACK },
+    { "SELECT", SQL_SELECT },
+    { "SET", SQL_SET },
+    { "SHOW", SQL_SHOW },
+    { "TABLE", SQL_TABLE },
+    { "TABLES", SQL_TABLES },
+    { "TO", SQL_TO },
+    { "TRANSACTION", SQL_TRANSACTION },
+    { "TRUNCATE", SQL_TRUNCATE },
+    { "UNION", SQL_UNION },
+    { "UPDATE", SQL_UPDATE },
+    { "USING", SQL_USING },
+    { "VALUES", SQL_VALUES },
+    { "VIEW", SQL_VIEW },
+    { "WHERE", SQL_WHERE },
+    { "WITH", SQL_WITH }
+};
+
+// Returns the offset of the first byte from `offset` on that the lexer does
+// not skip as whitespace or a comment.
+static size_t skipBlanks(const char* data, size_t length, size_t offset)
+{
+    while (offset < length) {
+        if (isspace((unsigned char)data[offset])) {
+            offset++;
+        }
+        else if (data[offset] == '-' && offset + 1 < length &&
+            data[offset + 1] == '-') {
+            while (offset < length && data[offset] != '\n')
+                offset++;
+        }
+        else {
+            break;
+        }
+    }
+
+    return offset;
+}
+
+int64_t tokenizeSql(const char* data, size_t length, int16_t* tokens,
+    uint32_t* offsets, size_t capacity)
+{
+    if (queryTooLong(length) || length > INT32_MAX)
+        return -1;
+
+    yyscan_t scanner;
+    if (hsql_lex_init(&scanner) != 0)
+        return -1;
+
+    YY_BUFFER_STATE state = hsql__scan_bytes(data, (int)length, scanner);
+
+    YYSTYPE yylval;
+    YYLTYPE yylloc = YYLTYPE();
+
+    // The lexer counts the bytes it consumes in total_column, so a token
+    // starts at the first byte after the previous one that is not skipped.
+    size_t end = 0;
+    size_t count = 0;
+    bool failed = false;
+
+    while (count < capacity) {
+        int token = hsql_lex(&yylval, &yylloc, scanner);
+        if (token == 0) {
+            // The lexer stops at an unknown character too.
+            failed = skipBlanks(data, length, end) != length;
+            break;
+        }
+
+        if (token == SQL_IDENTIFIER || token == SQL_STRING)
+            free(yylval.sval);
+
+        tokens[count] = (int16_t)token;
+        if (offsets != 0)
+            offsets[count] = (uint32_t)skipBlanks(data, length, end);
+
+        end = (size_t)yylloc.total_column;
+        count++;
+    }
+
+    hsql__delete_buffer(state, scanner);
+    hsql_lex_destroy(scanner);
+
+    return failed ? -1 : (int64_t)count;
+}
+
+int sqlparser_token(const char* name)
+{
+    for (const TokenName& entry : kTokenNames) {
+        if (strcmp(entry.name, name) == 0)
+            return entry.token;
+    }
+
+    return -1;
+}
@@ -0,0 +1,112 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "LuaSQLWorkers.h"
+
+
+struct WorkerTask {
+    WorkerJob job;
+    void* arg;
+};
+
+struct WorkerPool {
+    std::mutex mutex;
+    std::condition_variable wakeup;
+
+    std::deque<WorkerTask> tasks;
+    std::vector<std::thread> threads;
+
+    size_t size;
+
+    // Bumped to retire the running threads, which exit as soon as the queue
+    // is empty.
+    unsigned generation;
+
+    ~WorkerPool();
+};
+
+static WorkerPool pool;
+
+
+static size_t defaultWorkersCount()
+{
+    size_t count = std::thread::hardware_concurrency();
+
+    return count != 0 ? count : 1;
+}
+
+static void workerLoop(unsigned generation)
+{
+    std::unique_lock<std::mutex> lock(pool.mutex);
+
+    while (true) {
+        pool.wakeup.wait(lock, [generation] {
+            return pool.generation != generation || !pool.tasks.empty();
+        });
+
+        if (pool.tasks.empty())
+            return;
+
+        WorkerTask task = pool.tasks.front();
+        pool.tasks.pop_front();
+
+        lock.unlock();
+        task.job(task.arg);
+        lock.lock();
+    }
+}
+
+// Must be called with the pool mutex held.
+static void workersStop(std::unique_lock<std::mutex>& lock)
+{
+    std::vector<std::thread> threads;
+    threads.swap(pool.threads);
+
+    pool.generation++;
+    pool.wakeup.notify_all();
+
+    lock.unlock();
+    for (std::thread& thread : threads)
+        thread.join();
+    lock.lock();
+}
+
+WorkerPool::~WorkerPool()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    workersStop(lock);
+}
+
+void workersSubmit(WorkerJob job, void* arg)
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    if (pool.threads.empty()) {
+        if (pool.size == 0)
+            pool.size = defaultWorkersCount();
+
+        for (size_t i = 0; i < pool.size; i++)
+            pool.threads.emplace_back(workerLoop, pool.generation);
+    }
+
+    pool.tasks.push_back({ job, arg });
+    pool.wakeup.notify_one();
+}
+
+size_t workersCount()
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    return pool.size != 0 ? pool.size : defaultWorkersCount();
+}
+
+void workersConfigure(size_t count)
+{
+    std::unique_lock<std::mutex> lock(pool.mutex);
+
+    workersStop(lock);
+
+    pool.size = count;
+}
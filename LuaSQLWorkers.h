@@ -0,0 +1,20 @@
+#ifndef LUA_SQL_WORKERS_H
+#define LUA_SQL_WORKERS_H
+
+#include <cstddef>
+
+// Fixed pool of background threads shared by batch and asynchronous
+// parsing. The threads are started on the first submitted job.
+typedef void (*WorkerJob)(void* arg);
+
+// Queues job(arg) to be run by one of the workers.
+void workersSubmit(WorkerJob job, void* arg);
+
+// Number of threads the pool runs, started or not.
+size_t workersCount();
+
+// Stops the running workers once they drain the queue and sets the size of
+// the pool. Zero restores the default, one thread per hardware thread.
+void workersConfigure(size_t count);
+
+#endif
@@ -0,0 +1,74 @@
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "../LuaSQLParser.h"
+
+// Batch parsing throughput by the number of workers. The queries differ in
+// their literals, so the parse cache would not help even if enabled.
+
+static const size_t kBatchSize = 1024;
+
+static std::vector<std::string> generateQueries(size_t count)
+{
+    std::vector<std::string> queries;
+
+    for (size_t i = 0; i < count; i++) {
+        std::string n = std::to_string(i);
+
+        queries.push_back(
+            "select \"p\".\"id\", \"e\".\"name\", max(\"e\".\"duration\") "
+            "from \"process\" as \"p\" "
+            "inner join \"event\" as \"e\" on \"p\".\"id\" = \"e\".\"process_id\" "
+            "where \"p\".\"id\" in (" + n + ", " + n + "1, " + n + "2) "
+            "and \"e\".\"name\" like 'event_" + n + "%' "
+            "group by \"p\".\"id\", \"e\".\"name\" "
+            "having count(*) > " + n + " "
+            "limit 100 offset " + n + ";");
+    }
+
+    return queries;
+}
+
+static void BM_ParseSerial(benchmark::State& state)
+{
+    std::vector<std::string> queries = generateQueries(kBatchSize);
+
+    for (auto _ : state) {
+        for (const std::string& query : queries) {
+            LuaSQLParserResult* result =
+                parseSqlN(query.data(), query.size());
+            benchmark::DoNotOptimize(result);
+            finalize(result);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+
+static void BM_ParseBatch(benchmark::State& state)
+{
+    std::vector<std::string> queries = generateQueries(kBatchSize);
+
+    std::vector<const char*> data;
+    std::vector<size_t> lengths;
+    for (const std::string& query : queries) {
+        data.push_back(query.data());
+        lengths.push_back(query.size());
+    }
+
+    sqlparser_workers_configure(state.range(0));
+
+    for (auto _ : state) {
+        LuaSQLParserResult** results =
+            parseSqlBatch(data.data(), lengths.data(), data.size());
+        benchmark::DoNotOptimize(results);
+        finalizeBatch(results, data.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * queries.size());
+
+    sqlparser_workers_configure(0);
+}
+
+BENCHMARK(BM_ParseSerial)->UseRealTime();
+BENCHMARK(BM_ParseBatch)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
@@ -0,0 +1,188 @@
+#!/usr/bin/env tarantool
+
+-- Measures the Lua side of the binding on the same query sets as the
+-- native benchmarks: the native parse and copy as seen from Lua, the whole
+-- sqlparser.parse() call and, as their difference, the decoding of the
+-- result into Lua tables. The JIT trace aborts met while measuring tell
+-- whether the decoder stays compiled. Run from the repository root:
+--
+--     tarantool benchmark/bench.lua
+
+local clock = require("clock")
+local ffi = require("ffi")
+local fio = require("fio")
+local jit = require("jit")
+local vmdef = require("jit.vmdef")
+local yaml = require("yaml")
+
+package.path = "./?.lua;" .. package.path
+package.cpath = "./?.so;" .. package.cpath
+
+local parser = require("sqlparser")
+
+local sqlParserLib = ffi.load(package.search("libsqlparser"))
+
+local MIN_TIME = 0.5
+
+local function readCorpus(path)
+    local file, err = fio.open(path, "O_RDONLY")
+    if file == nil then
+        error(("Can not open file '%s': %s"):format(path, tostring(err)))
+    end
+
+    local data = file:read()
+    file:close()
+
+    local queries = { }
+    for _, row in ipairs(yaml.decode(data)) do
+        table.insert(queries, row[2])
+    end
+
+    return queries
+end
+
+local function generateQueries()
+    local columns = { }
+    for i = 0, 999 do
+        columns[i + 1] = ('"column_%d"'):format(i)
+    end
+
+    local chain = { '"c0" = 0' }
+    for i = 1, 499 do
+        chain[i + 1] = ('%s "c%d" = %d'):format(
+            i % 2 == 1 and "and" or "or", i, i)
+    end
+
+    local items = { }
+    for i = 0, 9999 do
+        items[i + 1] = tostring(i)
+    end
+
+    local terms = { }
+    for i = 0, 49999 do
+        terms[i + 1] = ('"c" = %d'):format(i)
+    end
+
+    return {
+        { "Wide select", { "select " .. table.concat(columns, ", ") ..
+            ' from "test";' } },
+        { "Deep boolean chain", { 'select "a" from "test" where ' ..
+            table.concat(chain, " ") .. ";" } },
+        { "Huge IN-list", { 'select "a" from "test" where "b" in (' ..
+            table.concat(items, ", ") .. ");" } },
+        -- The generators still recurse once per term, so the chain is
+        -- only parsed.
+        { "Long OR chain", { 'select "a" from "test" where ' ..
+            table.concat(terms, " or ") .. ";" }, parseOnly = true }
+    }
+end
+
+-- Trace aborts by reason, counted while measuring.
+local aborts
+local abortCount
+
+local function onTrace(what, _, _, _, err, info)
+    if what ~= "abort" then
+        return
+    end
+
+    local reason = vmdef.traceerr[err]
+    if type(reason) == "string" and reason:find("%%") then
+        reason = reason:format(type(info) == "number" and
+            vmdef.ffnames[info] or tostring(info))
+    end
+    reason = tostring(reason)
+
+    aborts[reason] = (aborts[reason] or 0) + 1
+    abortCount = abortCount + 1
+end
+
+-- Returns the most frequent abort reason, if any.
+local function topAbort()
+    local top, topCount = nil, 0
+
+    for reason, count in pairs(aborts) do
+        if count > topCount then
+            top, topCount = reason, count
+        end
+    end
+
+    return top
+end
+
+-- Runs fn over all queries until MIN_TIME passes. Returns ns and Lua heap
+-- bytes per query, the collector is stopped while measuring. Traces
+-- aborted after the warm-up run are counted in aborts.
+local function measure(queries, fn)
+    for _, query in ipairs(queries) do
+        fn(query)
+    end
+
+    aborts = { }
+    abortCount = 0
+    jit.attach(onTrace, "trace")
+
+    collectgarbage("collect")
+    collectgarbage("stop")
+
+    local runs = 0
+    local heap = collectgarbage("count")
+    local start = clock.monotonic64()
+    local elapsed
+
+    repeat
+        for _, query in ipairs(queries) do
+            fn(query)
+        end
+        runs = runs + 1
+
+        elapsed = tonumber(clock.monotonic64() - start)
+    until elapsed >= MIN_TIME * 1e9 or
+        collectgarbage("count") - heap > 512 * 1024
+
+    local bytes = (collectgarbage("count") - heap) * 1024
+
+    collectgarbage("restart")
+    collectgarbage("collect")
+
+    jit.attach(onTrace)
+
+    local n = runs * #queries
+
+    return elapsed / n, bytes / n
+end
+
+local stages = {
+    { "native", function(query)
+        sqlParserLib.finalize(sqlParserLib.parseSqlN(query, #query))
+    end },
+    { "parse", function(query)
+        return parser.parse(query)
+    end },
+    { "format", function(query)
+        return parser.format(query)
+    end }
+}
+
+local sets = generateQueries()
+table.insert(sets, 1, { "queries.yml", readCorpus("test/queries.yml") })
+
+print(("%-20s %-8s %14s %14s %8s  %s"):format("set", "stage", "ns/query",
+    "lua bytes/query", "aborts", "top abort reason"))
+
+for _, set in ipairs(sets) do
+    local results = { }
+
+    for _, stage in ipairs(stages) do
+        if not (set.parseOnly and stage[1] == "format") then
+            local ns, bytes = measure(set[2], stage[2])
+            results[stage[1]] = ns
+
+            print(("%-20s %-8s %14.0f %14.0f %8d  %s"):format(set[1],
+                stage[1], ns, bytes, abortCount, topAbort() or ""))
+        end
+    end
+
+    print(("%-20s %-8s %14.0f"):format(set[1], "decode",
+        results.parse - results.native))
+end
@@ -0,0 +1,171 @@
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "benchmark_utils.h"
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static std::atomic<uint64_t> allocCount(0);
+static std::atomic<uint64_t> allocBytes(0);
+
+static inline void countAlloc(size_t size)
+{
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+extern "C" void* malloc(size_t size)
+{
+    countAlloc(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    countAlloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    countAlloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+AllocStats allocStats()
+{
+    return {
+        allocCount.load(std::memory_order_relaxed),
+        allocBytes.load(std::memory_order_relaxed)
+    };
+}
+
+void setQueryCounters(benchmark::State& state, const AllocStats& start,
+    size_t queries)
+{
+    AllocStats end = allocStats();
+
+    double n = (double)state.iterations() * queries;
+
+    state.SetItemsProcessed(state.iterations() * queries);
+
+    state.counters["ns/query"] = benchmark::Counter(n,
+        benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    state.counters["allocs/query"] = (end.count - start.count) / n;
+    state.counters["bytes/query"] = (end.bytes - start.bytes) / n;
+}
+
+// Reads the plain scalar of a queries.yml item that starts on the current
+// line, folding continuation lines into spaces as YAML does.
+static std::string readScalar(const std::vector<std::string>& lines,
+    size_t* i, const std::string& first)
+{
+    std::string value = first;
+
+    while (*i + 1 < lines.size()) {
+        const std::string& next = lines[*i + 1];
+
+        size_t indent = next.find_first_not_of(' ');
+        if (indent == std::string::npos || indent < 4)
+            break;
+
+        if (!value.empty())
+            value += ' ';
+        value += next.substr(indent);
+
+        (*i)++;
+    }
+
+    return value;
+}
+
+static std::vector<BenchQuery> loadCorpus(const char* path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Can not open corpus '%s'\n", path);
+        exit(1);
+    }
+
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line))
+        lines.push_back(line);
+
+    std::vector<BenchQuery> queries;
+    bool haveQuery = true;
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        const std::string& l = lines[i];
+
+        if (l.compare(0, 4, "- - ") == 0) {
+            queries.push_back({ l.substr(4), "" });
+            haveQuery = false;
+        }
+        else if (!haveQuery && l.compare(0, 3, "  -") == 0) {
+            std::string first = l.size() > 4 ? l.substr(4) : "";
+            queries.back().query = readScalar(lines, &i, first);
+            haveQuery = true;
+        }
+    }
+
+    return queries;
+}
+
+const std::vector<BenchQuery>& corpusQueries()
+{
+    static std::vector<BenchQuery> queries = [] {
+        const char* path = getenv("SQLPARSER_CORPUS");
+        return loadCorpus(path != 0 ? path : "test/queries.yml");
+    }();
+
+    return queries;
+}
+
+const std::vector<BenchQuery>& generatedQueries()
+{
+    static std::vector<BenchQuery> queries = [] {
+        std::vector<BenchQuery> queries;
+        std::ostringstream q;
+
+        q << "select ";
+        for (int i = 0; i < 1000; i++)
+            q << (i != 0 ? ", " : "") << "\"column_" << i << "\"";
+        q << " from \"test\";";
+        queries.push_back({ "Wide select", q.str() });
+
+        q.str("");
+        q << "select \"a\" from \"test\" where \"c0\" = 0";
+        for (int i = 1; i < 500; i++)
+            q << (i % 2 ? " and " : " or ") << "\"c" << i << "\" = " << i;
+        q << ";";
+        queries.push_back({ "Deep boolean chain", q.str() });
+
+        q.str("");
+        q << "select \"a\" from \"test\" where \"b\" in (";
+        for (int i = 0; i < 10000; i++)
+            q << (i != 0 ? ", " : "") << i;
+        q << ");";
+        queries.push_back({ "Huge IN-list", q.str() });
+
+        q.str("");
+        q << "select \"a\" from \"test\" where \"c\" = 0";
+        for (int i = 1; i < 50000; i++)
+            q << " or \"c\" = " << i;
+        q << ";";
+        queries.push_back({ "Long OR chain", q.str() });
+
+        return queries;
+    }();
+
+    return queries;
+}
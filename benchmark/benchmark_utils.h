@@ -0,0 +1,36 @@
+#ifndef SQLPARSER_BENCHMARK_UTILS_H
+#define SQLPARSER_BENCHMARK_UTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+struct BenchQuery {
+    std::string name;
+    std::string query;
+};
+
+// The first query of every case of test/queries.yml. The path is taken
+// from SQLPARSER_CORPUS and defaults to test/queries.yml.
+const std::vector<BenchQuery>& corpusQueries();
+
+// Large synthetic queries: a wide select list, a deep boolean chain, a
+// huge IN-list and a left-deep OR chain of 50000 terms.
+const std::vector<BenchQuery>& generatedQueries();
+
+// Process-wide malloc counters, the benchmark binary interposes malloc().
+struct AllocStats {
+    uint64_t count;
+    uint64_t bytes;
+};
+
+AllocStats allocStats();
+
+// Sets the ns/query, allocs/query and bytes/query counters from the
+// allocations made since `start` and `queries` queries per iteration.
+void setQueryCounters(benchmark::State& state, const AllocStats& start,
+    size_t queries);
+
+#endif
@@ -0,0 +1,168 @@
+#!/usr/bin/env tarantool
+
+-- Compares WHERE clauses compiled by sqlparser.compileFilter() with a
+-- recursive interpreter of the same AST, the way filters are evaluated
+-- without the compiler. Run from the repository root:
+--
+--     tarantool benchmark/filter.lua
+
+local clock = require("clock")
+
+package.path = "./?.lua;" .. package.path
+package.cpath = "./?.so;" .. package.cpath
+
+local parser = require("sqlparser")
+
+local MIN_TIME = 0.5
+local TUPLE_COUNT = 100000
+
+local fields = { a = 1, b = 2, c = 3, d = 4, e = 5 }
+
+local queries = {
+    { "Comparisons", 'select * from "t" where "a" = 5 and "b" > 10;' },
+    { "IN-list or LIKE", 'select * from "t" where "c" in (' ..
+        '1, 3, 5, 7, 9, 11, 13, 15, 17, 19) or "d" like \'ab%\';' },
+    { "BETWEEN and IS NULL", 'select * from "t" where ' ..
+        '"a" between 10 and 20 and not "e" is null;' },
+    { "Parameters", 'select * from "t" where "a" = ? or "b" <> ?;' }
+}
+
+local params = { 7, 42 }
+
+local interpret
+
+local function interpretValue(expr, tuple)
+    local exprType = expr.type
+
+    if exprType == "columnRef" then
+        return tuple[fields[expr.name]]
+    elseif exprType == "parameter" then
+        return params[expr.paramId + 1]
+    elseif exprType == "literalNull" then
+        return nil
+    elseif exprType == "operator" then
+        return interpret(expr, tuple)
+    end
+
+    return expr.value
+end
+
+local function likeToPattern(pattern)
+    return "^" .. pattern:gsub("[%^%$%(%)%.%[%]%*%+%-%?]", "%%%0")
+        :gsub("%%", ".-"):gsub("_", ".") .. "$"
+end
+
+interpret = function(expr, tuple)
+    local op = expr.name
+
+    if op == "and" then
+        return interpret(expr.expr, tuple) and interpret(expr.expr2, tuple)
+    elseif op == "or" then
+        return interpret(expr.expr, tuple) or interpret(expr.expr2, tuple)
+    elseif op == "not" then
+        return not interpret(expr.expr, tuple)
+    elseif op == "is null" then
+        return interpretValue(expr.expr, tuple) == nil
+    end
+
+    local a = interpretValue(expr.expr, tuple)
+
+    if op == "in" then
+        for _, item in ipairs(expr.exprList) do
+            if a == interpretValue(item, tuple) then
+                return true
+            end
+        end
+        return false
+    elseif op == "between" then
+        return a ~= nil and a >= interpretValue(expr.exprList[1], tuple) and
+            a <= interpretValue(expr.exprList[2], tuple)
+    end
+
+    local b = interpretValue(expr.expr2, tuple)
+
+    if a == nil or b == nil then
+        return false
+    elseif op == "=" then
+        return a == b
+    elseif op == "<>" then
+        return a ~= b
+    elseif op == ">" then
+        return a > b
+    elseif op == "<" then
+        return a < b
+    elseif op == "like" then
+        return tostring(a):find(likeToPattern(b)) ~= nil
+    end
+
+    error("unsupported operator: " .. tostring(op))
+end
+
+local function generateTuples()
+    local tuples = { }
+
+    for i = 1, TUPLE_COUNT do
+        tuples[i] = {
+            i % 30,
+            i % 50,
+            i % 20,
+            ({ "abc", "abd", "xyz", "bca" })[i % 4 + 1],
+            i % 3 == 0 and box.NULL or i
+        }
+    end
+
+    return tuples
+end
+
+-- Returns ns per tuple of running fn over all tuples until MIN_TIME passes.
+local function measure(tuples, fn)
+    local runs = 0
+    local matched = 0
+    local start = clock.monotonic64()
+    local elapsed
+
+    repeat
+        for i = 1, #tuples do
+            if fn(tuples[i]) then
+                matched = matched + 1
+            end
+        end
+        runs = runs + 1
+
+        elapsed = tonumber(clock.monotonic64() - start)
+    until elapsed >= MIN_TIME * 1e9
+
+    return elapsed / (runs * #tuples), matched / runs
+end
+
+local tuples = generateTuples()
+
+print(("%-22s %14s %14s %10s %16s"):format("query", "interpret ns", "compiled ns",
+    "matched", "bind ns/query"))
+
+for _, query in ipairs(queries) do
+    local statement = parser.parse(query[2]).statements[1]
+    local where = statement.whereClause
+
+    local interpreted, matchedInterpreted = measure(tuples, function(tuple)
+        return interpret(where, tuple)
+    end)
+
+    local filter = parser.compileFilter(statement, fields, params)
+    local compiled, matched = measure(tuples, filter)
+
+    assert(matched == matchedInterpreted, "the filters disagree")
+
+    -- The code is cached, so binding the literals of another query of the
+    -- same shape is all that is left.
+    local binds = 0
+    local start = clock.monotonic64()
+    repeat
+        parser.compileFilter(statement, fields, params)
+        binds = binds + 1
+    until clock.monotonic64() - start >= MIN_TIME * 1e9
+
+    print(("%-22s %14.1f %14.1f %10d %16.0f"):format(query[1], interpreted,
+        compiled, matched,
+        tonumber(clock.monotonic64() - start) / binds))
+end
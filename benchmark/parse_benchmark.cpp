@@ -0,0 +1,121 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "../hyrise/src/SQLParser.h"
+#include "../LuaSQLParser.h"
+#include "benchmark_utils.h"
+
+// Cost of every native stage of sqlparser.parse() on the query sets: the
+// upstream parse alone, the copy into the arena alone and the whole native
+// pipeline, with and without a parser context. The Lua decoding is
+// measured by benchmark/bench.lua.
+
+// Defined in LuaSQLParser.cpp, not part of the public interface.
+LuaSQLParserResult* copySQLParserResult(hsql::SQLParserResult* result);
+
+// Argument 0 is the test/queries.yml corpus, the others are the generated
+// queries one by one.
+static std::vector<const BenchQuery*> querySet(benchmark::State& state)
+{
+    std::vector<const BenchQuery*> queries;
+
+    if (state.range(0) == 0) {
+        for (const BenchQuery& query : corpusQueries())
+            queries.push_back(&query);
+
+        state.SetLabel("queries.yml");
+    }
+    else {
+        const BenchQuery& query = generatedQueries()[state.range(0) - 1];
+        queries.push_back(&query);
+
+        state.SetLabel(query.name);
+    }
+
+    return queries;
+}
+
+static void BM_HyriseParse(benchmark::State& state)
+{
+    std::vector<const BenchQuery*> queries = querySet(state);
+
+    AllocStats start = allocStats();
+
+    for (auto _ : state) {
+        for (const BenchQuery* query : queries) {
+            hsql::SQLParserResult result;
+            hsql::SQLParser::parse(query->query, &result);
+            benchmark::DoNotOptimize(result.isValid());
+        }
+    }
+
+    setQueryCounters(state, start, queries.size());
+}
+
+static void BM_Copy(benchmark::State& state)
+{
+    std::vector<const BenchQuery*> queries = querySet(state);
+
+    std::vector<std::unique_ptr<hsql::SQLParserResult>> results;
+    for (const BenchQuery* query : queries) {
+        results.emplace_back(new hsql::SQLParserResult());
+        hsql::SQLParser::parse(query->query, results.back().get());
+    }
+
+    AllocStats start = allocStats();
+
+    for (auto _ : state) {
+        for (auto& result : results) {
+            LuaSQLParserResult* luaResult = copySQLParserResult(result.get());
+            benchmark::DoNotOptimize(luaResult);
+            finalize(luaResult);
+        }
+    }
+
+    setQueryCounters(state, start, queries.size());
+}
+
+static void BM_ParseSqlN(benchmark::State& state)
+{
+    std::vector<const BenchQuery*> queries = querySet(state);
+
+    AllocStats start = allocStats();
+
+    for (auto _ : state) {
+        for (const BenchQuery* query : queries) {
+            LuaSQLParserResult* result =
+                parseSqlN(query->query.data(), query->query.size());
+            benchmark::DoNotOptimize(result);
+            finalize(result);
+        }
+    }
+
+    setQueryCounters(state, start, queries.size());
+}
+
+static void BM_ParseSqlContext(benchmark::State& state)
+{
+    std::vector<const BenchQuery*> queries = querySet(state);
+
+    LuaSQLParserContext* context = sqlparser_context_new();
+
+    AllocStats start = allocStats();
+
+    for (auto _ : state) {
+        for (const BenchQuery* query : queries) {
+            LuaSQLParserResult* result = parseSqlContext(context,
+                query->query.data(), query->query.size());
+            benchmark::DoNotOptimize(result);
+        }
+    }
+
+    setQueryCounters(state, start, queries.size());
+
+    sqlparser_context_free(context);
+}
+
+BENCHMARK(BM_HyriseParse)->DenseRange(0, 4);
+BENCHMARK(BM_Copy)->DenseRange(0, 4);
+BENCHMARK(BM_ParseSqlN)->DenseRange(0, 4);
+BENCHMARK(BM_ParseSqlContext)->DenseRange(0, 4);
@@ -0,0 +1,567 @@
+#!/usr/bin/env tarantool
+
+-- Compiles WHERE expressions of the ASTs built by sqlparser.lua into Lua
+-- functions filtering tuples. The expression is turned into Lua source once
+-- per shape and load()ed; literals and parameters are not part of the
+-- source, they are bound as upvalues of a fresh closure for every query, so
+-- queries that differ only in them share the compiled code.
+
+-- Constants bound to locals of the filter, the rest is read from a table.
+-- LuaJIT allows 60 upvalues per function, the helpers take some.
+local MAX_LOCALS = 40
+
+-- Operators nested deeper than this are not compiled. AND and OR chains
+-- count as one level whatever their length.
+local MAX_DEPTH = 100
+
+-- Shapes compiled per field mapping before the cache of the mapping is
+-- dropped.
+local CACHE_SIZE = 1024
+
+-- Helpers of the generated code. NULL is nil, comparisons return true, false
+-- or nil for unknown as SQL does. The helpers are small enough for LuaJIT to
+-- inline them into the traces of the filters.
+local PRELUDE = [[
+local type, tostring = type, tostring
+
+local function eq(a, b)
+    if a == nil or b == nil then return nil end
+    return a == b
+end
+
+local function ne(a, b)
+    if a == nil or b == nil then return nil end
+    return a ~= b
+end
+
+local function lt(a, b)
+    if a == nil or b == nil then return nil end
+    return a < b
+end
+
+local function le(a, b)
+    if a == nil or b == nil then return nil end
+    return a <= b
+end
+
+local function gt(a, b)
+    if a == nil or b == nil then return nil end
+    return a > b
+end
+
+local function ge(a, b)
+    if a == nil or b == nil then return nil end
+    return a >= b
+end
+
+local function add(a, b)
+    if a == nil or b == nil then return nil end
+    return a + b
+end
+
+local function sub(a, b)
+    if a == nil or b == nil then return nil end
+    return a - b
+end
+
+local function mul(a, b)
+    if a == nil or b == nil then return nil end
+    return a * b
+end
+
+local function neg(a)
+    if a == nil then return nil end
+    return -a
+end
+
+local function cat(a, b)
+    if a == nil or b == nil then return nil end
+    return tostring(a) .. tostring(b)
+end
+
+local function between(a, low, high)
+    if a == nil or low == nil or high == nil then return nil end
+    return a >= low and a <= high
+end
+
+local function isin(a, set)
+    if a == nil then return nil end
+    if set.values[a] then return true end
+    if set.hasNull then return nil end
+    return false
+end
+
+local function like(a, match)
+    if a == nil or match == nil then return nil end
+    if type(a) ~= "string" then a = tostring(a) end
+    return match(a)
+end
+
+local function truth(a)
+    if a == nil then return nil end
+    if type(a) == "boolean" then return a end
+    return a ~= 0
+end
+]]
+
+local COMPARISONS = {
+    ["="] = "eq",
+    ["<>"] = "ne",
+    ["<"] = "lt",
+    ["<="] = "le",
+    [">"] = "gt",
+    [">="] = "ge"
+}
+
+local ARITHMETIC = {
+    ["+"] = "add",
+    ["-"] = "sub",
+    ["*"] = "mul",
+    ["||"] = "cat"
+}
+
+local LIKES = {
+    ["like"] = true,
+    ["not like"] = true,
+    ["ilike"] = true
+}
+
+local function isPlaceholder(expr)
+    local exprType = expr.type
+
+    return exprType == "literalInt" or exprType == "literalFloat" or
+        exprType == "literalString" or exprType == "parameter"
+end
+
+local function isPlaceholderList(exprList)
+    for _, item in ipairs(exprList) do
+        if not isPlaceholder(item) or item.alias ~= nil then
+            return false
+        end
+    end
+
+    return true
+end
+
+-- Walks the expression depth-first without recursion and lists its slots:
+-- the literals and parameters, IN-lists made of them only and LIKE
+-- patterns given by them. The returned signature describes everything but
+-- the slot values, two expressions with the same signature compile to the
+-- same code.
+local function scan(root)
+    local signature = { }
+    local slots = { }
+    local kinds = { }
+
+    local stack = { root }
+    local top = 1
+
+    while top > 0 do
+        local expr = stack[top]
+        stack[top] = nil
+        top = top - 1
+
+        if expr == nil then
+            signature[#signature + 1] = "-"
+        elseif isPlaceholder(expr) then
+            signature[#signature + 1] = "?"
+            slots[#slots + 1] = expr
+            kinds[expr] = "value"
+        else
+            signature[#signature + 1] = ("%s %s %s %s"):format(expr.type,
+                expr.name or "", expr.table or "",
+                expr.exprList ~= nil and #expr.exprList or "")
+
+            local children = { expr.expr, expr.expr2 }
+            local listed = expr.exprList
+
+            local op = expr.type == "operator" and expr.name or nil
+
+            if op == "in" and listed ~= nil and isPlaceholderList(listed) then
+                signature[#signature] = "in ?"
+                slots[#slots + 1] = expr
+                kinds[expr] = "set"
+                listed = nil
+            elseif LIKES[op] and expr.expr2 ~= nil and
+                isPlaceholder(expr.expr2)
+            then
+                slots[#slots + 1] = expr.expr2
+                kinds[expr.expr2] = op == "ilike" and "ipattern" or "pattern"
+                children[2] = nil
+            end
+
+            if listed ~= nil then
+                for i = #listed, 1, -1 do
+                    top = top + 1
+                    stack[top] = listed[i]
+                end
+            end
+
+            if children[2] ~= nil then
+                top = top + 1
+                stack[top] = children[2]
+            end
+
+            if children[1] ~= nil then
+                top = top + 1
+                stack[top] = children[1]
+            end
+        end
+    end
+
+    return table.concat(signature, "\n"), slots, kinds
+end
+
+local function getLiteral(expr, params)
+    if expr.type == "parameter" then
+        return params[expr.paramId + 1]
+    end
+
+    if expr.isBoolLiteral then
+        return expr.value ~= 0
+    end
+
+    return expr.value
+end
+
+local PATTERN_MAGIC = "[%^%$%(%)%%%.%[%]%*%+%-%?]"
+
+-- Turns a LIKE pattern into a function matching strings against it.
+local function getMatcher(pattern, caseless)
+    if pattern == nil then
+        return nil
+    end
+
+    pattern = tostring(pattern)
+    if caseless then
+        pattern = pattern:lower()
+    end
+
+    local luaPattern = { "^" }
+    local wildcards = 0
+    local prefix = nil
+
+    for i = 1, #pattern do
+        local c = pattern:sub(i, i)
+
+        if c == "%" then
+            wildcards = wildcards + 1
+            if wildcards == 1 and i == #pattern then
+                prefix = pattern:sub(1, i - 1)
+            end
+            luaPattern[#luaPattern + 1] = ".-"
+        elseif c == "_" then
+            wildcards = wildcards + 1
+            luaPattern[#luaPattern + 1] = "."
+        else
+            luaPattern[#luaPattern + 1] = c:gsub(PATTERN_MAGIC, "%%%0")
+        end
+    end
+
+    luaPattern[#luaPattern + 1] = "$"
+    luaPattern = table.concat(luaPattern)
+
+    local lower = string.lower
+    local find = string.find
+
+    -- Plain and prefix patterns avoid string.find(), which LuaJIT does not
+    -- compile.
+    if wildcards == 0 then
+        if caseless then
+            return function(s) return lower(s) == pattern end
+        end
+        return function(s) return s == pattern end
+    end
+
+    if prefix ~= nil then
+        local n = #prefix
+        if caseless then
+            return function(s) return lower(s:sub(1, n)) == prefix end
+        end
+        return function(s) return s:sub(1, n) == prefix end
+    end
+
+    if caseless then
+        return function(s) return find(lower(s), luaPattern) ~= nil end
+    end
+    return function(s) return find(s, luaPattern) ~= nil end
+end
+
+-- Returns the values of the slots for one query.
+local function bindSlots(slots, kinds, params)
+    local values = { }
+
+    for i, expr in ipairs(slots) do
+        local kind = kinds[expr]
+
+        if kind == "value" then
+            values[i] = getLiteral(expr, params)
+        elseif kind == "set" then
+            local set = { values = { }, hasNull = false }
+
+            for _, item in ipairs(expr.exprList) do
+                local value = getLiteral(item, params)
+                if value == nil then
+                    set.hasNull = true
+                else
+                    set.values[value] = true
+                end
+            end
+
+            values[i] = set
+        else
+            values[i] = getMatcher(getLiteral(expr, params),
+                kind == "ipattern")
+        end
+    end
+
+    return values
+end
+
+local Compiler = { }
+Compiler.__index = Compiler
+
+function Compiler:slot(expr)
+    local index = self.slotIndex[expr]
+
+    if index <= MAX_LOCALS then
+        return "v" .. index
+    end
+
+    return ("V[%d]"):format(index)
+end
+
+function Compiler:column(expr)
+    local fields = self.fields
+    local field
+
+    if expr.table ~= nil then
+        field = fields[expr.table .. "." .. expr.name]
+    end
+
+    field = field or fields[expr.name]
+
+    if field == nil then
+        error(("sqlparser: no field for column '%s'"):format(
+            expr.table ~= nil and expr.table .. "." .. expr.name or
+            expr.name), 0)
+    end
+
+    return ("t[%d]"):format(field)
+end
+
+function Compiler:value(expr, depth)
+    if depth > MAX_DEPTH then
+        error("sqlparser: the expression is too deep to compile", 0)
+    end
+
+    local exprType = expr.type
+
+    if self.slotIndex[expr] ~= nil then
+        return self:slot(expr)
+    elseif exprType == "literalNull" then
+        return "nil"
+    elseif exprType == "columnRef" then
+        return self:column(expr)
+    elseif exprType == "operator" then
+        local op = expr.name
+
+        if ARITHMETIC[op] and expr.expr2 ~= nil then
+            return ("%s(%s, %s)"):format(ARITHMETIC[op],
+                self:value(expr.expr, depth + 1),
+                self:value(expr.expr2, depth + 1))
+        elseif op == "-" and expr.arity == 1 then
+            return ("neg(%s)"):format(self:value(expr.expr, depth + 1))
+        end
+    end
+
+    error(("sqlparser: can not compile expression of type '%s' %s"):format(
+        exprType, expr.name or ""), 0)
+end
+
+-- Collects the operands of an AND or OR chain left to right.
+local function chainOperands(expr)
+    local op = expr.name
+    local operands = { }
+
+    local stack = { expr }
+    local top = 1
+
+    while top > 0 do
+        local node = stack[top]
+        stack[top] = nil
+        top = top - 1
+
+        if node.type == "operator" and node.name == op then
+            stack[top + 1] = node.expr2
+            stack[top + 2] = node.expr
+            top = top + 2
+        else
+            operands[#operands + 1] = node
+        end
+    end
+
+    return operands
+end
+
+-- Returns Lua code that is true exactly when the expression is TRUE, or
+-- FALSE if `want` is false. NULL is neither.
+function Compiler:condition(expr, want, depth)
+    if depth > MAX_DEPTH then
+        error("sqlparser: the expression is too deep to compile", 0)
+    end
+
+    local wantStr = tostring(want)
+
+    if expr.type ~= "operator" then
+        return ("(truth(%s) == %s)"):format(self:value(expr, depth), wantStr)
+    end
+
+    local op = expr.name
+
+    if op == "and" or op == "or" then
+        -- a AND b is TRUE if both are, FALSE if either is; OR the other way
+        -- around.
+        local join = (op == "and") == want and " and " or " or "
+
+        local parts = { }
+        for i, operand in ipairs(chainOperands(expr)) do
+            parts[i] = self:condition(operand, want, depth + 1)
+        end
+
+        return "(" .. table.concat(parts, join) .. ")"
+    elseif op == "not" then
+        return self:condition(expr.expr, not want, depth + 1)
+    elseif op == "is null" then
+        return ("(%s %s nil)"):format(self:value(expr.expr, depth + 1),
+            want and "==" or "~=")
+    elseif COMPARISONS[op] then
+        return ("(%s(%s, %s) == %s)"):format(COMPARISONS[op],
+            self:value(expr.expr, depth + 1),
+            self:value(expr.expr2, depth + 1), wantStr)
+    elseif op == "between" then
+        return ("(between(%s, %s, %s) == %s)"):format(
+            self:value(expr.expr, depth + 1),
+            self:value(expr.exprList[1], depth + 1),
+            self:value(expr.exprList[2], depth + 1), wantStr)
+    elseif op == "in" and expr.exprList ~= nil then
+        local value = self:value(expr.expr, depth + 1)
+
+        if self.slotIndex[expr] ~= nil then
+            return ("(isin(%s, %s) == %s)"):format(value, self:slot(expr),
+                wantStr)
+        end
+
+        -- IN is TRUE if any item is equal, FALSE if all are not.
+        local parts = { }
+        for i, item in ipairs(expr.exprList) do
+            parts[i] = ("(eq(%s, %s) == %s)"):format(value,
+                self:value(item, depth + 1), wantStr)
+        end
+
+        return "(" .. table.concat(parts, want and " or " or " and ") .. ")"
+    elseif LIKES[op] then
+        if self.slotIndex[expr.expr2] == nil then
+            error("sqlparser: LIKE patterns must be literals or parameters",
+                0)
+        end
+
+        return ("(like(%s, %s) == %s)"):format(
+            self:value(expr.expr, depth + 1), self:slot(expr.expr2),
+            tostring(want == (op ~= "not like")))
+    end
+
+    return ("(truth(%s) == %s)"):format(self:value(expr, depth), wantStr)
+end
+
+-- Generates the source of a chunk returning the filter factory for the
+-- expression. Raises an error for expressions it can not compile.
+local function generate(expr, fields, slots)
+    local compiler = setmetatable({
+        fields = fields,
+        slotIndex = { }
+    }, Compiler)
+
+    for i, slot in ipairs(slots) do
+        compiler.slotIndex[slot] = i
+    end
+
+    local body = compiler:condition(expr, true, 0)
+
+    local locals = { }
+    for i = 1, math.min(#slots, MAX_LOCALS) do
+        locals[i] = ("local v%d = V[%d]"):format(i, i)
+    end
+
+    return PRELUDE .. "\nreturn function(V)\n" ..
+        table.concat(locals, "\n") ..
+        "\nreturn function(t)\nreturn " .. body .. "\nend\nend\n"
+end
+
+local function loadFactory(expr, fields, slots)
+    local source = generate(expr, fields, slots)
+
+    local chunk, err = loadstring(source, "=sqlfilter")
+    if chunk == nil then
+        error("sqlparser: can not compile the expression: " .. err, 0)
+    end
+
+    return chunk()
+end
+
+-- Compiled filter factories by field mapping, fingerprint and signature.
+local cache = setmetatable({ }, { __mode = "k" })
+
+-- Returns a function of a tuple that is true if the expression is TRUE for
+-- it. `fields` maps column names, optionally qualified, to field numbers,
+-- `params` holds the values of the parameters. With a fingerprint the
+-- compiled code is cached; expressions that differ only in literals and
+-- parameters share it.
+local function compile(expr, fields, params, fingerprint)
+    if expr == nil then
+        return function() return true end
+    end
+
+    params = params or { }
+
+    local signature, slots, kinds = scan(expr)
+
+    if fingerprint == nil then
+        return loadFactory(expr, fields, slots)(bindSlots(slots, kinds, params))
+    end
+
+    local shapes = cache[fields]
+    if shapes == nil or shapes.count >= CACHE_SIZE then
+        shapes = { count = 0, byFingerprint = { } }
+        cache[fields] = shapes
+    end
+
+    -- Simplification can rewrite queries of one fingerprint differently, the
+    -- signature tells the variants apart.
+    local variants = shapes.byFingerprint[fingerprint]
+    if variants == nil then
+        variants = { }
+        shapes.byFingerprint[fingerprint] = variants
+    end
+
+    local factory = variants[signature]
+    if factory == nil then
+        factory = loadFactory(expr, fields, slots)
+        variants[signature] = factory
+        shapes.count = shapes.count + 1
+    end
+
+    return factory(bindSlots(slots, kinds, params))
+end
+
+-- Returns the source generated for the expression, for debugging.
+local function source(expr, fields)
+    local _, slots = scan(expr)
+
+    return generate(expr, fields, slots)
+end
+
+return {
+    compile = compile,
+    source = source
+}
@@ -13,30 +13,38 @@ local getOrderDescriptionStr
 local getWithDescriptionStr
 local getLimitDescriptionStr
 local getSelectStatementStr
+local getInsertStatementStr
+local getUpdateStatementStr
+local getDeleteStatementStr
 local getSQLStatementStr
 
+-- Expressions rendered between two yields.
+local YIELD_INTERVAL = 1024
+
+local exprCount = 0
+
 local function getArrStr(arr, getItemStr, ...)
     if arr == nil then
         return ""
     end
 
-    local str = ""
-
-    for _, item in ipairs(arr) do
-        str = str .. getItemStr(item, ...) .. ", "
-    end
+    local strs = { }
 
-    if str:sub(-2) == ", " then
-        str = str:sub(1, -3)
+    for i, item in ipairs(arr) do
+        strs[i] = getItemStr(item, ...)
     end
 
-    return str
+    return table.concat(strs, ", ")
 end
 
 getExprStr = function(expr, nested, allowAlias)
     assert(expr ~= nil, "sqlparser: expression is not specified")
 
-    fiber.yield()
+    exprCount = exprCount + 1
+    if exprCount >= YIELD_INTERVAL then
+        exprCount = 0
+        fiber.yield()
+    end
 
     local exprType = expr.type
 
@@ -406,6 +414,72 @@ getSelectStatementStr = function(selectStatement)
     return str
 end
 
+local function getTableNameStr(schema, tableName)
+    local str = '"' .. tableName .. '"'
+
+    if schema ~= nil then
+        str = '"' .. schema .. '"' .. "." .. str
+    end
+
+    return str
+end
+
+getInsertStatementStr = function(insertStatement)
+    assert(insertStatement ~= nil,
+        "sqlparser: insert statement is not specified")
+
+    local str = "insert into " ..
+        getTableNameStr(insertStatement.schema, insertStatement.tableName)
+
+    if insertStatement.columns ~= nil then
+        str = str .. " (" .. getArrStr(insertStatement.columns, function(column)
+            return '"' .. column .. '"'
+        end) .. ")"
+    end
+
+    if insertStatement.insertType == "values" then
+        str = str .. " values (" ..
+            getExprArrStr(insertStatement.values) .. ")"
+    elseif insertStatement.insertType == "select" then
+        str = str .. " " .. getSelectStatementStr(insertStatement.select)
+    else
+        error("sqlparser: unknown insert type: " ..
+            tostring(insertStatement.insertType))
+    end
+
+    return str
+end
+
+getUpdateStatementStr = function(updateStatement)
+    assert(updateStatement ~= nil,
+        "sqlparser: update statement is not specified")
+
+    local str = "update " .. getTableRefStr(updateStatement.table) ..
+        " set " .. getArrStr(updateStatement.updates, function(update)
+            return '"' .. update.column .. '" = ' .. getExprStr(update.value)
+        end)
+
+    if updateStatement.where ~= nil then
+        str = str .. " where " .. getExprStr(updateStatement.where)
+    end
+
+    return str
+end
+
+getDeleteStatementStr = function(deleteStatement)
+    assert(deleteStatement ~= nil,
+        "sqlparser: delete statement is not specified")
+
+    local str = "delete from " ..
+        getTableNameStr(deleteStatement.schema, deleteStatement.tableName)
+
+    if deleteStatement.expr ~= nil then
+        str = str .. " where " .. getExprStr(deleteStatement.expr)
+    end
+
+    return str
+end
+
 getSQLStatementStr = function(SQLStatement)
     assert(SQLStatement ~= nil,
         "sqlparser: SQL statement is not specified")
@@ -414,6 +488,12 @@ getSQLStatementStr = function(SQLStatement)
 
     if SQLStatement.type == "select" then
         str = getSelectStatementStr(SQLStatement)
+    elseif SQLStatement.type == "insert" then
+        str = getInsertStatementStr(SQLStatement)
+    elseif SQLStatement.type == "update" then
+        str = getUpdateStatementStr(SQLStatement)
+    elseif SQLStatement.type == "delete" then
+        str = getDeleteStatementStr(SQLStatement)
     else
         error(("Generating of an SQL query string for statement type '%s' is not implemented"):format(
             SQLStatement.type))
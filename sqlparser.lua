@@ -1,8 +1,13 @@
 #!/usr/bin/env tarantool
 
+local bit = require("bit")
+local clock = require("clock")
 local fio = require("fio")
 local ffi = require("ffi")
-local parserConst = require("sqlparserConst")
+local socket = require("socket")
+local tableNew = require("table.new")
+local parserView = require("sqlparserView")
+local sqlfilter = require("sqlfilter")
 local sqlgen = require("sqlgen")
 
 local hFilePath = debug.getinfo(1, "S").source
@@ -25,12 +30,147 @@ ffi.cdef(cDefs)
 
 ffi.cdef[[
 LuaSQLParserResult* parseSql(const char* query);
+LuaSQLParserResult* parseSqlN(const char* data, size_t length);
+
+LuaSQLParserResult** parseSqlBatch(const char* const* queries,
+    const size_t* lengths, size_t count);
+void finalizeBatch(LuaSQLParserResult** results, size_t count);
+
+void sqlparser_workers_configure(size_t count);
+
+LuaSQLGenResult* generateSql(const LuaSQLParserResult* result);
+void finalizeGenerated(LuaSQLGenResult* gen);
+
+LuaSQLTemplate* prepareSql(const char* data, size_t length);
+int64_t renderTemplate(const LuaSQLTemplate* tmpl, const LuaSQLValue* values,
+    size_t count, char* buffer, size_t capacity);
+void finalizeTemplate(LuaSQLTemplate* tmpl);
+
+size_t parseSqlToMsgpack(const char* query, size_t length, char* buffer,
+    size_t capacity, char** data);
+void freeMsgpack(char* data);
+LuaSQLGenResult* generateSqlFromMsgpack(const char* data, size_t size);
+
+typedef struct LuaSQLRewriter LuaSQLRewriter;
+
+LuaSQLRewriter* sqlparser_rewriter_new();
+void sqlparser_rewriter_free(LuaSQLRewriter* rewriter);
+void sqlparser_rewriter_table(LuaSQLRewriter* rewriter, const char* logical,
+    const char* physical);
+bool sqlparser_rewriter_predicate(LuaSQLRewriter* rewriter,
+    const char* predicate);
+void sqlparser_rewriter_limit(LuaSQLRewriter* rewriter, int64_t maxLimit);
+LuaSQLGenResult* rewriteSql(const LuaSQLRewriter* rewriter, const char* data,
+    size_t length);
+
+typedef struct LuaSQLAsyncParse LuaSQLAsyncParse;
+
+LuaSQLAsyncParse* parseSqlAsync(const char* data, size_t length);
+int parseSqlAsyncFd(LuaSQLAsyncParse* job);
+LuaSQLParserResult* parseSqlAsyncResult(LuaSQLAsyncParse* job);
+void parseSqlAsyncRelease(LuaSQLAsyncParse* job);
+
+typedef struct LuaSQLStream LuaSQLStream;
+
+LuaSQLStream* parseSqlStreamOpen(const char* data, size_t length);
+LuaSQLParserResult* parseSqlStreamNext(LuaSQLStream* stream,
+    size_t maxStatements);
+void parseSqlStreamClose(LuaSQLStream* stream);
 void finalize(LuaSQLParserResult* result);
+
+typedef struct LuaSQLParserContext LuaSQLParserContext;
+
+LuaSQLParserContext* sqlparser_context_new();
+void sqlparser_context_free(LuaSQLParserContext* context);
+LuaSQLParserResult* parseSqlContext(LuaSQLParserContext* context,
+    const char* data, size_t length);
+
+LuaFlatResult* parseSqlFlat(const char* query);
+void finalizeFlat(LuaFlatResult* result);
+
+LuaSQLReferences* parseSqlReferences(const char* data, size_t length);
+void finalizeReferences(LuaSQLReferences* refs);
+
+LuaSQLShardKeys* parseSqlShardKeys(const char* data, size_t length);
+void finalizeShardKeys(LuaSQLShardKeys* keys);
+
+void sqlparser_shard_key_set(const char* table, const char* const* columns,
+    size_t count);
+void sqlparser_shard_key_clear();
+
+int64_t tokenizeSql(const char* data, size_t length, int16_t* tokens,
+    uint32_t* offsets, size_t capacity);
+int sqlparser_token(const char* name);
+
+void sqlparser_cache_configure(size_t maxEntries, size_t maxBytes);
+void sqlparser_cache_stats(LuaSQLCacheStats* stats);
+
+void sqlparser_intern_configure(size_t maxBytes);
+void sqlparser_intern_stats(LuaSQLInternStats* stats);
+
+void sqlparser_limits_configure(size_t maxQueryBytes, size_t maxNodes,
+    size_t maxDepth, size_t maxStringBytes);
+
+void sqlparser_simplify_enable(bool enable);
+
+void sqlparser_stats_enable(bool enable);
+void sqlparser_stats_reset();
+void sqlparser_stats_decode(uint64_t ns);
+void sqlparser_stats(LuaSQLStats* stats);
+
+const LuaSQLEnumNames* sqlparser_enum_names();
 ]]
 
 local package = package.search("libsqlparser")
 local sqlParserLib = ffi.load(package)
 
+-- The decoder dispatches on the numeric enum values and names them through
+-- arrays indexed by value, filled once from the library's own tables.
+local C = ffi.C
+local enumNames = sqlParserLib.sqlparser_enum_names()
+
+local function getEnumNames(names, count)
+    count = tonumber(count)
+
+    local arr = tableNew(count, 0)
+    for i = 0, count - 1 do
+        arr[i] = ffi.string(names[i])
+    end
+
+    return arr
+end
+
+local exprTypeNames = getEnumNames(enumNames.exprTypes,
+    enumNames.exprTypeCount)
+local datetimeFieldNames = getEnumNames(enumNames.datetimeFields,
+    enumNames.datetimeFieldCount)
+local columnTypeNames = getEnumNames(enumNames.columnTypes,
+    enumNames.columnTypeCount)
+local operatorTypeNames = getEnumNames(enumNames.operatorTypes,
+    enumNames.operatorTypeCount)
+local statementTypeNames = getEnumNames(enumNames.statementTypes,
+    enumNames.statementTypeCount)
+local joinTypeNames = getEnumNames(enumNames.joinTypes,
+    enumNames.joinTypeCount)
+local tableRefTypeNames = getEnumNames(enumNames.tableRefTypes,
+    enumNames.tableRefTypeCount)
+local orderTypeNames = getEnumNames(enumNames.orderTypes,
+    enumNames.orderTypeCount)
+local setTypeNames = getEnumNames(enumNames.setTypes,
+    enumNames.setTypeCount)
+local insertTypeNames = getEnumNames(enumNames.insertTypes,
+    enumNames.insertTypeCount)
+local errorCodeNames = getEnumNames(enumNames.errorCodes,
+    enumNames.errorCodeCount)
+
+local operatorArity = tableNew(tonumber(enumNames.operatorTypeCount), 0)
+for i = 0, tonumber(enumNames.operatorTypeCount) - 1 do
+    operatorArity[i] = enumNames.operatorArity[i]
+end
+
+local uintptrType = ffi.typeof("uintptr_t")
+local NULL = box.NULL
+
 local getExpr
 local getExprArr
 local getJoinDefinition
@@ -42,6 +182,10 @@ local getOrderDescription
 local getWithDescription
 local getLimitDescription
 local getSelectStatement
+local getInsertStatement
+local getUpdateClause
+local getUpdateStatement
+local getDeleteStatement
 local getSQLStatement
 local getSQLParserResult
 
@@ -52,121 +196,188 @@ local function getArr(cdata, count, getItem, params)
 
     count = tonumber(count)
 
-    local arr = { }
+    local arr = tableNew(count, 0)
     for i = 0, count - 1 do
-        table.insert(arr, getItem(cdata[i], params))
+        arr[i + 1] = getItem(cdata[i], params)
     end
 
     return arr
 end
 
+-- Identifiers are interned by the library, so equal strings of a result
+-- usually share one address. Decoded strings are cached by address: for the
+-- result being decoded in resultStrs, and for good in sharedStrs when they
+-- live in the process-wide intern buffer.
+local resultStrs = nil
+local sharedStrs = { }
+local sharedStrFirst = 0
+local sharedStrLast = -1
+
 local function getStr(cdata)
     if cdata == nil then
         return nil
     end
 
-    return ffi.string(cdata)
-end
-
-local function getOperatorArity(opType)
-    if opType == nil then
-        return nil
+    if resultStrs == nil then
+        return ffi.string(cdata)
     end
 
-    local OperatorType = parserConst.OperatorType
+    local addr = tonumber(ffi.cast(uintptrType, cdata))
 
-    if opType == OperatorType.None then
-        return 0
+    local strs = resultStrs
+    if addr >= sharedStrFirst and addr <= sharedStrLast then
+        strs = sharedStrs
     end
 
-    if opType == OperatorType.Between then
-        return 3
+    local str = strs[addr]
+    if str == nil then
+        str = ffi.string(cdata)
+        strs[addr] = str
     end
 
-    if opType == OperatorType.Case or
-        opType == OperatorType.CaseListElement
-    then
-        return -1
+    return str
+end
+
+-- Fills the fields particular to each expression type, by type.
+local exprFillers = tableNew(#exprTypeNames + 1, 0)
+
+exprFillers[C.kExprLiteralFloat] = function(expr, cdata)
+    expr.value = tonumber(cdata.fval)
+end
+
+exprFillers[C.kExprLiteralString] = function(expr, cdata)
+    expr.value = expr.name
+end
+
+exprFillers[C.kExprLiteralInt] = function(expr, cdata)
+    expr.value = tonumber(cdata.ival)
+    expr.isBoolLiteral = (cdata.isBoolLiteral == true)
+end
+
+exprFillers[C.kExprLiteralNull] = function(expr)
+    expr.value = NULL
+end
+
+exprFillers[C.kExprParameter] = function(expr, cdata, params)
+    expr.paramId = tonumber(cdata.ival)
+    params[#params + 1] = expr
+end
+
+exprFillers[C.kExprFunctionRef] = function(expr, cdata)
+    expr.distinct = cdata.distinct
+
+    local datetimeField = cdata.datetimeField
+    if datetimeField > 0 then
+        expr.datetimeField = datetimeFieldNames[datetimeField]
     end
 
-    if opType >= OperatorType.Plus and
-        opType <= OperatorType.Concat
-    then
-        return 2
+    local columnType = cdata.columnType
+    if columnType > 0 then
+        expr.columnType = columnTypeNames[columnType]
     end
 
-    if opType >= OperatorType.Not and
-        opType <= OperatorType.Exists
-    then
-        return 1
+    local columnLength = tonumber(cdata.columnLength)
+    if columnLength > 0 then
+        expr.columnLength = columnLength
     end
+end
 
-    return nil
+exprFillers[C.kExprOperator] = function(expr, cdata)
+    local opType = cdata.opType
+    expr.name = operatorTypeNames[opType]
+    expr.arity = operatorArity[opType]
 end
 
-getExpr = function(cdata, params)
-    if cdata == nil then
-        return nil
-    end
+exprFillers[C.kExprArrayIndex] = function(expr, cdata)
+    expr.index = tonumber(cdata.ival)
+end
 
-    local expr = { }
+local function noFiller()
+end
 
-    local exprType = parserConst.getExprTypeStr(cdata.type)
-    expr.type = exprType
+for i = 0, #exprTypeNames do
+    exprFillers[i] = exprFillers[i] or noFiller
+end
 
-    if exprType == "parameter" then
-        table.insert(params, expr)
-    end
+-- Fills everything but the children of an expression.
+local function fillExpr(expr, cdata, params)
+    local exprType = cdata.type
 
-    expr.expr = getExpr(cdata.expr, params)
-    expr.expr2 = getExpr(cdata.expr2, params)
-    expr.exprList = getExprArr(cdata.exprList, cdata.exprListSize, params)
+    local typeName = exprTypeNames[exprType]
+    if typeName == nil then
+        error("sqlparser: unknown expression type: " .. tostring(exprType))
+    end
+    expr.type = typeName
 
-    expr.select = getSelectStatement(cdata.select, params)
+    if cdata.select ~= nil then
+        expr.select = getSelectStatement(cdata.select, params)
+    end
 
     expr.name = getStr(cdata.name)
     expr.table = getStr(cdata.table)
     expr.alias = getStr(cdata.alias)
 
-    if exprType == "literalFloat" then
-        expr.value = tonumber(cdata.fval)
-    elseif exprType == "literalString" then
-        expr.value = getStr(cdata.name)
-    elseif exprType == "literalInt" then
-        expr.value = tonumber(cdata.ival)
-        expr.isBoolLiteral = (cdata.isBoolLiteral == true)
-    elseif exprType == "literalNull" then
-        expr.value = box.NULL
-    elseif exprType == "parameter" then
-        expr.paramId = tonumber(cdata.ival)
-    elseif exprType == "functionRef" then
-        expr.distinct = cdata.distinct
-
-        local datetimeField = tonumber(cdata.datetimeField)
-        if cdata.datetimeField > 0 then
-            expr.datetimeField =
-                parserConst.getDatetimeFieldStr(datetimeField)
+    exprFillers[exprType](expr, cdata, params)
+end
+
+-- Walks the expression tree with an explicit stack of (cdata, table)
+-- pairs, so that long operator chains do not hit the Lua C stack limit.
+getExpr = function(cdata, params)
+    if cdata == nil then
+        return nil
+    end
+
+    local root = tableNew(0, 8)
+
+    local stackCdata = { cdata }
+    local stackExpr = { root }
+    local top = 1
+
+    while top > 0 do
+        local exprCdata = stackCdata[top]
+        local expr = stackExpr[top]
+        stackCdata[top] = nil
+        stackExpr[top] = nil
+        top = top - 1
+
+        fillExpr(expr, exprCdata, params)
+
+        if exprCdata.exprList ~= nil then
+            local count = tonumber(exprCdata.exprListSize)
+            local exprList = tableNew(count, 0)
+            expr.exprList = exprList
+
+            for i = count - 1, 0, -1 do
+                local item = exprCdata.exprList[i]
+                if item ~= nil then
+                    local itemExpr = tableNew(0, 8)
+                    exprList[i + 1] = itemExpr
+
+                    top = top + 1
+                    stackCdata[top] = item
+                    stackExpr[top] = itemExpr
+                end
+            end
         end
 
-        local columnType = tonumber(cdata.columnType)
-        if columnType > 0 then
-            expr.columnType =
-                parserConst.getColumnTypeStr(columnType)
+        if exprCdata.expr2 ~= nil then
+            expr.expr2 = tableNew(0, 8)
+
+            top = top + 1
+            stackCdata[top] = exprCdata.expr2
+            stackExpr[top] = expr.expr2
         end
 
-        local columnLength = tonumber(cdata.columnLength)
-        if columnLength > 0 then
-            expr.columnLength = columnLength
+        if exprCdata.expr ~= nil then
+            expr.expr = tableNew(0, 8)
+
+            top = top + 1
+            stackCdata[top] = exprCdata.expr
+            stackExpr[top] = expr.expr
         end
-    elseif exprType == "operator" then
-        local opTypeNum = tonumber(cdata.opType)
-        expr.name = parserConst.getOperatorTypeStr(opTypeNum)
-        expr.arity = getOperatorArity(opTypeNum)
-    elseif exprType == "arrayIndex" then
-        expr.index = tonumber(cdata.ival)
     end
 
-    return expr
+    return root
 end
 
 getExprArr = function(cdata, count, params)
@@ -184,8 +395,7 @@ getJoinDefinition = function(cdata, params)
     joinDefinition.right = getTableRef(cdata.right, params)
     joinDefinition.condition = getExpr(cdata.condition, params)
 
-    joinDefinition.type =
-        parserConst.getJoinTypeStr(cdata.type)
+    joinDefinition.type = joinTypeNames[cdata.type]
 
     return joinDefinition
 end
@@ -211,7 +421,7 @@ getTableRef = function(cdata, params)
 
     local tableRef = { }
 
-    tableRef.type = parserConst.getTableRefTypeStr(cdata.type)
+    tableRef.type = tableRefTypeNames[cdata.type]
 
     tableRef.schema = getStr(cdata.schema)
     tableRef.name = getStr(cdata.name)
@@ -248,7 +458,7 @@ getSetOperation = function(cdata, params)
 
     local setOp = { }
 
-    setOp.setType = parserConst.getSetTypeStr(cdata.setType)
+    setOp.setType = setTypeNames[cdata.setType]
 
     setOp.isAll = cdata.isAll
 
@@ -270,7 +480,7 @@ getOrderDescription = function(cdata, params)
 
     local orderDesc = { }
 
-    orderDesc.type = parserConst.getOrderTypeStr(cdata.type)
+    orderDesc.type = orderTypeNames[cdata.type]
 
     orderDesc.expr = getExpr(cdata.expr, params)
 
@@ -335,6 +545,101 @@ getSelectStatement = function(cdata, params)
     return statement
 end
 
+getInsertStatement = function(cdata, params)
+    if cdata == nil then
+        return nil
+    end
+
+    local statement = { }
+
+    statement.insertType = insertTypeNames[cdata.type]
+
+    statement.schema = getStr(cdata.schema)
+    statement.tableName = getStr(cdata.tableName)
+
+    statement.columns = getArr(cdata.columns, cdata.columnCount, getStr)
+
+    statement.values = getExprArr(cdata.values, cdata.valueCount, params)
+
+    statement.select = getSelectStatement(cdata.select, params)
+
+    return statement
+end
+
+getUpdateClause = function(cdata, params)
+    if cdata == nil then
+        return nil
+    end
+
+    local update = { }
+
+    update.column = getStr(cdata.column)
+    update.value = getExpr(cdata.value, params)
+
+    return update
+end
+
+getUpdateStatement = function(cdata, params)
+    if cdata == nil then
+        return nil
+    end
+
+    local statement = { }
+
+    statement.table = getTableRef(cdata.table, params)
+
+    statement.updates = getArr(cdata.updates, cdata.updateCount,
+        getUpdateClause, params)
+
+    statement.where = getExpr(cdata.where, params)
+
+    return statement
+end
+
+getDeleteStatement = function(cdata, params)
+    if cdata == nil then
+        return nil
+    end
+
+    local statement = { }
+
+    statement.schema = getStr(cdata.schema)
+    statement.tableName = getStr(cdata.tableName)
+
+    statement.expr = getExpr(cdata.expr, params)
+
+    return statement
+end
+
+local function getLiteralValue(cdata)
+    local exprType = cdata.type
+
+    if exprType == C.kExprLiteralFloat then
+        return tonumber(cdata.fval)
+    elseif exprType == C.kExprLiteralString then
+        return getStr(cdata.name)
+    elseif cdata.isBoolLiteral then
+        return cdata.ival ~= 0
+    end
+
+    return tonumber(cdata.ival)
+end
+
+-- Pointer types and decoders of the statements with a body, by type.
+local statementCtypes = {
+    [C.kStmtSelect] = ffi.typeof("LuaSelectStatement*"),
+    [C.kStmtInsert] = ffi.typeof("LuaInsertStatement*"),
+    [C.kStmtUpdate] = ffi.typeof("LuaUpdateStatement*"),
+    [C.kStmtDelete] = ffi.typeof("LuaDeleteStatement*")
+}
+
+local statementDecoders = {
+    [C.kStmtSelect] = getSelectStatement,
+    [C.kStmtInsert] = getInsertStatement,
+    [C.kStmtUpdate] = getUpdateStatement,
+    [C.kStmtDelete] = getDeleteStatement
+}
+
 getSQLStatement = function(cdata, params)
     if cdata == nil then
         return nil
@@ -342,25 +647,38 @@ getSQLStatement = function(cdata, params)
 
     local statement
 
-    local statementType =
-        parserConst.getStatementTypeStr(cdata.type)
+    local statementType = cdata.type
 
-    if statementType == "select" then
-        local cdataEx = ffi.cast("LuaSelectStatement*", cdata)
-        statement = getSelectStatement(cdataEx, params)
+    local decode = statementDecoders[statementType]
+    if decode ~= nil then
+        statement = decode(ffi.cast(statementCtypes[statementType], cdata),
+            params)
     else
         statement = { }
     end
 
-    statement.type = statementType
+    statement.type = statementTypeNames[statementType]
 
     statement.stringLength = statement.stringLength
 
     statement.hints = getExprArr(cdata.hints, cdata.hintCount, params)
 
+    statement.fingerprint = bit.tohex(cdata.fingerprint, 16)
+
+    local literalCount = tonumber(cdata.literalCount)
+    local literals = tableNew(literalCount, 0)
+    for i = 0, literalCount - 1 do
+        literals[i + 1] = getLiteralValue(cdata.literals[i])
+    end
+    statement.literals = literals
+
     return statement
 end
 
+local function byParamId(a, b)
+    return a.paramId < b.paramId
+end
+
 getSQLParserResult = function(cdata)
     if cdata == nil then
         return nil
@@ -368,38 +686,1086 @@ getSQLParserResult = function(cdata)
 
     local result = { }
 
+    resultStrs = { }
+
     result.isValid = cdata.isValid
+    result.errorCode = errorCodeNames[cdata.errorCode]
 
     result.parameters = { }
 
     result.statements = getArr(cdata.statements, cdata.statementCount,
         getSQLStatement, result.parameters)
 
-    table.sort(result.parameters, function(a, b)
-        return a.paramId < b.paramId
-    end)
+    if #result.parameters > 1 then
+        table.sort(result.parameters, byParamId)
+    end
 
     result.errorMsg = getStr(cdata.errorMsg)
     result.errorLine = tonumber(cdata.errorLine)
-    result.errorColumn = tonumber(result.errorColumn)
+    result.errorColumn = tonumber(cdata.errorColumn)
+
+    local simplified = cdata.simplified
+    if simplified.folded + simplified.tautologies + simplified.negations +
+        simplified.duplicates + simplified.flattened +
+        simplified.normalized ~= 0
+    then
+        result.simplified = {
+            folded = tonumber(simplified.folded),
+            tautologies = tonumber(simplified.tautologies),
+            negations = tonumber(simplified.negations),
+            duplicates = tonumber(simplified.duplicates),
+            flattened = tonumber(simplified.flattened),
+            normalized = tonumber(simplified.normalized)
+        }
+    end
+
+    resultStrs = nil
 
     return result
 end
 
 
+-- Decoded ASTs of cached results, keyed by the result address. Each entry
+-- holds a reference to its result, so the address can not be reused while
+-- the entry exists.
+local sharedAsts = { }
+local sharedAstCount = 0
+local sharedAstLimit = 0
+
+-- Results behind the shared ASTs. Shared ASTs are immutable, so they can be
+-- rendered back to SQL from the results instead of the Lua tables.
+local sharedAstResults = setmetatable({ }, { __mode = "k" })
+
+-- Mirrors the library switch, so that decoding reads the clock only while
+-- the stats are enabled.
+local statsEnabled = false
+
+local function decodeSQLParserResult(cdata)
+    if not statsEnabled then
+        return getSQLParserResult(cdata)
+    end
+
+    local start = clock.monotonic64()
+    local obj = getSQLParserResult(cdata)
+    sqlParserLib.sqlparser_stats_decode(clock.monotonic64() - start)
+
+    return obj
+end
+
+-- Decodes a parser result and takes over its reference.
+local function decodeResult(cdata)
+    if sharedAstLimit == 0 then
+        local obj = decodeSQLParserResult(cdata)
+
+        sqlParserLib.finalize(cdata)
+
+        return obj
+    end
+
+    local key = tonumber(ffi.cast("uintptr_t", cdata))
+
+    local shared = sharedAsts[key]
+    if shared ~= nil then
+        sqlParserLib.finalize(cdata)
+
+        return shared.ast
+    end
+
+    if sharedAstCount >= sharedAstLimit then
+        sharedAsts = { }
+        sharedAstCount = 0
+    end
+
+    local obj = decodeSQLParserResult(cdata)
+
+    cdata = ffi.gc(cdata, sqlParserLib.finalize)
+
+    sharedAsts[key] = {
+        cdata = cdata,
+        ast = obj
+    }
+    sharedAstCount = sharedAstCount + 1
+
+    sharedAstResults[obj] = cdata
+
+    return obj
+end
+
+-- Queries of at least this many bytes are parsed on the worker pool, while
+-- the calling fiber waits, instead of blocking the tx thread.
+local asyncThreshold = 64 * 1024
+
+-- Parses the query on the worker pool. Falls back to parsing in place if
+-- the completion fd can not be created.
+local function parseAsync(query)
+    local job = sqlParserLib.parseSqlAsync(query, #query)
+    if job == nil then
+        return sqlParserLib.parseSqlN(query, #query)
+    end
+
+    job = ffi.gc(job, sqlParserLib.parseSqlAsyncRelease)
+
+    local fd = sqlParserLib.parseSqlAsyncFd(job)
+
+    local cdata = sqlParserLib.parseSqlAsyncResult(job)
+    while cdata == nil do
+        socket.iowait(fd, "R")
+        cdata = sqlParserLib.parseSqlAsyncResult(job)
+    end
+
+    sqlParserLib.parseSqlAsyncRelease(ffi.gc(job, nil))
+
+    return cdata
+end
+
+-- While the cache is off, queries are parsed with one context that keeps
+-- its memory from query to query. Its result is decoded before the next
+-- parse and is not finalized.
+local parserContext = sqlParserLib.sqlparser_context_new()
+if parserContext ~= nil then
+    parserContext = ffi.gc(parserContext, sqlParserLib.sqlparser_context_free)
+end
+
+local cacheEnabled = false
+
 local function parse(query)
     assert(query ~= nil, "sqlparser: SQL query string is not specified")
 
-    local cdata = sqlParserLib.parseSql(query)
+    local cdata
+    if asyncThreshold > 0 and #query >= asyncThreshold then
+        cdata = parseAsync(query)
+    elseif not cacheEnabled and parserContext ~= nil then
+        return decodeSQLParserResult(
+            sqlParserLib.parseSqlContext(parserContext, query, #query))
+    else
+        cdata = sqlParserLib.parseSqlN(query, #query)
+    end
 
-    local obj = getSQLParserResult(cdata)
+    return decodeResult(cdata)
+end
+
+-- Sets the size in bytes from which parse() goes asynchronous, zero
+-- disables asynchronous parsing.
+local function configureAsync(threshold)
+    asyncThreshold = threshold or 0
+end
+
+-- Parses an array of queries at once, spreading them over the worker
+-- pool. Returns the ASTs in the order of the queries.
+local function parseBatch(queries)
+    assert(queries ~= nil, "sqlparser: SQL queries are not specified")
+
+    local count = #queries
+
+    local cQueries = ffi.new("const char*[?]", count)
+    local cLengths = ffi.new("size_t[?]", count)
+
+    for i = 1, count do
+        cQueries[i - 1] = queries[i]
+        cLengths[i - 1] = #queries[i]
+    end
+
+    local cResults = sqlParserLib.parseSqlBatch(cQueries, cLengths, count)
+    if cResults == nil then
+        error("sqlparser: out of memory")
+    end
+
+    local asts = { }
+
+    for i = 1, count do
+        -- The entry is cleared, so that finalizeBatch() keeps the
+        -- reference taken over by decodeResult().
+        asts[i] = decodeResult(cResults[i - 1])
+        cResults[i - 1] = nil
+    end
+
+    sqlParserLib.finalizeBatch(cResults, count)
+
+    return asts
+end
+
+-- Returns an iterator over the statements of a script, parsing up to
+-- `batch` of them (1 by default) per step. Each step yields an AST like the
+-- one of parse(), whose error positions are relative to the script. The
+-- parser result is released as soon as it is decoded, so only the ASTs the
+-- caller keeps stay in memory.
+local function statements(script, batch)
+    assert(script ~= nil, "sqlparser: SQL script string is not specified")
+
+    local stream = sqlParserLib.parseSqlStreamOpen(script, #script)
+    if stream == nil then
+        error("sqlparser: out of memory")
+    end
+
+    stream = ffi.gc(stream, sqlParserLib.parseSqlStreamClose)
+
+    return function()
+        if stream == nil then
+            return nil
+        end
+
+        local cdata = sqlParserLib.parseSqlStreamNext(stream, batch or 1)
+        if cdata == nil then
+            -- The stream points into the script, which may go only now.
+            sqlParserLib.parseSqlStreamClose(ffi.gc(stream, nil))
+            stream = nil
+            script = nil
+
+            return nil
+        end
+
+        local obj = decodeSQLParserResult(cdata)
+        sqlParserLib.finalize(cdata)
+
+        return obj
+    end
+end
+
+-- Sets the number of threads parsing batches, zero means one per
+-- hardware thread.
+local function configureWorkers(count)
+    sqlParserLib.sqlparser_workers_configure(count or 0)
+end
+
+-- Enables the parse cache. `options.entries` and `options.bytes` set its
+-- budget, zero or nil disables it. With `options.shareAst` set, parse()
+-- returns the same AST table for every hit of a cache entry, such ASTs
+-- must not be modified.
+local function configureCache(options)
+    options = options or { }
+
+    local entries = options.entries or 0
+    local bytes = options.bytes or 0
+
+    sqlParserLib.sqlparser_cache_configure(entries, bytes)
+
+    cacheEnabled = entries > 0 and bytes > 0
+
+    sharedAsts = { }
+    sharedAstCount = 0
+    sharedAstLimit = 0
+
+    if options.shareAst and bytes > 0 then
+        sharedAstLimit = entries
+    end
+end
+
+local function cacheStats()
+    local stats = ffi.new("LuaSQLCacheStats")
+
+    sqlParserLib.sqlparser_cache_stats(stats)
+
+    return {
+        hits = tonumber(stats.hits),
+        misses = tonumber(stats.misses),
+        evictions = tonumber(stats.evictions),
+        entries = tonumber(stats.entries),
+        bytes = tonumber(stats.bytes),
+        maxEntries = tonumber(stats.maxEntries),
+        maxBytes = tonumber(stats.maxBytes)
+    }
+end
+
+-- Interns identifiers process-wide into a buffer of `bytes`, zero or nil
+-- disables it. Strings from that buffer are converted to Lua strings once
+-- per process instead of once per result.
+local function configureIntern(bytes)
+    sqlParserLib.sqlparser_intern_configure(bytes or 0)
+
+    local stats = ffi.new("LuaSQLInternStats")
+    sqlParserLib.sqlparser_intern_stats(stats)
+
+    sharedStrs = { }
+    sharedStrFirst = tonumber(ffi.cast("uintptr_t", stats.buffer))
+    sharedStrLast = sharedStrFirst + tonumber(stats.capacity) - 1
+end
+
+local function internStats()
+    local stats = ffi.new("LuaSQLInternStats")
+
+    sqlParserLib.sqlparser_intern_stats(stats)
+
+    return {
+        capacity = tonumber(stats.capacity),
+        bytes = tonumber(stats.bytes),
+        entries = tonumber(stats.entries)
+    }
+end
+
+-- Limits the queries parsed from now on: `options.queryBytes`,
+-- `options.nodes`, `options.depth` and `options.stringBytes`, zero or nil
+-- disables a limit. Rejected queries have an invalid AST with errorCode
+-- "limit".
+local function configureLimits(options)
+    options = options or { }
+
+    sqlParserLib.sqlparser_limits_configure(options.queryBytes or 0,
+        options.nodes or 0, options.depth or 0, options.stringBytes or 0)
+end
+
+-- Switches the native simplification of parsed queries, see README.md.
+local function enableSimplify(enable)
+    sqlParserLib.sqlparser_simplify_enable(enable and true or false)
+end
+
+-- Turns the per-phase timing and tree size statistics on or off.
+local function enableStats(enable)
+    statsEnabled = enable and true or false
+    sqlParserLib.sqlparser_stats_enable(statsEnabled)
+end
+
+local function resetStats()
+    sqlParserLib.sqlparser_stats_reset()
+end
+
+local statsPhases = { "parse", "copy", "decode", "finalize" }
+
+local function stats()
+    local cStats = ffi.new("LuaSQLStats")
+
+    sqlParserLib.sqlparser_stats(cStats)
+
+    local phases = { }
+
+    for i, name in ipairs(statsPhases) do
+        local phase = cStats.phases[i - 1]
+
+        -- histogram[k] counts calls of [2^(k - 1), 2^k) nanoseconds.
+        local histogram = { }
+        for j = 0, 31 do
+            histogram[j + 1] = tonumber(phase.histogram[j])
+        end
+
+        phases[name] = {
+            count = tonumber(phase.count),
+            totalNs = tonumber(phase.totalNs),
+            maxNs = tonumber(phase.maxNs),
+            histogram = histogram
+        }
+    end
+
+    return {
+        enabled = cStats.enabled,
+        phases = phases,
+        queries = tonumber(cStats.queries),
+        queryBytes = tonumber(cStats.queryBytes),
+        bytesAllocated = tonumber(cStats.bytesAllocated),
+        nodes = tonumber(cStats.nodes),
+        maxQueryBytes = tonumber(cStats.maxQueryBytes),
+        maxBytesAllocated = tonumber(cStats.maxBytesAllocated),
+        maxNodes = tonumber(cStats.maxNodes),
+        maxDepth = tonumber(cStats.maxDepth)
+    }
+end
+
+-- Turns the output of the native generator into an array of SQL queries.
+local function generated(gen)
+    if gen == nil then
+        error("sqlparser: out of memory")
+    end
+
+    if gen.errorMsg ~= nil then
+        local errorMsg = ffi.string(gen.errorMsg)
+        sqlParserLib.finalizeGenerated(gen)
+        error("sqlparser: " .. errorMsg)
+    end
+
+    local queries = { }
+
+    for i = 0, tonumber(gen.statementCount) - 1 do
+        queries[i + 1] = ffi.string(gen.buffer + gen.offsets[i],
+            gen.offsets[i + 1] - gen.offsets[i])
+    end
+
+    sqlParserLib.finalizeGenerated(gen)
+
+    return queries
+end
+
+-- Renders a parser result to an array of SQL queries natively.
+local function generate(cdata)
+    return generated(sqlParserLib.generateSql(cdata))
+end
+
+-- Renders an AST back to an array of SQL queries. ASTs that may have been
+-- modified by the caller are rendered by sqlgen.lua, shared ones natively.
+local function toString(ast)
+    local cdata = sharedAstResults[ast]
+    if cdata ~= nil then
+        return generate(cdata)
+    end
+
+    return sqlgen.generate(ast)
+end
+
+-- Parses the query and renders it back to SQL without building a Lua AST.
+local function format(query)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    local cdata = sqlParserLib.parseSqlN(query, #query)
+
+    local ok, queries = pcall(generate, cdata)
 
     sqlParserLib.finalize(cdata)
 
-    return obj
+    if not ok then
+        error(queries, 0)
+    end
+
+    return queries
+end
+
+-- Encodings that fit go into this buffer and are copied out from it.
+local MSGPACK_BUFFER_SIZE = 16384
+local msgpackBuf = ffi.new("char[?]", MSGPACK_BUFFER_SIZE)
+local msgpackData = ffi.new("char*[1]")
+
+-- Parses the query and encodes the result as MessagePack, with the same
+-- keys and values as the table parse() returns, without building it. The
+-- encoding is returned as a string or, given a buffer.ibuf, appended to it
+-- and its size returned.
+local function parseToMsgpack(query, ibuf)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    local size = sqlParserLib.parseSqlToMsgpack(query, #query, msgpackBuf,
+        MSGPACK_BUFFER_SIZE, msgpackData)
+    if size == 0 then
+        error("sqlparser: out of memory or SELECTs nested too deeply")
+    end
+
+    local data = msgpackData[0]
+
+    local encoded
+    if ibuf ~= nil then
+        ffi.copy(ibuf:reserve(size), data, size)
+        ibuf:alloc(size)
+        encoded = tonumber(size)
+    else
+        encoded = ffi.string(data, size)
+    end
+
+    if data ~= msgpackBuf then
+        sqlParserLib.freeMsgpack(data)
+    end
+
+    return encoded
+end
+
+-- Renders MessagePack made by parseToMsgpack() back to an array of SQL
+-- queries natively. `data` is a string, or a pointer to `size` bytes.
+local function msgpackToSql(data, size)
+    assert(data ~= nil, "sqlparser: MessagePack data is not specified")
+
+    if type(data) == "string" then
+        size = size or #data
+    end
+
+    return generated(sqlParserLib.generateSqlFromMsgpack(data, size))
+end
+
+local Template = { }
+Template.__index = Template
+
+-- Values are bound and queries rendered in these buffers, grown on demand.
+local templateValues = ffi.new("LuaSQLValue[?]", 16)
+local templateValueCount = 16
+local templateBuf = ffi.new("char[?]", 1024)
+local templateBufSize = 1024
+
+local int64Type = ffi.typeof("int64_t")
+local uint64Type = ffi.typeof("uint64_t")
+
+-- Renders the statement with params[i] bound to the parameter of id i - 1,
+-- nil and box.NULL bind NULL.
+function Template:render(params)
+    local count = self.paramCount
+
+    if count > templateValueCount then
+        templateValues = ffi.new("LuaSQLValue[?]", count)
+        templateValueCount = count
+    end
+
+    for i = 0, count - 1 do
+        local param = params[i + 1]
+        local paramType = type(param)
+        local value = templateValues[i]
+
+        if paramType == "number" then
+            if param == math.floor(param) and param >= -2^63 and
+                param < 2^63
+            then
+                value.type = C.kValueInt
+                value.ival = param
+            else
+                value.type = C.kValueFloat
+                value.fval = param
+            end
+        elseif paramType == "string" then
+            value.type = C.kValueString
+            value.str = param
+            value.length = #param
+        elseif paramType == "boolean" then
+            value.type = C.kValueBool
+            value.ival = param and 1 or 0
+        elseif ffi.istype(int64Type, param) or
+            (ffi.istype(uint64Type, param) and param < 0x8000000000000000ULL)
+        then
+            value.type = C.kValueInt
+            value.ival = param
+        elseif param == nil then
+            value.type = C.kValueNull
+        else
+            error(("sqlparser: can not bind parameter %d: %s"):format(i,
+                tostring(param)))
+        end
+    end
+
+    local size = sqlParserLib.renderTemplate(self.cdata, templateValues,
+        count, templateBuf, templateBufSize)
+    if size < 0 then
+        error("sqlparser: can not bind the parameters: a float is not " ..
+            "finite or a string has a NUL byte")
+    end
+
+    if size > templateBufSize then
+        templateBufSize = tonumber(size)
+        templateBuf = ffi.new("char[?]", templateBufSize)
+
+        size = sqlParserLib.renderTemplate(self.cdata, templateValues,
+            count, templateBuf, templateBufSize)
+    end
+
+    return ffi.string(templateBuf, size)
+end
+
+-- Parses a single statement into a template to render with bound
+-- parameters.
+local function prepare(query)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    local tmpl = sqlParserLib.prepareSql(query, #query)
+    if tmpl == nil then
+        error("sqlparser: out of memory")
+    end
+
+    if tmpl.errorMsg ~= nil then
+        local errorMsg = ffi.string(tmpl.errorMsg)
+        sqlParserLib.finalizeTemplate(tmpl)
+        error("sqlparser: " .. errorMsg)
+    end
+
+    return setmetatable({
+        cdata = ffi.gc(tmpl, sqlParserLib.finalizeTemplate),
+        paramCount = tonumber(tmpl.paramCount)
+    }, Template)
+end
+
+local Rewriter = { }
+Rewriter.__index = Rewriter
+
+-- Rewrites the query by the rules and returns an array of SQL queries.
+function Rewriter:rewrite(query)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    return generated(sqlParserLib.rewriteSql(self.cdata, query, #query))
+end
+
+-- Makes a native rewriter. `rules.tables` maps logical table names to
+-- physical ones, `rules.predicate` is ANDed into every query block for each
+-- logical table and `rules.maxLimit` caps the LIMIT of top-level SELECTs.
+local function rewriter(rules)
+    rules = rules or { }
+
+    local cdata = sqlParserLib.sqlparser_rewriter_new()
+    if cdata == nil then
+        error("sqlparser: out of memory")
+    end
+    cdata = ffi.gc(cdata, sqlParserLib.sqlparser_rewriter_free)
+
+    for logical, physical in pairs(rules.tables or { }) do
+        sqlParserLib.sqlparser_rewriter_table(cdata, logical, physical)
+    end
+
+    if rules.predicate ~= nil and
+        not sqlParserLib.sqlparser_rewriter_predicate(cdata, rules.predicate)
+    then
+        error("sqlparser: the predicate is not a WHERE clause: " ..
+            rules.predicate)
+    end
+
+    if rules.maxLimit ~= nil then
+        sqlParserLib.sqlparser_rewriter_limit(cdata, rules.maxLimit)
+    end
+
+    return setmetatable({ cdata = cdata }, Rewriter)
+end
+
+-- Parses the query into a flat buffer and returns a lazy read-only view of
+-- it. Nothing but the accessed fields is ever turned into Lua values.
+local function view(query)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    local cdata = sqlParserLib.parseSqlFlat(query)
+    if cdata == nil then
+        error("sqlparser: the query is too large for a flat AST")
+    end
+
+    cdata = ffi.gc(cdata, sqlParserLib.finalizeFlat)
+
+    return parserView.getResultView(cdata)
+end
+
+-- Lists the tables a query reads or writes and the columns it uses
+-- without building the AST. Columns that do not resolve to exactly one
+-- listed table are collected in `unresolved`.
+local function references(query)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    local cdata = sqlParserLib.parseSqlReferences(query, #query)
+    if cdata == nil then
+        error("sqlparser: out of memory")
+    end
+
+    local result = {
+        isValid = cdata.isValid,
+        errorCode = errorCodeNames[cdata.errorCode],
+        tables = { },
+        unresolved = { }
+    }
+
+    if cdata.errorMsg ~= nil then
+        result.errorMsg = ffi.string(cdata.errorMsg)
+        result.errorLine = tonumber(cdata.errorLine)
+        result.errorColumn = tonumber(cdata.errorColumn)
+    end
+
+    for i = 0, tonumber(cdata.tableCount) - 1 do
+        local ref = cdata.tables[i]
+
+        result.tables[i + 1] = {
+            schema = ref.schema ~= nil and ffi.string(ref.schema) or nil,
+            name = ffi.string(ref.name),
+            alias = ref.alias ~= nil and ffi.string(ref.alias) or nil,
+            columns = { }
+        }
+    end
+
+    for i = 0, tonumber(cdata.columnCount) - 1 do
+        local ref = cdata.columns[i]
+        local name = ffi.string(ref.name)
+
+        if ref.table < 0 then
+            table.insert(result.unresolved, name)
+        else
+            table.insert(result.tables[tonumber(ref.table) + 1].columns, name)
+        end
+    end
+
+    sqlParserLib.finalizeReferences(cdata)
+
+    return result
+end
+
+-- Replaces the registered shard keys with the given ones, a map from table
+-- names to arrays of key column names.
+local function configureShardKeys(keys)
+    sqlParserLib.sqlparser_shard_key_clear()
+
+    for tableName, columns in pairs(keys or { }) do
+        local cColumns = ffi.new("const char*[?]", #columns, columns)
+        sqlParserLib.sqlparser_shard_key_set(tableName, cColumns, #columns)
+    end
+end
+
+local function getShardValue(cdata)
+    if cdata.type == C.kExprParameter then
+        return { type = "parameter", paramId = tonumber(cdata.ival) }
+    end
+
+    return getLiteralValue(cdata)
+end
+
+-- Finds the shard key tuples a single statement is restricted to. Returns
+-- scatter = true if the statement may touch any shard.
+local function shardKeys(query)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    local cdata = sqlParserLib.parseSqlShardKeys(query, #query)
+    if cdata == nil then
+        error("sqlparser: out of memory")
+    end
+
+    local result = {
+        isValid = cdata.isValid,
+        errorCode = errorCodeNames[cdata.errorCode],
+        scatter = cdata.scatter,
+        tuples = { }
+    }
+
+    if cdata.errorMsg ~= nil then
+        result.errorMsg = ffi.string(cdata.errorMsg)
+        result.errorLine = tonumber(cdata.errorLine)
+        result.errorColumn = tonumber(cdata.errorColumn)
+    end
+
+    if cdata.table ~= nil then
+        result.schema = cdata.schema ~= nil and ffi.string(cdata.schema) or nil
+        result.table = ffi.string(cdata.table)
+    end
+
+    local keyLength = tonumber(cdata.keyLength)
+
+    for i = 0, tonumber(cdata.tupleCount) - 1 do
+        local tuple = { }
+
+        for j = 0, keyLength - 1 do
+            tuple[j + 1] = getShardValue(cdata.values[i * keyLength + j])
+        end
+
+        result.tuples[i + 1] = tuple
+    end
+
+    sqlParserLib.finalizeShardKeys(cdata)
+
+    return result
+end
+
+-- Token numbers of the lexer, by keyword. Single-character tokens are
+-- numbered by their character.
+local tokenIds = { }
+
+for _, name in ipairs({ "IDENTIFIER", "ALTER", "AS", "BEGIN", "COLUMNS",
+    "COMMIT", "COPY", "CREATE", "DEALLOCATE", "DELETE", "DESCRIBE", "DROP",
+    "EXCEPT", "EXECUTE", "EXISTS", "FROM", "GROUP", "HAVING", "IF", "IMPORT",
+    "INDEX", "INSERT", "INTERSECT", "INTO", "JOIN", "LIMIT", "ON", "ORDER",
+    "PREPARE", "ROLLBACK", "SELECT", "SHOW", "TABLE", "TRUNCATE", "UNION",
+    "UPDATE", "VIEW", "WHERE", "WITH" }) do
+    tokenIds[name] = sqlParserLib.sqlparser_token(name)
+end
+
+local T = tokenIds
+local T_LPAREN = string.byte("(")
+local T_RPAREN = string.byte(")")
+local T_COMMA = string.byte(",")
+local T_DOT = string.byte(".")
+local T_SEMICOLON = string.byte(";")
+
+-- Statement types by their leading keyword, and whether they write. The
+-- ones of COPY and SHOW depend on what follows.
+local classifyKeywords = {
+    [T.SELECT] = { "select", false },
+    [T.WITH] = { "select", false },
+    [T.INSERT] = { "insert", true },
+    [T.UPDATE] = { "update", true },
+    [T.DELETE] = { "delete", true },
+    [T.TRUNCATE] = { "delete", true },
+    [T.CREATE] = { "create", true },
+    [T.DROP] = { "drop", true },
+    [T.DEALLOCATE] = { "drop", false },
+    [T.ALTER] = { "alter", true },
+    [T.IMPORT] = { "import", true },
+    [T.COPY] = { "export", false },
+    [T.SHOW] = { "show", false },
+    [T.DESCRIBE] = { "show", false },
+    [T.PREPARE] = { "prepare", false },
+    [T.EXECUTE] = { "execute", true },
+    [T.BEGIN] = { "transaction", false },
+    [T.COMMIT] = { "transaction", false },
+    [T.ROLLBACK] = { "transaction", false }
+}
+
+-- Keywords ending the FROM clause of a SELECT.
+local fromClauseEnd = {
+    [T.WHERE] = true,
+    [T.GROUP] = true,
+    [T.HAVING] = true,
+    [T.ORDER] = true,
+    [T.LIMIT] = true,
+    [T.UNION] = true,
+    [T.INTERSECT] = true,
+    [T.EXCEPT] = true
+}
+
+-- Buffers of tokenizeSql(), grown on demand and kept.
+local tokenCapacity = 256
+local tokenBuf = ffi.new("int16_t[?]", tokenCapacity)
+local offsetBuf = ffi.new("uint32_t[?]", tokenCapacity)
+
+-- Walks the tokens of one query. Positions past the last token read as 0.
+local Cursor = { }
+Cursor.__index = Cursor
+
+function Cursor:token(i)
+    if i >= self.count then
+        return 0
+    end
+
+    return tokenBuf[i]
+end
+
+-- Returns the identifier at token i as written, unquoted.
+function Cursor:identifier(i)
+    local offset = offsetBuf[i] + 1
+
+    if self.query:byte(offset) == 34 then
+        return self.query:match('^"([^"]*)"', offset)
+    end
+
+    return self.query:match("^[%w_$]+", offset)
+end
+
+-- Adds the possibly schema-qualified table name at token i, if there is
+-- one, and returns the token after it.
+function Cursor:addTable(i)
+    if self:token(i) ~= T.IDENTIFIER then
+        return i
+    end
+
+    local ref = { name = self:identifier(i) }
+    i = i + 1
+
+    if self:token(i) == T_DOT and self:token(i + 1) == T.IDENTIFIER then
+        ref.schema = ref.name
+        ref.name = self:identifier(i + 1)
+        i = i + 2
+    end
+
+    table.insert(self.tables, ref)
+
+    return i
+end
+
+-- Returns the first `token` of the statement from token i on, or nil.
+function Cursor:find(i, token)
+    while true do
+        local current = self:token(i)
+
+        if current == token then
+            return i
+        elseif current == 0 or current == T_SEMICOLON then
+            return nil
+        end
+
+        i = i + 1
+    end
+end
+
+-- Skips IF [NOT] EXISTS.
+function Cursor:skipIfExists(i)
+    if self:token(i) ~= T.IF then
+        return i
+    end
+
+    local j = self:find(i, T.EXISTS)
+
+    return j ~= nil and j + 1 or i
+end
+
+-- Adds the tables of the top-level FROM clause of the SELECT at token i,
+-- leaving out the names of the WITH tables defined before it.
+function Cursor:addFromTables(i)
+    local depth = 0
+    local inWith = self:token(i) == T.WITH
+    local inFrom = false
+    local expectTable = false
+    local withNames = { }
+
+    while true do
+        local token = self:token(i)
+
+        if token == 0 or (depth == 0 and token == T_SEMICOLON) then
+            break
+        elseif token == T_LPAREN then
+            depth = depth + 1
+            expectTable = false
+        elseif token == T_RPAREN then
+            depth = depth - 1
+        elseif depth > 0 then
+            -- Nothing in parentheses is a leading table.
+        elseif token == T.IDENTIFIER and expectTable then
+            -- WITH tables are not qualified by a schema.
+            if not withNames[self:identifier(i)] or
+                self:token(i + 1) == T_DOT then
+                i = self:addTable(i) - 1
+            end
+
+            expectTable = false
+        elseif inWith then
+            if token == T.SELECT then
+                inWith = false
+            elseif token == T.IDENTIFIER and self:token(i + 1) == T.AS then
+                withNames[self:identifier(i)] = true
+            end
+        elseif token == T.FROM then
+            inFrom = true
+            expectTable = true
+        elseif inFrom and (token == T_COMMA or token == T.JOIN) then
+            expectTable = true
+        elseif inFrom and fromClauseEnd[token] then
+            break
+        end
+
+        -- A parenthesized SELECT ends with its closing parenthesis.
+        if depth < 0 then
+            break
+        end
+
+        i = i + 1
+    end
+end
+
+-- Classifies the statement at token i and returns the token after it.
+function Cursor:statement(i)
+    while self:token(i) == T_LPAREN do
+        i = i + 1
+    end
+
+    local token = self:token(i)
+    local keyword = classifyKeywords[token]
+    if keyword == nil then
+        self.isValid = false
+        return self.count
+    end
+
+    local statementType, write = keyword[1], keyword[2]
+    local following = self:token(i + 1)
+
+    if token == T.SELECT or token == T.WITH then
+        self:addFromTables(i)
+    elseif token == T.INSERT or token == T.DELETE or token == T.IMPORT then
+        local j = self:find(i, token == T.DELETE and T.FROM or T.INTO)
+        if j ~= nil then
+            self:addTable(j + 1)
+        end
+    elseif token == T.UPDATE or token == T.DESCRIBE then
+        self:addTable(i + 1)
+    elseif token == T.TRUNCATE then
+        self:addTable(following == T.TABLE and i + 2 or i + 1)
+    elseif token == T.CREATE or token == T.DROP or token == T.ALTER then
+        if following == T.TABLE or following == T.VIEW then
+            self:addTable(self:skipIfExists(i + 2))
+        elseif following == T.INDEX then
+            local j = self:find(i, T.ON)
+            if j ~= nil then
+                self:addTable(j + 1)
+            end
+        end
+    elseif token == T.COPY then
+        local j = self:addTable(i + 1)
+        if self:token(j) == T.FROM then
+            statementType, write = "import", true
+        end
+    elseif token == T.SHOW and following == T.COLUMNS then
+        self:addTable(i + 2)
+    end
+
+    if self.type == nil then
+        self.type = statementType
+    end
+    self.write = self.write or write
+
+    return (self:find(i, T_SEMICOLON) or self.count) + 1
+end
+
+-- Classifies a query from its tokens only, which is much cheaper than
+-- parsing it. Returns the statement type named as in the AST, whether the
+-- query may write and the tables named by the leading clauses: the FROM
+-- clause of a SELECT, the target of anything else. For scripts the type is
+-- the one of the first statement, `write` and `tables` cover them all.
+-- Queries the classifier does not recognize, or the lexer rejects, come
+-- out with `isValid` false and are left to parse().
+local function classify(query)
+    assert(query ~= nil, "sqlparser: SQL query string is not specified")
+
+    local count
+    repeat
+        count = tonumber(sqlParserLib.tokenizeSql(query, #query, tokenBuf,
+            offsetBuf, tokenCapacity))
+
+        -- No query has more tokens than bytes.
+        if count == tokenCapacity then
+            tokenCapacity = math.min(tokenCapacity * 4, #query + 1)
+            tokenBuf = ffi.new("int16_t[?]", tokenCapacity)
+            offsetBuf = ffi.new("uint32_t[?]", tokenCapacity)
+        end
+    until count < tokenCapacity
+
+    local cursor = setmetatable({
+        query = query,
+        count = count,
+        isValid = count > 0,
+        write = false,
+        tables = { },
+        statementCount = 0
+    }, Cursor)
+
+    local i = 0
+    while cursor.isValid and i < count do
+        i = cursor:statement(i)
+        cursor.statementCount = cursor.statementCount + 1
+    end
+
+    if not cursor.isValid then
+        return { isValid = false }
+    end
+
+    return {
+        isValid = true,
+        type = cursor.type,
+        write = cursor.write,
+        tables = cursor.tables,
+        statementCount = cursor.statementCount
+    }
+end
+
+-- Compiles the WHERE clause of a parsed SELECT, UPDATE or DELETE into a
+-- function of a tuple, see sqlfilter.lua. The code is cached by the
+-- statement fingerprint and the `fields` table.
+local function compileFilter(statement, fields, params)
+    assert(statement ~= nil, "sqlparser: statement is not specified")
+    assert(fields ~= nil, "sqlparser: fields are not specified")
+
+    local where
+
+    if statement.type == "select" then
+        where = statement.whereClause
+    elseif statement.type == "update" then
+        where = statement.where
+    elseif statement.type == "delete" then
+        where = statement.expr
+    else
+        error("sqlparser: statements of type '" .. tostring(statement.type) ..
+            "' have no filter")
+    end
+
+    return sqlfilter.compile(where, fields, params, statement.fingerprint)
 end
 
 return {
     parse = parse,
-    tostring = sqlgen.generate
+    references = references,
+    configureShardKeys = configureShardKeys,
+    shardKeys = shardKeys,
+    classify = classify,
+    compileFilter = compileFilter,
+    parseBatch = parseBatch,
+    statements = statements,
+    view = view,
+    configureCache = configureCache,
+    cacheStats = cacheStats,
+    configureLimits = configureLimits,
+    configureIntern = configureIntern,
+    internStats = internStats,
+    enableSimplify = enableSimplify,
+    enableStats = enableStats,
+    resetStats = resetStats,
+    stats = stats,
+    configureWorkers = configureWorkers,
+    configureAsync = configureAsync,
+    tostring = toString,
+    format = format,
+    parseToMsgpack = parseToMsgpack,
+    msgpackToSql = msgpackToSql,
+    rewriter = rewriter,
+    prepare = prepare
 }
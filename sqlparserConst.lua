@@ -34,6 +34,7 @@ end
 
 
 local DatetimeFieldStr = {
+    "", -- none
     "second",
     "minute",
     "hour",
@@ -183,6 +184,40 @@ local function getOperatorTypeStr(value)
     return str
 end
 
+local function getOperatorArity(opType)
+    if opType == nil then
+        return nil
+    end
+
+    if opType == OperatorType.None then
+        return 0
+    end
+
+    if opType == OperatorType.Between then
+        return 3
+    end
+
+    if opType == OperatorType.Case or
+        opType == OperatorType.CaseListElement
+    then
+        return -1
+    end
+
+    if opType >= OperatorType.Plus and
+        opType <= OperatorType.Concat
+    then
+        return 2
+    end
+
+    if opType >= OperatorType.Not and
+        opType <= OperatorType.Exists
+    then
+        return 1
+    end
+
+    return nil
+end
+
 
 local StatementTypeStr = {
     "error", -- unused
@@ -319,6 +354,52 @@ local function getSetTypeStr(value)
 end
 
 
+local InsertTypeStr = {
+    "values",
+    "select"
+}
+
+local function getInsertTypeStr(value)
+    value = tonumber(value)
+
+    if value == nil then
+        return nil
+    end
+
+    local str = InsertTypeStr[value + 1]
+
+    if str == nil then
+        error("sqlparser: unknown insert type: " ..
+            tostring(value))
+    end
+
+    return str
+end
+
+local ErrorCodeStr = {
+    "none",
+    "syntax",
+    "limit"
+}
+
+local function getErrorCodeStr(value)
+    value = tonumber(value)
+
+    if value == nil then
+        return nil
+    end
+
+    local str = ErrorCodeStr[value + 1]
+
+    if str == nil then
+        error("sqlparser: unknown error code: " ..
+            tostring(value))
+    end
+
+    return str
+end
+
+
 return {
     OperatorType = OperatorType,
 
@@ -326,9 +407,12 @@ return {
     getDatetimeFieldStr = getDatetimeFieldStr,
     getColumnTypeStr = getColumnTypeStr,
     getOperatorTypeStr = getOperatorTypeStr,
+    getOperatorArity = getOperatorArity,
     getStatementTypeStr = getStatementTypeStr,
     getJoinTypeStr = getJoinTypeStr,
     getTableRefTypeStr = getTableRefTypeStr,
     getOrderTypeStr = getOrderTypeStr,
-    getSetTypeStr = getSetTypeStr
+    getSetTypeStr = getSetTypeStr,
+    getInsertTypeStr = getInsertTypeStr,
+    getErrorCodeStr = getErrorCodeStr
 }
@@ -0,0 +1,570 @@
+#!/usr/bin/env tarantool
+
+-- Lazy, read-only views over a flat parser result (see LuaFlatResult in
+-- LuaDataTypes.h). A view decodes a field straight from the flat buffer
+-- the first time it is accessed and keeps the decoded value, so callers pay
+-- only for the parts of the AST they actually look at. Field names and
+-- values are the same as in the tables returned by sqlparser.parse().
+
+local ffi = require("ffi")
+local parserConst = require("sqlparserConst")
+
+local charPtr = ffi.typeof("const char*")
+local uint32Ptr = ffi.typeof("const uint32_t*")
+local LuaFlatResultPtr = ffi.typeof("const LuaFlatResult*")
+local LuaFlatExprPtr = ffi.typeof("const LuaFlatExpr*")
+local LuaFlatAliasPtr = ffi.typeof("const LuaFlatAlias*")
+local LuaFlatJoinDefinitionPtr = ffi.typeof("const LuaFlatJoinDefinition*")
+local LuaFlatTableRefPtr = ffi.typeof("const LuaFlatTableRef*")
+local LuaFlatGroupByDescriptionPtr =
+    ffi.typeof("const LuaFlatGroupByDescription*")
+local LuaFlatSetOperationPtr = ffi.typeof("const LuaFlatSetOperation*")
+local LuaFlatOrderDescriptionPtr =
+    ffi.typeof("const LuaFlatOrderDescription*")
+local LuaFlatWithDescriptionPtr = ffi.typeof("const LuaFlatWithDescription*")
+local LuaFlatLimitDescriptionPtr =
+    ffi.typeof("const LuaFlatLimitDescription*")
+local LuaFlatSQLStatementPtr = ffi.typeof("const LuaFlatSQLStatement*")
+local LuaFlatSelectStatementPtr = ffi.typeof("const LuaFlatSelectStatement*")
+local LuaFlatInsertStatementPtr = ffi.typeof("const LuaFlatInsertStatement*")
+local LuaFlatUpdateClausePtr = ffi.typeof("const LuaFlatUpdateClause*")
+local LuaFlatUpdateStatementPtr = ffi.typeof("const LuaFlatUpdateStatement*")
+local LuaFlatDeleteStatementPtr = ffi.typeof("const LuaFlatDeleteStatement*")
+
+local ExprView
+local AliasView
+local JoinDefinitionView
+local TableRefView
+local GroupByDescriptionView
+local SetOperationView
+local OrderDescriptionView
+local WithDescriptionView
+local LimitDescriptionView
+local SQLStatementView
+local SelectStatementView
+local InsertStatementView
+local UpdateClauseView
+local UpdateStatementView
+local DeleteStatementView
+
+local function makeView(getters)
+    return {
+        __index = function(view, key)
+            local getter = getters[key]
+            if getter == nil then
+                return nil
+            end
+
+            local value = getter(view._buf, view._ref)
+            rawset(view, key, value)
+
+            return value
+        end
+    }
+end
+
+local function getView(buf, ref, viewMeta)
+    if ref == 0 then
+        return nil
+    end
+
+    return setmetatable({ _buf = buf, _ref = ref }, viewMeta)
+end
+
+local function getStr(buf, ref)
+    if ref == 0 then
+        return nil
+    end
+
+    local ptr = buf.base + ref
+
+    return ffi.string(ptr + 4, ffi.cast(uint32Ptr, ptr)[0])
+end
+
+local function getArr(buf, ref, getItem, param)
+    if ref == 0 then
+        return nil
+    end
+
+    local items = ffi.cast(uint32Ptr, buf.base + ref)
+
+    local arr = { }
+    for i = 1, items[0] do
+        arr[i] = getItem(buf, items[i], param)
+    end
+
+    return arr
+end
+
+local function getViewArr(buf, ref, viewMeta)
+    return getArr(buf, ref, getView, viewMeta)
+end
+
+local function getStatementView(buf, ref)
+    if ref == 0 then
+        return nil
+    end
+
+    local node = ffi.cast(LuaFlatSQLStatementPtr, buf.base + ref)
+
+    local statementType = parserConst.getStatementTypeStr(node.type)
+
+    if statementType == "select" then
+        return getView(buf, ref, SelectStatementView)
+    elseif statementType == "insert" then
+        return getView(buf, ref, InsertStatementView)
+    elseif statementType == "update" then
+        return getView(buf, ref, UpdateStatementView)
+    elseif statementType == "delete" then
+        return getView(buf, ref, DeleteStatementView)
+    end
+
+    return getView(buf, ref, SQLStatementView)
+end
+
+
+local function exprNode(buf, ref)
+    return ffi.cast(LuaFlatExprPtr, buf.base + ref)
+end
+
+local function exprType(buf, ref)
+    return parserConst.getExprTypeStr(exprNode(buf, ref).type)
+end
+
+ExprView = makeView({
+    type = exprType,
+    expr = function(buf, ref)
+        return getView(buf, exprNode(buf, ref).expr, ExprView)
+    end,
+    expr2 = function(buf, ref)
+        return getView(buf, exprNode(buf, ref).expr2, ExprView)
+    end,
+    exprList = function(buf, ref)
+        return getViewArr(buf, exprNode(buf, ref).exprList, ExprView)
+    end,
+    select = function(buf, ref)
+        return getView(buf, exprNode(buf, ref).select, SelectStatementView)
+    end,
+    name = function(buf, ref)
+        local node = exprNode(buf, ref)
+
+        if exprType(buf, ref) == "operator" then
+            return parserConst.getOperatorTypeStr(node.opType)
+        end
+
+        return getStr(buf, node.name)
+    end,
+    table = function(buf, ref)
+        return getStr(buf, exprNode(buf, ref).table)
+    end,
+    alias = function(buf, ref)
+        return getStr(buf, exprNode(buf, ref).alias)
+    end,
+    value = function(buf, ref)
+        local node = exprNode(buf, ref)
+        local t = exprType(buf, ref)
+
+        if t == "literalFloat" then
+            return tonumber(node.fval)
+        elseif t == "literalString" then
+            return getStr(buf, node.name)
+        elseif t == "literalInt" then
+            return tonumber(node.ival)
+        elseif t == "literalNull" then
+            return box.NULL
+        end
+
+        return nil
+    end,
+    isBoolLiteral = function(buf, ref)
+        if exprType(buf, ref) ~= "literalInt" then
+            return nil
+        end
+
+        return exprNode(buf, ref).isBoolLiteral
+    end,
+    paramId = function(buf, ref)
+        if exprType(buf, ref) ~= "parameter" then
+            return nil
+        end
+
+        return tonumber(exprNode(buf, ref).ival)
+    end,
+    distinct = function(buf, ref)
+        if exprType(buf, ref) ~= "functionRef" then
+            return nil
+        end
+
+        return exprNode(buf, ref).distinct
+    end,
+    datetimeField = function(buf, ref)
+        local datetimeField = exprNode(buf, ref).datetimeField
+
+        if exprType(buf, ref) ~= "functionRef" or datetimeField == 0 then
+            return nil
+        end
+
+        return parserConst.getDatetimeFieldStr(datetimeField)
+    end,
+    columnType = function(buf, ref)
+        local columnType = exprNode(buf, ref).columnType
+
+        if exprType(buf, ref) ~= "functionRef" or columnType == 0 then
+            return nil
+        end
+
+        return parserConst.getColumnTypeStr(columnType)
+    end,
+    columnLength = function(buf, ref)
+        local columnLength = tonumber(exprNode(buf, ref).columnLength)
+
+        if exprType(buf, ref) ~= "functionRef" or columnLength <= 0 then
+            return nil
+        end
+
+        return columnLength
+    end,
+    arity = function(buf, ref)
+        if exprType(buf, ref) ~= "operator" then
+            return nil
+        end
+
+        return parserConst.getOperatorArity(exprNode(buf, ref).opType)
+    end,
+    index = function(buf, ref)
+        if exprType(buf, ref) ~= "arrayIndex" then
+            return nil
+        end
+
+        return tonumber(exprNode(buf, ref).ival)
+    end
+})
+
+AliasView = makeView({
+    name = function(buf, ref)
+        return getStr(buf, ffi.cast(LuaFlatAliasPtr, buf.base + ref).name)
+    end,
+    columns = function(buf, ref)
+        return getArr(buf, ffi.cast(LuaFlatAliasPtr, buf.base + ref).columns,
+            getStr)
+    end
+})
+
+local function joinNode(buf, ref)
+    return ffi.cast(LuaFlatJoinDefinitionPtr, buf.base + ref)
+end
+
+JoinDefinitionView = makeView({
+    left = function(buf, ref)
+        return getView(buf, joinNode(buf, ref).left, TableRefView)
+    end,
+    right = function(buf, ref)
+        return getView(buf, joinNode(buf, ref).right, TableRefView)
+    end,
+    condition = function(buf, ref)
+        return getView(buf, joinNode(buf, ref).condition, ExprView)
+    end,
+    type = function(buf, ref)
+        return parserConst.getJoinTypeStr(joinNode(buf, ref).type)
+    end
+})
+
+local function tableRefNode(buf, ref)
+    return ffi.cast(LuaFlatTableRefPtr, buf.base + ref)
+end
+
+TableRefView = makeView({
+    type = function(buf, ref)
+        return parserConst.getTableRefTypeStr(tableRefNode(buf, ref).type)
+    end,
+    schema = function(buf, ref)
+        return getStr(buf, tableRefNode(buf, ref).schema)
+    end,
+    name = function(buf, ref)
+        return getStr(buf, tableRefNode(buf, ref).name)
+    end,
+    alias = function(buf, ref)
+        return getView(buf, tableRefNode(buf, ref).alias, AliasView)
+    end,
+    select = function(buf, ref)
+        return getView(buf, tableRefNode(buf, ref).select,
+            SelectStatementView)
+    end,
+    list = function(buf, ref)
+        return getViewArr(buf, tableRefNode(buf, ref).list, TableRefView)
+    end,
+    join = function(buf, ref)
+        return getView(buf, tableRefNode(buf, ref).join, JoinDefinitionView)
+    end
+})
+
+local function groupByNode(buf, ref)
+    return ffi.cast(LuaFlatGroupByDescriptionPtr, buf.base + ref)
+end
+
+GroupByDescriptionView = makeView({
+    columns = function(buf, ref)
+        return getViewArr(buf, groupByNode(buf, ref).columns, ExprView)
+    end,
+    having = function(buf, ref)
+        return getView(buf, groupByNode(buf, ref).having, ExprView)
+    end
+})
+
+local function setOpNode(buf, ref)
+    return ffi.cast(LuaFlatSetOperationPtr, buf.base + ref)
+end
+
+SetOperationView = makeView({
+    setType = function(buf, ref)
+        return parserConst.getSetTypeStr(setOpNode(buf, ref).setType)
+    end,
+    isAll = function(buf, ref)
+        return setOpNode(buf, ref).isAll
+    end,
+    nestedSelectStatement = function(buf, ref)
+        return getView(buf, setOpNode(buf, ref).nestedSelectStatement,
+            SelectStatementView)
+    end,
+    resultOrder = function(buf, ref)
+        return getViewArr(buf, setOpNode(buf, ref).resultOrder,
+            OrderDescriptionView)
+    end,
+    resultLimit = function(buf, ref)
+        return getView(buf, setOpNode(buf, ref).resultLimit,
+            LimitDescriptionView)
+    end
+})
+
+local function orderNode(buf, ref)
+    return ffi.cast(LuaFlatOrderDescriptionPtr, buf.base + ref)
+end
+
+OrderDescriptionView = makeView({
+    type = function(buf, ref)
+        return parserConst.getOrderTypeStr(orderNode(buf, ref).type)
+    end,
+    expr = function(buf, ref)
+        return getView(buf, orderNode(buf, ref).expr, ExprView)
+    end
+})
+
+local function withNode(buf, ref)
+    return ffi.cast(LuaFlatWithDescriptionPtr, buf.base + ref)
+end
+
+WithDescriptionView = makeView({
+    alias = function(buf, ref)
+        return getStr(buf, withNode(buf, ref).alias)
+    end,
+    select = function(buf, ref)
+        return getView(buf, withNode(buf, ref).select, SelectStatementView)
+    end
+})
+
+local function limitNode(buf, ref)
+    return ffi.cast(LuaFlatLimitDescriptionPtr, buf.base + ref)
+end
+
+LimitDescriptionView = makeView({
+    limit = function(buf, ref)
+        return getView(buf, limitNode(buf, ref).limit, ExprView)
+    end,
+    offset = function(buf, ref)
+        return getView(buf, limitNode(buf, ref).offset, ExprView)
+    end
+})
+
+local function statementNode(buf, ref)
+    return ffi.cast(LuaFlatSQLStatementPtr, buf.base + ref)
+end
+
+local SQLStatementGetters = {
+    type = function(buf, ref)
+        return parserConst.getStatementTypeStr(statementNode(buf, ref).type)
+    end,
+    stringLength = function(buf, ref)
+        return tonumber(statementNode(buf, ref).stringLength)
+    end,
+    hints = function(buf, ref)
+        return getViewArr(buf, statementNode(buf, ref).hints, ExprView)
+    end
+}
+
+SQLStatementView = makeView(SQLStatementGetters)
+
+local function selectNode(buf, ref)
+    return ffi.cast(LuaFlatSelectStatementPtr, buf.base + ref)
+end
+
+SelectStatementView = makeView({
+    type = SQLStatementGetters.type,
+    stringLength = SQLStatementGetters.stringLength,
+    hints = SQLStatementGetters.hints,
+    fromTable = function(buf, ref)
+        return getView(buf, selectNode(buf, ref).fromTable, TableRefView)
+    end,
+    selectDistinct = function(buf, ref)
+        return selectNode(buf, ref).selectDistinct
+    end,
+    selectList = function(buf, ref)
+        return getViewArr(buf, selectNode(buf, ref).selectList, ExprView)
+    end,
+    whereClause = function(buf, ref)
+        return getView(buf, selectNode(buf, ref).whereClause, ExprView)
+    end,
+    groupBy = function(buf, ref)
+        return getView(buf, selectNode(buf, ref).groupBy,
+            GroupByDescriptionView)
+    end,
+    setOperations = function(buf, ref)
+        return getViewArr(buf, selectNode(buf, ref).setOperations,
+            SetOperationView)
+    end,
+    order = function(buf, ref)
+        return getViewArr(buf, selectNode(buf, ref).order,
+            OrderDescriptionView)
+    end,
+    withDescriptions = function(buf, ref)
+        return getViewArr(buf, selectNode(buf, ref).withDescriptions,
+            WithDescriptionView)
+    end,
+    limit = function(buf, ref)
+        return getView(buf, selectNode(buf, ref).limit, LimitDescriptionView)
+    end
+})
+
+local function insertNode(buf, ref)
+    return ffi.cast(LuaFlatInsertStatementPtr, buf.base + ref)
+end
+
+InsertStatementView = makeView({
+    type = SQLStatementGetters.type,
+    stringLength = SQLStatementGetters.stringLength,
+    hints = SQLStatementGetters.hints,
+    insertType = function(buf, ref)
+        return parserConst.getInsertTypeStr(insertNode(buf, ref).type)
+    end,
+    schema = function(buf, ref)
+        return getStr(buf, insertNode(buf, ref).schema)
+    end,
+    tableName = function(buf, ref)
+        return getStr(buf, insertNode(buf, ref).tableName)
+    end,
+    columns = function(buf, ref)
+        return getArr(buf, insertNode(buf, ref).columns, getStr)
+    end,
+    values = function(buf, ref)
+        return getViewArr(buf, insertNode(buf, ref).values, ExprView)
+    end,
+    select = function(buf, ref)
+        return getView(buf, insertNode(buf, ref).select, SelectStatementView)
+    end
+})
+
+local function updateClauseNode(buf, ref)
+    return ffi.cast(LuaFlatUpdateClausePtr, buf.base + ref)
+end
+
+UpdateClauseView = makeView({
+    column = function(buf, ref)
+        return getStr(buf, updateClauseNode(buf, ref).column)
+    end,
+    value = function(buf, ref)
+        return getView(buf, updateClauseNode(buf, ref).value, ExprView)
+    end
+})
+
+local function updateNode(buf, ref)
+    return ffi.cast(LuaFlatUpdateStatementPtr, buf.base + ref)
+end
+
+UpdateStatementView = makeView({
+    type = SQLStatementGetters.type,
+    stringLength = SQLStatementGetters.stringLength,
+    hints = SQLStatementGetters.hints,
+    table = function(buf, ref)
+        return getView(buf, updateNode(buf, ref).table, TableRefView)
+    end,
+    updates = function(buf, ref)
+        return getViewArr(buf, updateNode(buf, ref).updates, UpdateClauseView)
+    end,
+    where = function(buf, ref)
+        return getView(buf, updateNode(buf, ref).where, ExprView)
+    end
+})
+
+local function deleteNode(buf, ref)
+    return ffi.cast(LuaFlatDeleteStatementPtr, buf.base + ref)
+end
+
+DeleteStatementView = makeView({
+    type = SQLStatementGetters.type,
+    stringLength = SQLStatementGetters.stringLength,
+    hints = SQLStatementGetters.hints,
+    schema = function(buf, ref)
+        return getStr(buf, deleteNode(buf, ref).schema)
+    end,
+    tableName = function(buf, ref)
+        return getStr(buf, deleteNode(buf, ref).tableName)
+    end,
+    expr = function(buf, ref)
+        return getView(buf, deleteNode(buf, ref).expr, ExprView)
+    end
+})
+
+local function resultNode(buf)
+    return ffi.cast(LuaFlatResultPtr, buf.base)
+end
+
+local ResultView = makeView({
+    isValid = function(buf)
+        return resultNode(buf).isValid
+    end,
+    statements = function(buf)
+        return getArr(buf, resultNode(buf).statements, getStatementView)
+    end,
+    parameters = function(buf)
+        local parameters = getViewArr(buf, resultNode(buf).parameters,
+            ExprView)
+
+        if parameters == nil and resultNode(buf).isValid then
+            parameters = { }
+        end
+
+        return parameters
+    end,
+    errorCode = function(buf)
+        return parserConst.getErrorCodeStr(resultNode(buf).errorCode)
+    end,
+    errorMsg = function(buf)
+        return getStr(buf, resultNode(buf).errorMsg)
+    end,
+    errorLine = function(buf)
+        return tonumber(resultNode(buf).errorLine)
+    end,
+    errorColumn = function(buf)
+        return tonumber(resultNode(buf).errorColumn)
+    end
+})
+
+
+-- Wraps a flat result. `cdata` must already carry its finalizer: the views
+-- keep it alive for as long as any of them is reachable.
+local function getResultView(cdata)
+    if cdata == nil then
+        return nil
+    end
+
+    local buf = {
+        cdata = cdata,
+        base = ffi.cast(charPtr, cdata)
+    }
+
+    -- The result header is the only node located at offset 0.
+    return setmetatable({ _buf = buf, _ref = 0 }, ResultView)
+end
+
+return {
+    getResultView = getResultView
+}
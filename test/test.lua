@@ -1,7 +1,9 @@
 #!/usr/bin/env tarantool
 
+local buffer = require("buffer")
 local fio = require("fio")
 local jsonLib = require("json")
+local msgpackLib = require("msgpack")
 local tap = require("tap")
 local yamlLib = require("yaml")
 
@@ -29,7 +31,7 @@ local function readFromFile(path)
 end
 
 local function testSql(test, queryOrig, queryGen)
-    test:plan(2)
+    test:plan(4)
 
     test:diag("Testing query: " .. queryOrig)
 
@@ -44,6 +46,13 @@ local function testSql(test, queryOrig, queryGen)
     local queries = parser.tostring(ast)
     local query = queries[1]
 
+    local viewQueries = parser.tostring(parser.view(queryOrig))
+    test:is(viewQueries[1], queryGen,
+        "The query generated from the flat AST view coincides with the sample")
+
+    test:is(parser.format(queryOrig)[1], queryGen,
+        "The query generated natively coincides with the sample")
+
     return test:is(query, queryGen, "The generated query coincides with the sample")
 end
 
@@ -62,7 +71,7 @@ local queries = readFromFile("queries.yml")
 
 local test = tap.test("Tarantool SQL Parser Test")
 
-test:plan(#queries)
+test:plan(#queries + 19)
 
 for _, row in ipairs(queries) do
     test:test(row[1], function(test)
@@ -74,4 +83,509 @@ for _, row in ipairs(queries) do
     end)
 end
 
+test:test("Parse cache", function(test)
+    test:plan(5)
+
+    local query = queries[1][2]
+
+    parser.configureCache({ entries = 16, bytes = 1024 * 1024, shareAst = true })
+
+    local ast1 = parser.parse(query)
+    local ast2 = parser.parse(query)
+
+    local stats = parser.cacheStats()
+    test:is(stats.misses, 1, "The first parse misses the cache")
+    test:is(stats.hits, 1, "The second parse hits the cache")
+    test:ok(ast1 == ast2, "Cache hits share the decoded AST")
+    test:is(parser.tostring(ast1)[1], queries[1][3],
+        "Shared ASTs are rendered natively")
+
+    parser.configureCache()
+
+    test:is(parser.cacheStats().entries, 0, "Disabling the cache drops its entries")
+end)
+
+test:test("Parser context", function(test)
+    test:plan(5)
+
+    local ast1 = parser.parse(queries[1][2])
+    local ast2 = parser.parse("select from;")
+    local ast3 = parser.parse(queries[2][2])
+
+    test:is(parser.tostring(ast1)[1], queries[1][3],
+        "ASTs outlive the next parse")
+    test:is(ast2.isValid, false, "Errors are reported")
+    test:is(parser.tostring(ast3)[1], queries[2][2],
+        "The context parses again after an error")
+
+    parser.parse("select 1 -- x")
+    test:ok(parser.parse("select 2;").isValid,
+        "A trailing comment does not carry over to the next query")
+
+    parser.parse("select 'abc")
+    test:ok(parser.parse("select 2;").isValid,
+        "An unterminated string does not carry over to the next query")
+end)
+
+test:test("Deep expressions", function(test)
+    test:plan(3)
+
+    local terms = { }
+    for i = 1, 50000 do
+        terms[i] = '"a" = ' .. i
+    end
+
+    local chain = 'select "a" from "t" where ' ..
+        table.concat(terms, " or ") .. ";"
+
+    local function depth(expr, field)
+        local n = 0
+        while expr ~= nil do
+            n = n + 1
+            expr = expr[field]
+        end
+        return n
+    end
+
+    local ast = parser.parse(chain)
+    test:ok(ast.isValid and depth(ast.statements[1].whereClause, "expr") ==
+        50001, "A long operator chain is parsed and decoded")
+
+    local nested = "select " .. ("1 + ("):rep(2000) .. "1" ..
+        (")"):rep(2000) .. ";"
+
+    ast = parser.parse(nested)
+    test:ok(ast.isValid and
+        depth(ast.statements[1].selectList[1], "expr2") == 2001,
+        "Deeply nested parentheses are parsed and decoded")
+
+    local view = parser.view(chain)
+    test:ok(view.isValid and depth(view.statements[1].whereClause, "expr") ==
+        50001, "A long operator chain is flattened")
+end)
+
+test:test("Native rendering depth", function(test)
+    test:plan(2)
+
+    local terms = { }
+    for i = 1, 50000 do
+        terms[i] = '"a" = ' .. i
+    end
+
+    local query = 'select "a" from "t" where ' ..
+        table.concat(terms, " or ") .. ";"
+
+    local rendered = parser.format(query)[1]
+    test:is(rendered:sub(-15), 'or "a" = 50000;',
+        "Long operator chains are rendered without recursion")
+
+    local nested = "select " .. ("(1 + "):rep(2000) .. "1" ..
+        (")"):rep(2000) .. ";"
+
+    local ok, err = pcall(parser.format, nested)
+    test:ok(not ok and tostring(err):find("nested too deeply") ~= nil,
+        "Deeper nesting is an error rather than a crash")
+end)
+
+test:test("Fingerprints", function(test)
+    test:plan(4)
+
+    local stmt1 = parser.parse(
+        [[select "a" from "test" where "b" = 1 and "c" in (1, 2, 3);]]
+    ).statements[1]
+    local stmt2 = parser.parse(
+        [[select "a" from "test" where "b" = 'x' and "c" in (?, 5);]]
+    ).statements[1]
+    local stmt3 = parser.parse(
+        [[select "a" from "test" where "d" = 1 and "c" in (1, 2, 3);]]
+    ).statements[1]
+
+    test:is(stmt1.fingerprint, stmt2.fingerprint,
+        "Literals and IN-lists do not affect the fingerprint")
+    test:isnt(stmt1.fingerprint, stmt3.fingerprint,
+        "Identifiers affect the fingerprint")
+    test:is_deeply(stmt1.literals, { 1, 1, 2, 3 },
+        "Literals are extracted")
+    test:is_deeply(stmt2.literals, { "x", 5 },
+        "Parameters are not listed as literals")
+end)
+
+test:test("Batch parse", function(test)
+    test:plan(2)
+
+    local texts = { }
+    local asts = { }
+
+    for i, row in ipairs(queries) do
+        texts[i] = row[2]
+        asts[i] = parser.parse(row[2])
+    end
+
+    parser.configureWorkers(2)
+
+    local batch = parser.parseBatch(texts)
+
+    test:is(#batch, #texts, "One AST per query")
+    test:is_deeply(batch, asts, "Batch ASTs match the ones parsed one by one")
+
+    parser.configureWorkers()
+end)
+
+test:test("Statement streams", function(test)
+    test:plan(5)
+
+    local texts = { }
+    local expected = { }
+
+    for _, row in ipairs(queries) do
+        local ast = parser.parse(row[2])
+        if ast.isValid then
+            table.insert(texts, row[2])
+            for _, sql in ipairs(parser.tostring(ast)) do
+                table.insert(expected, sql)
+            end
+        end
+    end
+
+    local script = table.concat(texts, ";\n")
+
+    local function collect(batch)
+        local sqls = { }
+        local valid = true
+
+        for ast in parser.statements(script, batch) do
+            valid = valid and ast.isValid
+            for _, sql in ipairs(parser.tostring(ast)) do
+                table.insert(sqls, sql)
+            end
+        end
+
+        return sqls, valid
+    end
+
+    local single, valid = collect()
+    test:ok(valid, "Every streamed statement parses")
+    test:is_deeply(single, expected, "Statements are streamed one at a time")
+    test:is_deeply(collect(3), expected, "Batches hold the same statements")
+
+    local bad = "select 1;\n\nselect from;"
+    local errorLine
+    for ast in parser.statements(bad) do
+        if not ast.isValid then
+            errorLine = ast.errorLine
+        end
+    end
+    test:is(errorLine, parser.parse(bad).errorLine,
+        "Errors are positioned in the script")
+    test:is(type(parser.parse(bad).errorColumn), "number",
+        "Error columns are decoded")
+end)
+
+test:test("Asynchronous parse", function(test)
+    test:plan(1)
+
+    local query = queries[#queries][2]
+    local ast = parser.parse(query)
+
+    parser.configureAsync(1)
+    test:is_deeply(parser.parse(query), ast,
+        "Asynchronous and synchronous ASTs match")
+    parser.configureAsync(64 * 1024)
+end)
+
+test:test("Limits", function(test)
+    test:plan(7)
+
+    local query = "select a, b from t where c = 1 and (d = 2 or e = 'xyz');"
+
+    parser.configureLimits({ queryBytes = 16 })
+    local ast = parser.parse(query)
+    test:is(ast.isValid, false, "Long queries are rejected")
+    test:is(ast.errorCode, "limit", "Rejections have their own error code")
+
+    parser.configureLimits({ nodes = 5 })
+    test:is(parser.parse(query).errorCode, "limit", "Node count is limited")
+
+    parser.configureLimits({ depth = 3 })
+    test:is(parser.parse(query).errorCode, "limit", "Depth is limited")
+    test:is(parser.references(query).errorCode, "limit",
+        "Reference lists are held to the limits")
+
+    parser.configureLimits()
+    test:is(parser.parse(query).isValid, true, "Limits can be lifted")
+
+    parser.configureCache({ entries = 16, bytes = 1024 * 1024 })
+    parser.parse(query)
+    parser.configureLimits({ nodes = 5 })
+    test:is(parser.parse(query).errorCode, "limit",
+        "Cached results are held to new limits")
+    parser.configureLimits()
+    parser.configureCache()
+end)
+
+test:test("Interning", function(test)
+    test:plan(3)
+
+    local query = 'select "a", "t"."a" from "t" where "a" = 1 and "b" = "a";'
+    local ast = parser.parse(query)
+
+    parser.configureIntern(1024)
+
+    test:is_deeply(parser.parse(query), ast,
+        "Interned identifiers decode to the same AST")
+    test:is(parser.internStats().entries, 3, "Each identifier is interned once")
+    test:is_deeply(parser.parse(query), ast, "Shared identifiers are reused")
+
+    parser.configureIntern()
+end)
+
+test:test("Stats", function(test)
+    test:plan(4)
+
+    parser.resetStats()
+    parser.parse(queries[1][2])
+    test:is(parser.stats().queries, 0, "Nothing is counted while disabled")
+
+    parser.enableStats(true)
+    parser.parse(queries[1][2])
+    parser.parse(queries[2][2])
+    parser.enableStats(false)
+
+    local stats = parser.stats()
+    test:is(stats.queries, 2, "Parsed queries are counted")
+    test:is(stats.phases.decode.count, 2, "Decoding is timed from Lua")
+    test:ok(stats.nodes > 0 and stats.maxDepth > 0, "Tree sizes are recorded")
+
+    parser.resetStats()
+end)
+
+test:test("References", function(test)
+    test:plan(5)
+
+    local refs = parser.references('select "x"."a", "b" from "s"."t" as "x" ' ..
+        'where "x"."c" in (select "d" from "u");')
+
+    test:is(refs.isValid, true, "References are extracted")
+    test:is_deeply(refs.tables[1], { schema = "s", name = "t", alias = "x",
+        columns = { "a", "b", "c" } }, "Aliases and the single table resolve")
+    test:is_deeply(refs.tables[2], { name = "u", columns = { "d" } },
+        "Subqueries resolve against their own FROM clause")
+
+    refs = parser.references('select "a" from "t", "u";')
+    test:is_deeply(refs.unresolved, { "a" },
+        "Ambiguous columns are not resolved")
+
+    test:is(parser.references("select from;").errorCode, "syntax",
+        "Syntax errors are reported")
+end)
+
+test:test("Classification", function(test)
+    test:plan(6)
+
+    local agree = true
+    for _, row in ipairs(queries) do
+        local ast = parser.parse(row[2])
+        local class = parser.classify(row[2])
+
+        if ast.isValid and (not class.isValid or class.write or
+            class.type ~= ast.statements[1].type) then
+            agree = false
+        end
+    end
+    test:ok(agree, "Classes agree with the parser")
+
+    local class = parser.classify(
+        [[select "a" from "s"."t1" as "x" join "t2" on "x"."a" = "t2"."b", ]] ..
+        [[(select 1 from "t3") as "y" where "c" in (select "d" from "t4");]])
+    test:is_deeply(class.tables, { { schema = "s", name = "t1" },
+        { name = "t2" } }, "Leading tables of a SELECT")
+
+    test:is_deeply(parser.classify(
+        [[with "w" as (select "a" from "t1") select "a" from "w", "t2";]]
+    ).tables, { { name = "t2" } }, "WITH tables are left out")
+
+    test:is_deeply(parser.classify([[insert into "t" values (1);]]), {
+        isValid = true,
+        type = "insert",
+        write = true,
+        tables = { { name = "t" } },
+        statementCount = 1
+    }, "Targets of writes")
+
+    test:ok(parser.classify([[select 1; delete from "t";]]).write,
+        "Scripts write if any statement does")
+    test:ok(not parser.classify("select @ from t;").isValid,
+        "Lexer errors are left to the parser")
+end)
+
+test:test("Shard keys", function(test)
+    test:plan(5)
+
+    parser.configureShardKeys({ t = { "a", "b" } })
+
+    local keys = parser.shardKeys(
+        'select * from "t" where "a" in (1, 2) and "b" = ?;')
+    test:is(keys.scatter, false, "Pinned keys are routed")
+    test:is_deeply(keys.tuples, {
+        { 1, { type = "parameter", paramId = 0 } },
+        { 2, { type = "parameter", paramId = 0 } }
+    }, "IN-lists expand to key tuples")
+
+    keys = parser.shardKeys('select * from "t" where "a" = 1 or "b" = 2;')
+    test:is(keys.scatter, true, "Unpinned keys scatter")
+
+    keys = parser.shardKeys('insert into "t" ("b", "a") values (2, 1);')
+    test:is_deeply(keys.tuples, { { 1, 2 } }, "Inserted keys are routed")
+
+    parser.configureShardKeys()
+    test:is(parser.shardKeys('select * from "t" where "a" = 1 and "b" = 2;')
+        .scatter, true, "Keys can be unregistered")
+end)
+
+test:test("Simplification", function(test)
+    test:plan(#queries + 4)
+
+    parser.enableSimplify(true)
+
+    for _, row in ipairs(queries) do
+        local query = row[2]
+        local simplified = parser.format(query)[1]
+
+        if parser.parse(query).simplified == nil then
+            test:is(simplified, ((row[3] or query):gsub("%(%s+", "(")),
+                "Untouched query: " .. query)
+        else
+            test:is(parser.format(simplified)[1], simplified,
+                "Simplification is stable: " .. query)
+        end
+    end
+
+    local ast = parser.parse(
+        'select "a" from "t" where 1 = 1 and "b" = 2 + 3 and "b" = 5;')
+    test:is(parser.tostring(ast)[1], 'select "a" from "t" where "b" = 5;',
+        "Constants are folded and repeated predicates dropped")
+    test:is_deeply(ast.simplified, { folded = 2, tautologies = 1,
+        negations = 0, duplicates = 1, flattened = 0, normalized = 0 },
+        "Changes are reported")
+
+    test:is(parser.format('select "a" from "t" where not not "b" between ' ..
+        '1 and 1 or "c" in (2, 2);')[1],
+        'select "a" from "t" where "b" = 1 or "c" = 2;',
+        "Negations, BETWEEN and IN are normalized")
+
+    parser.enableSimplify(false)
+    test:is(parser.format('select "a" from "t" where 1 = 1;')[1],
+        'select "a" from "t" where 1 = 1;', "Simplification can be disabled")
+end)
+
+test:test("MessagePack", function(test)
+    test:plan(#queries + 3)
+
+    for _, row in ipairs(queries) do
+        test:is(parser.msgpackToSql(parser.parseToMsgpack(row[2]))[1],
+            ((row[3] or row[2]):gsub("%(%s+", "(")),
+            "Round trip: " .. row[2])
+    end
+
+    local query = 'select "a", count("b") from "t" where "c" = ? and ' ..
+        '"d" is null or "e" in (1, 2.5, \'x\') group by "a" limit 10;'
+    test:is_deeply(msgpackLib.decode(parser.parseToMsgpack(query)),
+        parser.parse(query), "The encoding decodes to the AST")
+
+    local ibuf = buffer.ibuf()
+    local size = parser.parseToMsgpack(query, ibuf)
+    test:is(parser.msgpackToSql(ibuf.rpos, size)[1], parser.format(query)[1],
+        "Encodings can be appended to a buffer")
+    ibuf:recycle()
+
+    test:ok(not pcall(parser.msgpackToSql, string.char(0x81, 0xa7)),
+        "Malformed MessagePack is rejected")
+end)
+
+test:test("Rewriting", function(test)
+    test:plan(4)
+
+    local rewriter = parser.rewriter({
+        tables = { orders = "orders_7", users = "users_7" },
+        predicate = '"tenant_id" = 7',
+        maxLimit = 100
+    })
+
+    test:is(rewriter:rewrite(
+        'select "id" from "orders" where "total" > 10 limit 500;')[1],
+        'select "id" from "orders_7" where "total" > 10 and ' ..
+        '"orders_7"."tenant_id" = 7 limit 100;',
+        "Tables are renamed, predicates injected and limits capped")
+
+    test:is(rewriter:rewrite('select "o"."id" from "orders" as "o" ' ..
+        'left join "users" on "o"."uid" = "users"."id";')[1],
+        'select "o"."id" from "orders_7" as "o" left join "users_7" on ' ..
+        '"o"."uid" = "users_7"."id" and "users_7"."tenant_id" = 7 ' ..
+        'where "o"."tenant_id" = 7 limit 100;',
+        "The nullable side of an outer join is filtered in its condition")
+
+    test:is(rewriter:rewrite('delete from "orders" where "id" = ?;')[1],
+        'delete from "orders_7" where "id" = ? and ' ..
+        '"orders_7"."tenant_id" = 7;', "DELETE is rewritten")
+
+    test:ok(not pcall(parser.rewriter,
+        { predicate = '"a" = 1; drop table "t"' }),
+        "The predicate must be a single WHERE clause")
+end)
+
+test:test("Templates", function(test)
+    test:plan(4)
+
+    local tmpl = parser.prepare(
+        'select "a" from "t" where "b" = ? and "c" in (?, ?);')
+    test:is(tmpl.paramCount, 3, "Parameters are counted")
+    test:is(tmpl:render({ 1, "it's", box.NULL }),
+        'select "a" from "t" where "b" = 1 and "c" in (\'it\'\'s\', null);',
+        "Integers, strings and NULL are bound")
+
+    tmpl = parser.prepare('update "t" set "a" = ? where "b" = ?;')
+    test:is(tmpl:render({ 2.5, true }),
+        'update "t" set "a" = 2.5 where "b" = true;',
+        "Floats and booleans are bound")
+
+    test:ok(not pcall(parser.prepare, 'select "a" from "t"; select 1;'),
+        "A template holds a single statement")
+end)
+
+test:test("Filters", function(test)
+    test:plan(6)
+
+    local fields = { a = 1, b = 2, c = 3 }
+
+    local function filter(query, params)
+        local statement = parser.parse(query).statements[1]
+        return parser.compileFilter(statement, fields, params)
+    end
+
+    local f = filter('select * from "t" where "a" > 1 and "c" like \'x%\';')
+    test:ok(f({ 2, 0, "xy" }) and not f({ 1, 0, "xy" }) and
+        not f({ 2, 0, "yx" }), "Comparisons and LIKE are compiled")
+
+    f = filter('select * from "t" where "a" in (1, 2) or ' ..
+        '"b" between ? and ?;', { 5, 6 })
+    test:ok(f({ 2, 0 }) and f({ 9, 5 }) and not f({ 9, 7 }),
+        "IN, BETWEEN and parameters are compiled")
+
+    f = filter('select * from "t" where not "a" = 1;')
+    test:ok(f({ 2 }) and not f({ 1 }) and not f({ box.NULL }),
+        "NULL is neither TRUE nor FALSE")
+
+    local f1 = filter('select * from "t" where "a" = 1;')
+    local f2 = filter('select * from "t" where "a" = 2;')
+    test:ok(f1({ 1 }) and not f1({ 2 }) and f2({ 2 }) and not f2({ 1 }),
+        "Literals are bound per query")
+
+    local statement = parser.parse('delete from "t";').statements[1]
+    test:is(parser.compileFilter(statement, fields)({ }), true,
+        "No WHERE clause matches everything")
+
+    test:ok(not pcall(filter, 'select * from "t" where "z" = 1;'),
+        "Unknown columns are rejected")
+end)
+
 os.exit(test:check() and 0 or 1)